@@ -0,0 +1,180 @@
+/* freediag
+ *
+ * bench_carsim : measure CARSIM request throughput.
+ *
+ * GPLv3
+ *
+ * Generates a large carsim .db file, then times request / response cycles
+ * through the public L0 API (diag_l0_send + diag_l0_recv), with requests
+ * spread evenly over the whole file.
+ * The file is also compiled (see carsimc.c) to compare open times; requests
+ * are run against the compiled file.
+ * If a clock speed is given, CARSIM bus timing emulation is enabled with
+ * that "simclock" value (0 = virtual clock); the modelled bus time is then
+ * reported by the L0 when it closes.
+ *
+ * usage: bench_carsim [number of RQ lines] [number of requests] [simclock]
+ */
+
+#include <stdlib.h>
+
+#include "diag.h"
+#include "diag_err.h"
+#include "diag_os.h"
+#include "diag_l0.h"
+#include "diag_l1.h"
+#include "diag_simdb.h"
+#include "bench_sim.h"
+
+#define BENCH_DBFILE "bench_carsim.db"
+#define BENCH_DBCFILE "bench_carsim.dbc"
+#define DEF_LINES	5000
+#define DEF_REQS	20000
+#define RX_TIMEOUT	50	//ms; end of responses, about P2max
+
+//generate db with (lines) exact requests, followed by a few wildcard requests.
+//ret 0 if ok
+static int gen_db(const char *fname, unsigned lines) {
+	FILE *fp;
+	unsigned i;
+
+	fp = fopen(fname, "w");
+	if (!fp) {
+		fprintf(stderr, "Can't create %s\n", fname);
+		return -1;
+	}
+
+	fprintf(fp, "# generated by bench_carsim\n");
+	for (i = 0; i < lines; i++) {
+		fprintf(fp, "# request %u\n", i);
+		fprintf(fp, "RQ 0x22 0x%02X 0x%02X\n", (i >> 8) & 0xFF, i & 0xFF);
+		fprintf(fp, "RP 0x62 req2 req3 0x%02X 0x%02X cks1\n", i & 0xFF, (i * 7) & 0xFF);
+	}
+	for (i = 0; i < 16; i++) {
+		fprintf(fp, "RQ 0x31 XXXX 0x%02X\n", i);
+		fprintf(fp, "RP 0x71 req2 0x%02X\n", i);
+		fprintf(fp, "RP 0x71 req2 0x%02X 0x00\n", i);
+	}
+	fclose(fp);
+	return 0;
+}
+
+//simclock < 0 : no timing emulation
+static struct diag_l0_device *open_sim(const char *fname, int simclock) {
+	struct diag_l0_device *dl0d;
+
+	dl0d = bench_sim_new(fname, simclock);
+	if (!dl0d)
+		return NULL;
+	if (diag_l0_open(dl0d, DIAG_L1_RAW)) {
+		fprintf(stderr, "Can't open CARSIM with %s\n", fname);
+		diag_l0_del(dl0d);
+		return NULL;
+	}
+	return dl0d;
+}
+
+int main(int argc, char **argv) {
+	struct diag_l0_device *dl0d;
+	unsigned lines = DEF_LINES;
+	unsigned reqs = DEF_REQS;
+	int simclock = -1;
+	unsigned i, resps;
+	unsigned long long t0, tload, tdone, ttext;
+	struct simdb *db;
+	uint8_t rxbuf[MAXRBUF];
+
+	if (argc > 1)
+		lines = (unsigned) strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		reqs = (unsigned) strtoul(argv[2], NULL, 0);
+	if (argc > 3)
+		simclock = (int) strtol(argv[3], NULL, 0);
+	if ((lines == 0) || (lines > 0x10000) || (reqs == 0) || (argc > 4)) {
+		printf("usage: %s [RQ lines (1-65536)] [requests] [simclock (0 = virtual)]\n", argv[0]);
+		return 1;
+	}
+
+	if (diag_init()) {
+		fprintf(stderr, "diag_init failed\n");
+		return 1;
+	}
+
+	if (gen_db(BENCH_DBFILE, lines)) {
+		diag_end();
+		return 1;
+	}
+
+	t0 = diag_os_gethrt();
+	db = simdb_load(BENCH_DBFILE);
+	ttext = diag_os_gethrt() - t0;
+	if (!db || simdb_save(db, BENCH_DBCFILE)) {
+		simdb_free(db);
+		remove(BENCH_DBFILE);
+		diag_end();
+		return 1;
+	}
+	simdb_free(db);
+
+	t0 = diag_os_gethrt();
+	dl0d = open_sim(BENCH_DBCFILE, simclock);
+	tload = diag_os_gethrt();
+	if (!dl0d) {
+		remove(BENCH_DBFILE);
+		remove(BENCH_DBCFILE);
+		diag_end();
+		return 1;
+	}
+
+	resps = 0;
+	for (i = 0; i < reqs; i++) {
+		uint8_t txbuf[3];
+		unsigned idx;
+		int rv;
+
+		//spread requests over the whole file; 1 in 16 hits a wildcard line
+		if ((i & 0x0F) == 0x0F) {
+			txbuf[0] = 0x31;
+			txbuf[1] = (uint8_t) i;
+			txbuf[2] = (uint8_t) (i >> 4) & 0x0F;
+		} else {
+			idx = (i * 7919U) % lines;
+			txbuf[0] = 0x22;
+			txbuf[1] = (uint8_t) (idx >> 8);
+			txbuf[2] = (uint8_t) idx;
+		}
+
+		if (diag_l0_send(dl0d, NULL, txbuf, sizeof(txbuf))) {
+			fprintf(stderr, "send failed at request %u\n", i);
+			break;
+		}
+		while ((rv = diag_l0_recv(dl0d, NULL, rxbuf, sizeof(rxbuf), RX_TIMEOUT)) > 0) {
+			resps++;
+		}
+		if (rv != DIAG_ERR_TIMEOUT) {
+			fprintf(stderr, "recv failed at request %u\n", i);
+			break;
+		}
+	}
+	tdone = diag_os_gethrt();
+
+	if (simclock >= 0)
+		diag_l0_debug |= DIAG_DEBUG_CLOSE;	//report bus time
+	diag_l0_close(dl0d);
+	diag_l0_del(dl0d);
+	remove(BENCH_DBFILE);
+	remove(BENCH_DBCFILE);
+
+	{
+		unsigned long long tl = diag_os_hrtus(tload - t0);
+		unsigned long long tr = diag_os_hrtus(tdone - tload);
+
+		printf("db: %u RQ lines; load text: %llu us, open compiled: %llu us\n",
+			lines + 16, diag_os_hrtus(ttext), tl);
+		printf("%u requests, %u responses in %llu us : %.0f requests/s\n",
+			i, resps, tr, tr? (i * 1000000.0 / tr) : 0.0);
+	}
+
+	diag_end();
+	return 0;
+}
@@ -0,0 +1,149 @@
+/* freediag
+ *
+ * bench_msg : count diag_msg allocations per J1979 PID request.
+ *
+ * GPLv3
+ *
+ * Runs mode 1 PID requests through the whole stack (SAEJ1979 L3, ISO9141 L2,
+ * CARSIM L0 without timing emulation), with a receive callback that keeps
+ * each response, like scantool's j1979_data_rcv() does.
+ * The same loop is run with the msg pool disabled (diag_msgpool_max = 0) and
+ * enabled, with the callback copying the response (diag_dupmsg), then with
+ * the pool and the callback keeping a reference instead (diag_retainmsg).
+ * For each we report diag_allocmsg() calls and the heap allocations they
+ * cost, per request. Elapsed time is mostly the L2 inter-request delays,
+ * so it is not reported.
+ *
+ * The ECU is tests/bench_msg.db; another .db file with the same requests
+ * can be given.
+ *
+ * usage: bench_msg [number of requests] [.db file]
+ */
+
+#include <stdlib.h>
+
+#include "diag.h"
+#include "diag_err.h"
+#include "diag_os.h"
+#include "diag_l0.h"
+#include "diag_l1.h"
+#include "diag_l2.h"
+#include "diag_l3.h"
+#include "bench_sim.h"
+
+#ifndef BENCH_MSG_DB
+	#define BENCH_MSG_DB "bench_msg.db"	//normally set by CMake
+#endif
+#define DEF_REQS	200
+#define NPIDS	16	//PIDs 0x00-0x0F, see bench_msg.db
+#define RX_TIMEOUT	100
+
+static struct diag_msg *lastrx;	//copy of the last response
+static unsigned long resps;
+static bool retain;	//rcv() : diag_retainmsg() instead of diag_dupmsg()
+
+static void rcv(UNUSED(void *handle), struct diag_msg *msg) {
+	diag_freemsg(lastrx);
+	lastrx = retain? diag_retainmsg(msg) : diag_dupmsg(msg);
+	resps++;
+}
+
+//run (reqs) requests; ret 0 if ok
+static int bench_one(const char *name, struct diag_l3_conn *l3c, unsigned reqs) {
+	struct diag_msgpool_stats st;
+	unsigned i;
+
+	diag_msgpool_getstats(&st, 1);
+	resps = 0;
+	for (i = 0; i < reqs; i++) {
+		uint8_t data[2];
+		struct diag_msg msg = {0};
+
+		data[0] = 0x01;
+		data[1] = (uint8_t) (i % NPIDS);
+		msg.data = data;
+		msg.len = sizeof(data);
+		if (diag_l3_send(l3c, &msg) ||
+				(diag_l3_recv(l3c, RX_TIMEOUT, rcv, NULL) < 0)) {
+			fprintf(stderr, "request %u failed\n", i);
+			break;
+		}
+	}
+	diag_freemsg(lastrx);
+	lastrx = NULL;
+	diag_msgpool_getstats(&st, 1);
+
+	printf("%-8s %10.2f %10.2f %8lu %6lu\n", name,
+		(double) st.allocs / i, (double) st.heap / i, st.pooled, i - resps);
+	return (i == reqs)? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+	struct diag_l0_device *dl0d;
+	struct diag_l2_conn *l2c;
+	struct diag_l3_conn *l3c;
+	unsigned reqs = DEF_REQS;
+	const char *dbfile = BENCH_MSG_DB;
+	unsigned int defmax;
+	int rv = 1;
+
+	if (argc > 1)
+		reqs = (unsigned) strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		dbfile = argv[2];
+	if ((reqs == 0) || (argc > 3)) {
+		printf("usage: %s [requests] [.db file]\n", argv[0]);
+		return 1;
+	}
+
+	if (diag_init()) {
+		fprintf(stderr, "diag_init failed\n");
+		return 1;
+	}
+	dl0d = bench_sim_new(dbfile, -1);
+	if (!dl0d) {
+		diag_end();
+		return 1;
+	}
+	if (diag_l2_open(dl0d, DIAG_L1_ISO9141)) {
+		fprintf(stderr, "Can't open CARSIM with %s\n", dbfile);
+		goto del_l0;
+	}
+	l2c = diag_l2_StartCommunications(dl0d, DIAG_L2_PROT_ISO9141,
+		DIAG_L2_TYPE_SLOWINIT | DIAG_L2_TYPE_FUNCADDR, 10400, 0x33, 0xF1);
+	if (!l2c) {
+		fprintf(stderr, "L2 StartCommunications failed\n");
+		goto close_l2;
+	}
+	l3c = diag_l3_start("SAEJ1979", l2c);
+	if (!l3c) {
+		fprintf(stderr, "L3 start failed\n");
+		goto stop_l2;
+	}
+
+	printf("%u mode 1 PID requests, per request :\n", reqs);
+	printf("%-8s %10s %10s %8s %6s\n", "pool", "allocmsg", "heap",
+		"pooled", "errs");
+
+	defmax = diag_msgpool_max;
+	diag_msgpool_max = 0;
+	if (bench_one("off", l3c, reqs) == 0) {
+		diag_msgpool_max = defmax;
+		if (bench_one("on", l3c, reqs) == 0) {
+			retain = 1;
+			if (bench_one("retain", l3c, reqs) == 0)
+				rv = 0;
+		}
+	}
+	diag_msgpool_max = defmax;
+
+	diag_l3_stop(l3c);
+stop_l2:
+	diag_l2_StopCommunications(l2c);
+close_l2:
+	diag_l2_close(dl0d);
+del_l0:
+	diag_l0_del(dl0d);
+	diag_end();
+	return rv;
+}
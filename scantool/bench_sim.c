@@ -0,0 +1,43 @@
+/* freediag
+ *
+ * bench_sim : CARSIM setup shared by the benchmarks.
+ *
+ * GPLv3
+ */
+
+#include <string.h>
+
+#include "diag.h"
+#include "diag_cfg.h"
+#include "diag_l0.h"
+#include "bench_sim.h"
+
+#include "utlist.h"
+
+struct diag_l0_device *bench_sim_new(const char *fname, int simclock) {
+	struct diag_l0_device *dl0d;
+	struct cfgi *cfgp;
+	bool found = 0;
+
+	dl0d = diag_l0_new("CARSIM");
+	if (!dl0d) {
+		fprintf(stderr, "CARSIM driver not available\n");
+		return NULL;
+	}
+
+	LL_FOREACH(diag_l0_getcfg(dl0d), cfgp) {
+		if (strcmp(cfgp->shortname, "simfile") == 0) {
+			found = !diag_cfg_setstr(cfgp, fname);
+		} else if ((strcmp(cfgp->shortname, "simtiming") == 0) && (simclock >= 0)) {
+			diag_cfg_setbool(cfgp, 1);
+		} else if ((strcmp(cfgp->shortname, "simclock") == 0) && (simclock >= 0)) {
+			diag_cfg_setint(cfgp, simclock);
+		}
+	}
+	if (!found) {
+		fprintf(stderr, "Can't set CARSIM simfile %s\n", fname);
+		diag_l0_del(dl0d);
+		return NULL;
+	}
+	return dl0d;
+}
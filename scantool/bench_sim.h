@@ -0,0 +1,20 @@
+#ifndef _BENCH_SIM_H_
+#define _BENCH_SIM_H_
+
+/* freediag
+ * GPLv3
+ *
+ * bench_sim : CARSIM setup shared by the benchmarks.
+ */
+
+#include "diag_l0.h"
+
+/** Create a CARSIM L0 device using a .db or .dbc file; not opened yet.
+ *
+ * @param simclock : if >= 0, enable bus timing emulation with that "simclock"
+ *	value (0 = virtual clock); < 0 : no timing emulation.
+ * @return new device, NULL if failed (a message was printed)
+ */
+struct diag_l0_device *bench_sim_new(const char *fname, int simclock);
+
+#endif // _BENCH_SIM_H_
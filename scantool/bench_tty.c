@@ -0,0 +1,205 @@
+/* freediag
+ *
+ * bench_tty : compare the diag_tty_read() implementations (see SEL_TTYREAD
+ * in diag_tty_unix.h) on a pty.
+ *
+ * GPLv3
+ *
+ * A writer thread sends bursts of bytes on the pty master at a fixed interval;
+ * the reader calls diag_tty_read() on the slave for one byte at a time, like
+ * K-line L2 code does. With bursts > 1, bytes are served from the read-ahead
+ * buffer. For each implementation, we report syscalls per byte,
+ * latency (write -> diag_tty_read() return), and the overshoot of reads that
+ * time out.
+ *
+ * usage: bench_tty [bytes] [interval (us)] [burst]
+ */
+
+#define _GNU_SOURCE	//for posix_openpt() etc
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "diag.h"
+#include "diag_err.h"
+#include "diag_os.h"
+#include "diag_tty.h"
+#include "diag_tty_unix.h"
+
+#define DEF_BYTES	500
+#define DEF_INTERVAL	2000	//us; about 2 byte times at 10400bps, plus P1
+#define RD_TIMEOUT	100	//ms
+#define TO_READS	50	//number of reads that time out
+#define TO_TIMEOUT	5	//ms
+#define MAX_BURST	64
+
+struct writer_args {
+	int fd;
+	unsigned bytes;
+	unsigned long interval;
+	unsigned burst;		//bytes per write()
+	unsigned long long *tw;	//write timestamps
+};
+
+//plain sleep, not diag_os_hrtwait() : spinning would starve the reader on a
+//single CPU. Latency is measured from the actual write time anyway.
+static void *writer(void *p) {
+	struct writer_args *wa = p;
+	struct timespec ts;
+	unsigned i;
+
+	ts.tv_sec = wa->interval / 1000000;
+	ts.tv_nsec = (wa->interval % 1000000) * 1000;
+	for (i = 0; i < wa->bytes; i += wa->burst) {
+		uint8_t c[MAX_BURST];
+		unsigned j, len;
+
+		len = (wa->bytes - i < wa->burst)? wa->bytes - i : wa->burst;
+		for (j = 0; j < len; j++)
+			c[j] = (uint8_t) (i + j);
+		nanosleep(&ts, NULL);
+		for (j = 0; j < len; j++)
+			wa->tw[i + j] = diag_os_gethrt();
+		if (write(wa->fd, c, len) != (ssize_t) len)
+			break;
+	}
+	return NULL;
+}
+
+//run one implementation; ret 0 if ok
+static int bench_one(const char *name, struct unix_tty_int *uti, int mfd,
+		unsigned bytes, unsigned long interval, unsigned burst) {
+	struct writer_args wa;
+	pthread_t wt;
+	unsigned long long *tr;
+	unsigned long long lsum = 0, lmax = 0, tosum = 0, tomax = 0;
+	unsigned long sc;
+	unsigned i, errs = 0;
+
+	if (diag_calloc(&wa.tw, bytes) || diag_calloc(&tr, bytes))
+		return -1;
+	wa.fd = mfd;
+	wa.bytes = bytes;
+	wa.interval = interval;
+	wa.burst = burst;
+
+	diag_tty_iflush(uti);
+	uti->rd_syscalls = 0;
+	if (pthread_create(&wt, NULL, writer, &wa)) {
+		free(wa.tw);
+		free(tr);
+		return -1;
+	}
+	for (i = 0; i < bytes; i++) {
+		uint8_t c;
+		if ((diag_tty_read(uti, &c, 1, RD_TIMEOUT) != 1) || (c != (uint8_t) i)) {
+			errs++;
+		}
+		tr[i] = diag_os_gethrt();
+	}
+	pthread_join(wt, NULL);
+	sc = uti->rd_syscalls;
+
+	for (i = 0; i < bytes; i++) {
+		unsigned long long l = (tr[i] > wa.tw[i])? diag_os_hrtus(tr[i] - wa.tw[i]) : 0;
+		lsum += l;
+		if (l > lmax)
+			lmax = l;
+	}
+
+	//reads that time out
+	for (i = 0; i < TO_READS; i++) {
+		uint8_t c;
+		unsigned long long t0 = diag_os_gethrt();
+		unsigned long long e;
+		if (diag_tty_read(uti, &c, 1, TO_TIMEOUT) != DIAG_ERR_TIMEOUT)
+			errs++;
+		e = diag_os_hrtus(diag_os_gethrt() - t0);
+		e = (e > TO_TIMEOUT * 1000)? e - TO_TIMEOUT * 1000 : 0;
+		tosum += e;
+		if (e > tomax)
+			tomax = e;
+	}
+
+	printf("%-8s %8.2f %10llu %10llu %10llu %10llu %6u\n", name,
+		(double) sc / bytes, lsum / bytes, lmax, tosum / TO_READS, tomax, errs);
+
+	free(wa.tw);
+	free(tr);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	unsigned bytes = DEF_BYTES;
+	unsigned long interval = DEF_INTERVAL;
+	unsigned burst = 1;
+	struct unix_tty_int *uti;
+	struct diag_serial_settings set;
+	int mfd;
+	char *sname;
+
+	if (argc > 1)
+		bytes = (unsigned) strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		interval = strtoul(argv[2], NULL, 0);
+	if (argc > 3)
+		burst = (unsigned) strtoul(argv[3], NULL, 0);
+	if ((bytes == 0) || (interval == 0) || (interval >= RD_TIMEOUT * 1000) ||
+			(burst == 0) || (burst > MAX_BURST) || (argc > 4)) {
+		printf("usage: %s [bytes] [interval (us)] [burst (1-%d)]\n", argv[0], MAX_BURST);
+		return 1;
+	}
+
+	if (diag_init()) {
+		fprintf(stderr, "diag_init failed\n");
+		return 1;
+	}
+
+	mfd = posix_openpt(O_RDWR | O_NOCTTY);
+	if ((mfd < 0) || grantpt(mfd) || unlockpt(mfd) || ((sname = ptsname(mfd)) == NULL)) {
+		fprintf(stderr, "Can't create pty\n");
+		diag_end();
+		return 1;
+	}
+	uti = diag_tty_open(sname);
+	if (uti == NULL) {
+		close(mfd);
+		diag_end();
+		return 1;
+	}
+	//raw mode; the speed is meaningless on a pty
+	set.speed = 10400;
+	set.databits = diag_databits_8;
+	set.stopbits = diag_stopbits_1;
+	set.parflag = diag_par_n;
+	if (diag_tty_setup(uti, &set)) {
+		fprintf(stderr, "Can't setup pty\n");
+		diag_tty_close(uti);
+		close(mfd);
+		diag_end();
+		return 1;
+	}
+
+	printf("%u bytes, %u every %lu us; latency and timeout overshoot in us\n", bytes, burst, interval);
+	printf("%-8s %8s %10s %10s %10s %10s %6s\n", "read", "sc/byte",
+		"lat avg", "lat max", "to avg", "to max", "errs");
+
+#if defined(_POSIX_TIMERS) && (SEL_TIMEOUT==S_POSIX || SEL_TIMEOUT==S_AUTO)
+	uti->use_poll = 0;
+	bench_one("timer", uti, mfd, bytes, interval, burst);
+#else
+	uti->use_poll = 0;
+	bench_one("select", uti, mfd, bytes, interval, burst);
+#endif
+#ifdef USE_TTYPOLL
+	uti->use_poll = 1;
+	bench_one("poll", uti, mfd, bytes, interval, burst);
+#endif
+
+	diag_tty_close(uti);
+	close(mfd);
+	diag_end();
+	return 0;
+}
@@ -0,0 +1,60 @@
+/* freediag
+ *
+ * carsimc : CARSIM database compiler
+ *
+ * GPLv3
+ *
+ * Converts a carsim text .db file to the binary format (see diag_simdb.h),
+ * which the CARSIM L0 maps in memory instead of parsing it at every open.
+ * The compiled file depends on the host's byte order and struct layout;
+ * compile it on the same kind of machine that will use it.
+ *
+ * usage: carsimc <input .db file> <output file>
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "diag.h"
+#include "diag_err.h"
+#include "diag_simdb.h"
+
+
+int main(int argc, char **argv) {
+	struct simdb *db;
+	int rv;
+
+	if (argc != 3) {
+		printf("usage: %s <input .db file> <output file>\n", argv[0]);
+		return 1;
+	}
+
+	if (strcmp(argv[1], argv[2]) == 0) {
+		fprintf(stderr, "input and output must be different files\n");
+		return 1;
+	}
+
+	db = simdb_load(argv[1]);
+	if (!db) {
+		fprintf(stderr, "Can't load %s\n", argv[1]);
+		return 1;
+	}
+
+	rv = simdb_save(db, argv[2]);
+	if (rv == 0) {
+		printf("%s: %u requests, %u responses, %u index nodes, %u ECUs, %u states\n",
+			argv[2], db->num_rq, db->num_rp, db->num_nodes, db->num_ecus, db->num_states);
+	}
+	simdb_free(db);
+	if (rv)
+		return 1;
+
+	//make sure the result loads.
+	db = simdb_load(argv[2]);
+	if (!db) {
+		fprintf(stderr, "Can't load compiled file %s\n", argv[2]);
+		return 1;
+	}
+	simdb_free(db);
+	return 0;
+}
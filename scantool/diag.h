@@ -74,6 +74,13 @@ extern "C" {
 	#define UNUSED(X)	X	//how can we suppress "unused parameter" warnings on other compilers?
 #endif // __GNUC__
 
+//thread-local storage class; left undefined if unknown (the msg pool is then disabled)
+#if defined(__GNUC__)
+	#define DIAG_TLS	__thread
+#elif defined(_MSC_VER)
+	#define DIAG_TLS	__declspec(thread)
+#endif
+
 //hacks for MS Visual studio / visual C
 #ifdef MSVC
 	typedef SSIZE_T ssize_t;	//XXX ssize_t is currently only needed because of diag_tty_unix.c:diag_tty_{read,write}.
@@ -100,6 +107,7 @@ extern "C" {
 #define MAXRBUF 1024
 
 #define DIAG_MAX_MSGLEN 4200	/** limit diag_allocmsg() message size. */
+#define DIAG_MSG_INLINE	64	/** diag_allocmsg() payloads up to this size are stored in the msg block */
 
 typedef uint8_t target_type, source_type, databyte_type, command_type;
 typedef uint16_t flag_type;	//this is used for L2 type flags (see diag_l2.h)
@@ -121,6 +129,11 @@ typedef uint16_t flag_type;	//this is used for L2 type flags (see diag_l2.h)
 #define DIAG_IOCTL_GET_L2_DATA	0x2023	/* Get the L2 Keybytes etc into
 										 * diag_l2_data passed to us
 										 */
+#define DIAG_IOCTL_SETRXLEN	0x2024	/* Expected data length (no headers / checksum) of the
+									 * responses to the next diag_l2_send(); 0 = unknown.
+									 * data = (const unsigned int *). Only a hint, for L2s
+									 * that frame messages by timeouts (iso9141).
+									 */
 #define DIAG_IOCTL_SETSPEED	0x2101	/* Set speed, bits etc. data = (const struct diag_serial_settings *); ret 0 if ok
 									 * Ignored if DIAG_L1_AUTOSPEED or DIAG_L1_NOTTY is set */
 #define DIAG_IOCTL_INITBUS	0x2201	/* Initialise the ecu bus, data = (struct diag_l1_initbus_args *)
@@ -168,6 +181,15 @@ enum debugflag_enum {OPEN=DIAG_DEBUG_OPEN,
 	TIMER=DIAG_DEBUG_TIMER,
 	NIL=0
 };
+/** One segment of a scatter-gather send : see diag_l1_sendv().
+ * Lets L2 code send header, payload and checksum from where they are,
+ * without copying them into one frame buffer first.
+ */
+struct diag_iov {
+	const void *data;
+	size_t len;
+};
+
 // struct debugflags_descr : filled + used in scantool_debug.c
 struct debugflags_descr {
 	enum debugflag_enum mask;
@@ -210,6 +232,10 @@ struct diag_msg
 	uint8_t	iflags;		/* Internal flags */
 	#define	DIAG_MSG_IFLAG_MALLOC	1	/* We malloced; we Free -- this is set when the msg
 										 * was created by diag_allocmsg()*/
+	#define	DIAG_MSG_IFLAG_POOL	2	/* block from the msg pool; ->idata may point inside it */
+	unsigned int	irefs;		/* Reference count, see diag_retainmsg() */
+	struct diag_msg	*iowner;	/* If set, ->data points inside this msg's payload
+							 * (see diag_sharesinglemsg); we hold a reference to it. */
 };
 
 /** Allocate a new diag_msg
@@ -229,10 +255,60 @@ struct diag_msg	*diag_dupmsg(struct diag_msg *);
  */
 struct diag_msg	*diag_dupsinglemsg(struct diag_msg *);
 
+/** Keep a reference to a diag_msg chain, without copying it.
+ *
+ * Every message of the chain gets one more reference; each reference is
+ * dropped by one diag_freemsg() (a.k.a. diag_releasemsg) of the chain.
+ * While a message is shared, nobody may modify it (data, len, next etc.).
+ * If the chain wasn't made by diag_allocmsg() (e.g. a msg on the stack), a
+ * copy is returned instead, as diag_dupmsg() would.
+ * @return msg, or a copy; NULL if failed. Must be freed with diag_freemsg().
+ */
+struct diag_msg	*diag_retainmsg(struct diag_msg *msg);
+
+/** Make a new diag_msg that shares the payload of (msg), without copying it.
+ *
+ * The new msg has the same header fields, len and data pointer as (msg), and
+ * no ->next; those can be changed freely. The payload bytes must not be
+ * modified by anyone while shared; (msg) itself may be freed at any time.
+ * Falls back to diag_dupsinglemsg() if (msg) wasn't made by diag_allocmsg().
+ * @return new struct diag_msg, must be freed with diag_freemsg().
+ */
+struct diag_msg	*diag_sharesinglemsg(struct diag_msg *msg);
+
 /** Free a diag_msg
  * Safe to call with NULL arg
+ * This drops one reference to every message in the chain; messages are
+ * only freed when their last reference is gone.
  */
 void diag_freemsg(struct diag_msg *);
+#define diag_releasemsg(M) diag_freemsg(M)
+
+/* msg pool : each thread keeps a freelist of up to diag_msgpool_max
+ * diag_allocmsg() blocks, each with room for DIAG_MSG_INLINE bytes of data.
+ * Messages may be freed by another thread than the one that allocated them;
+ * the block simply moves to the freeing thread's list.
+ * Set diag_msgpool_max to 0 to disable the pool (one calloc() for the struct,
+ * another for the data, as before).
+ */
+extern unsigned int diag_msgpool_max;
+
+/** msg pool counters, for the calling thread */
+struct diag_msgpool_stats {
+	unsigned long allocs;	//diag_allocmsg() calls
+	unsigned long heap;	//calloc() / malloc() calls done by diag_allocmsg()
+	unsigned long pooled;	//blocks currently in the freelist
+};
+
+/** Get msg pool counters of the calling thread
+ * @param reset: clear allocs and heap counters after reading
+ */
+void diag_msgpool_getstats(struct diag_msgpool_stats *st, bool reset);
+
+/** Free all blocks in the calling thread's msg pool.
+ * Must be called by threads that use diag_msg, before they terminate.
+ */
+void diag_msgpool_flush(void);
 
 /** Calculate 8bit checksum
  * @param len: number of bytes in *data
@@ -302,6 +378,10 @@ int diag_flcalloc(const char *name, const int line,
 //diag_flmalloc : do not call directly !
 int diag_flmalloc(const char *name, const int line, void **p, size_t s);
 
+//diag_flrealloc : do not call directly !
+int diag_flrealloc(const char *name, const int line,
+	void **p, size_t n, size_t s);
+
 /** calloc() with logging (clears data)
  * @param P: *ptr
  * @param N: number of (sizeof) elems to allocate
@@ -318,6 +398,13 @@ int diag_flmalloc(const char *name, const int line, void **p, size_t s);
 #define diag_malloc(P, S) diag_flmalloc(CURFILE, __LINE__, \
 	((void **)(P)), (S))
 
+/** realloc() with logging. New elements are not cleared.
+ * @param P: *ptr; unchanged if the realloc fails.
+ * @param N: new number of (sizeof) elems
+ */
+#define diag_realloc(P, N) diag_flrealloc(CURFILE, __LINE__, \
+	((void **)(P)), (N), sizeof(*(*P)))
+
 /** Add a string to array-of-strings (argv style)
 * @param elems: number of elements already in table
 * @return new table ptr, NULL if failed
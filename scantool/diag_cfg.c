@@ -134,6 +134,10 @@ char * diag_cfg_getstr(struct cfgi *cfgp) {
 		len=strlen(cfgp->val.str)+1;
 		fmt="%s";
 		break;
+	case CFGT_BOOL:
+		len=2;
+		fmt="%d";
+		break;
 	default:
 		return diag_pseterr(DIAG_ERR_BADCFG);
 		break;
@@ -143,7 +147,11 @@ char * diag_cfg_getstr(struct cfgi *cfgp) {
 		return diag_pseterr(DIAG_ERR_NOMEM);
 	}
 
-	snprintf(str, len, fmt, cfgp->val.str);
+	if (cfgp->type == CFGT_BOOL) {
+		snprintf(str, len, fmt, cfgp->val.b? 1 : 0);
+	} else {
+		snprintf(str, len, fmt, cfgp->val.str);
+	}
 	return str;
 }
 
@@ -33,8 +33,10 @@
 #include "diag_os.h"
 #include "diag_err.h"
 #include "diag_dtc.h"
+#include "diag_l0_rec.h"
 #include "diag_l1.h"
 #include "diag_l2.h"
+#include "diag_timer.h"
 
 #include "utlist.h"
 
@@ -53,10 +55,14 @@ int diag_init(void)	//returns 0 if normal exit
 
 	//XXX This is interesting: the following functions only ever return 0...
 
+	if ((rv = diag_timer_init()))
+		return diag_iseterr(rv);
 	if ((rv = diag_l1_init()))
 		return diag_iseterr(rv);
 	if ((rv = diag_l2_init()))
 		return diag_iseterr(rv);
+	if ((rv = diag_l0_rec_init()))
+		return diag_iseterr(rv);
 	if ((rv = diag_os_init()))
 		return diag_iseterr(rv);
 
@@ -85,6 +91,9 @@ int diag_end(void) {
 		fprintf(stderr, FLFMT "Could not close OS functions!\n", FL);
 		rv=-1;
 	}
+	(void) diag_l0_rec_end();	//after diag_os_close : no more timer callbacks
+	diag_timer_end();
+	diag_msgpool_flush();
 	//nothing to do for diag_dtc_init
 
 	diag_initialized=0;
@@ -94,22 +103,60 @@ int diag_end(void) {
 
 /** Message handling **/
 
-struct diag_msg *
-diag_allocmsg(size_t datalen)
-{
-	struct diag_msg *newmsg;
+#define MSGPOOL_DEFMAX	32	//default diag_msgpool_max
 
-	if (datalen > DIAG_MAX_MSGLEN) {
-		fprintf(stderr, FLFMT "_allocmsg with >%d bytes !? report this !\n", FL, DIAG_MAX_MSGLEN);
-		return diag_pseterr(DIAG_ERR_BADLEN);
+unsigned int diag_msgpool_max = MSGPOOL_DEFMAX;
+
+//pool block. The msg must stay the first member : diag_freemsg() casts back.
+struct msgblk {
+	struct diag_msg msg;
+	uint8_t ibuf[DIAG_MSG_INLINE];
+};
+
+#ifdef DIAG_TLS
+	//per-thread freelist, chained through msg.next. No locking needed.
+	static DIAG_TLS struct diag_msg *pool_free;
+	static DIAG_TLS unsigned int pool_n;
+	static DIAG_TLS struct diag_msgpool_stats pool_st;
+#else
+	//no thread-local storage : no pool, only the counters (racy, but only for debugging).
+	static struct diag_msgpool_stats pool_st;
+#endif
+
+void diag_msgpool_getstats(struct diag_msgpool_stats *st, bool reset) {
+#ifdef DIAG_TLS
+	pool_st.pooled = pool_n;
+#endif
+	*st = pool_st;
+	if (reset) {
+		pool_st.allocs = 0;
+		pool_st.heap = 0;
 	}
+}
 
+void diag_msgpool_flush(void) {
+#ifdef DIAG_TLS
+	while (pool_free != NULL) {
+		struct diag_msg *msg = pool_free;
+		pool_free = msg->next;
+		free(msg);
+	}
+	pool_n = 0;
+#endif
+}
+
+//plain diag_allocmsg(), without pool. datalen already checked
+static struct diag_msg *allocmsg_heap(size_t datalen) {
+	struct diag_msg *newmsg;
+
+	pool_st.heap++;
 	if (diag_calloc(&newmsg, 1))
 		return diag_pseterr(DIAG_ERR_NOMEM);
 
 	newmsg->iflags |= DIAG_MSG_IFLAG_MALLOC;
 
 	if (datalen) {
+		pool_st.heap++;
 		if (diag_calloc(&newmsg->idata, datalen)) {
 			free(newmsg);
 			return diag_pseterr(DIAG_ERR_NOMEM);
@@ -117,9 +164,58 @@ diag_allocmsg(size_t datalen)
 	} else {
 		newmsg->idata = NULL;
 	}
+	return newmsg;
+}
+
+struct diag_msg *
+diag_allocmsg(size_t datalen)
+{
+	struct diag_msg *newmsg;
+
+	if (datalen > DIAG_MAX_MSGLEN) {
+		fprintf(stderr, FLFMT "_allocmsg with >%d bytes !? report this !\n", FL, DIAG_MAX_MSGLEN);
+		return diag_pseterr(DIAG_ERR_BADLEN);
+	}
+
+	pool_st.allocs++;
+#ifdef DIAG_TLS
+	if (diag_msgpool_max) {
+		struct msgblk *blk;
+
+		if (pool_free != NULL) {
+			blk = (struct msgblk *) pool_free;
+			pool_free = pool_free->next;
+			pool_n--;
+		} else {
+			pool_st.heap++;
+			if (diag_malloc(&blk, sizeof(*blk)))
+				return diag_pseterr(DIAG_ERR_NOMEM);
+		}
+		newmsg = &blk->msg;
+		memset(newmsg, 0, sizeof(*newmsg));
+		newmsg->iflags = DIAG_MSG_IFLAG_MALLOC | DIAG_MSG_IFLAG_POOL;
+
+		if (datalen <= DIAG_MSG_INLINE) {
+			newmsg->idata = datalen? blk->ibuf : NULL;
+			memset(blk->ibuf, 0, datalen);
+		} else {
+			pool_st.heap++;
+			if (diag_calloc(&newmsg->idata, datalen)) {
+				diag_freemsg(newmsg);
+				return diag_pseterr(DIAG_ERR_NOMEM);
+			}
+		}
+	} else
+#endif
+	{
+		newmsg = allocmsg_heap(datalen);
+		if (newmsg == NULL)
+			return NULL;
+	}
 
 	newmsg->len=datalen;
 	newmsg->next=NULL;
+	newmsg->irefs = 1;
 	newmsg->data = newmsg->idata;	/* Keep tab as users change newmsg->data */
 	// i.e. some functions do (diagmsg->data += skiplen) which would prevent us
 	// from doing free(diagmsg->data)  (the pointer was changed).
@@ -191,25 +287,88 @@ diag_dupsinglemsg(struct diag_msg *msg)
 	return newmsg;
 }
 
-/* Free a msg that we dup'd, recursively following the whole chain */
-// it doesn't absolutely need to be recursive but in case of trouble
-// it's easier to see the whole call stack leading to the failure.
-// Of course, not async safe.
-void
-diag_freemsg(struct diag_msg *msg)
+struct diag_msg *
+diag_retainmsg(struct diag_msg *msg)
 {
-	if (msg == NULL) return;
+	struct diag_msg *tmsg;
 
-	if (msg->next != NULL) {
-		diag_freemsg(msg->next);	//recurse
+	assert(msg != NULL);
+
+	LL_FOREACH(msg, tmsg) {
+		if ((tmsg->iflags & DIAG_MSG_IFLAG_MALLOC) == 0) {
+			//not refcounted : copy everything
+			return diag_dupmsg(msg);
+		}
 	}
+	LL_FOREACH(msg, tmsg) {
+		tmsg->irefs++;
+	}
+	return msg;
+}
+
+struct diag_msg *
+diag_sharesinglemsg(struct diag_msg *msg)
+{
+	struct diag_msg *newmsg, *owner;
+
+	assert(msg != NULL);
+
+	if ((msg->iflags & DIAG_MSG_IFLAG_MALLOC) == 0)
+		return diag_dupsinglemsg(msg);
+
+	newmsg = diag_allocmsg(0);
+	if (newmsg == NULL)
+		return diag_pseterr(DIAG_ERR_NOMEM);
+
+	//always point to the msg that holds the payload, not to another view
+	owner = msg->iowner? msg->iowner : msg;
+	owner->irefs++;
+	newmsg->iowner = owner;
+
+	newmsg->fmt = msg->fmt;
+	newmsg->type = msg->type;
+	newmsg->dest = msg->dest;
+	newmsg->src = msg->src;
+	newmsg->rxtime = msg->rxtime;
+	newmsg->len = msg->len;
+	newmsg->data = msg->data;
+
+	return newmsg;
+}
 
+//drop one reference to a single msg (not the chain), free it if it was the last.
+static void
+releasesinglemsg(struct diag_msg *msg)
+{
 	if ( (msg->iflags & DIAG_MSG_IFLAG_MALLOC) == 0 ) {
 		fprintf(stderr,
 			FLFMT "diag_freemsg free-ing a non diag_allocmsg()'d message %p!\n",
 			FL, (void *)msg);
 		free(msg);
 		return;
+	}
+
+	if (msg->irefs > 1) {
+		msg->irefs--;
+		return;
+	}
+
+	if (msg->iowner != NULL)
+		releasesinglemsg(msg->iowner);
+
+	if (msg->iflags & DIAG_MSG_IFLAG_POOL) {
+		struct msgblk *blk = (struct msgblk *) msg;
+
+		if ((msg->idata != NULL) && (msg->idata != blk->ibuf))
+			free(msg->idata);
+#ifdef DIAG_TLS
+		if (pool_n < diag_msgpool_max) {
+			msg->next = pool_free;
+			pool_free = msg;
+			pool_n++;
+			return;
+		}
+#endif
 	} else if (msg->idata != NULL) {
 		free(msg->idata);
 	}
@@ -219,6 +378,24 @@ diag_freemsg(struct diag_msg *msg)
 	return;
 }
 
+/* Free a msg that we dup'd, recursively following the whole chain */
+// it doesn't absolutely need to be recursive but in case of trouble
+// it's easier to see the whole call stack leading to the failure.
+// Of course, not async safe.
+void
+diag_freemsg(struct diag_msg *msg)
+{
+	if (msg == NULL) return;
+
+	if (msg->next != NULL) {
+		diag_freemsg(msg->next);	//recurse
+	}
+
+	releasesinglemsg(msg);
+
+	return;
+}
+
 
 // diag_cks1: return simple 8-bit checksum of
 // [len] bytes at *data. Everybody needs this !
@@ -380,6 +557,29 @@ int diag_flmalloc(const char *name, const int line, void **pp, size_t s) {
 	return 0;
 }
 
+//diag_flrealloc : resize (*pp) to (n*size) bytes. (*pp) is only updated
+//if successful. ret 0 if ok
+int diag_flrealloc(const char *name, const int line,
+	void **pp, size_t n, size_t s)
+{
+	void *p;
+
+	if ((s != 0) && (n != 0) && (pp != NULL)) {
+		p = realloc(*pp, n * s);
+	} else {
+		p = NULL;
+	}
+	if (p == NULL) {
+		fprintf(stderr,
+			"%s:%d: realloc(%ld, %ld) failed: %s\n", name, line,
+			(long)n, (long)s, strerror(errno));
+		return diag_iseterr(DIAG_ERR_NOMEM);
+	}
+	*pp = p;
+
+	return 0;
+}
+
 /* Add a string to array-of-strings (argv style)
 */
 char ** strlist_add(char ** list, const char * news, int elems) {
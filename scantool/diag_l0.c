@@ -12,8 +12,31 @@
 #include "diag.h"
 #include "diag_err.h"
 #include "diag_l0.h"
+#include "diag_l0_rec.h"
+#include "diag_os.h"
+#include "diag_tty.h"
 
 int diag_l0_debug;	//debug flags for l0
+bool diag_l0_stats_on;
+
+void diag_l0_stats_reset(struct diag_l0_device *dl0d) {
+	assert(dl0d);
+	memset(&dl0d->stats, 0, sizeof(dl0d->stats));
+}
+
+void diag_l0_stats_hist(unsigned long *bins, unsigned long long us) {
+	unsigned int n = 0;
+
+	while ((us >>= 1) && (n < DIAG_L0_STATBINS - 1))
+		n++;
+	bins[n]++;
+}
+
+//count a successful send of (len) bytes
+#define L0_STATS_TX(dl0d, len) do { \
+		(dl0d)->stats.tx_calls++; \
+		(dl0d)->stats.tx_bytes += (len); \
+	} while (0)
 
 int diag_l0_open(struct diag_l0_device *dl0d, int l1proto) {
 	return dl0d->dl0->_open(dl0d, l1proto);
@@ -61,6 +84,9 @@ void diag_l0_del(struct diag_l0_device *dl0d) {
 
 	assert(!dl0d->opened);
 
+	if (dl0d->rec)
+		(void) diag_l0_rec_stop(dl0d, NULL, NULL);
+
 	dl0d->dl0->_del(dl0d);
 	free(dl0d);
 	return;
@@ -80,19 +106,86 @@ uint32_t diag_l0_getflags(struct diag_l0_device *dl0d) {
 
 int diag_l0_recv(struct diag_l0_device *dl0d,
 				const char *subinterface, void *data, size_t len, unsigned int timeout) {
+	int rv;
+	unsigned long long t0 = 0;
+
 	assert(dl0d);
-	return dl0d->dl0->_recv(dl0d, subinterface, data, len, timeout);
+	if (diag_l0_stats_on)
+		t0 = diag_os_gethrt();
+	rv = dl0d->dl0->_recv(dl0d, subinterface, data, len, timeout);
+	if (diag_l0_stats_on) {
+		struct diag_l0_stats *st = &dl0d->stats;
+
+		diag_l0_stats_hist(st->rx_lat, diag_os_hrtus(diag_os_gethrt() - t0));
+		st->rx_calls++;
+		if (rv > 0)
+			st->rx_bytes += (unsigned) rv;
+		else if (rv == DIAG_ERR_TIMEOUT)
+			st->rx_timeouts++;
+		else
+			st->rx_errors++;
+	}
+	if (dl0d->rec)
+		diag_l0_rec_rx(dl0d, data, rv);
+	return rv;
 }
 
 int	diag_l0_send(struct diag_l0_device *dl0d,
 		const char *subinterface, const void *data, size_t len) {
+	int rv;
+
+	assert(dl0d);
+	rv = dl0d->dl0->_send(dl0d, subinterface, data, len);
+	if (diag_l0_stats_on && (rv == 0))
+		L0_STATS_TX(dl0d, len);
+	if (dl0d->rec && (rv == 0))
+		diag_l0_rec_tx(dl0d, data, len);
+	return rv;
+}
+
+int	diag_l0_sendv(struct diag_l0_device *dl0d,
+		const char *subinterface, const struct diag_iov *iov, unsigned int iovcnt) {
+	int rv;
+	unsigned int i;
+	size_t len = 0;
+
 	assert(dl0d);
-	return dl0d->dl0->_send(dl0d, subinterface, data, len);
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].len;
+	if (dl0d->dl0->_sendv) {
+		rv = dl0d->dl0->_sendv(dl0d, subinterface, iov, iovcnt);
+	} else {
+		uint8_t buf[MAXRBUF];
+		size_t pos = 0;
+
+		if (len > sizeof(buf))
+			return diag_iseterr(DIAG_ERR_BADLEN);
+		for (i = 0; i < iovcnt; i++) {
+			memcpy(&buf[pos], iov[i].data, iov[i].len);
+			pos += iov[i].len;
+		}
+		rv = dl0d->dl0->_send(dl0d, subinterface, buf, len);
+	}
+	if (diag_l0_stats_on && (rv == 0))
+		L0_STATS_TX(dl0d, len);
+	if (dl0d->rec && (rv == 0)) {
+		for (i = 0; i < iovcnt; i++)
+			diag_l0_rec_tx(dl0d, iov[i].data, iov[i].len);
+	}
+	return rv;
 }
 
 int diag_l0_ioctl(struct diag_l0_device *dl0d, unsigned cmd, void *data) {
+	int rv;
+
 	assert(dl0d);
 
-	return dl0d->dl0->_ioctl(dl0d, cmd, data);
+	rv = dl0d->dl0->_ioctl(dl0d, cmd, data);
+	if (dl0d->rec && (rv == 0) && (cmd == DIAG_IOCTL_INITBUS))
+		diag_l0_rec_initbus(dl0d, data);
+	if ((rv == 0) && (cmd == DIAG_IOCTL_SETSPEED)) {
+		dl0d->byte_us = DIAG_SS_BYTE_US((const struct diag_serial_settings *) data);
+	}
+	return rv;
 }
 
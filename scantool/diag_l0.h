@@ -23,6 +23,28 @@ struct diag_l1_initbus_args;
 struct diag_serial_settings;
 struct diag_l0;
 
+/*
+ * I/O statistics, per L0 device. Only updated while diag_l0_stats_on is set.
+ * Latency histograms are log-scale : bin n counts values in [2^n, 2^(n+1)) us,
+ * bin 0 also gets 0 us, and the last bin gets everything above.
+ */
+#define DIAG_L0_STATBINS	24	//2^24 us = 16.7 s
+
+struct diag_l0_stats {
+	unsigned long tx_calls;		/** diag_l0_send() / diag_l0_sendv() calls */
+	unsigned long tx_bytes;
+	unsigned long tx_frames;	/** diag_l1_send() calls */
+	unsigned long rx_calls;		/** diag_l0_recv() calls */
+	unsigned long rx_bytes;
+	unsigned long rx_frames;	/** diag_l1_recv() calls that returned data */
+	unsigned long rx_timeouts;
+	unsigned long rx_errors;	/** diag_l0_recv() errors other than timeouts */
+	unsigned long echo_errors;	/** bad or missing half-duplex echo (diag_l1_send) */
+	unsigned long rx_lat[DIAG_L0_STATBINS];	/** diag_l0_recv() duration */
+	unsigned long rsp_lat[DIAG_L0_STATBINS];	/** end of diag_l1_send() -> first byte from diag_l1_recv() */
+	unsigned long long t_sent;	/** diag_os_gethrt() at end of last diag_l1_send(); 0 once the response started */
+};
+
 /*
  * L0 device structure
  * This is the structure to interface between the L1 code
@@ -36,6 +58,10 @@ struct diag_l0_device
 	const struct diag_l0 *dl0;		/** The L0 driver's diag_l0 */
 
 	bool opened;		/** L0 status */
+	struct diag_l0_rec *rec;	/** session recorder, if active. see diag_l0_rec.h */
+	unsigned long byte_us;	/** time to send one byte at the current speed (us), 0 if unknown.
+				 * Updated by DIAG_IOCTL_SETSPEED */
+	struct diag_l0_stats stats;	/** see diag_l0_stats_on */
 };
 
 
@@ -73,6 +99,10 @@ struct diag_l0
 		const char *subinterface, const void *data, size_t len);
 
 	int (*_ioctl)(struct diag_l0_device *, unsigned cmd, void *data);
+
+	/* optional; if NULL, diag_l0_sendv() joins the segments and calls _send */
+	int	(*_sendv)(struct diag_l0_device *,
+		const char *subinterface, const struct diag_iov *iov, unsigned int iovcnt);
 };
 
 
@@ -135,6 +165,13 @@ int diag_l0_recv(struct diag_l0_device *,
 int	diag_l0_send(struct diag_l0_device *,
 					const char *subinterface, const void *data, size_t len);
 
+/** Send bytes gathered from (iovcnt) segments, as if they were one buffer.
+ * @param subinterface: ignored
+ * @return 0 on success
+ */
+int	diag_l0_sendv(struct diag_l0_device *,
+					const char *subinterface, const struct diag_iov *iov, unsigned int iovcnt);
+
 /** Send IOCTL to L0
  *	@param command : IOCTL #, defined in diag.h
  *	@param data	optional, input/output
@@ -147,6 +184,16 @@ int diag_l0_ioctl(struct diag_l0_device *, unsigned cmd, void *data);
 
 extern int diag_l0_debug;	// debug flags
 
+/** Enable I/O statistics (struct diag_l0_stats) for all L0 devices.
+ * When clear, the counters cost one test per call. */
+extern bool diag_l0_stats_on;
+
+/** Clear the I/O statistics of (dl0d) */
+void diag_l0_stats_reset(struct diag_l0_device *dl0d);
+
+/** Add (us) to a latency histogram (DIAG_L0_STATBINS bins) */
+void diag_l0_stats_hist(unsigned long *bins, unsigned long long us);
+
 
 /*
  * l0dev_list : static-allocated list of supported L0 devices, since it can
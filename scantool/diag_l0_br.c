@@ -185,7 +185,8 @@ br_write(struct diag_l0_device *dl0d, const void *dp, size_t txlen)
 	if (txlen <=0)
 		return diag_iseterr(DIAG_ERR_BADLEN);
 
-	if (diag_tty_write(dev->tty_int, dp, txlen) != (int) txlen) {
+	//every write is followed by a read of the BR1's reply : don't wait for the drain
+	if (diag_tty_write_nb(dev->tty_int, dp, txlen) != (int) txlen) {
 		fprintf(stderr, FLFMT "br_write error\n", FL);
 		return diag_iseterr(DIAG_ERR_GENERAL);
 	}
@@ -698,7 +699,9 @@ const void *data, size_t len)
 		 * This means the receive code will resend the request if it
 		 * wants to get a frame number 2 or 3 or whatever
 		 */
-		memcpy(dev->dev_rxbuf, data, len);
+		if (len > sizeof(dev->dev_txbuf))
+			return diag_iseterr(DIAG_ERR_BADLEN);
+		memcpy(dev->dev_txbuf, data, len);
 		dev->dev_txlen = len;
 		dev->dev_framenr = 1;
 
@@ -768,11 +771,10 @@ void *data, size_t len, unsigned int timeout)
 			}
 			return 0;	/* Strange, user asked for 0 bytes */
 			break;
+		case BR_STATE_CLOSED:
+		case BR_STATE_OPEN:
 		default:
-			//So BR_STATE_CLOSED and BR_STATE_OPEN.
-			// I don't know what's supposed to happen here, so
-			fprintf(stderr, FLFMT "Warning : landed in a strange place. Report this please !\n", FL);
-			return 0;
+			//normal read, see below
 			break;
 	}
 
@@ -931,6 +933,7 @@ const struct diag_l0 diag_l0_br = {
 	br_getflags,
 	br_recv,
 	br_send,
-	br_ioctl
+	br_ioctl,
+	NULL	//_sendv : see diag_l0_sendv()
 };
 
@@ -89,7 +89,8 @@ struct dumb_device
 				" 0x10: LLINE_INV : Invert polarity of the L line. see\n" \
 				"\tdoc/dumb_interfaces.txt !! This is unusual.\n" \
 				" 0x20: FAST_BREAK : use alternate iso14230 fastinit code.\n" \
-				" 0x40: BLOCKDUPLEX : use message-based half duplex removal (if P4==0)\n\n" \
+				" 0x40: BLOCKDUPLEX : use message-based half duplex removal (if P4==0)\n" \
+				" 0x80: SET_BREAK : with FAST_BREAK, use a set / clear break instead of 0x00 @ 360bps.\n\n" \
 				"ex.: \"dumbopts 9\" for MAN_BREAK and USE_LLINE.\n"
 
 
@@ -111,6 +112,7 @@ struct dumb_device
 #define LLINE_INV 0x10		//invert polarity of the L line if set. see doc/dumb_interfaces.txt
 #define FAST_BREAK 0x20		//do we use diag_tty_fastbreak for iso14230-style fast init.
 #define BLOCKDUPLEX 0x40	//This allows half duplex removal on a whole message if P4==0 (see diag_l1_send())
+#define SET_BREAK 0x80		//with FAST_BREAK : diag_tty_fastbreak sets / clears break (see diag_tty_setbrkmode)
 #define DUMBDEFAULTS (MAN_BREAK | BLOCKDUPLEX)	//default set of flags
 
 
@@ -220,6 +222,11 @@ static int dumb_open(struct diag_l0_device *dl0d, int iProtocol)
 	dev->fast_break = dumbopts & FAST_BREAK;
 	dev->blockduplex = dumbopts & BLOCKDUPLEX;
 
+	if ((dumbopts & SET_BREAK) &&
+			diag_tty_setbrkmode(dev->tty_int, DIAG_BRK_SET)) {
+		fprintf(stderr, FLFMT "Warning : SET_BREAK not available, using 0x00 @ 360bps.\n", FL);
+	}
+
 	/*
 	 * We set RTS to low, and DTR high, because this allows some
 	 * interfaces to work than need power from the DTR/RTS lines;
@@ -302,9 +309,8 @@ dumb_fastinit(struct diag_l0_device *dl0d)
 			}
 			tb1 = diag_os_gethrt() - tb0;
 			tb1 = diag_os_hrtus(tb1)/1000;	//elapsed ms so far within tWUP
-			tb1 = (50 - WUPFLUSH) - tb1;	//remaining time in WUP
-			if (tb1 > 25) return DIAG_ERR_GENERAL;	//should never happen !
-			diag_os_millisleep((unsigned int) tb1);
+			if (tb1 > (50 - WUPFLUSH)) return DIAG_ERR_GENERAL;	//should never happen !
+			diag_os_hrtwait(tb0, (50 - WUPFLUSH) * 1000);	//end of tWUP, less WUPFLUSH
 		}	//if FAST_BREAK
 	} else {
 		// do K line only
@@ -318,9 +324,8 @@ dumb_fastinit(struct diag_l0_device *dl0d)
 
 			tb1 = diag_os_gethrt() - tb0;
 			tb1 = diag_os_hrtus(tb1)/1000;	//elapsed ms so far within tWUP
-			tb1 = (50 - WUPFLUSH) - tb1;	//remaining time in WUP
-			if (tb1 > 25) return DIAG_ERR_GENERAL;	//should never happen !
-			diag_os_millisleep((unsigned int) tb1);
+			if (tb1 > (50 - WUPFLUSH)) return DIAG_ERR_GENERAL;	//should never happen !
+			diag_os_hrtwait(tb0, (50 - WUPFLUSH) * 1000);	//end of tWUP, less WUPFLUSH
 		}
 	}	//if USE_LLINE
 	// here we have WUPFLUSH ms before tWUP is done; we use this
@@ -354,17 +359,22 @@ dumb_Lline(struct diag_l0_device *dl0d, uint8_t ecuaddr)
 	 */
 	int i, rv=0;
 	struct dumb_device *dev = dl0d->l0_int;
+	unsigned long long t0;
+	unsigned long tbit;	//end of current bit, us since t0
 //	uint8_t cbuf[10];
 
 	// We also toggle DTR to disable RXD (blocking it at logical 1).
 	// However, at least one system I tested doesn't react well to
 	// DTR-toggling.
 	/* Set RTS low, for 200ms (Start bit) */
+	t0 = diag_os_gethrt();
 	if (diag_tty_control(dev->tty_int, (dev->clr_dtr), !(dev->lline_inv)) < 0) {
 		fprintf(stderr, FLFMT "_LLine: Failed to set DTR & RTS\n", FL);
 		return;
 	}
-	diag_os_millisleep(BPS_PERIOD);		/* 200ms -5% */
+	//bit edges are timed from t0 so errors don't accumulate
+	tbit = BPS_PERIOD * 1000;
+	diag_os_hrtwait(t0, tbit);		/* 200ms -5% */
 
 	for (i=0; i<8; i++) {
 		if (ecuaddr & (1<<i)) {
@@ -380,7 +390,8 @@ dumb_Lline(struct diag_l0_device *dl0d, uint8_t ecuaddr)
 				FL);
 			return;
 		}
-		diag_os_millisleep(BPS_PERIOD);		/* 200ms -5% */
+		tbit += BPS_PERIOD * 1000;
+		diag_os_hrtwait(t0, tbit);		/* 200ms -5% */
 	}
 	/* And set high for the stop bit */
 	if (diag_tty_control(dev->tty_int, (dev->clr_dtr), !(dev->lline_inv)) < 0) {
@@ -388,7 +399,8 @@ dumb_Lline(struct diag_l0_device *dl0d, uint8_t ecuaddr)
 			FL);
 		return;
 	}
-	diag_os_millisleep(BPS_PERIOD);		/* 200ms -5% */
+	tbit += BPS_PERIOD * 1000;
+	diag_os_hrtwait(t0, tbit);		/* 200ms -5% */
 
 	/* Now put DTR/RTS back correctly so RX side is enabled */
 	if (diag_tty_control(dev->tty_int, !(dev->clr_dtr), dev->set_rts) < 0) {
@@ -437,6 +449,9 @@ dumb_slowinit(struct diag_l0_device *dl0d, struct diag_l1_initbus_args *in,
 		int bitcounter;
 		uint8_t tempbyte=in->addr;
 		bool curbit = 0;	//startbit
+		//bit edges are timed from t0 so errors don't accumulate
+		unsigned long long t0 = diag_os_gethrt();
+		unsigned long tbit = 0;	//end of current bit, us since t0
 		for (bitcounter=0; bitcounter<=8; bitcounter++) {
 			//LSB first.
 			if (curbit) {
@@ -444,7 +459,8 @@ dumb_slowinit(struct diag_l0_device *dl0d, struct diag_l1_initbus_args *in,
 						//release L
 						diag_tty_control(dev->tty_int, !(dev->clr_dtr), (dev->lline_inv));
 				}
-				diag_os_millisleep(BPS_PERIOD);
+				tbit += BPS_PERIOD * 1000;
+				diag_os_hrtwait(t0, tbit);
 			} else {
 				unsigned int lowtime=BPS_PERIOD;
 				//to prevent spurious breaks if we have a sequence of 0's :
@@ -462,6 +478,7 @@ dumb_slowinit(struct diag_l0_device *dl0d, struct diag_l1_initbus_args *in,
 					diag_tty_control(dev->tty_int, !(dev->clr_dtr), !(dev->lline_inv));
 				}
 				diag_tty_break(dev->tty_int, lowtime);
+				tbit += lowtime * 1000;
 			}
 			curbit = tempbyte & 1;
 			tempbyte = tempbyte >>1;
@@ -470,7 +487,8 @@ dumb_slowinit(struct diag_l0_device *dl0d, struct diag_l1_initbus_args *in,
 		if (dev->use_L) {
 			diag_tty_control(dev->tty_int, !(dev->clr_dtr), dev->set_rts);	//release L
 		}
-		diag_os_millisleep(BPS_PERIOD);	//stop bit
+		tbit += BPS_PERIOD * 1000;
+		diag_os_hrtwait(t0, tbit);	//stop bit
 
 		//at this point the stop bit just finished. We could just purge the input buffer ?
 		//Usually the next thing to happen is the ECU will send the sync byte (0x55) within W1
@@ -581,6 +599,8 @@ static int
 dumb_initbus(struct diag_l0_device *dl0d, struct diag_l1_initbus_args *in)
 {
 	int rv = DIAG_ERR_INIT_NOTSUPP;
+	struct diag_os_waitstats ws0, ws1;
+	unsigned int rt;
 
 	struct dumb_device *dev;
 
@@ -596,6 +616,10 @@ dumb_initbus(struct diag_l0_device *dl0d, struct diag_l1_initbus_args *in)
 
 	(void)diag_tty_iflush(dev->tty_int);	/* Flush unread input */
 
+	//bit-banged timing : use realtime mode if enabled ("set realtime")
+	diag_os_getwaitstats(&ws0, 0);
+	rt = diag_os_rt_enter();
+
 	switch (in->type) {
 		case DIAG_L1_INITBUS_FAST:
 			rv = dumb_fastinit(dl0d);
@@ -610,6 +634,17 @@ dumb_initbus(struct diag_l0_device *dl0d, struct diag_l1_initbus_args *in)
 			break;
 	}
 
+	diag_os_rt_exit();
+	if (rt && (diag_l0_debug & DIAG_DEBUG_TIMER)) {
+		unsigned long n;
+
+		diag_os_getwaitstats(&ws1, 0);
+		n = ws1.count - ws0.count;
+		fprintf(stderr, FLFMT "realtime init (0x%X): %lu waits, %lu late, avg err %lldus\n",
+			FL, rt, n, ws1.late - ws0.late,
+			n? (ws1.sumerr - ws0.sumerr) / (long long) n : 0);
+	}
+
 
 	if (rv) {
 		fprintf(stderr, FLFMT "L0 initbus failed with %d\n", FL, rv);
@@ -658,7 +693,16 @@ const void *data, size_t len)
 		fprintf(stderr, "\n");
 	}
 
-	if ((rv = diag_tty_write(dev->tty_int, data, len)) != (int) len) {
+	/*
+	 * K-line is half duplex : diag_l1_send() reads back the echo right
+	 * after this, which tells when the bytes are on the wire. No need to
+	 * wait for the tty to drain.
+	 */
+	if (dev->protocol & (DIAG_L1_ISO9141 | DIAG_L1_ISO14230))
+		rv = diag_tty_write_nb(dev->tty_int, data, len);
+	else
+		rv = diag_tty_write(dev->tty_int, data, len);
+	if (rv != (int) len) {
 		fprintf(stderr, FLFMT "dumb_send: write error\n", FL);
 		return diag_iseterr(DIAG_ERR_GENERAL);
 	}
@@ -666,6 +710,48 @@ const void *data, size_t len)
 	return 0;
 }
 
+/*
+ * Scatter-gather version of dumb_send : the segments go out in one writev()
+ * instead of being joined in a buffer.
+ */
+static int
+dumb_sendv(struct diag_l0_device *dl0d,
+UNUSED(const char *subinterface),
+const struct diag_iov *iov, unsigned int iovcnt)
+{
+	ssize_t rv;
+	size_t len = 0;
+	unsigned int i;
+	struct dumb_device *dev = dl0d->l0_int;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].len;
+	if (len == 0)
+		return diag_iseterr(DIAG_ERR_BADLEN);
+
+	if (diag_l0_debug & DIAG_DEBUG_WRITE) {
+		fprintf(stderr, FLFMT "l0_sendv dl0d=%p len=%ld; ",
+			FL, (void *)dl0d, (long)len);
+		if (diag_l0_debug & DIAG_DEBUG_DATA) {
+			for (i = 0; i < iovcnt; i++)
+				diag_data_dump(stderr, iov[i].data, iov[i].len);
+		}
+		fprintf(stderr, "\n");
+	}
+
+	//see dumb_send about write_nb
+	if (dev->protocol & (DIAG_L1_ISO9141 | DIAG_L1_ISO14230))
+		rv = diag_tty_writev_nb(dev->tty_int, iov, iovcnt);
+	else
+		rv = diag_tty_writev(dev->tty_int, iov, iovcnt);
+	if (rv != (ssize_t) len) {
+		fprintf(stderr, FLFMT "dumb_sendv: write error\n", FL);
+		return diag_iseterr(DIAG_ERR_GENERAL);
+	}
+
+	return 0;
+}
+
 /*
  * Get data (blocking), returns number of bytes read, between 1 and len
  * If timeout is set to 0, this becomes non-blocking
@@ -781,4 +867,5 @@ const struct diag_l0 diag_l0_dumb = {
 	dumb_recv,
 	dumb_send,
 	dumb_ioctl,
+	dumb_sendv,
 };
@@ -456,6 +456,134 @@ static void dtest_13(struct diag_l0_device *dl0d) {
 	return;
 }
 
+//dtest_15 : compare diag_tty_fastbreak() implementations (see diag_tty_setbrkmode).
+//For each one, measure against the tty clock :
+// - pulse : start of a 25ms low pulse -> its echo. The 0x00 @ 360bps echo comes after
+//	the stop bit (27.8ms); a break echo comes when the break is cleared (25ms);
+// - tWUP : diag_tty_fastbreak(40) duration, vs 40ms;
+// - 1st byte : start of the pattern -> echo of the following 0x55 @ 10400, vs 40ms + 0.96ms.
+//Then report the method with the smallest worst-case tWUP error, and the dumbopts
+//that make the dumb driver's fast init use it.
+static void dtest_15(struct diag_l0_device *dl0d) {
+	#define DT15_ITERS	10
+	#define DT15_WUP	40	//ms
+	static const struct {
+		enum diag_tty_brkmode mode;
+		const char *name;
+		const char *dumbopts;
+	} methods[] = {
+		{DIAG_BRK_BYTE, "0x00 @ 360bps", "FAST_BREAK (0x20)"},
+		{DIAG_BRK_SET, "set/clear break", "FAST_BREAK + SET_BREAK (0xA0)"},
+	};
+	struct dt_device *dev = dl0d->l0_int;
+	struct diag_serial_settings set;
+	const uint8_t db = 0x55;
+	long besterr = -1;
+	unsigned int m, best = 0;
+
+	set.databits = diag_databits_8;
+	set.stopbits = diag_stopbits_1;
+	set.parflag = diag_par_n;
+
+	fprintf(stderr, "Starting test 15: fast break methods, %d iterations each.\n", DT15_ITERS);
+	printf("times in us\n%-16s %17s %17s %17s %5s %7s\n", "method", "pulse avg/max",
+		"tWUP err avg/max", "1st byte avg/max", "errs", "no echo");
+
+	for (m = 0; m < ARRAY_SIZE(methods); m++) {
+		unsigned long psum = 0, pmax = 0, fsum = 0, fmax = 0;
+		long wsum = 0, wmax = 0;
+		unsigned int i, errs = 0, n = 0, np = 0;
+
+		if (diag_tty_setbrkmode(dev->tty_int, methods[m].mode)) {
+			printf("%-16s not available\n", methods[m].name);
+			continue;
+		}
+		for (i = 0; i < DT15_ITERS; i++) {
+			unsigned long long t0, te;
+			unsigned long pulse, first;
+			long werr;
+			uint8_t c;
+
+			diag_tty_iflush(dev->tty_int);
+			//pulse : same primitives as diag_tty_fastbreak(), but timed up to the echo
+			if (methods[m].mode == DIAG_BRK_BYTE) {
+				set.speed = 360;
+				if (diag_tty_setup(dev->tty_int, &set)) {
+					errs++;
+					break;
+				}
+				t0 = diag_os_gethrt();
+				if (diag_tty_write(dev->tty_int, "", 1) != 1) {
+					errs++;
+				}
+			} else {
+				t0 = diag_os_gethrt();
+				if (diag_tty_break(dev->tty_int, 25)) {
+					errs++;
+				}
+			}
+			//some adapters don't report breaks : not fatal
+			if (diag_tty_read(dev->tty_int, &c, 1, 100) == 1) {
+				te = diag_os_gethrt();
+				pulse = (unsigned long) diag_os_hrtus(te - t0);
+				np++;
+				psum += pulse;
+				if (pulse > pmax) pmax = pulse;
+			}
+			set.speed = 10400;
+			if (diag_tty_setup(dev->tty_int, &set)) {
+				errs++;
+				break;
+			}
+			diag_os_millisleep(DT15_WUP);	//K line idle between patterns
+
+			//tWUP, then first byte
+			t0 = diag_os_gethrt();
+			if (diag_tty_fastbreak(dev->tty_int, DT15_WUP)) {
+				errs++;
+				continue;
+			}
+			werr = (long) diag_os_hrtus(diag_os_gethrt() - t0) - DT15_WUP * 1000L;
+			diag_tty_iflush(dev->tty_int);	//break echo, if any
+			if (diag_tty_write(dev->tty_int, &db, 1) != 1) {
+				errs++;
+				continue;
+			}
+			if ((diag_tty_read(dev->tty_int, &c, 1, 100) != 1) || (c != db)) {
+				errs++;
+				continue;
+			}
+			first = (unsigned long) diag_os_hrtus(diag_os_gethrt() - t0);
+
+			n++;
+			wsum += werr;
+			if (labs(werr) > labs(wmax)) wmax = werr;
+			fsum += first;
+			if (first > fmax) fmax = first;
+			diag_os_millisleep(DT15_WUP);
+		}
+		if (n == 0) {
+			printf("%-16s failed (%u errors)\n", methods[m].name, errs);
+			continue;
+		}
+		printf("%-16s %8lu/%8lu %8ld/%8ld %8lu/%8lu %5u %7u\n", methods[m].name,
+			np? psum / np : 0, pmax, wsum / (long) n, wmax, fsum / n, fmax, errs,
+			DT15_ITERS - np);
+		if ((errs == 0) && ((besterr < 0) || (labs(wmax) < besterr))) {
+			besterr = labs(wmax);
+			best = m;
+		}
+	}
+	(void) diag_tty_setbrkmode(dev->tty_int, DIAG_BRK_BYTE);
+
+	if (besterr < 0) {
+		printf("No method worked; check the interface.\n");
+		return;
+	}
+	printf("Best: %s, i.e. dumb driver %s.\n", methods[best].name, methods[best].dumbopts);
+	return;
+}
+
 static int
 dt_new(struct diag_l0_device *dl0d) {
 	struct dt_device *dev;
@@ -626,6 +754,9 @@ static int dt_open(struct diag_l0_device *dl0d, int testnum)
 	case 14:
 		dtest_7(dl0d);	//same test, different speed
 		break;
+	case 15:
+		dtest_15(dl0d);
+		break;
 	default:
 		break;
 	}
@@ -758,5 +889,6 @@ const struct diag_l0 diag_l0_dumbtest = {
 	dt_getflags,
 	dt_recv,
 	dt_send,
-	dt_ioctl
+	dt_ioctl,
+	NULL	//_sendv : see diag_l0_sendv()
 };
@@ -284,7 +284,8 @@ elm_sendcmd(struct diag_l0_device *dl0d, const uint8_t *data, size_t len, unsign
 		fprintf(stderr, FLFMT "elm_sendcmd: %.*s\n", FL, (int) len-1, (char *)data);
 	}
 
-	rv = diag_tty_write(dev->tty_int, data, len);
+	//no need to wait for the command to be sent : the read below covers it.
+	rv = diag_tty_write_nb(dev->tty_int, data, len);
 	if (rv != (int) len) {	//XXX danger ! evil cast
 		fprintf(stderr, FLFMT "elm_sendcmd: write error\n", FL);
 		return diag_iseterr(DIAG_ERR_GENERAL);
@@ -892,7 +893,7 @@ static int elm_purge(struct diag_l0_device *dl0d) {
 	int rv;
 	struct elm_device *dev = dl0d->l0_int;
 
-	if (diag_tty_write(dev->tty_int, buf, 4) != 4) {
+	if (diag_tty_write_nb(dev->tty_int, buf, 4) != 4) {
 		fprintf(stderr, FLFMT "elm_purge : write error\n", FL);
 		return diag_iseterr(DIAG_ERR_GENERAL);
 	}
@@ -990,9 +991,9 @@ elm_send(struct diag_l0_device *dl0d,
 
 	if(dev->protocol & DIAG_L1_ISO9141) {
 		i -= 6;
-		rv=diag_tty_write(dev->tty_int, buf+6, i+1); // skip header
+		rv=diag_tty_write_nb(dev->tty_int, buf+6, i+1); // skip header
 	} else {
-		rv=diag_tty_write(dev->tty_int, buf, i+1);
+		rv=diag_tty_write_nb(dev->tty_int, buf, i+1);
 	}
 	if (rv != (int) (i+1)) {	//XXX danger ! evil cast !
 		fprintf(stderr, FLFMT "elm_send:write error\n",FL);
@@ -1248,5 +1249,6 @@ const struct diag_l0 diag_l0_elm = {
 	elm_getflags,
 	elm_recv,
 	elm_send,
-	elm_ioctl
+	elm_ioctl,
+	NULL	//_sendv : see diag_l0_sendv()
 };
@@ -990,5 +990,6 @@ const struct diag_l0 diag_l0_me = {
 	muleng_getflags,
 	muleng_recv,
 	muleng_send,
-	muleng_ioctl
+	muleng_ioctl,
+	NULL	//_sendv : see diag_l0_sendv()
 };
@@ -0,0 +1,515 @@
+/* freediag
+ *
+ * L0 session recorder : see diag_l0_rec.h
+ *
+ * GPLv3
+ *
+ * Events (struct rec_ev + data bytes) are appended to rec->evbuf under
+ * evmtx. The writer swaps evbuf and wbuf, then replays the events in wbuf
+ * to assemble exchanges (one request + its responses) and writes each new
+ * one to the file. Lock order is always wmtx, then evmtx.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "diag.h"
+#include "diag_err.h"
+#include "diag_os.h"
+#include "diag_l0.h"
+#include "diag_l1.h"
+#include "diag_l0_rec.h"
+#include "diag_timer.h"
+
+#include "utlist.h"
+
+#define REC_EVBUFSIZE	65536	//per event buffer; two are used
+#define REC_FILEBUF	65536	//stdio buffer for the output file
+#define REC_HASHSIZE	4096	//de-duplication hash table
+#define REC_MAXREQ	255	//max request length, as for carsim
+#define REC_MAXRP	255	//max bytes per RP line
+#define REC_MAXRESP	64	//max RP lines per exchange
+#define REC_BAUD	10400	//to estimate response transmission time, for P2
+#define REC_FLUSHDELAY	300	//ms; write out recorded events at most this long after they occur
+
+enum rec_evtype {
+	EV_TX,		//request bytes
+	EV_RX,		//response bytes
+	EV_RXTO,	//receive timeout
+	EV_FASTINIT,
+	EV_SLOWINIT,	//data = target address
+};
+
+struct rec_ev {
+	unsigned long long t;	//diag_os_gethrt() when the event was recorded, if timing
+	uint32_t l0flags;	//diag_l0_getflags()
+	uint16_t len;		//number of data bytes that follow
+	uint8_t type;		//enum rec_evtype
+};
+
+//de-duplication : every exchange written so far
+struct rec_seen {
+	struct rec_seen *next;
+	uint32_t hash;
+	uint32_t len;
+	uint8_t key[];		//request + responses, see rec_key()
+};
+
+struct diag_l0_rec {
+	struct diag_l0_rec *next;	//rec_list
+	struct diag_l0_device *dl0d;
+	FILE *fp;
+	bool timing;
+
+	//recording side; protected by evmtx
+	diag_mtx *evmtx;
+	uint8_t *evbuf;
+	size_t evlen;
+	struct diag_timer flush;	//armed when evbuf becomes non-empty
+
+	//writer side; protected by wmtx
+	diag_mtx *wmtx;
+	uint8_t *wbuf;
+	bool hdr_done;
+	unsigned echo_left;	//half-duplex echo bytes still expected
+	bool rxto;		//a receive timed out since the last request
+	unsigned long long t_last;	//end of the last request / response
+
+	//exchange being assembled
+	bool xvalid;
+	uint8_t req[REC_MAXREQ];
+	unsigned reqlen;
+	uint8_t rp[REC_MAXRESP][REC_MAXRP];
+	uint16_t rplen[REC_MAXRESP];
+	unsigned rp2[REC_MAXRESP];	//P2, ms
+	unsigned nrp;
+	uint8_t key[1 + REC_MAXREQ + REC_MAXRESP * (1 + REC_MAXRP)];	//rec_key() of the exchange
+
+	struct rec_seen *seen[REC_HASHSIZE];
+	unsigned nexch, ndup;
+};
+
+static struct diag_l0_rec *rec_list;	//active recorders, for diag_l0_rec_end
+static diag_mtx *rec_listmtx;
+
+
+/** writer **/
+
+//FNV-1a
+static uint32_t rec_hash(const uint8_t *p, size_t len) {
+	uint32_t h = 2166136261U;
+	while (len--) {
+		h ^= *p++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+//serialize the current exchange (without timing) in key[]; ret length
+static size_t rec_key(const struct diag_l0_rec *rec, uint8_t *key) {
+	size_t kl = 0;
+	unsigned i;
+
+	key[kl++] = (uint8_t) rec->reqlen;
+	memcpy(&key[kl], rec->req, rec->reqlen);
+	kl += rec->reqlen;
+	for (i = 0; i < rec->nrp; i++) {
+		key[kl++] = (uint8_t) rec->rplen[i];
+		memcpy(&key[kl], rec->rp[i], rec->rplen[i]);
+		kl += rec->rplen[i];
+	}
+	return kl;
+}
+
+//@return 1 if the current exchange was already written, 0 if it's a new one.
+static bool rec_dedup(struct diag_l0_rec *rec) {
+	uint8_t *key = rec->key;
+	struct rec_seen *sp;
+	size_t kl;
+	uint32_t h;
+
+	kl = rec_key(rec, key);
+	h = rec_hash(key, kl);
+
+	LL_FOREACH(rec->seen[h % REC_HASHSIZE], sp) {
+		if ((sp->hash == h) && (sp->len == kl) && (memcmp(sp->key, key, kl) == 0))
+			return 1;
+	}
+
+	if (diag_malloc(&sp, sizeof(*sp) + kl))
+		return 0;	//can't remember it : write it anyway
+	sp->hash = h;
+	sp->len = (uint32_t) kl;
+	memcpy(sp->key, key, kl);
+	LL_PREPEND(rec->seen[h % REC_HASHSIZE], sp);
+	return 0;
+}
+
+static void rec_writebytes(FILE *fp, const uint8_t *data, unsigned len) {
+	unsigned i;
+
+	for (i = 0; i < len; i++) {
+		fprintf(fp, " 0x%02X", data[i]);
+	}
+	fprintf(fp, "\n");
+}
+
+static void rec_writehdr(struct diag_l0_rec *rec, uint32_t l0flags) {
+	time_t now = time(NULL);
+
+	fprintf(rec->fp, "# carsim db recorded from %s interface on %s",
+		rec->dl0d->dl0->shortname, asctime(localtime(&now)));
+	if (l0flags & DIAG_L1_DATAONLY)
+		fprintf(rec->fp, "CFG DATAONLY\n");
+	if (l0flags & DIAG_L1_STRIPSL2CKSUM)
+		fprintf(rec->fp, "CFG NOL2CKSUM\n");
+	if (l0flags & DIAG_L1_DOESL2FRAME)
+		fprintf(rec->fp, "CFG FRAMED\n");
+	if (l0flags & DIAG_L1_DOESFULLINIT)
+		fprintf(rec->fp, "CFG FULLINIT\n");
+	fprintf(rec->fp, "\n");
+	rec->hdr_done = 1;
+}
+
+//write out current exchange if it's a new one
+static void rec_endexch(struct diag_l0_rec *rec) {
+	unsigned i;
+
+	if (!rec->xvalid)
+		return;
+	rec->xvalid = 0;
+
+	if (rec_dedup(rec)) {
+		rec->ndup++;
+		return;
+	}
+	rec->nexch++;
+
+	fprintf(rec->fp, "RQ");
+	rec_writebytes(rec->fp, rec->req, rec->reqlen);
+	for (i = 0; i < rec->nrp; i++) {
+		fprintf(rec->fp, "RP");
+		if (rec->timing)
+			fprintf(rec->fp, " P2=%u", rec->rp2[i]);
+		rec_writebytes(rec->fp, rec->rp[i], rec->rplen[i]);
+	}
+}
+
+static void rec_newexch(struct diag_l0_rec *rec) {
+	rec_endexch(rec);
+	rec->xvalid = 1;
+	rec->reqlen = 0;
+	rec->nrp = 0;
+	rec->rxto = 0;
+}
+
+static void rec_addreq(struct diag_l0_rec *rec, const uint8_t *data, unsigned len) {
+	len = MIN(len, REC_MAXREQ - rec->reqlen);
+	memcpy(&rec->req[rec->reqlen], data, len);
+	rec->reqlen += len;
+}
+
+//add RP line(s); P2 is the gap since the previous request / response,
+//minus the time the response bytes themselves took on the bus.
+static void rec_addrp(struct diag_l0_rec *rec, const uint8_t *data, unsigned len, unsigned long long t) {
+	while (len && (rec->nrp < REC_MAXRESP)) {
+		unsigned chunk = MIN(len, REC_MAXRP);
+		unsigned p2 = 0;
+
+		if (rec->timing) {
+			unsigned long long gap = diag_os_hrtus(t - rec->t_last);
+			unsigned long long bytetime = chunk * 10 * 1000000ULL / REC_BAUD;
+			if (gap > bytetime)
+				p2 = (unsigned) ((gap - bytetime + 500) / 1000);
+		}
+		memcpy(rec->rp[rec->nrp], data, chunk);
+		rec->rplen[rec->nrp] = (uint16_t) chunk;
+		rec->rp2[rec->nrp] = p2;
+		rec->nrp++;
+		data += chunk;
+		len -= chunk;
+	}
+	rec->t_last = t;
+}
+
+//replay events from wbuf
+static void rec_process(struct diag_l0_rec *rec, size_t wlen) {
+	size_t pos = 0;
+
+	while (pos + sizeof(struct rec_ev) <= wlen) {
+		struct rec_ev ev;
+		const uint8_t *data;
+		unsigned len;
+
+		memcpy(&ev, &rec->wbuf[pos], sizeof(ev));
+		data = &rec->wbuf[pos + sizeof(ev)];
+		len = ev.len;
+		pos += sizeof(ev) + len;
+
+		if (!rec->hdr_done)
+			rec_writehdr(rec, ev.l0flags);
+
+		switch (ev.type) {
+		case EV_TX:
+			//P4 byte-by-byte sends : same request until a response or timeout
+			if (!rec->xvalid || rec->nrp || rec->rxto || !rec->reqlen)
+				rec_newexch(rec);
+			rec_addreq(rec, data, len);
+			if (ev.l0flags & (DIAG_L1_HALFDUPLEX | DIAG_L1_BLOCKDUPLEX))
+				rec->echo_left += len;
+			rec->t_last = ev.t;
+			break;
+		case EV_RX:
+			if (rec->echo_left) {
+				unsigned skip = MIN(len, rec->echo_left);
+				rec->echo_left -= skip;
+				data += skip;
+				len -= skip;
+			}
+			//unsolicited data can't be replayed : drop it
+			if (len && rec->xvalid)
+				rec_addrp(rec, data, len, ev.t);
+			break;
+		case EV_RXTO:
+			rec->rxto = 1;
+			rec->echo_left = 0;
+			break;
+		case EV_FASTINIT:
+			//CARSIM simulates the wake-up pattern with a 0x00 request
+			rec_newexch(rec);
+			rec->req[0] = 0x00;
+			rec->reqlen = 1;
+			rec->xvalid = 1;
+			rec_endexch(rec);
+			rec->t_last = ev.t;
+			break;
+		case EV_SLOWINIT:
+			//address byte; CARSIM reads the sync pattern from the first RP
+			rec_newexch(rec);
+			rec_addreq(rec, data, len);
+			rec->rp[0][0] = 0x55;
+			rec->rplen[0] = 1;
+			rec->rp2[0] = 0;
+			rec->nrp = 1;
+			rec->t_last = ev.t;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+//write out everything recorded so far. Caller must hold wmtx.
+static void rec_flush(struct diag_l0_rec *rec) {
+	uint8_t *tmp;
+	size_t wlen;
+
+	diag_os_lock(rec->evmtx);
+	tmp = rec->wbuf;
+	rec->wbuf = rec->evbuf;
+	rec->evbuf = tmp;
+	wlen = rec->evlen;
+	rec->evlen = 0;
+	diag_os_unlock(rec->evmtx);
+
+	if (wlen == 0)
+		return;
+	rec_process(rec, wlen);
+	fflush(rec->fp);
+}
+
+
+/** recording side **/
+
+static void rec_event(struct diag_l0_device *dl0d, enum rec_evtype type,
+		const void *data, size_t len) {
+	struct diag_l0_rec *rec = dl0d->rec;
+	struct rec_ev ev;
+	size_t need;
+
+	if (len > REC_EVBUFSIZE - sizeof(ev))
+		len = REC_EVBUFSIZE - sizeof(ev);
+	need = sizeof(ev) + len;
+
+	ev.t = rec->timing? diag_os_gethrt() : 0;
+	ev.l0flags = diag_l0_getflags(dl0d);
+	ev.len = (uint16_t) len;
+	ev.type = (uint8_t) type;
+
+	diag_os_lock(rec->evmtx);
+	if (rec->evlen + need > REC_EVBUFSIZE) {
+		//full : have to write it out now.
+		diag_os_unlock(rec->evmtx);
+		diag_os_lock(rec->wmtx);
+		rec_flush(rec);
+		diag_os_unlock(rec->wmtx);
+		diag_os_lock(rec->evmtx);
+	}
+	if (rec->evlen == 0) {
+		(void) diag_timer_add(&rec->flush, diag_os_getms() + REC_FLUSHDELAY);
+	}
+	memcpy(&rec->evbuf[rec->evlen], &ev, sizeof(ev));
+	if (len)
+		memcpy(&rec->evbuf[rec->evlen + sizeof(ev)], data, len);
+	rec->evlen += need;
+	diag_os_unlock(rec->evmtx);
+}
+
+void diag_l0_rec_tx(struct diag_l0_device *dl0d, const void *data, size_t len) {
+	rec_event(dl0d, EV_TX, data, len);
+}
+
+void diag_l0_rec_rx(struct diag_l0_device *dl0d, const void *data, int rv) {
+	if (rv > 0) {
+		rec_event(dl0d, EV_RX, data, (size_t) rv);
+	} else if (rv == DIAG_ERR_TIMEOUT) {
+		rec_event(dl0d, EV_RXTO, NULL, 0);
+	}
+}
+
+void diag_l0_rec_initbus(struct diag_l0_device *dl0d, const struct diag_l1_initbus_args *in) {
+	switch (in->type) {
+	case DIAG_L1_INITBUS_FAST:
+		rec_event(dl0d, EV_FASTINIT, NULL, 0);
+		break;
+	case DIAG_L1_INITBUS_5BAUD:
+		rec_event(dl0d, EV_SLOWINIT, &in->addr, 1);
+		break;
+	default:
+		break;
+	}
+}
+
+
+//flush timer handler
+static unsigned long rec_flushtimer(void *arg, unsigned long now) {
+	struct diag_l0_rec *rec = arg;
+
+	//don't wait if the recording side is flushing a full buffer
+	if (!diag_os_trylock(rec->wmtx))
+		return now + REC_FLUSHDELAY;
+	rec_flush(rec);
+	diag_os_unlock(rec->wmtx);
+	return DIAG_TIMER_NONE;
+}
+
+
+/** public funcs **/
+
+static void rec_free(struct diag_l0_rec *rec) {
+	unsigned i;
+
+	for (i = 0; i < REC_HASHSIZE; i++) {
+		struct rec_seen *sp, *tmp;
+		LL_FOREACH_SAFE(rec->seen[i], sp, tmp) {
+			free(sp);
+		}
+	}
+	if (rec->evmtx)
+		diag_os_delmtx(rec->evmtx);
+	if (rec->wmtx)
+		diag_os_delmtx(rec->wmtx);
+	free(rec->evbuf);
+	free(rec->wbuf);
+	free(rec);
+}
+
+int diag_l0_rec_start(struct diag_l0_device *dl0d, const char *fname, bool timing) {
+	struct diag_l0_rec *rec;
+	int rv;
+
+	assert((dl0d != NULL) && (fname != NULL));
+
+	if (dl0d->rec)
+		return diag_iseterr(DIAG_ERR_GENERAL);
+
+	if ((rv = diag_calloc(&rec, 1)))
+		return diag_iseterr(rv);
+
+	if ((rv = diag_malloc(&rec->evbuf, REC_EVBUFSIZE)) ||
+		(rv = diag_malloc(&rec->wbuf, REC_EVBUFSIZE))) {
+		rec_free(rec);
+		return diag_iseterr(rv);
+	}
+	rec->evmtx = diag_os_newmtx();
+	rec->wmtx = diag_os_newmtx();
+	if (!rec->evmtx || !rec->wmtx) {
+		rec_free(rec);
+		return diag_iseterr(DIAG_ERR_GENERAL);
+	}
+
+	rec->fp = fopen(fname, "w");
+	if (rec->fp == NULL) {
+		fprintf(stderr, FLFMT "Unable to create file \"%s\"\n", FL, fname);
+		rec_free(rec);
+		return diag_iseterr(DIAG_ERR_GENERAL);
+	}
+	setvbuf(rec->fp, NULL, _IOFBF, REC_FILEBUF);
+
+	rec->dl0d = dl0d;
+	rec->timing = timing;
+	rec->flush.fn = rec_flushtimer;
+	rec->flush.arg = rec;
+
+	diag_os_lock(rec_listmtx);
+	LL_PREPEND(rec_list, rec);
+	dl0d->rec = rec;
+	diag_os_unlock(rec_listmtx);
+	return 0;
+}
+
+int diag_l0_rec_stop(struct diag_l0_device *dl0d, unsigned *nexch, unsigned *ndup) {
+	struct diag_l0_rec *rec;
+	int rv = 0;
+
+	assert(dl0d != NULL);
+
+	rec = dl0d->rec;
+	if (!rec)
+		return diag_iseterr(DIAG_ERR_GENERAL);
+
+	diag_os_lock(rec_listmtx);
+	LL_DELETE(rec_list, rec);
+	dl0d->rec = NULL;
+	diag_os_unlock(rec_listmtx);
+
+	diag_timer_del(&rec->flush);
+	diag_os_lock(rec->wmtx);
+	rec_flush(rec);
+	rec_endexch(rec);
+	diag_os_unlock(rec->wmtx);
+
+	if (!rec->hdr_done)
+		fprintf(rec->fp, "# nothing recorded\n");
+	if (fclose(rec->fp) != 0) {
+		fprintf(stderr, FLFMT "Error writing recorded file\n", FL);
+		rv = DIAG_ERR_GENERAL;
+	}
+
+	if (nexch)
+		*nexch = rec->nexch;
+	if (ndup)
+		*ndup = rec->ndup;
+
+	rec_free(rec);
+	return rv? diag_iseterr(rv) : 0;
+}
+
+int diag_l0_rec_init(void) {
+	rec_listmtx = diag_os_newmtx();
+	if (rec_listmtx == NULL)
+		return diag_iseterr(DIAG_ERR_GENERAL);
+	return 0;
+}
+
+int diag_l0_rec_end(void) {
+	//close files of recorders that weren't stopped
+	while (rec_list) {
+		(void) diag_l0_rec_stop(rec_list->dl0d, NULL, NULL);
+	}
+	diag_os_delmtx(rec_listmtx);
+	rec_listmtx = NULL;
+	return 0;
+}
@@ -0,0 +1,58 @@
+#ifndef _DIAG_L0_REC_H_
+#define _DIAG_L0_REC_H_
+
+/* freediag
+ * GPLv3
+ *
+ * L0 session recorder : writes the traffic of an L0 device as a carsim .db file.
+ *
+ * diag_l0_send(), diag_l0_recv() and diag_l0_ioctl() hand every request,
+ * response and bus init to the device's recorder (if any). On that path the
+ * recorder only copies the raw bytes to a memory buffer; formatting,
+ * de-duplication and file writes happen later, from a timer (diag_timer.h)
+ * armed when the first event is buffered, or when the buffer is full.
+ *
+ * Every successful diag_l0_recv() becomes one RP line, so that CARSIM replays
+ * the responses with the same granularity. Identical exchanges (request and
+ * all its responses) are only written once.
+ */
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct diag_l0_device;
+struct diag_l1_initbus_args;
+struct diag_l0_rec;
+
+/** Start recording the traffic of an L0 device to a new carsim .db file
+ *
+ * @param timing : add P2 annotations (measured response latency) to RP lines
+ * @return 0 if ok
+ */
+int diag_l0_rec_start(struct diag_l0_device *dl0d, const char *fname, bool timing);
+
+/** Stop recording; flushes + closes the file.
+ *
+ * @param nexch, ndup : if not NULL, set to the number of exchanges written,
+ * and the number of duplicate exchanges that were skipped.
+ * @return 0 if ok
+ */
+int diag_l0_rec_stop(struct diag_l0_device *dl0d, unsigned *nexch, unsigned *ndup);
+
+/** set up / tear down global state; called from diag_init() and diag_end(). */
+int diag_l0_rec_init(void);
+int diag_l0_rec_end(void);
+
+/* hooks for diag_l0.c; not for general use */
+void diag_l0_rec_tx(struct diag_l0_device *dl0d, const void *data, size_t len);
+void diag_l0_rec_rx(struct diag_l0_device *dl0d, const void *data, int rv);
+void diag_l0_rec_initbus(struct diag_l0_device *dl0d, const struct diag_l1_initbus_args *in);
+
+#if defined(__cplusplus)
+}
+#endif
+#endif // _DIAG_L0_REC_H_
@@ -37,14 +37,26 @@
  * with allowance for comments (lines started with "#") and a very small and
  * rigid syntax (check the comments in the file).
  *
+ * By default responses are returned instantly. With "simtiming" set, the
+ * simulator also models bus timing : request and response bytes take
+ * 10 bit times at the .db file's baud rate, responses start P2 after the
+ * end of the request (or of the previous response), and response bytes
+ * are separated by P1. Receive timeouts are honoured against that model.
+ * Time is kept by a pluggable clock (struct sim_clock) : "simclock" = 1
+ * runs in real time, N > 1 runs N times faster than real time, and 0 uses
+ * a virtual clock that jumps ahead instead of waiting.
+ *
+ * The .db file can describe several ECUs, each with its own state machine
+ * (see diag_simdb.h). Every ECU matching a request queues its own responses;
+ * they are interleaved on the bus according to each ECU's P2. ECUs go back
+ * to their initial state on every bus init.
+ *
  */
 
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h> // str**()
-#include <ctype.h>
 #include <stdbool.h>
-#include <math.h> // sin()
 
 #include "diag.h"
 #include "diag_err.h"
@@ -53,6 +65,7 @@
 #include "diag_l0.h"
 #include "diag_l1.h"
 #include "diag_cfg.h"
+#include "diag_simdb.h"
 
 #include "utlist.h"
 
@@ -66,21 +79,34 @@ extern const struct diag_l0 diag_l0_sim;
 
 const char *simfile_default=DB_FILE;	//default filename
 
+#define SIM_TWUP	50	//ms, ISO14230 fast init wake-up pattern
+#define SIM_T5BAUD	2000	//ms, 10 bits @ 5 baud
+#define SIM_W1MAX	300	//ms, max delay before the 5-baud init sync byte
 
-// ECU responses linked list:
-struct sim_ecu_response
-{
-	char *text; // unparsed text for the response!
-	uint8_t *data; // parsed final response.
-	uint8_t len; // final response length.
-	struct sim_ecu_response* next;
+struct sim_device;
+
+/** Per-ECU state */
+struct sim_ecu {
+	uint32_t state;		//current state, index in db->states[]
+	// Responses to the last request, still to be received : db->rp[rp_next ... rp_next + rp_left - 1]
+	unsigned rp_next;
+	unsigned rp_left;
+	unsigned long long t_ref;	//end of the request, or of this ECU's last response
 };
 
+/** Clock used for bus timing emulation. Times are in microseconds. */
+struct sim_clock {
+	const char *name;
+	unsigned long long (*now)(struct sim_device *dev);
+	void (*wait_until)(struct sim_device *dev, unsigned long long t);	//return once now() >= t
+};
+
+
 /* Internal state (struct diag_l0_device->l0_int) */
 struct sim_device
 {
 	int protocol;
-	FILE* fp; // DB file pointer.
+	struct simdb *db; // parsed + indexed DB file.
 	// Configuration variables.
 	// These affect the kind of flags we should return.
 	// This makes the simulator configurable towards using
@@ -95,9 +121,22 @@ struct sim_device
 	int	proto_restrict;	/* (optional) only accept connections matching this proto */
 
 	struct cfgi simfile;
+	struct cfgi simtiming;	//bool : emulate bus timing
+	struct cfgi simclock;	//int : clock speed for timing emulation, 0 = virtual
 
 	uint8_t sim_last_ecu_request[255];	// Copy of most recent request.
-	struct sim_ecu_response* sim_last_ecu_responses;	// For keeping all the responses to the last request.
+	struct sim_ecu *ecus;	// one per db->ecus[]
+	unsigned rp_left;	// total number of queued responses, all ECUs
+	uint8_t *rpcount;	// "cnt1" counters : number of times each db->rp[] was sent
+
+	/* timing emulation, if enabled */
+	bool timing;
+	const struct sim_clock *clock;
+	unsigned clk_scale;		//scaled clock : speed factor
+	unsigned long long clk_t0;	//scaled clock : hrt timestamp of time 0
+	unsigned long long vtime;	//virtual clock : current time
+	unsigned byte_us;		//time to transmit one byte
+	unsigned long long rp_due;	//bus busy until then : end of the request or of the last response
 };
 
 
@@ -124,399 +163,168 @@ static void sim_close(struct diag_l0_device *dl0d);
 /**************************************************/
 
 
-// Allocates one new ecu response and fills it with given text.
-struct sim_ecu_response*
-sim_new_ecu_response_txt(const char* text)
-{
-	struct sim_ecu_response *resp;
-	int rv;
-
-	if ((rv=diag_calloc(&resp, 1)))
-		return diag_pseterr(rv);
-
-	resp->data = NULL;
-	resp->len = 0;
-	resp->text = NULL;
-	resp->next = NULL;
-
-	if ((text != NULL) && strlen(text)) {
-		if ((rv=diag_calloc(&(resp->text), strlen(text)+1))) {
-			free(resp);
-			return diag_pseterr(rv);
-		}
+/** Timing emulation clocks **/
 
-		strncpy(resp->text, text, strlen(text));	//using strlen() defeats the purpose of strncpy ...
-	}
-
-	return resp;
+// scaled clock : real time, multiplied by clk_scale.
+static unsigned long long sim_scaled_now(struct sim_device *dev)
+{
+	return diag_os_hrtus(diag_os_gethrt() - dev->clk_t0) * dev->clk_scale;
 }
 
-// Allocates one new ecu response and fills it with given data.
-// (not used yet, here for "just in case")
-struct sim_ecu_response*
-sim_new_ecu_response_bin(const uint8_t* data, const uint8_t len)
+static void sim_scaled_wait(struct sim_device *dev, unsigned long long t)
 {
-	struct sim_ecu_response *resp;
-
-	if (diag_calloc(&resp, 1))
-		return diag_pseterr(DIAG_ERR_NOMEM);
-	resp->data = NULL;
-	resp->len = 0;
-	resp->text = NULL;
-	resp->next = NULL;
-
-	if ((len > 0) && (data != NULL)) {
-		if (diag_calloc(&resp->data, len)) {
-			free(resp);
-			return diag_pseterr(DIAG_ERR_NOMEM);
-		}
-		memcpy(resp->data, data, len);
-		resp->len = len;
+	while (1) {
+		unsigned long long now = sim_scaled_now(dev);
+		unsigned long long rem;
+
+		if (now >= t)
+			return;
+		rem = (t - now) / dev->clk_scale;
+		if (rem >= 1000)
+			diag_os_millisleep((unsigned int) (rem / 1000));
+		//else : spin for the sub-millisecond remainder
 	}
-
-	return resp;
 }
 
-// Frees an ecu response and returns the next one in the list.
-struct sim_ecu_response*
-sim_free_ecu_response(struct sim_ecu_response** resp)
+// virtual clock : only advances when waiting, without actually waiting.
+static unsigned long long sim_virtual_now(struct sim_device *dev)
 {
-	struct sim_ecu_response* next_resp = NULL;
-
-	if (resp && *resp) {
-
-		//get pointer to next one.
-		next_resp = (*resp)->next;
-
-		//free this one.
-		if ((*resp)->data)
-			free((*resp)->data);
-		if ((*resp)->text)
-			free((*resp)->text);
-		free(*resp);
-		*resp = NULL;
-	}
-
-	//return next one.
-	return next_resp;
+	return dev->vtime;
 }
 
-
-// Frees all responses from the given one until the end of the list.
-void sim_free_ecu_responses(struct sim_ecu_response** resp_pp)
+static void sim_virtual_wait(struct sim_device *dev, unsigned long long t)
 {
-	struct sim_ecu_response** temp_resp_pp = resp_pp;
-	uint8_t count = 0;
-
-	if ((resp_pp==NULL) || (*resp_pp==NULL))
-		return;
+	if (t > dev->vtime)
+		dev->vtime = t;
+}
 
-	while (*temp_resp_pp != NULL) {
-		*temp_resp_pp = sim_free_ecu_response(temp_resp_pp);
-		count++;
-	}
+static const struct sim_clock sim_clock_scaled = {"scaled", sim_scaled_now, sim_scaled_wait};
+static const struct sim_clock sim_clock_virtual = {"virtual", sim_virtual_now, sim_virtual_wait};
 
-	if (diag_l0_debug & DIAG_DEBUG_WRITE)
-		fprintf(stderr, FLFMT " %d responses freed from queue.\n", FL, count);
-	return;
+// let (ms) elapse on the simulated bus.
+static void sim_bus_wait(struct sim_device *dev, unsigned ms)
+{
+	dev->clock->wait_until(dev, dev->clock->now(dev) + ms * 1000ULL);
 }
 
-// for debug purposes.
-void sim_dump_ecu_responses(struct sim_ecu_response* resp_p)
+// bus time taken by a response.
+static unsigned long long sim_rp_duration(const struct sim_device *dev, const struct simdb_rp *rp)
 {
-	struct sim_ecu_response* tresp;
-	uint8_t count = 0;
+	unsigned long long d = (unsigned long long) rp->len * dev->byte_us;
 
-	LL_FOREACH(resp_p, tresp) {
-		fprintf(stderr, FLFMT "response #%d: %s", FL, count, tresp->text);
-		count++;
-	}
-
-	fprintf(stderr, FLFMT "%d responses in queue.\n", FL, count);
+	if (rp->len > 1)
+		d += (rp->len - 1) * rp->p1 * 1000ULL;
+	return d;
 }
 
 
-// Builds a list of responses for a request, by finding them in the DB file.
-void sim_find_responses(struct sim_ecu_response** resp_pp, FILE* fp, const uint8_t* data, const uint8_t len)
+// for debug purposes.
+static void sim_dump_ecu_responses(const struct sim_device *dev)
 {
-#define TAG_REQUEST "RQ"
-#define TAG_RESPONSE "RP"
-#define VALUE_DONTCARE "XXXX"
-#define REQBYTES	11	//number of request bytes analyzed
-
-	uint8_t resp_count = 0;
-	uint8_t new_resp_count = 0;
-	uint8_t synth_req[REQBYTES];
-	char line_buf[1280+1]; // 255 response bytes * 5 ("0xYY ") + tolerance for a token ("abc1 ") = 1280.
-	int end_responses = 0;
-	int request_found = 0;
-	struct sim_ecu_response *resp_p;
-
-
-	// walk to the end of the list (last valid item).
-	LL_FOREACH(*resp_pp, resp_p) {
-		resp_count++;
-	}
-
-	// go to the beginning of the DB file.
-	rewind(fp);
-
-	// search for the given request.
-	while (!request_found && !end_responses) {
-		// get a line from DB file.
-		if (fgets(line_buf, sizeof(line_buf), fp) == NULL)
-		{
-			// EOF reached.
-			break;
-		}
-		// ignore all lines except requests.
-		if (strncmp(line_buf, TAG_REQUEST, strlen(TAG_REQUEST)) != 0)
-			continue;
-		// synthesize up to 11 byte values from DB request line.
-		unsigned int i, num;
-		char *p, *q;
-		p = line_buf + 3;
-		for (i=0; i < REQBYTES; i++) {
-			while (isspace(*p))
-				p++;
-			if (*p == '\0')
-				break;
-			if (strncmp(p, VALUE_DONTCARE, strlen(VALUE_DONTCARE)) == 0) {
-				if (i < len)
-					synth_req[i] = data[i];
-				p += strlen(VALUE_DONTCARE);
-			} else {
-				synth_req[i] = (uint8_t)strtoul(p, &q, 16);
-				if (p == q)
-					break;
-				p = q;
-				if (!isspace(*p))
-					break;
-			}
-		}
-		num = i;
-		// compare given request with synthesized DB file request.
-		if (memcmp(data, synth_req, MIN(len, num)) == 0) {
-			// got a match, now cycle the following lines for responses.
-			request_found = 1;
-			while (!end_responses) {
-				// get a line from file.
-				if (fgets(line_buf, sizeof(line_buf), fp) == NULL) {
-					// EOF reached.
-					end_responses = 1;
-					break;
-				}
-				// ignore all lines except responses.
-				if (strncmp(line_buf, TAG_RESPONSE, strlen(TAG_RESPONSE)) != 0) {
-					// if it's another request, then end the list.
-					if (strncmp(line_buf, TAG_REQUEST, strlen(TAG_REQUEST)) == 0) {
-						end_responses = 1;
- 						break;
-					} else {
-						continue;
-					}
-				}
-				// add the new response (without the tag).
-				if (resp_count + new_resp_count == 0) {
-					// create the root of the list.
-					resp_p = *resp_pp = sim_new_ecu_response_txt(line_buf + strlen(TAG_RESPONSE) + 1);
-					if (!resp_p) {
-						fprintf(stderr, FLFMT "Could not add new response \"%s\"\n", FL, line_buf + strlen(TAG_RESPONSE) + 1);
-						end_responses=1;
-					}
-				} else {
-					// add to the end of the list.
-					resp_p->next = sim_new_ecu_response_txt(line_buf + strlen(TAG_RESPONSE) + 1);
-					if (!(resp_p->next)) {
-						fprintf(stderr, FLFMT "Could not add new response \"%s\"\n", FL, line_buf + strlen(TAG_RESPONSE) + 1);
-						end_responses=1;
-					}
-					resp_p = resp_p->next;
-				}
-				new_resp_count++;
-			}
+	unsigned e, i;
+
+	for (e = 0; e < dev->db->num_ecus; e++) {
+		const struct sim_ecu *q = &dev->ecus[e];
+		for (i = 0; i < q->rp_left; i++) {
+			fprintf(stderr, FLFMT "ECU \"%s\" response #%u: %s\n", FL,
+				SIMDB_NAME(dev->db, &dev->db->ecus[e]), i,
+				SIMDB_RPTEXT(dev->db, &dev->db->rp[q->rp_next + i]));
 		}
 	}
 
-	if (diag_l0_debug & DIAG_DEBUG_DATA)
-		fprintf(stderr, FLFMT "%d responses queued for receive, %d new.\n", FL, resp_count+new_resp_count, new_resp_count);
+	fprintf(stderr, FLFMT "%u responses in queue.\n", FL, dev->rp_left);
 }
 
 
-// Returns a value between 0x00 and 0xFF calculated as the trigonometric
-// sine of the current system time (with a period of one second).
-uint8_t sine1(UNUSED(uint8_t *data), UNUSED(uint8_t pos))
+// Drop all queued responses.
+static void sim_flush_responses(struct sim_device *dev)
 {
-	unsigned long now=diag_os_getms();
-	//sin() returns a float between -1.0 and 1.0
-	return (uint8_t) (0x7F * sin(now * 6.283185 / 1000));
-}
+	unsigned e;
 
-// Returns a value between 0x00 and 0xFF directly proportional
-// to the value of the current system time (with a period of one second).
-uint8_t sawtooth1(UNUSED(uint8_t *data), UNUSED(uint8_t pos))
-{
-	unsigned long now=diag_os_getms();
-	return (uint8_t) (0xFF * (now % 1000));
+	for (e = 0; e < dev->db->num_ecus; e++) {
+		dev->ecus[e].rp_left = 0;
+	}
+	dev->rp_left = 0;
 }
 
-// Returns a value copied from the specified position in the request.
-uint8_t requestbyten(UNUSED(uint8_t *data), char *s, uint8_t req[])
-{
-	int index;
-	bool increment = 0;
-	bool bogus = 0;
-	uint8_t value;
-	char *p;
-
-	index = (uint8_t)strtoul(s, &p, 10);
-	if (*s == '\0') {
-		bogus = 1;
-	} else if (p[0]=='+' && p[1]=='\0') {
-		increment = 1;
-	} else if (*p != '\0') {
-		bogus = 1;
-	}
 
-	index--;
-	if (index<0 || index>254)
-		bogus = 1;
+// Put every ECU back in its initial state.
+static void sim_reset_states(struct sim_device *dev)
+{
+	unsigned e;
 
-	if (bogus) {
-		fprintf(stderr, FLFMT "Invalid req* token in response\n", FL);
-		return 0;
+	for (e = 0; e < dev->db->num_ecus; e++) {
+		dev->ecus[e].state = dev->db->ecus[e].state0;
 	}
-
-	value = req[index];
-	if (increment)
-		value++;
-	return value;
 }
 
-// Parses a response's text to data.
-// Replaces special tokens with function results. This mangles resp_p->text, which shouldn't be a problem
-void sim_parse_response(struct sim_ecu_response* resp_p, uint8_t req[])
+
+// Queues the responses of every ECU for a request, by looking them up
+// in the index of each ECU's current state; applies state transitions.
+static void sim_find_responses(struct sim_device *dev, const uint8_t* data, const uint8_t len)
 {
-#define TOKEN_SINE1	 "sin1"
-#define TOKEN_SAWTOOTH1 "swt1"
-#define TOKEN_ISO9141CS "cks1"
-#define TOKEN_REQUESTBYTE "req"
-#define SRESP_SIZE 255
-
-	uint8_t synth_resp[SRESP_SIZE];	// 255 response bytes.
-	char *cur_tok = NULL;		//current token
-	char *rptr = resp_p->text;	//working copy of the ptr. We will mangle resp_p->text
-	int ret;
-	int pos = 0;
+	const struct simdb *db = dev->db;
+	unsigned e;
+
+	dev->rp_left = 0;
+	for (e = 0; e < db->num_ecus; e++) {
+		struct sim_ecu *q = &dev->ecus[e];
+		const struct simdb_rq *rq;
 
-	// extract byte values from response line, splitting tokens at whitespace / EOL.
-	while ((cur_tok = strtok(rptr, " \t\r\n")) != NULL) {
-		if (pos == 0xff) {
-			fprintf(stderr, "Malformed db file, > 255 bytes on one line !");
-			break;
+		rq = simdb_find(db, q->state, data, len);
+		if (rq == NULL) {
+			q->rp_left = 0;
+			continue;
 		}
-		// try replacing a token with a calculated value.
-		if (strcmp(cur_tok, TOKEN_SINE1) == 0)
-			synth_resp[pos] = sine1(synth_resp, pos);
-		else if (strcmp(cur_tok, TOKEN_SAWTOOTH1) == 0)
-			synth_resp[pos] = sawtooth1(synth_resp, pos);
-		else if (strcmp(cur_tok, TOKEN_ISO9141CS) == 0)
-			synth_resp[pos] = diag_cks1(synth_resp, pos);
-		else if (strncmp(cur_tok, TOKEN_REQUESTBYTE, strlen(TOKEN_REQUESTBYTE)) == 0)
-			synth_resp[pos] = requestbyten(synth_resp, cur_tok + strlen(TOKEN_REQUESTBYTE), req);
-		else {
-			// failed. try scanning element as an Hex byte.
-			unsigned int tempbyte;
-			ret = sscanf(cur_tok, "%X", &tempbyte);	//can't scan direct to uint8 !
-			if (ret != 1) {
-				fprintf(stderr, FLFMT "Error parsing line: %s at position %d.\n", FL, resp_p->text, pos*5);
-				break;
+		q->rp_next = rq->rp_first;
+		q->rp_left = rq->rp_num;
+		q->t_ref = dev->rp_due;
+		dev->rp_left += rq->rp_num;
+
+		if (rq->next_state != SIMDB_NONE) {
+			if (diag_l0_debug & DIAG_DEBUG_DATA) {
+				fprintf(stderr, FLFMT "ECU \"%s\": state \"%s\" -> \"%s\"\n", FL,
+					SIMDB_NAME(db, &db->ecus[e]), SIMDB_NAME(db, &db->states[q->state]),
+					SIMDB_NAME(db, &db->states[rq->next_state]));
 			}
-			synth_resp[pos] = (uint8_t) tempbyte;
+			q->state = rq->next_state;
 		}
-		pos++;
-		rptr = NULL;	//strtok: continue parsing
 	}
 
-	// copy to user.
-	if (diag_calloc(&(resp_p->data),pos)) {
-		fprintf(stderr, FLFMT "Error parsing response\n", FL);
-		return;
-	}
-	memcpy(resp_p->data, synth_resp, pos);
-	resp_p->len = pos;
+	if (diag_l0_debug & DIAG_DEBUG_DATA)
+		fprintf(stderr, FLFMT "%u responses queued for receive.\n", FL, dev->rp_left);
 }
 
-// Reads the configuration options from the file.
-// Stores them in globals.
-void sim_read_cfg(struct sim_device *dev)
+
+// Find the ECU whose next response starts first on the bus : P2 after its
+// own reference time, and not before the bus is free. Ties go to the first ECU.
+// @return NULL if no responses are queued; *start is set otherwise.
+static struct sim_ecu *sim_next_ecu(struct sim_device *dev, unsigned long long *start)
 {
-	FILE *fp = dev->fp;
-	char *p; // temp string pointer.
-	char line_buf[21]; // 20 chars generally enough for a config token.
-
-#define TAG_CFG "CFG"
-#define CFG_DATAONLY "DATAONLY"
-#define CFG_NOL2CKSUM "NOL2CKSUM"
-#define CFG_FRAMED "FRAMED"
-#define CFG_FULLINIT "FULLINIT"
-#define CFG_P9141	"P_9141"
-#define CFG_P14230	"P_14230"
-#define CFG_P1850P	"P_J1850P"
-#define CFG_P1850V	"P_J1850V"
-#define CFG_PCAN	"P_CAN"
-#define CFG_PRAW	"P_RAW"
-
-	dev->dataonly = 0;
-	dev->nocksum = 0;
-	dev->fullinit = 0;
-	dev->proto_restrict = 0;
-
-	// search for all config lines.
-	while (1) {
-		// get a line from DB file.
-		if (fgets(line_buf, 20, fp) == NULL) {
-			// EOF reached.
-			break;
-		}
-		// ignore all lines except configs.
-		if (strncmp(line_buf, TAG_CFG, strlen(TAG_CFG)) != 0)
-			continue;
-		// get the config values.
-		p = line_buf + strlen(TAG_CFG) + 1;
+	struct sim_ecu *best = NULL;
+	unsigned e;
 
-		if (strncmp(p, CFG_DATAONLY, strlen(CFG_DATAONLY)) == 0) {
-			dev->dataonly = 1;
-			continue;
-		} else if (strncmp(p, CFG_NOL2CKSUM, strlen(CFG_NOL2CKSUM)) == 0) {
-			dev->nocksum = 1;
-			continue;
-		} else if (strncmp(p, CFG_FRAMED, strlen(CFG_FRAMED)) == 0) {
-			dev->framed = 1;
-		} else if (strncmp(p, CFG_FULLINIT, strlen(CFG_FULLINIT)) == 0) {
-			dev->fullinit = 1;
-		} else if (strncmp(p, CFG_P9141, strlen(CFG_P9141)) == 0) {
-			dev->proto_restrict=DIAG_L1_ISO9141;
-			continue;
-		} else if (strncmp(p, CFG_P14230, strlen(CFG_P14230)) == 0) {
-			dev->proto_restrict=DIAG_L1_ISO14230;
-			continue;
-		} else if (strncmp(p, CFG_P1850P, strlen(CFG_P1850P)) == 0) {
-			dev->proto_restrict=DIAG_L1_J1850_PWM;
-			continue;
-		} else if (strncmp(p, CFG_P1850V, strlen(CFG_P1850V)) == 0) {
-			dev->proto_restrict=DIAG_L1_J1850_VPW;
-			continue;
-		} else if (strncmp(p, CFG_PCAN, strlen(CFG_PCAN)) == 0) {
-			dev->proto_restrict=DIAG_L1_CAN;
-			continue;
-		} else if (strncmp(p, CFG_PRAW, strlen(CFG_PRAW)) == 0) {
-			dev->proto_restrict=DIAG_L1_RAW;
+	if (dev->rp_left == 0)
+		return NULL;
+
+	for (e = 0; e < dev->db->num_ecus; e++) {
+		struct sim_ecu *q = &dev->ecus[e];
+		unsigned long long t;
+
+		if (q->rp_left == 0)
 			continue;
+		t = q->t_ref + dev->db->rp[q->rp_next].p2 * 1000ULL;
+		if (t < dev->rp_due)
+			t = dev->rp_due;
+		if (!best || (t < *start)) {
+			best = q;
+			*start = t;
 		}
 	}
+	return best;
 }
 
+
 /**************************************************/
 // INTERFACE FUNCTIONS:
 /**************************************************/
@@ -547,7 +355,20 @@ sim_new(struct diag_l0_device *dl0d) {
 		free(dev);
 		return diag_iseterr(DIAG_ERR_GENERAL);
 	}
-	dev->simfile.next = NULL;	//mark as first/only/last item in the list
+	if (diag_cfgn_bool(&dev->simtiming, 0, 0) ||
+		diag_cfgn_int(&dev->simclock, 1, 1)) {
+		diag_cfg_clear(&dev->simfile);
+		free(dev);
+		return diag_iseterr(DIAG_ERR_GENERAL);
+	}
+	dev->simtiming.shortname = "simtiming";
+	dev->simtiming.descr = "Emulate bus timing (baud rate, P1, P2 from the simulation file)";
+	dev->simclock.shortname = "simclock";
+	dev->simclock.descr = "Timing emulation clock : 1 = real time, N = N times faster, 0 = virtual (no waiting)";
+
+	dev->simfile.next = &dev->simtiming;
+	dev->simtiming.next = &dev->simclock;
+	dev->simclock.next = NULL;
 	return 0;
 }
 
@@ -563,6 +384,8 @@ sim_del(struct diag_l0_device * dl0d) {
 	if (!dev) return;
 
 	diag_cfg_clear(&dev->simfile);
+	diag_cfg_clear(&dev->simtiming);
+	diag_cfg_clear(&dev->simclock);
 	free(dev);
 
 	return;
@@ -584,18 +407,48 @@ sim_open(struct diag_l0_device *dl0d, int iProtocol)
 		fprintf(stderr, FLFMT "open simfile %s proto=%d\n", FL, simfile, iProtocol);
 
 	dev->protocol = iProtocol;
-	dev->sim_last_ecu_responses = NULL;
 
-	// Open the DB file:
-	if ((dev->fp = fopen(simfile, "r")) == NULL) {
-		fprintf(stderr, FLFMT "Unable to open file \"%s\": ", FL, simfile);
+	// Parse + index the DB file:
+	if ((dev->db = simdb_load(simfile)) == NULL) {
+		fprintf(stderr, FLFMT "Unable to load file \"%s\"\n", FL, simfile);
 		return diag_iseterr(DIAG_ERR_GENERAL);
 	}
 
-	rewind(dev->fp);
+	if (diag_calloc(&dev->ecus, dev->db->num_ecus) ||
+		diag_calloc(&dev->rpcount, dev->db->num_rp + 1)) {
+		free(dev->ecus);
+		dev->ecus = NULL;
+		simdb_free(dev->db);
+		dev->db = NULL;
+		return diag_iseterr(DIAG_ERR_NOMEM);
+	}
+	sim_reset_states(dev);
+	dev->rp_left = 0;
+
+	// Configuration flags from the db file:
+	dev->dataonly = dev->db->dataonly;
+	dev->nocksum = dev->db->nocksum;
+	dev->framed = dev->db->framed;
+	dev->fullinit = dev->db->fullinit;
+	dev->proto_restrict = dev->db->proto_restrict;
+
+	// Timing emulation:
+	dev->timing = dev->simtiming.val.b && !dev->fullinit;
+	if (dev->simclock.val.i > 0) {
+		dev->clock = &sim_clock_scaled;
+		dev->clk_scale = (unsigned) dev->simclock.val.i;
+		dev->clk_t0 = diag_os_gethrt();
+	} else {
+		dev->clock = &sim_clock_virtual;
+		dev->vtime = 0;
+	}
+	dev->byte_us = (unsigned) (10 * 1000000ULL / dev->db->baud);
+	dev->rp_due = 0;
 
-	// Read the configuration flags from the db file:
-	sim_read_cfg(dev);
+	if ((diag_l0_debug & DIAG_DEBUG_OPEN) && dev->timing) {
+		fprintf(stderr, FLFMT "timing emulation: %u baud, %s clock x%d\n", FL,
+			dev->db->baud, dev->clock->name, dev->simclock.val.i);
+	}
 
 	/* if a specific proto was set, refuse a mismatched connection */
 	if (dev->proto_restrict) {
@@ -621,17 +474,22 @@ sim_close(struct diag_l0_device *dl0d)
 	assert(dev != NULL);
 
 	// If debugging, print to stderr.
-	if (diag_l0_debug & DIAG_DEBUG_CLOSE)
+	if (diag_l0_debug & DIAG_DEBUG_CLOSE) {
 		fprintf(stderr, FLFMT "dl0d=%p closing simfile\n", FL,
 			(void *)dl0d);
+		if (dev->timing)
+			fprintf(stderr, FLFMT "%s clock: %llu us of bus time\n", FL,
+				dev->clock->name, dev->clock->now(dev));
+	}
 
-	sim_free_ecu_responses(&dev->sim_last_ecu_responses);
-
+	dev->rp_left = 0;
+	free(dev->ecus);
+	dev->ecus = NULL;
+	free(dev->rpcount);
+	dev->rpcount = NULL;
 
-	if (dev->fp != NULL) {
-		fclose(dev->fp);
-		dev->fp = NULL;
-	}
+	simdb_free(dev->db);
+	dev->db = NULL;
 
 	dl0d->opened = 0;
 	return;
@@ -648,14 +506,15 @@ sim_initbus(struct diag_l0_device *dl0d, struct diag_l1_initbus_args *in)
 
 	dev = (struct sim_device *)dl0d->l0_int;
 
-	sim_free_ecu_responses(&dev->sim_last_ecu_responses);
-
 	if (diag_l0_debug & DIAG_DEBUG_IOCTL)
 		fprintf(stderr, FLFMT "device link %p info %p initbus type %d\n", FL, (void *)dl0d, (void *)dev, in->type);
 
 	if (!dev)
 		return diag_iseterr(DIAG_ERR_INIT_NOTSUPP);
 
+	sim_flush_responses(dev);
+	sim_reset_states(dev);
+
 	if (dev->fullinit)
 		return 0;
 
@@ -665,13 +524,17 @@ sim_initbus(struct diag_l0_device *dl0d, struct diag_l1_initbus_args *in)
 		// We simulate a break with a single "0x00" char.
 		if (diag_l0_debug & DIAG_DEBUG_DATA)
 			fprintf(stderr, FLFMT "Sending: BREAK!\n", FL);
+		if (dev->timing)
+			sim_bus_wait(dev, SIM_TWUP);
 		sim_send(dl0d, 0, &sim_break, 1);
 		break;
 	case DIAG_L1_INITBUS_5BAUD:
 		// Send Service Address (as if it was at 5baud).
+		if (dev->timing)
+			sim_bus_wait(dev, SIM_T5BAUD);
 		sim_send(dl0d, 0, &in->addr, 1);
 		// Receive Synch Pattern (as if it was at 10.4kbaud).
-		sim_recv(dl0d, 0 , synch_patt, 1, 0);
+		sim_recv(dl0d, 0 , synch_patt, 1, dev->timing? SIM_W1MAX : 0);
 		break;
 	default:
 		return diag_iseterr(DIAG_ERR_INIT_NOTSUPP);
@@ -702,9 +565,15 @@ sim_send(struct diag_l0_device *dl0d,
 		return diag_iseterr(DIAG_ERR_GENERAL);
 	}
 
-	if (dev->sim_last_ecu_responses != NULL) {
-		fprintf(stderr, FLFMT "AAAHHH!!! You're sending a new request before reading all previous responses!!! \n", FL);
-		return diag_iseterr(DIAG_ERR_GENERAL);
+	if (dev->rp_left) {
+		if (!dev->timing) {
+			fprintf(stderr, FLFMT "AAAHHH!!! You're sending a new request before reading all previous responses!!! \n", FL);
+			return diag_iseterr(DIAG_ERR_GENERAL);
+		}
+		// late responses : they would have been lost on a real bus.
+		if (diag_l0_debug & DIAG_DEBUG_WRITE)
+			fprintf(stderr, FLFMT "dropping %u unread responses\n", FL, dev->rp_left);
+		sim_flush_responses(dev);
 	}
 
 	if (diag_l0_debug & DIAG_DEBUG_WRITE) {
@@ -716,19 +585,49 @@ sim_send(struct diag_l0_device *dl0d,
 		}
 	}
 
+	// Request goes out on the bus; responses are timed from its end.
+	// Without timing emulation, this only orders the responses of several ECUs.
+	if (dev->timing) {
+		dev->rp_due = dev->clock->now(dev) + len * dev->byte_us;
+		dev->clock->wait_until(dev, dev->rp_due);
+	} else {
+		dev->rp_due = 0;
+	}
+
 	// Store a copy of this request for use by req* function tokens.
 	memcpy(dev->sim_last_ecu_request, data, len);
 
 	// Build the list of responses for this request.
-	sim_find_responses(&dev->sim_last_ecu_responses, dev->fp, data, (uint8_t) len);
+	sim_find_responses(dev, data, (uint8_t) len);
 
 	if (diag_l0_debug & DIAG_DEBUG_DATA)
-		sim_dump_ecu_responses(dev->sim_last_ecu_responses);
+		sim_dump_ecu_responses(dev);
 
 	return 0;
 }
 
 
+// Timing emulation for sim_recv : wait until the next response (from ECU q,
+// starting at (start)) is complete on the bus, or until the timeout.
+// Responses are delivered as whole frames.
+// @return 0 if a response is ready, DIAG_ERR_TIMEOUT otherwise.
+static int sim_recv_wait(struct sim_device *dev, const struct sim_ecu *q,
+		unsigned long long start, unsigned int timeout)
+{
+	unsigned long long deadline;
+
+	deadline = dev->clock->now(dev) + timeout * 1000ULL;
+
+	if (!q || (start > deadline)) {
+		// nothing queued, or not even started yet : stays queued.
+		dev->clock->wait_until(dev, deadline);
+		return DIAG_ERR_TIMEOUT;
+	}
+
+	dev->clock->wait_until(dev, start + sim_rp_duration(dev, &dev->db->rp[q->rp_next]));
+	return 0;
+}
+
 // Gets present ECU response from the prepared list.
 // Returns ECU response with parsed data (if applicable).
 // Returns number of bytes read.
@@ -738,8 +637,9 @@ sim_recv(struct diag_l0_device *dl0d,
 		void *data, size_t len, unsigned int timeout)
 {
 	size_t xferd;
-	struct sim_ecu_response* resp_p = NULL;
 	struct sim_device * dev = dl0d->l0_int;
+	struct sim_ecu *q;
+	unsigned long long start = 0;
 
 	if (!len)
 		return diag_iseterr(DIAG_ERR_BADLEN);
@@ -748,16 +648,34 @@ sim_recv(struct diag_l0_device *dl0d,
 			FLFMT "link %p recv upto %ld bytes timeout %u\n",
 			FL, (void *)dl0d, (long)len, timeout);
 
-	// "Receive from the ECU" a response.
-	resp_p = dev->sim_last_ecu_responses;
-	if (resp_p != NULL) {
-		// Parse the response (replace simulated values if needed).
-		sim_parse_response(resp_p, dev->sim_last_ecu_request);
-		// Copy to client.
-		xferd = MIN(resp_p->len, len);
-		memcpy(data, resp_p->data, xferd);
-		// Free the present response in the list (and walk to the next one).
-		dev->sim_last_ecu_responses = sim_free_ecu_response(&dev->sim_last_ecu_responses);
+	q = sim_next_ecu(dev, &start);
+
+	if (dev->timing && sim_recv_wait(dev, q, start, timeout)) {
+		// nothing (yet) within the timeout
+		xferd = 0;
+		memset(data, 0, len);
+	} else if (q) {
+		// "Receive from the ECU" a response.
+		const struct simdb_rp *rp = &dev->db->rp[q->rp_next];
+		uint8_t count = dev->rpcount[q->rp_next]++;
+
+		// Generate the response (replace simulated values if needed),
+		// straight into the caller's buffer if it's large enough.
+		if (rp->len <= len) {
+			xferd = simdb_run(dev->db, rp, dev->sim_last_ecu_request, count, data);
+		} else {
+			uint8_t synth_resp[SIMDB_RPMAX];
+			xferd = simdb_run(dev->db, rp, dev->sim_last_ecu_request, count, synth_resp);
+			xferd = MIN(xferd, len);
+			memcpy(data, synth_resp, xferd);
+		}
+		// the bus is busy until the end of this response.
+		dev->rp_due = start + sim_rp_duration(dev, rp);
+		q->t_ref = dev->rp_due;
+		// walk to the next one.
+		q->rp_next++;
+		q->rp_left--;
+		dev->rp_left--;
 	} else {
 		// Nothing to receive, simulate timeout on return.
 		xferd = 0;
@@ -855,5 +773,6 @@ const struct diag_l0 diag_l0_sim =
 	sim_getflags,
 	sim_recv,
 	sim_send,
-	sim_ioctl
+	sim_ioctl,
+	NULL	//_sendv : see diag_l0_sendv()
 };
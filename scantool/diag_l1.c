@@ -129,8 +129,92 @@ int diag_l1_ioctl(struct diag_l0_device *dl0d, unsigned cmd, void *data) {
 }
 
 
+//I/O statistics, see diag_l0_stats_on
+#define L1_STATS_ECHOERR(dl0d) do { \
+		if (diag_l0_stats_on) \
+			(dl0d)->stats.echo_errors++; \
+	} while (0)
+
+//frame sent : start timing the response
+static void l1_stats_sent(struct diag_l0_device *dl0d) {
+	if (!diag_l0_stats_on)
+		return;
+	dl0d->stats.tx_frames++;
+	dl0d->stats.t_sent = diag_os_gethrt();
+}
+
+/*
+ * Byte-by-byte half duplex send, pipelined : byte i is sent at
+ * t0 + i * (byte time + P4) without waiting for the previous echo; echoes
+ * are collected in the gaps between sends, and the first bad one aborts.
+ * The byte time comes from the last DIAG_IOCTL_SETSPEED.
+ *
+ * Returns 0 on success, or an error code (not diag_iseterr()'d)
+ */
+static int
+l1_send_pipelined(struct diag_l0_device *dl0d, const char *subinterface,
+		const uint8_t *dp, size_t len, unsigned int p4)
+{
+	uint8_t echo[MAXRBUF];
+	unsigned long slot = dl0d->byte_us + p4 * 1000UL;	//us
+	unsigned long long t0;
+	size_t sent, rxd = 0;
+	int rv;
+
+	t0 = diag_os_gethrt();
+	for (sent = 0; sent < len; sent++) {
+		unsigned long long next;	//us after t0 : time for the next byte
+
+		if (sent)
+			diag_os_hrtwait(t0, sent * slot);
+		rv = diag_l0_send(dl0d, subinterface, &dp[sent], 1);
+		if (rv != 0)
+			return rv;
+
+		//check echoes received so far, without going past the next slot
+		next = (sent + 1) * slot;
+		while (rxd <= sent) {
+			unsigned long long now = diag_os_hrtus(diag_os_gethrt() - t0);
+			unsigned int tout;
+
+			if (sent + 1 == len)
+				tout = 200;	//last byte : wait for the remaining echoes
+			else if (now + 1000 <= next)
+				tout = (unsigned int) ((next - now) / 1000);
+			else
+				break;
+
+			rv = diag_l0_recv(dl0d, NULL, &echo[rxd], sent + 1 - rxd, tout);
+			if (rv == DIAG_ERR_TIMEOUT) {
+				if (sent + 1 == len)
+					break;
+				continue;
+			}
+			if (rv <= 0)
+				return DIAG_ERR_GENERAL;
+
+			for (; rv > 0; rv--, rxd++) {
+				if (echo[rxd] != dp[rxd]) {
+					fprintf(stderr, "Bus Error: got 0x%X expected 0x%X\n",
+						echo[rxd], dp[rxd]);
+					L1_STATS_ECHOERR(dl0d);
+					return DIAG_ERR_BUSERROR;
+				}
+			}
+		}
+	}
+
+	if (rxd != len) {
+		if (rxd == 0)
+			fprintf(stderr, "Half duplex interface not echoing!\n");
+		L1_STATS_ECHOERR(dl0d);
+		return DIAG_ERR_GENERAL;
+	}
+	return 0;
+}
+
 /*
- * Send a load of data
+ * Send a load of data, gathered from (iovcnt) segments
  *
  * P4 is the inter byte gap
  *
@@ -141,13 +225,19 @@ int diag_l1_ioctl(struct diag_l0_device *dl0d, unsigned cmd, void *data) {
  * Returns 0 on success
  */
 int
-diag_l1_send(struct diag_l0_device *dl0d, const char *subinterface, const void *data, size_t len, unsigned int p4)
+diag_l1_sendv(struct diag_l0_device *dl0d, const char *subinterface,
+		const struct diag_iov *iov, unsigned int iovcnt, unsigned int p4)
 {
 	int rv = DIAG_ERR_GENERAL;
 	uint32_t l0flags;
 	uint8_t duplexbuf[MAXRBUF];
+	size_t len = 0;
+	unsigned int i;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].len;
 
-	if (len > MAXRBUF)
+	if ((iovcnt == 0) || (len > MAXRBUF))
 		return diag_iseterr(DIAG_ERR_BADLEN);
 
 	l0flags = diag_l1_getflags(dl0d);
@@ -156,7 +246,8 @@ diag_l1_send(struct diag_l0_device *dl0d, const char *subinterface, const void *
 		fprintf(stderr, FLFMT "_send: len=%d P4=%u l0flags=0x%X; ", FL,
 				(int) len, p4, l0flags);
 		if (diag_l1_debug & DIAG_DEBUG_DATA) {
-			diag_data_dump(stderr, data, len);
+			for (i = 0; i < iovcnt; i++)
+				diag_data_dump(stderr, iov[i].data, iov[i].len);
 		}
 		fprintf(stderr, "\n");
 	}
@@ -174,26 +265,52 @@ diag_l1_send(struct diag_l0_device *dl0d, const char *subinterface, const void *
 		/*
 		 * Send the lot
 		 */
-		rv = diag_l0_send(dl0d, subinterface, data, len);
+		rv = diag_l0_sendv(dl0d, subinterface, iov, iovcnt);
 
 		//optionally remove echos
 		if ((l0flags & DIAG_L1_BLOCKDUPLEX) && (rv==0)) {
+			size_t offset = 0;
+
 			//try to read the same number of sent bytes; timeout=300ms + 1ms/byte
 			//This is plenty OK for typical 10.4kbps but should be changed
 			//if ever slow speeds are used.
 			if (diag_l0_recv(dl0d, NULL, duplexbuf, len, 300+len) != (int) len) {
+				L1_STATS_ECHOERR(dl0d);
 				rv=DIAG_ERR_GENERAL;
 			}
 
 			//compare to sent bytes
-			if ( memcmp(duplexbuf, data, len) !=0) {
-				fprintf(stderr,FLFMT "Bus Error: bad half duplex echo!\n", FL);
-				rv=DIAG_ERR_BUSERROR;
+			for (i = 0; i < iovcnt; i++) {
+				if (memcmp(&duplexbuf[offset], iov[i].data, iov[i].len) != 0) {
+					fprintf(stderr,FLFMT "Bus Error: bad half duplex echo!\n", FL);
+					if (rv == 0)
+						L1_STATS_ECHOERR(dl0d);
+					rv=DIAG_ERR_BUSERROR;
+					break;
+				}
+				offset += iov[i].len;
 			}
 		}
 	} else {
-		/* else: send each byte */
-		const uint8_t *dp = (const uint8_t *)data;
+		/* else: send each byte, from one contiguous buffer */
+		uint8_t txbuf[MAXRBUF];
+		const uint8_t *dp = (const uint8_t *)iov[0].data;
+
+		if (iovcnt > 1) {
+			size_t offset = 0;
+			for (i = 0; i < iovcnt; i++) {
+				memcpy(&txbuf[offset], iov[i].data, iov[i].len);
+				offset += iov[i].len;
+			}
+			dp = txbuf;
+		}
+
+		if ((l0flags & DIAG_L1_HALFDUPLEX) && dl0d->byte_us) {
+			rv = l1_send_pipelined(dl0d, subinterface, dp, len, p4);
+			if (rv == 0)
+				l1_stats_sent(dl0d);
+			return rv? diag_iseterr(rv):0;
+		}
 
 		while (len--) {
 			rv = diag_l0_send(dl0d, subinterface, dp, 1);
@@ -211,6 +328,7 @@ diag_l1_send(struct diag_l0_device *dl0d, const char *subinterface, const void *
 
 				c = *dp - 1; /* set it with wrong val. */
 				if (diag_l0_recv(dl0d, NULL, &c, 1, 200) != 1) {
+					L1_STATS_ECHOERR(dl0d);
 					rv=DIAG_ERR_GENERAL;
 					break;
 				}
@@ -221,6 +339,7 @@ diag_l1_send(struct diag_l0_device *dl0d, const char *subinterface, const void *
 					else
 						fprintf(stderr,"Bus Error: got 0x%X expected 0x%X\n",
 							c, *dp);
+					L1_STATS_ECHOERR(dl0d);
 					rv = DIAG_ERR_BUSERROR;
 					break;
 				}
@@ -228,13 +347,25 @@ diag_l1_send(struct diag_l0_device *dl0d, const char *subinterface, const void *
 			dp++;
 
 			if (p4)	/* Inter byte gap */
-				diag_os_millisleep(p4);
+				diag_os_hrtwait(diag_os_gethrt(), p4 * 1000);
 		}
 	}
 
+	if (rv == 0)
+		l1_stats_sent(dl0d);
 	return rv? diag_iseterr(rv):0;
 }
 
+int
+diag_l1_send(struct diag_l0_device *dl0d, const char *subinterface, const void *data, size_t len, unsigned int p4)
+{
+	struct diag_iov iov;
+
+	iov.data = data;
+	iov.len = len;
+	return diag_l1_sendv(dl0d, subinterface, &iov, 1, p4);
+}
+
 /*
  * Get data (blocking, unless timeout is 0)
  * returns # of bytes read, or <0 if error.
@@ -262,6 +393,16 @@ diag_l1_recv(struct diag_l0_device *dl0d,
 		return DIAG_ERR_TIMEOUT;
 	}
 
+	if ((rv > 0) && diag_l0_stats_on) {
+		struct diag_l0_stats *st = &dl0d->stats;
+
+		st->rx_frames++;
+		if (st->t_sent) {
+			diag_l0_stats_hist(st->rsp_lat, diag_os_hrtus(diag_os_gethrt() - st->t_sent));
+			st->t_sent = 0;
+		}
+	}
+
 	if ((rv>0) &&
 			(diag_l1_debug & DIAG_DEBUG_DATA) && (diag_l1_debug & DIAG_DEBUG_READ)) {
 		fprintf(stderr, "got %d bytes, ",rv);
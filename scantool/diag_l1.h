@@ -218,6 +218,14 @@ void diag_l1_close(struct diag_l0_device *);
  */
 int diag_l1_send(struct diag_l0_device *, const char *subinterface, const void *data, size_t len, unsigned int p4);
 
+/** Send data gathered from several segments, as one message.
+ *
+ * Same as diag_l1_send() with the concatenation of iov[0..iovcnt-1].
+ * @return 0 if ok
+ */
+int diag_l1_sendv(struct diag_l0_device *, const char *subinterface,
+	const struct diag_iov *iov, unsigned int iovcnt, unsigned int p4);
+
 /** Receive data.
  *
  * @return # of bytes read, DIAG_ERR_TIMEOUT or \<0 if failed. DIAG_ERR_TIMEOUT is not a hard failure
@@ -92,54 +92,52 @@ static int diag_l2_rmconn(struct diag_l2_conn *dl2c)
 	return 0;
 }
 
+#define L2_KA_RETRY	10	//ms; retry delay if connlist_mtx is busy
+
 /*
- * Called regularly to check timeouts etc (call at least once per
- * second)
- * Note: This is called from a signal handler.
- *
- * XXX Uses functions not async-signal-safe.
- * This parses through the l2internal.dl2conn_list linked-list and
- * calls the  ->diag_l2_proto_timeout function for every dl2conn
- * that has expired.
- *
- * In order for this to work well, all L2
+ * Keepalive timer handler (see diag_timer.h), one per L2 connection.
+ * Calls ->diag_l2_proto_timeout if nothing was sent or received
+ * for tinterval ms, otherwise reschedules itself to tlast + tinterval.
  */
-void
-diag_l2_timer(void)
+static unsigned long
+diag_l2_katimer(void *arg, unsigned long now)
 {
-	struct diag_l2_conn	*d_l2_conn;
-
-	unsigned long now;
+	struct diag_l2_conn *d_l2_conn = arg;
+	unsigned long next;
 
-	if (!diag_os_trylock(l2internal.connlist_mtx)) return;
+	/* connection list is being modified; try again shortly */
+	if (!diag_os_trylock(l2internal.connlist_mtx))
+		return now + L2_KA_RETRY;
 
-	now=diag_os_getms();	/* XXX probably Not async safe */
-
-	LL_FOREACH(l2internal.dl2conn_list, d_l2_conn) {
-		int expired = 0;
-
-		/*
-		 * If in monitor mode, or the connection isn't open,
-		 * or L1 does the keepalive, do nothing
-		 */
-		if (((d_l2_conn->diag_l2_type & DIAG_L2_TYPE_INITMASK) ==DIAG_L2_TYPE_MONINIT) ||
-				(d_l2_conn->diag_l2_state != DIAG_L2_STATE_OPEN) ||
-				(d_l2_conn->diag_link->l1flags & DIAG_L1_DOESKEEPALIVE)) {
-			continue;
-		}
-
-		/* Check the send timers vs requested expiry time */
+	/*
+	 * If in monitor mode, or L1 does the keepalive, do nothing;
+	 * if the connection isn't open (yet), check again later.
+	 */
+	if (((d_l2_conn->diag_l2_type & DIAG_L2_TYPE_INITMASK) ==DIAG_L2_TYPE_MONINIT) ||
+			(d_l2_conn->diag_link->l1flags & DIAG_L1_DOESKEEPALIVE) ||
+			!d_l2_conn->l2proto->diag_l2_proto_timeout) {
+		diag_os_unlock(l2internal.connlist_mtx);
+		return DIAG_TIMER_NONE;
+	}
+	if (d_l2_conn->diag_l2_state != DIAG_L2_STATE_OPEN) {
+		diag_os_unlock(l2internal.connlist_mtx);
+		return now + d_l2_conn->tinterval;
+	}
 
-		//we're subtracting unsigned values but since the clock is
-		//monotonic, the difference will always be >= 0
-		expired = ((now - d_l2_conn->tlast) > d_l2_conn->tinterval)? 1:0 ;
+	/* Check the send timers vs requested expiry time */
 
-		/* If expired, call the timeout routine */
-		if (expired && d_l2_conn->l2proto->diag_l2_proto_timeout)
-			d_l2_conn->l2proto->diag_l2_proto_timeout(d_l2_conn);
+	//we're subtracting unsigned values but since the clock is
+	//monotonic, the difference will always be >= 0
+	if ((now - d_l2_conn->tlast) > d_l2_conn->tinterval) {
+		d_l2_conn->l2proto->diag_l2_proto_timeout(d_l2_conn);
 	}
+	//the timeout routine normally updates tlast
+	next = d_l2_conn->tlast + d_l2_conn->tinterval + 1;
+	if ((long) (next - now) <= 0)
+		next = now + d_l2_conn->tinterval;
+
 	diag_os_unlock(l2internal.connlist_mtx);
-	return;
+	return next;
 }
 
 /*
@@ -450,6 +448,18 @@ diag_l2_StartCommunications(struct diag_l0_device *dl0d, int L2protocol, flag_ty
 	d_l2_conn->tlast=diag_os_getms();
 	d_l2_conn->diag_l2_state = DIAG_L2_STATE_OPEN;
 
+	/* Start keepalive timer, unless nothing to do */
+	d_l2_conn->ka.fn = diag_l2_katimer;
+	d_l2_conn->ka.arg = d_l2_conn;
+	if ((d_l2_conn->tinterval != (unsigned long) -1) &&
+			d_l2_conn->l2proto->diag_l2_proto_timeout &&
+			((d_l2_conn->diag_l2_type & DIAG_L2_TYPE_INITMASK) != DIAG_L2_TYPE_MONINIT) &&
+			!(d_l2_conn->diag_link->l1flags & DIAG_L1_DOESKEEPALIVE)) {
+		if (diag_timer_add(&d_l2_conn->ka, d_l2_conn->tlast + d_l2_conn->tinterval + 1)) {
+			fprintf(stderr, FLFMT "Could not start keepalive timer !\n", FL);
+		}
+	}
+
 	if (diag_l2_debug & DIAG_DEBUG_OPEN)
 		fprintf(stderr,
 			FLFMT "diag_l2_StartComms returns %p\n",
@@ -473,6 +483,9 @@ diag_l2_StopCommunications(struct diag_l2_conn *d_l2_conn)
 
 	d_l2_conn->diag_l2_state = DIAG_L2_STATE_CLOSING;
 
+	//stop keepalives; waits if one is being sent right now
+	diag_timer_del(&d_l2_conn->ka);
+
 	/*
 	 * Call protocol close routine, if it exists
 	 */
@@ -511,6 +524,9 @@ diag_l2_send(struct diag_l2_conn *d_l2_conn, struct diag_msg *msg)
 			FLFMT "diag_l2_send %p msg %p msglen %d called\n",
 				FL, (void *)d_l2_conn, (void *)msg, msg->len);
 
+	d_l2_conn->rxlen = d_l2_conn->rxlen_next;
+	d_l2_conn->rxlen_next = 0;
+
 	/* Call protocol specific send routine */
 	rv = d_l2_conn->l2proto->diag_l2_proto_send(d_l2_conn, msg);
 
@@ -626,6 +642,9 @@ int diag_l2_ioctl(struct diag_l2_conn *d_l2_conn, unsigned int cmd, void *data)
 		d->kb1 = d_l2_conn->diag_l2_kb1;
 		d->kb2 = d_l2_conn->diag_l2_kb2;
 		break;
+	case DIAG_IOCTL_SETRXLEN:
+		d_l2_conn->rxlen_next = *(const unsigned int *)data;
+		break;
 	case DIAG_IOCTL_SETSPEED:
 		if (dl2l->l1flags & (DIAG_L1_AUTOSPEED | DIAG_L1_NOTTY))
 			break;
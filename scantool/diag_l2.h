@@ -41,6 +41,8 @@
 extern "C" {
 #endif
 
+#include "diag_timer.h"
+
 //diag_l2_link : elements of the diag_l2_links linked-list.
 //An l2 link associates an existing diag_l0_device with
 //one L1 proto and L1 flags.
@@ -81,6 +83,7 @@ struct diag_l2_conn
 	//  _request, or _startcomm is called succesfully.
 	unsigned long tlast;		// Time of last received || sent data, in ms.
 	unsigned long tinterval;	// How long before expiry (usually set by startcomms() once). Set to -1 for "never"
+	struct diag_timer ka;		// keepalive timer, armed by diag_l2_StartCommunications()
 
 	const struct diag_l2_proto *l2proto;	/* Protocol handler */
 
@@ -131,6 +134,14 @@ struct diag_l2_conn
 	uint8_t	diag_l2_kb1;	/* KB 1, (ISO stuff really) */
 	uint8_t	diag_l2_kb2;	/* KB 2, (ISO stuff really) */
 
+	/*
+	 * Expected response data length, 0 if unknown : see DIAG_IOCTL_SETRXLEN.
+	 * diag_l2_send() moves rxlen_next to rxlen, so a hint only applies to
+	 * the responses of one request.
+	 */
+	unsigned int rxlen_next;
+	unsigned int rxlen;
+
 
 	/* Main linked list of all connections */
 	struct diag_l2_conn *next;
@@ -227,6 +238,14 @@ extern const struct diag_l2_proto *l2proto_list[];
  * SAE J1978 is the ODB II ScanTool specification document
  */
 #define DIAG_L2_IDLE_J1978	0x20
+
+/*
+ * DIAG_L2_TYPE_ATP: tell the ISO14230 code to negotiate faster timings
+ * (shorter P2, P3min and P4min) with the AccessTimingParameters service
+ * once connected. Physical addressing only; if the ECU refuses, the
+ * default timings are kept.
+ */
+#define DIAG_L2_TYPE_ATP	0x40
 /*****/
 
 
@@ -389,8 +408,6 @@ struct diag_msg *diag_l2_request(struct diag_l2_conn *connection, struct diag_ms
 int diag_l2_ioctl(struct diag_l2_conn *connection, unsigned int cmd, void *data);
 
 
-void diag_l2_timer(void);	/* Regular timer routine */
-
 extern int diag_l2_debug;
 extern struct diag_l2_conn  *global_l2_conn;	//TODO : move in globcfg struct
 
@@ -130,7 +130,7 @@ static void
 dl2p_d2_request_callback(void *handle, struct diag_msg *in)
 {
 	struct diag_msg **out = (struct diag_msg **)handle;
-	*out = diag_dupsinglemsg(in);
+	*out = diag_sharesinglemsg(in);
 }
 
 static struct diag_msg *
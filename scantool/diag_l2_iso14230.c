@@ -165,6 +165,81 @@ dl2p_14230_decode(uint8_t *data, int len,
 	return (*hdrlen + *datalen + 1);
 }
 
+/*
+ * Length-aware receive : look at the frame being received in dp->rxbuf, and
+ * return the number of bytes still missing to complete it (header, data and
+ * checksum), 1 if we don't have the format byte yet, or 0 if it's complete.
+ * Returns <0 if the header can't tell the length (CARB mode, zero length);
+ * the caller then falls back to gap-based framing for this frame.
+ * Errors are not reported here : _int_recv() will decode the frame anyway.
+ */
+static int
+dl2p_14230_missing(struct diag_l2_14230 *dp, int l1flags)
+{
+	int hdrlen, datalen, framelen;
+	uint8_t fmt;
+
+	if (dp->rxoffset == 0)
+		return 1;
+
+	fmt = dp->rxbuf[0];
+	if ((fmt & 0xC0) == 0x40)
+		return DIAG_ERR_BADDATA;	//CARB mode
+
+	hdrlen = (fmt & 0x80)? 3:1;	//format, [target, source]
+	datalen = fmt & 0x3F;
+	if (datalen == 0)
+		hdrlen++;		//additional length byte
+
+	if (dp->rxoffset < hdrlen)
+		return hdrlen - dp->rxoffset;
+
+	if (datalen == 0)
+		datalen = dp->rxbuf[hdrlen - 1];
+	if (datalen == 0)
+		return DIAG_ERR_BADDATA;
+
+	framelen = hdrlen + datalen + 1;
+	if (l1flags & DIAG_L1_STRIPSL2CKSUM)
+		framelen -= 1;
+
+	return (framelen > dp->rxoffset)? framelen - dp->rxoffset : 0;
+}
+
+/*
+ * End of a frame (after the P2min gap, or when its length says so) :
+ * copy the received bytes into a new message, add it to the
+ * connection's list, and empty rxbuf.
+ * Ret 0 if ok, diag_iseterr'd error otherwise.
+ */
+static int
+dl2p_14230_endframe(struct diag_l2_conn *d_l2_conn, struct diag_l2_14230 *dp)
+{
+	struct diag_msg	*tmsg;
+
+	tmsg = diag_allocmsg((size_t)dp->rxoffset);
+	if (tmsg == NULL)
+		return diag_iseterr(DIAG_ERR_NOMEM);
+	memcpy(tmsg->data, dp->rxbuf, (size_t)dp->rxoffset);
+	tmsg->rxtime = diag_os_chronoms(0);
+	dp->rxoffset = 0;
+	/*
+	 * ADD message to list
+	 */
+	diag_l2_addmsg(d_l2_conn, tmsg);
+	if (d_l2_conn->diag_msg == tmsg) {
+
+		if ((diag_l2_debug & DIAG_DEBUG_DATA) && (diag_l2_debug & DIAG_DEBUG_PROTO)) {
+			fprintf(stderr, FLFMT "Copying %u bytes to data: ",
+				FL, tmsg->len);
+			diag_data_dump(stderr, tmsg->data, tmsg->len);
+			fprintf(stderr, "\n");
+		}
+
+	}
+	return 0;
+}
+
 /*
  * Internal receive function: does all the message building, but doesn't
  * do call back. Strips header and checksum; if address info was present
@@ -191,7 +266,13 @@ dl2p_14230_decode(uint8_t *data, int len,
  * be to loop, reading 1 byte at a time, with timeout=P1max or p2min to split
  * messages, and timeout=P2max to detect the last byte of a response... this
  * means calling diag_l1_recv a whole lot more often however.
-
+ *
+ * On byte-stream L1s (no L2 framing, headers present), we now do something
+ * like that, but length-aware : read the format byte, then the rest of the
+ * header, then exactly the remaining data + checksum bytes; the frame is
+ * complete as soon as the last byte arrives, without waiting for the P2min gap.
+ * The gap-based framing is kept for monitor mode, for frames whose header
+ * doesn't give the length, and for L1s that return whole frames (NOTTY etc).
  */
 static int
 dl2p_14230_int_recv(struct diag_l2_conn *d_l2_conn, unsigned int timeout)
@@ -199,7 +280,9 @@ dl2p_14230_int_recv(struct diag_l2_conn *d_l2_conn, unsigned int timeout)
 	struct diag_l2_14230 *dp;
 	int rv, l1_doesl2frame, l1flags;
 	unsigned int tout;
+	size_t want;
 	int state;
+	bool lenrecv, gapframe;
 	struct diag_msg	*tmsg, *lastmsg;
 
 #define ST_STATE1	1	/* Start */
@@ -234,6 +317,11 @@ dl2p_14230_int_recv(struct diag_l2_conn *d_l2_conn, unsigned int timeout)
 			timeout += 100;
 	}
 
+	//length-aware receive, see above
+	lenrecv = !dp->monitor_mode &&
+		!(l1flags & (DIAG_L1_DOESL2FRAME | DIAG_L1_NOHDRS | DIAG_L1_NOTTY));
+	gapframe = 0;
+
 
 	while (1) {
 		switch (state) {
@@ -243,8 +331,10 @@ dl2p_14230_int_recv(struct diag_l2_conn *d_l2_conn, unsigned int timeout)
 		case ST_STATE2:
 			//State 2 : if we're between bytes of the same message; if we timeout with P2min it's
 			//probably because the message is ended.
-			tout = d_l2_conn->diag_l2_p2min - 2;
-			if (tout < d_l2_conn->diag_l2_p1max)
+			//(P2min can be very short after AccessTimingParameters)
+			if (d_l2_conn->diag_l2_p2min > d_l2_conn->diag_l2_p1max + 2)
+				tout = d_l2_conn->diag_l2_p2min - 2;
+			else
 				tout = d_l2_conn->diag_l2_p1max;
 			break;
 		case ST_STATE3:
@@ -266,13 +356,20 @@ dl2p_14230_int_recv(struct diag_l2_conn *d_l2_conn, unsigned int timeout)
 		 * In l1_doesl2frame mode, we get full frames, so we don't
 		 * do the read in state2
 		 */
+		want = sizeof(dp->rxbuf) - dp->rxoffset;
+		if (lenrecv && !gapframe) {
+			rv = dl2p_14230_missing(dp, l1flags);
+			if (rv > 0)
+				want = (size_t) rv;
+			else
+				gapframe = 1;
+		}
+
 		if ( (state == ST_STATE2) && l1_doesl2frame )
 			rv = DIAG_ERR_TIMEOUT;
 		else
 			rv = diag_l1_recv(d_l2_conn->diag_link->l2_dl0d, 0,
-				&dp->rxbuf[dp->rxoffset],
-				sizeof(dp->rxbuf) - dp->rxoffset,
-				tout);
+				&dp->rxbuf[dp->rxoffset], want, tout);
 
 		if (diag_l2_debug & DIAG_DEBUG_PROTO)
 			fprintf(stderr,
@@ -300,26 +397,9 @@ dl2p_14230_int_recv(struct diag_l2_conn *d_l2_conn, unsigned int timeout)
 				 * End of that message, maybe more to come
 				 * Copy data into a message
 				 */
-				tmsg = diag_allocmsg((size_t)dp->rxoffset);
-				if (tmsg == NULL)
-					return diag_iseterr(DIAG_ERR_NOMEM);
-				memcpy(tmsg->data, dp->rxbuf, (size_t)dp->rxoffset);
-				tmsg->rxtime = diag_os_chronoms(0);
-				dp->rxoffset = 0;
-				/*
-				 * ADD message to list
-				 */
-				diag_l2_addmsg(d_l2_conn, tmsg);
-				if (d_l2_conn->diag_msg == tmsg) {
-
-					if ((diag_l2_debug & DIAG_DEBUG_DATA) && (diag_l2_debug & DIAG_DEBUG_PROTO)) {
-						fprintf(stderr, FLFMT "Copying %u bytes to data: ",
-							FL, tmsg->len);
-						diag_data_dump(stderr, tmsg->data, tmsg->len);
-						fprintf(stderr, "\n");
-					}
-
-				}
+				if (dl2p_14230_endframe(d_l2_conn, dp))
+					return DIAG_ERR_NOMEM;
+				gapframe = 0;
 				state = ST_STATE3;
 				continue;
 			case ST_STATE3:
@@ -363,6 +443,24 @@ dl2p_14230_int_recv(struct diag_l2_conn *d_l2_conn, unsigned int timeout)
 			 */
 			state = ST_STATE2;
 		}
+
+		if (lenrecv && !gapframe) {
+			rv = dl2p_14230_missing(dp, l1flags);
+			if (rv < 0) {
+				gapframe = 1;
+			} else if (rv == 0) {
+				/*
+				 * Frame complete : no need to wait for the
+				 * P2min gap. Pretend it happened.
+				 */
+				if (diag_l2_debug & DIAG_DEBUG_PROTO)
+					fprintf(stderr, FLFMT "frame complete, %d bytes\n",
+						FL, dp->rxoffset);
+				if (dl2p_14230_endframe(d_l2_conn, dp))
+					return DIAG_ERR_NOMEM;
+				state = ST_STATE3;
+			}
+		}
 	}
 
 	/*
@@ -411,11 +509,11 @@ dl2p_14230_int_recv(struct diag_l2_conn *d_l2_conn, unsigned int timeout)
 			 * This message contains more than one
 			 * data frame (because it arrived with
 			 * odd timing), this means we have to
-			 * do horrible copy about the data
-			 * things ....
+			 * split it : the new msg shares the
+			 * data, no copy.
 			 */
 			struct diag_msg	*amsg;
-			amsg = diag_dupsinglemsg(tmsg);
+			amsg = diag_sharesinglemsg(tmsg);
 			if (amsg == NULL) {
 				return diag_iseterr(DIAG_ERR_NOMEM);
 			}
@@ -484,6 +582,109 @@ dl2p_14230_int_recv(struct diag_l2_conn *d_l2_conn, unsigned int timeout)
 
 static int
 dl2p_14230_send(struct diag_l2_conn *d_l2_conn, struct diag_msg *msg);
+//We need this in _startcomms and _stopcomms
+static struct diag_msg *
+dl2p_14230_request(struct diag_l2_conn *d_l2_conn, struct diag_msg *msg,
+		int *errval);
+
+/*
+ * AccessTimingParameters (SID 0x83, see ISO14230-3 & ISO14230-2 table 6) :
+ * P2min, P3min and P4min are in 0.5ms units, P2max in 25ms units and P3max
+ * in 250ms units. P2max values > 0xF0 use a special encoding which we don't
+ * need : we only treat them as "very long".
+ */
+#define ATP_TPI_RDLIMITS	0x00	//read limits of possible timing parameters
+#define ATP_TPI_SET	0x03	//set timing parameters to given values
+#define ATP_P2MAX_RES	25U
+#define ATP_P3MAX_RES	250U
+#define ATP_P2MAX_SPECIAL	0xF0
+
+/*
+ * Negotiate faster timings (DIAG_L2_TYPE_ATP) : read the ECU's limits, then
+ * ask for P2min, P3min and P4min at those limits, and the shortest P2max
+ * above the new P2min. P3max is only lowered if the ECU requires it.
+ * The new values are stored in the connection only if the ECU accepts them;
+ * in any other case we keep the defaults, so this doesn't set the error code.
+ * Must be called with the connection established.
+ * Ret 0 if the new timings are in effect.
+ */
+static int
+dl2p_14230_atp(struct diag_l2_conn *d_l2_conn)
+{
+	struct diag_msg msg={0};
+	struct diag_msg *rmsg;
+	uint8_t data[7];
+	unsigned int p2min, p2max, p3min, p3max, p4min;
+	int errval;
+
+	data[0] = DIAG_KW2K_SI_ATP;
+	data[1] = ATP_TPI_RDLIMITS;
+	msg.data = data;
+	msg.len = 2;
+	rmsg = dl2p_14230_request(d_l2_conn, &msg, &errval);
+	if ((rmsg == NULL) || errval || (rmsg->len < 7) ||
+			(rmsg->data[0] != DIAG_KW2K_RC_ATPPR) ||
+			(rmsg->data[1] != ATP_TPI_RDLIMITS)) {
+		if (diag_l2_debug & DIAG_DEBUG_INIT)
+			fprintf(stderr, FLFMT "ATP: can't read timing limits, keeping defaults\n", FL);
+		diag_freemsg(rmsg);
+		return DIAG_ERR_ECUSAIDNO;
+	}
+
+	//decode limits, rounding the 0.5ms values up
+	p2min = (rmsg->data[2] + 1U) / 2;
+	p3min = (rmsg->data[4] + 1U) / 2;
+	p4min = (rmsg->data[6] + 1U) / 2;
+
+	p2max = (p2min + ATP_P2MAX_RES) / ATP_P2MAX_RES;	//in 25ms units
+	if ((rmsg->data[3] <= ATP_P2MAX_SPECIAL) && (p2max > rmsg->data[3]))
+		p2max = rmsg->data[3];
+	p2max *= ATP_P2MAX_RES;
+
+	p3max = d_l2_conn->diag_l2_p3max;
+	if (p3max > rmsg->data[5] * ATP_P3MAX_RES)
+		p3max = rmsg->data[5] * ATP_P3MAX_RES;
+	diag_freemsg(rmsg);
+
+	if ((p2max <= p2min) || (p3max <= p3min) || (p2min > 0x7F) ||
+			(p3min > 0x7F) || (p4min > 0x7F)) {
+		if (diag_l2_debug & DIAG_DEBUG_INIT)
+			fprintf(stderr, FLFMT "ATP: unusable timing limits, keeping defaults\n", FL);
+		return DIAG_ERR_BADDATA;
+	}
+
+	data[0] = DIAG_KW2K_SI_ATP;
+	data[1] = ATP_TPI_SET;
+	data[2] = (uint8_t) (p2min * 2);
+	data[3] = (uint8_t) (p2max / ATP_P2MAX_RES);
+	data[4] = (uint8_t) (p3min * 2);
+	data[5] = (uint8_t) (p3max / ATP_P3MAX_RES);
+	data[6] = (uint8_t) (p4min * 2);
+	msg.len = 7;
+	rmsg = dl2p_14230_request(d_l2_conn, &msg, &errval);
+	if ((rmsg == NULL) || errval || (rmsg->len < 2) ||
+			(rmsg->data[0] != DIAG_KW2K_RC_ATPPR) ||
+			(rmsg->data[1] != ATP_TPI_SET)) {
+		if (diag_l2_debug & DIAG_DEBUG_INIT)
+			fprintf(stderr, FLFMT "ATP: new timings refused, keeping defaults\n", FL);
+		diag_freemsg(rmsg);
+		return DIAG_ERR_ECUSAIDNO;
+	}
+	diag_freemsg(rmsg);
+
+	d_l2_conn->diag_l2_p2min = (uint16_t) p2min;
+	d_l2_conn->diag_l2_p2max = (uint16_t) p2max;
+	d_l2_conn->diag_l2_p3min = (uint16_t) p3min;
+	d_l2_conn->diag_l2_p3max = (uint16_t) p3max;
+	d_l2_conn->diag_l2_p4min = (uint16_t) p4min;
+	d_l2_conn->tinterval = p3max * 2/3;
+
+	if (diag_l2_debug & DIAG_DEBUG_INIT)
+		fprintf(stderr, FLFMT "ATP: P2min=%u P2max=%u P3min=%u P3max=%u P4min=%u\n",
+			FL, p2min, p2max, p3min, p3max, p4min);
+	return 0;
+}
+
 /*
  * The complex initialisation routine for ISO14230, which supports
  * 2 types of initialisation (5-BAUD, FAST) and functional
@@ -743,8 +944,8 @@ dl2p_14230_startcomms( struct diag_l2_conn	*d_l2_conn, flag_type flags,
 			((d_l2_conn->diag_l2_kb1 & 8)? ISO14230_LONGHDR:0);
 	if (diag_l2_debug & DIAG_DEBUG_PROTO)
 		fprintf(stderr, FLFMT "new modeflags=0x%04X\n", FL, dp->modeflags);
-	//For now, we won't bother with Normal / Extended timings. We don't
-	//need to unless we use the AccessTimingParameters service (scary)
+	//For now, we won't bother with Extended timings. Faster Normal timings
+	//can be negotiated with DIAG_L2_TYPE_ATP, see below.
 
 	/*
 	 * Now, we want to remove any rubbish left
@@ -766,13 +967,19 @@ dl2p_14230_startcomms( struct diag_l2_conn	*d_l2_conn, flag_type flags,
 	/* And we're done */
 	dp->state = STATE_ESTABLISHED ;
 
+	/*
+	 * Optional : faster timings. Only with physical addressing (a single
+	 * ECU), and not if the interface does the framing with its own timing.
+	 * Failure is not fatal, we just keep the defaults.
+	 */
+	if ((flags & DIAG_L2_TYPE_ATP) && !dp->monitor_mode &&
+			!(dp->modeflags & ISO14230_FUNCADDR) &&
+			!(d_l2_conn->diag_link->l1flags & DIAG_L1_DOESL2FRAME))
+		(void) dl2p_14230_atp(d_l2_conn);
+
 	return 0;
 }
 
-//We need this in _stopcomms
-static struct diag_msg *
-dl2p_14230_request(struct diag_l2_conn *d_l2_conn, struct diag_msg *msg,
-		int *errval);
 
 /* _stopcomms:
  * Send a stopcomms message, and wait for the +ve response, for upto
@@ -844,9 +1051,11 @@ static int
 dl2p_14230_send(struct diag_l2_conn *d_l2_conn, struct diag_msg *msg)
 {
 	int rv;
-	size_t len;
-	uint8_t buf[MAXRBUF];
-	int offset=0;	//data payload starts at buf[offset}
+	uint8_t buf[5];		//header : fmt, [tgt, src], [len]
+	uint8_t cks;
+	int offset=0;	//header length
+	struct diag_iov iov[3];	//header, payload, checksum : sent without joining them
+	unsigned int iovcnt;
 	struct diag_l2_14230 *dp;
 
 	if (msg->len < 1)
@@ -918,19 +1127,25 @@ dl2p_14230_send(struct diag_l2_conn *d_l2_conn, struct diag_msg *msg)
 		offset += 1;
 	}
 
-	memcpy(&buf[offset], msg->data, msg->len);
-
-	len = msg->len + offset;	/* data + hdr */
+	iov[0].data = buf;
+	iov[0].len = offset;
+	iov[1].data = msg->data;
+	iov[1].len = msg->len;
+	iovcnt = 2;
 
 	if ((d_l2_conn->diag_link->l1flags & DIAG_L1_DOESL2CKSUM) == 0) {
 		/* We must add checksum, which is sum of bytes */
-		buf[len] = diag_cks1(buf, len);
-		len++;				/* + checksum */
+		cks = (uint8_t) (diag_cks1(buf, offset) + diag_cks1(msg->data, msg->len));
+		iov[2].data = &cks;
+		iov[2].len = 1;
+		iovcnt = 3;
 	}
 
 	if ((diag_l2_debug & DIAG_DEBUG_WRITE) && (diag_l2_debug & DIAG_DEBUG_DATA)) {
+		unsigned int i;
 		fprintf(stderr, FLFMT "_send: ", FL);
-		diag_data_dump(stderr, buf, len);
+		for (i = 0; i < iovcnt; i++)
+			diag_data_dump(stderr, iov[i].data, iov[i].len);
 		fprintf(stderr, "\n");
 	}
 
@@ -938,8 +1153,8 @@ dl2p_14230_send(struct diag_l2_conn *d_l2_conn, struct diag_msg *msg)
 	if (dp->state == STATE_ESTABLISHED)
 		diag_os_millisleep(d_l2_conn->diag_l2_p3min);
 
-	rv = diag_l1_send (d_l2_conn->diag_link->l2_dl0d, NULL,
-		buf, len, d_l2_conn->diag_l2_p4min);
+	rv = diag_l1_sendv (d_l2_conn->diag_link->l2_dl0d, NULL,
+		iov, iovcnt, d_l2_conn->diag_l2_p4min);
 
 	return rv? diag_iseterr(rv):0;
 }
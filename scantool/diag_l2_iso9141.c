@@ -332,6 +332,12 @@ dl2p_iso9141_decode(uint8_t *data, int len,
  * XXX Dilemma. To properly split messages, do we trust our timing VS iso9141 P2min/max requirements?
  * Do we try to find valid headers + checksum and filter out bad frames ?
  * Do we let L3_saej1979 try and DJ the framing through L2 ?
+
+ *
+ * If L3 told us the expected response length (DIAG_IOCTL_SETRXLEN), we read
+ * exactly one frame's worth of bytes, and a frame with a valid checksum is
+ * complete as soon as its last byte arrives, without waiting for the P2min
+ * gap. Otherwise (or if the checksum doesn't match), framing is by timeouts.
  */
 int
 dl2p_iso9141_int_recv(struct diag_l2_conn *d_l2_conn, unsigned int timeout)
@@ -339,6 +345,8 @@ dl2p_iso9141_int_recv(struct diag_l2_conn *d_l2_conn, unsigned int timeout)
 	int rv, l1_doesl2frame, l1flags;
 	unsigned int tout = 0;
 	int state;
+	unsigned int framelen;	//expected frame length, 0 if unknown
+	bool gapframe;		//current frame doesn't match framelen
 	struct diag_l2_iso9141 *dp;
 	struct diag_msg *tmsg, *lastmsg;
 
@@ -369,6 +377,15 @@ dl2p_iso9141_int_recv(struct diag_l2_conn *d_l2_conn, unsigned int timeout)
 			timeout += SMART_TIMEOUT;
 	}
 
+	// Expected length hint : only useful on byte-stream L1s, with headers
+	// and checksum. (CARSIM etc. give us whole frames anyway)
+	framelen = 0;
+	gapframe = 0;
+	if (d_l2_conn->rxlen && ((d_l2_conn->rxlen + OHLEN_ISO9141) <= MAXLEN_ISO9141) &&
+			!(l1flags & (DIAG_L1_DOESL2FRAME | DIAG_L1_NOHDRS | DIAG_L1_NOTTY |
+				DIAG_L1_STRIPSL2CKSUM)))
+		framelen = d_l2_conn->rxlen + OHLEN_ISO9141;
+
 	// Message read cycle: byte-per-byte for passive interfaces,
 	// frame-per-frame for smart interfaces (DOESL2FRAME).
 	// ISO-9141-2 says:
@@ -409,17 +426,27 @@ dl2p_iso9141_int_recv(struct diag_l2_conn *d_l2_conn, unsigned int timeout)
 				break;
 		}
 
+		// Got the expected length : check it's really the end of the frame.
+		if (framelen && !gapframe && (dp->rxoffset >= framelen)) {
+			if ((dp->rxoffset > framelen) ||
+					(diag_cks1(dp->rxbuf, framelen - 1) != dp->rxbuf[framelen - 1]))
+				gapframe = 1;	//wrong hint ? Finish this one by timeout.
+		}
+
 		// If L0/L1 does L2 framing, we get full frames, so we don't
 		// need to do the read byte-per-byte (skip state2):
 		if ( (state == ST_STATE2) && l1_doesl2frame )
 			rv = DIAG_ERR_TIMEOUT;
 		else if (dp->rxoffset == MAXLEN_ISO9141)
 			rv = DIAG_ERR_TIMEOUT;	//we got a full frame already !
+		else if (framelen && !gapframe && (dp->rxoffset == framelen))
+			rv = DIAG_ERR_TIMEOUT;	//got the expected frame
 		else
 			// Receive data into the buffer:
 			rv = diag_l1_recv(d_l2_conn->diag_link->l2_dl0d, 0,
 					&dp->rxbuf[dp->rxoffset],
-					MAXLEN_ISO9141 - dp->rxoffset,
+					(framelen && !gapframe)? framelen - dp->rxoffset :
+						(unsigned int) (MAXLEN_ISO9141 - dp->rxoffset),
 					tout);
 
 		// Timeout = end of message or end of responses.
@@ -455,6 +482,7 @@ dl2p_iso9141_int_recv(struct diag_l2_conn *d_l2_conn, unsigned int timeout)
 					}
 
 					dp->rxoffset = 0;
+					gapframe = 0;
 
 					// Add received message to response list:
 					diag_l2_addmsg(d_l2_conn, tmsg);
@@ -535,7 +563,7 @@ dl2p_iso9141_int_recv(struct diag_l2_conn *d_l2_conn, unsigned int timeout)
 
 			if (rv > MAXLEN_ISO9141) {
 				struct diag_msg	*amsg;
-				amsg = diag_dupsinglemsg(tmsg);
+				amsg = diag_sharesinglemsg(tmsg);
 				if (amsg == NULL) {
 					return diag_iseterr(DIAG_ERR_NOMEM);
 				}
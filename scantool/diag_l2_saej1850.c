@@ -124,12 +124,14 @@ dl2p_j1850_stopcomms(struct diag_l2_conn* d_l2_conn)
 
 
 /* Thanks to B. Roadman's web site for this CRC code */
-uint8_t
-dl2p_j1850_crc(uint8_t *msg_buf, int nbytes)
+/* Feed nbytes into crc_reg (0xFF to start); the CRC is ~crc_reg at the end. */
+static uint8_t
+j1850_crc_update(uint8_t crc_reg, const uint8_t *msg_buf, int nbytes)
 {
-	uint8_t crc_reg=0xff,poly,i,j;
-	uint8_t *byte_point;
+	uint8_t poly,j;
+	const uint8_t *byte_point;
 	uint8_t bit_point;
+	int i;
 
 	for (i=0, byte_point=msg_buf; i<nbytes; ++i, ++byte_point)
 	{
@@ -152,7 +154,13 @@ dl2p_j1850_crc(uint8_t *msg_buf, int nbytes)
 			}
 		}
 	}
-	return ~crc_reg;	// Return CRC
+	return crc_reg;
+}
+
+uint8_t
+dl2p_j1850_crc(uint8_t *msg_buf, int nbytes)
+{
+	return ~j1850_crc_update(0xff, msg_buf, nbytes);	// Return CRC
 }
 
 /*
@@ -167,7 +175,10 @@ dl2p_j1850_send(struct diag_l2_conn *d_l2_conn, struct diag_msg *msg)
 	int l1flags, rv, l1protocol;
 	struct diag_l2_j1850 *dp;
 
-	uint8_t buf[MAXRBUF];
+	uint8_t hdr[3];
+	uint8_t crc;
+	struct diag_iov iov[3];	//header, payload, CRC : sent without joining them
+	unsigned int iovcnt = 0;
 	int offset = 0;
 
 	if (diag_l2_debug & DIAG_DEBUG_WRITE)
@@ -190,23 +201,29 @@ dl2p_j1850_send(struct diag_l2_conn *d_l2_conn, struct diag_msg *msg)
 		// Add the J1850 header to the data
 
 		if (l1protocol == DIAG_L1_J1850_PWM)
-			buf[0] = 0x61;
+			hdr[0] = 0x61;
 		else
-			buf[0] = 0x68;
-		buf[1] = dp->dstaddr;
-		buf[2] = dp->srcaddr;
+			hdr[0] = 0x68;
+		hdr[1] = dp->dstaddr;
+		hdr[2] = dp->srcaddr;
+		iov[iovcnt].data = hdr;
+		iov[iovcnt++].len = 3;
 		offset += 3;
 	}
 
-	// Now copy in data
-	memcpy(&buf[offset], msg->data, msg->len);
+	// Now the data
+	iov[iovcnt].data = msg->data;
+	iov[iovcnt++].len = msg->len;
 	offset += msg->len;
 
 	if (((l1flags & DIAG_L1_DOESL2CKSUM) == 0) &&
 		((l1flags & DIAG_L1_DATAONLY) == 0)) {
-		// Add in J1850 CRC
-		int curoff = offset;
-		buf[offset++] = dl2p_j1850_crc(buf, curoff);
+		// Add in J1850 CRC, over header + data
+		crc = ~j1850_crc_update(j1850_crc_update(0xff, hdr, 3),
+				msg->data, (int) msg->len);
+		iov[iovcnt].data = &crc;
+		iov[iovcnt++].len = 1;
+		offset++;
 	}
 
 	if (diag_l2_debug & DIAG_DEBUG_WRITE)
@@ -215,8 +232,8 @@ dl2p_j1850_send(struct diag_l2_conn *d_l2_conn, struct diag_msg *msg)
 				FL, offset);
 
 	// And send data to Layer 1
-	rv = diag_l1_send (d_l2_conn->diag_link->l2_dl0d, 0,
-				buf, (size_t)offset, 0);
+	rv = diag_l1_sendv (d_l2_conn->diag_link->l2_dl0d, 0,
+				iov, iovcnt, 0);
 
 	return rv? diag_iseterr(rv):0 ;
 }
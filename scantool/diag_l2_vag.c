@@ -74,6 +74,10 @@ struct diag_l2_vag
 	unsigned long long msg_finish_time; //a point in time when the last message finished arriving/departing
 };
 
+//byte #i of an outgoing block : 3 header bytes (length, counter, title), data, end byte
+#define VAG_TXBYTE(hdr, msg, i)	(((i) < 3)? (hdr)[i] : \
+				((i) < 3 + (msg)->len)? (msg)->data[(i) - 3] : KWP1281_END_BYTE)
+
 /*
  * Useful internal routines
  */
@@ -551,17 +555,16 @@ dl2p_vag_send(struct diag_l2_conn *d_l2_conn, struct diag_msg *msg)
 	//are we master? if not then the caller should be redesigned/fixed
 	assert(dp->master == 1);
 
+	//The block is sent one byte at a time, straight from hdr[] and msg->data
+	//(see VAG_TXBYTE) : no need to assemble it first.
+	uint8_t hdr[3];
+	unsigned int txoffset = 0;
 	//the length of the block (counter byte, title byte, data bytes and block end byte)
-	dp->rxbuf[0] = msg->len + 3;
+	hdr[0] = msg->len + 3;
 	//block counter
-	dp->rxbuf[1] = dp->seq_nr;
+	hdr[1] = dp->seq_nr;
 	//block title (service identification - SID)
-	dp->rxbuf[2] = msg->type;
-	//data
-	memcpy(&dp->rxbuf[3], msg->data, msg->len);
-	//block end byte
-	dp->rxbuf[3+msg->len] = KWP1281_END_BYTE;
-	dp->rxoffset = 0;
+	hdr[2] = msg->type;
 
 	//time gap between messages
 	unsigned long long elapsed_time = diag_os_hrtus(diag_os_gethrt() - dp->msg_finish_time)/1000;
@@ -571,18 +574,19 @@ dl2p_vag_send(struct diag_l2_conn *d_l2_conn, struct diag_msg *msg)
 	//send the block to the ECU
 	while(1) {
 		//send one byte at a time
-		rv = diag_l1_send(d_l2_conn->diag_link->l2_dl0d, 0, &dp->rxbuf[dp->rxoffset], 1,
+		uint8_t txbyte = VAG_TXBYTE(hdr, msg, txoffset);
+		rv = diag_l1_send(d_l2_conn->diag_link->l2_dl0d, 0, &txbyte, 1,
 		                  d_l2_conn->diag_l2_p4min);
 		unsigned long long byte_sent_time = diag_os_gethrt();
 
 		if(diag_l2_debug & DIAG_DEBUG_PROTO)
-			fprintf(stderr, FLFMT "after send, rv=%d rtoffset=%d\n", FL, rv, dp->rxoffset);
+			fprintf(stderr, FLFMT "after send, rv=%d txoffset=%u\n", FL, rv, txoffset);
 
 		if(rv < 0)
 			return diag_iseterr(rv);
 
 		//have we just written the last byte? if so, then no inverted response will arrive
-		if(dp->rxoffset == dp->rxbuf[0]) {
+		if(txoffset == hdr[0]) {
 			dp->msg_finish_time = diag_os_gethrt();
 			break;
 		}
@@ -600,7 +604,7 @@ dl2p_vag_send(struct diag_l2_conn *d_l2_conn, struct diag_msg *msg)
 			if(++retries > KWP1281_TO_RETRIES || rv != DIAG_ERR_TIMEOUT)
 				return diag_iseterr(rv);
 			//retry sending the message
-			dp->rxoffset = 0;
+			txoffset = 0;
 			//but only after another t_r8 - we must be sure that the receiver times-out
 			//so that it will expect a re-started message
 			elapsed_time = diag_os_hrtus(diag_os_gethrt() - byte_sent_time)/1000;
@@ -609,7 +613,7 @@ dl2p_vag_send(struct diag_l2_conn *d_l2_conn, struct diag_msg *msg)
 		}
 
 		//check the received byte
-		uint8_t complement = ~dp->rxbuf[dp->rxoffset];
+		uint8_t complement = ~txbyte;
 		if(recv_byte != complement) {
 			if(diag_l2_debug & DIAG_DEBUG_PROTO)
 				fprintf(stderr, FLFMT "Received incorrect inverted byte: 0x%.2X (expected 0x%.2X)\n",
@@ -619,7 +623,7 @@ dl2p_vag_send(struct diag_l2_conn *d_l2_conn, struct diag_msg *msg)
 				return diag_iseterr(DIAG_ERR_BADCSUM);
 			}
 			//retry sending the message
-			dp->rxoffset = 0;
+			txoffset = 0;
 			//but only after another t_r8 - we must be sure that the receiver times-out
 			//so that it will expect a re-started message
 			elapsed_time = diag_os_hrtus(diag_os_gethrt() - byte_sent_time)/1000;
@@ -627,7 +631,7 @@ dl2p_vag_send(struct diag_l2_conn *d_l2_conn, struct diag_msg *msg)
 			continue;
 		}
 
-		dp->rxoffset++;
+		txoffset++;
 		//how much time elapsed since receiving a correct complement byte?
 		elapsed_time = diag_os_hrtus(diag_os_gethrt() - complement_recv_time)/1000;
 		//give ECU some time before sending next byte
@@ -42,6 +42,24 @@ int diag_l3_debug;
 
 static struct diag_l3_conn	*diag_l3_list;
 
+/*
+ * Keepalive timer handler (see diag_timer.h) : call the protocol
+ * timer once the connection was idle for tinterval ms.
+ */
+static unsigned long diag_l3_katimer(void *arg, unsigned long now)
+{
+	struct diag_l3_conn *conn = arg;
+	unsigned long next;
+
+	if ((now - conn->timer) >= conn->tinterval) {
+		(void) conn->d_l3_proto->diag_l3_proto_timer(conn, now - conn->timer);
+	}
+	next = conn->timer + conn->tinterval;
+	if ((long) (next - now) <= 0)
+		next = now + conn->tinterval;
+	return next;
+}
+
 
 struct diag_l3_conn *
 diag_l3_start(const char *protocol, struct diag_l2_conn *d_l2_conn)
@@ -107,6 +125,16 @@ diag_l3_start(const char *protocol, struct diag_l2_conn *d_l2_conn)
 		 */
 		LL_PREPEND(diag_l3_list, d_l3_conn);
 
+		/* Start keepalive timer, unless L1 does the keepalive stuff */
+		d_l3_conn->ka.fn = diag_l3_katimer;
+		d_l3_conn->ka.arg = d_l3_conn;
+		if (dp->diag_l3_proto_timer && d_l3_conn->tinterval &&
+				!(d_l3_conn->d_l3l1_flags & DIAG_L1_DOESKEEPALIVE)) {
+			if (diag_timer_add(&d_l3_conn->ka, d_l3_conn->timer + d_l3_conn->tinterval)) {
+				fprintf(stderr, FLFMT "Could not start keepalive timer !\n", FL);
+			}
+		}
+
 	}
 
 	if (diag_l3_debug & DIAG_DEBUG_OPEN)
@@ -125,6 +153,9 @@ int diag_l3_stop(struct diag_l3_conn *d_l3_conn)
 
 	const struct diag_l3_proto *dp = d_l3_conn->d_l3_proto;
 
+	//stop keepalives; waits if one is being sent right now
+	diag_timer_del(&d_l3_conn->ka);
+
 	/* Remove from list */
 	LL_DELETE(diag_l3_list, d_l3_conn);
 
@@ -219,40 +250,6 @@ diag_l3_request(struct diag_l3_conn *dl3c, struct diag_msg *txmsg, int *errval)
 	return rxmsg;
 }
 
-/*
- * Note: This is called regularly from a signal handler.
- * (see diag_os.c)
- * XXX This calls non async-signal-safe functions!
- */
-
-void diag_l3_timer(void)
-{
-	/*
-	 * Regular timer routine
-	 * Call protocol specific timer
-	 */
-	struct diag_l3_conn *conn;
-	unsigned long now=diag_os_getms();
-
-	LL_FOREACH(diag_l3_list, conn) {
-		/* Call L3 timer routine for this connection */
-		const struct diag_l3_proto *dp = conn->d_l3_proto;
-
-		//skip connection if L1 does the keepalive stuff
-		if (conn->d_l3l1_flags & DIAG_L1_DOESKEEPALIVE)
-			continue;
-
-		if (dp->diag_l3_proto_timer) {
-			unsigned long diffms;
-
-			diffms = now - conn->timer;
-
-			(void) dp->diag_l3_proto_timer(conn, diffms);
-		}
-	}
-}
-
-
 /* Base implementations for some functions */
 
 
@@ -31,6 +31,8 @@
 extern "C" {
 #endif
 
+#include "diag_timer.h"
+
 struct diag_l2_conn;
 struct diag_msg;
 
@@ -54,6 +56,9 @@ struct diag_l3_conn
 
 	/* time (in ms since an arbitrary reference) of last tx/rx , for managing periodic timers */
 	unsigned long timer;
+	/* ms of idle time before diag_l3_proto_timer is called; 0 = never. Set by proto_start. */
+	unsigned long tinterval;
+	struct diag_timer ka;	//managed by diag_l3.c
 
 	/* Linked list held by main L3 code */
 	struct diag_l3_conn	*next;
@@ -96,9 +101,9 @@ struct diag_l3_proto {
 		const size_t bufsize);
 
 	/* Timer (optional)
-	 * If defined, this is called from diag_l3_timer()
-	 * by the periodic callback (in diag_os); the ms argument
-	 * is the difference (in ms) between [now] and [diag_l3_conn->timer].
+	 * If defined, this is called from the timer thread (see diag_timer.h)
+	 * once the connection was idle for diag_l3_conn->tinterval ms;
+	 * the ms argument is the difference (in ms) between [now] and [diag_l3_conn->timer].
 	 * ret 0 if ok
 	 */
 	int (*diag_l3_proto_timer)(struct diag_l3_conn *, unsigned long ms);
@@ -154,14 +159,6 @@ struct diag_msg *diag_l3_request(struct diag_l3_conn *dl3c, struct diag_msg *txm
  */
 int diag_l3_ioctl(struct diag_l3_conn *connection, unsigned int cmd, void *data);
 
-/** Periodic timer dispatcher
- *
- * (call only from diag_os_*.c) *
- * This calls the diag_l3_proto_timer function of every
- * diag_l3_conn in the diag_l3_list linked-list.
- */
-void diag_l3_timer(void);
-
 
 /* Base implementations:
  * these are defined in diag_l3.c and perform no operation.
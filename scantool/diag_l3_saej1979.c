@@ -46,6 +46,11 @@ struct l3_j1979_int {
 	int	rxoffset;
 };
 
+//PIDs 0x06-0x09 and 0x55-0x58 may have an extra data byte, see
+//diag_l3_j1979_getlen()
+#define J1979_PID_VARLEN(pid) ((((pid) >= 0x06) && ((pid) <= 0x09)) || \
+		(((pid) >= 0x55) && ((pid) <= 0x58)))
+
 /*
  * Return the expected J1979 packet length for a given mode byte
  * This includes *only* up to 7 data bytes (headers and checksum are stripped and
@@ -198,11 +203,11 @@ static int diag_l3_j1979_getlen(uint8_t *data, int len)
 		if ((data[1] & 0x1f) ==0) {
 			rv=7;	//supported INFOTYPES
 		} else if (data[1] & 1) {
-			//INFOTYPE is odd:
-			rv=7;
-		} else {
-			//even
+			//INFOTYPE is odd : message count
 			rv=3;
+		} else {
+			//even : VIN / CALID / CVN etc. data frames
+			rv=7;
 		}
 		break;
 	default:
@@ -221,6 +226,7 @@ static int
 diag_l3_j1979_send(struct diag_l3_conn *d_l3_conn, struct diag_msg *msg)
 {
 	int rv;
+	unsigned int rxlen;
 	struct diag_l2_conn *d_conn;
 	struct l3_j1979_int *l3i = d_l3_conn->l3_int;
 //	uint8_t buf[32];
@@ -247,6 +253,23 @@ diag_l3_j1979_send(struct diag_l3_conn *d_l3_conn, struct diag_msg *msg)
 	// (iso9141 + J1850 : dest = 0x6A )
 
 
+	/* Tell L2 how long the responses should be, if we know exactly :
+	 * L2 may end a frame on that length + a good checksum alone.
+	 */
+	rxlen = 0;
+	if ((msg->len >= 1) && (msg->data[0] >= 1) && (msg->data[0] <= 9)) {
+		uint8_t rsp[2];
+
+		rsp[0] = msg->data[0] | 0x40;
+		rsp[1] = (msg->len >= 2)? msg->data[1] : 0;
+		rv = diag_l3_j1979_getlen(rsp, sizeof(rsp));
+		if (((rsp[0] == 0x41) || (rsp[0] == 0x42)) && J1979_PID_VARLEN(rsp[1]))
+			rv = 0;
+		if (rv > 0)
+			rxlen = (unsigned int) rv;
+	}
+	(void) diag_l2_ioctl(d_conn, DIAG_IOCTL_SETRXLEN, &rxlen);
+
 	/* L2 does framing, adds addressing and CRC, so do nothing else*/
 	rv = diag_l2_send(d_conn, msg);
 
@@ -766,6 +789,9 @@ int diag_l3_j1979_start(struct diag_l3_conn *d_l3_conn) {
 		return diag_iseterr(rv);
 	}
 
+	/* keepalive from the timer thread, unless L2 does it for us */
+	if (!(d_l3_conn->d_l3l2_flags & DIAG_L2_FLAG_KEEPALIVE))
+		d_l3_conn->tinterval = J1979_KEEPALIVE;
 
 	return 0;
 }
@@ -41,7 +41,7 @@ extern "C" {
 	typedef int OS_ERRTYPE;
 #endif
 
-#define ALARM_TIMEOUT 300	// ms interval timeout for timer callbacks (keepalive etc)
+#define ALARM_TIMEOUT 300	// ms interval for timer callbacks, when they are polled (keepalive etc)
 
 /* Common prototypes but note that the source
  * is different and defined in OS specific
@@ -51,6 +51,11 @@ extern "C" {
 int diag_os_init(void);
 int diag_os_close(void);
 
+/** Wake the timer thread : the earliest diag_timer deadline changed.
+ * Called by diag_timer_add(); see diag_timer.h
+ */
+void diag_os_timer_wake(void);
+
 /** Millisecond sleep (blocking)
  *
  * @param ms requested delay
@@ -59,6 +64,35 @@ int diag_os_close(void);
  */
 void diag_os_millisleep(unsigned int ms);
 
+/** Precise delay : return when diag_os_gethrt() reaches t0 + us.
+ *
+ * Sleeps until shortly before the deadline, then spins on diag_os_gethrt().
+ * The margin self-tunes to the observed wakeup latency of the OS sleep.
+ * Since the deadline is absolute, a sequence of waits from the same t0
+ * (ex.: bits of a 5 baud init) doesn't accumulate errors.
+ * Burns CPU for the last part of the delay : use for init / inter-byte timing,
+ * not for general waits.
+ *
+ * @param t0 : diag_os_gethrt() timestamp
+ * @param us : delay from t0, in microseconds
+ */
+void diag_os_hrtwait(unsigned long long t0, unsigned long us);
+
+/** diag_os_hrtwait() statistics; all times in microseconds */
+struct diag_os_waitstats {
+	unsigned long count;	//number of waits
+	unsigned long late;	//waits that returned > DIAG_OS_WAITLATE after the deadline
+	long long sumerr;	//sum of (return time - deadline)
+	long maxerr;		//worst error
+	unsigned long margin;	//current sleep margin
+};
+#define DIAG_OS_WAITLATE	500	//us
+
+/** Get diag_os_hrtwait() stats
+ * @param reset : clear counters after copying them (the margin is kept)
+ */
+void diag_os_getwaitstats(struct diag_os_waitstats *ws, bool reset);
+
 /** Check if a key was pressed
  *
  * @return 0 if no key was pressed
@@ -86,6 +120,31 @@ const char * diag_os_geterr(OS_ERRTYPE os_errno);
 /* Scheduler */
 int diag_os_sched(void);
 
+/** Realtime mode, for timing-critical sequences (bit-banged inits).
+ * Opt-in, with "set realtime" : diag_os_rt_enter() does nothing while
+ * diag_os_rtprio is 0. */
+extern int diag_os_rtprio;	//SCHED_FIFO priority (1-99); 0 : realtime mode disabled
+extern int diag_os_rtcpu;	//CPU to pin the calling thread to; -1 : don't pin
+
+//diag_os_rt_enter() results
+#define DIAG_OS_RT_FIFO		0x01	//realtime priority set
+#define DIAG_OS_RT_MLOCK	0x02	//memory locked
+#define DIAG_OS_RT_PIN		0x04	//pinned to diag_os_rtcpu
+#define DIAG_OS_RT_STACK	0x08	//stack pre-faulted
+
+/** Enter realtime mode, if enabled : raise the calling thread to
+ * realtime priority, lock memory, pin to a CPU and pre-fault the stack.
+ *
+ * Every step that fails (typically, without privileges) is skipped.
+ * Must be paired with diag_os_rt_exit(); calls may be nested.
+ * @return DIAG_OS_RT_* flags of what was achieved; 0 if disabled.
+ */
+unsigned int diag_os_rt_enter(void);
+
+/** Leave realtime mode : restore the scheduling, memory and CPU settings
+ * saved by the outermost diag_os_rt_enter(). */
+void diag_os_rt_exit(void);
+
 /** Return current "time" in milliseconds.
  *
  * This must use a monotonic (i.e. always increasing) clock source; this
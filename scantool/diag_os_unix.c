@@ -56,6 +56,7 @@
  */
 
 
+#define _GNU_SOURCE	//for sched_setaffinity()
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
@@ -64,9 +65,8 @@
 #include "diag_os_unix.h"
 #include "diag.h"
 
-#include "diag_l2.h"
-#include "diag_l3.h"
 #include "diag_err.h"
+#include "diag_timer.h"
 
 #include <unistd.h>
 
@@ -75,6 +75,9 @@
 #include <signal.h>
 #include <time.h>
 #include <pthread.h>
+#include <sys/utsname.h>	//for calibration cache
+#include <sched.h>
+#include <sys/mman.h>	//mlockall
 
 /***
  * In the following #ifdefs, enable/include everything supported.
@@ -90,8 +93,6 @@
 	static clockid_t clkid_pt = CLOCK_MONOTONIC;	//clockid for periodic timer,
 	static clockid_t clkid_gt = CLOCK_MONOTONIC;	// for clock_gettime(),
 	static clockid_t clkid_ns = CLOCK_MONOTONIC;	// for clock_nanosleep()
-
-	static timer_t ptimer_id;	//periodic timer ID
 #endif // _POSIX_TIMERS
 
 #ifdef __linux__
@@ -111,70 +112,127 @@
 static int diag_os_init_done=0;
 static int discover_done = 0;	//protect diag_os_millisleep() and _gethrt()
 
-static void diag_os_discover(void);
+//background re-validation of cached diag_os_calibrate() results
+static pthread_t calib_thread;
+static bool calib_bg;		//calib_thread was started
+static pthread_mutex_t calib_lock = PTHREAD_MUTEX_INITIALIZER;	//protects calib_quit
+static pthread_cond_t calib_cond = PTHREAD_COND_INITIALIZER;	//signals calib_quit
+static bool calib_quit;
+#define CALIB_BGDELAY	3	//s; short-lived processes (scripts) exit before the re-validation
 
-static pthread_mutex_t periodic_lock = PTHREAD_MUTEX_INITIALIZER;
+static void diag_os_discover(void);
 
-static void
 #if defined(_POSIX_TIMERS) && (SEL_PERIODIC==S_POSIX || SEL_PERIODIC==S_AUTO)
-diag_os_periodic(UNUSED(union sigval sv))
+/* Timer thread : sleeps until the earliest diag_timer deadline, or until
+ * diag_os_timer_wake() signals a new one. Nothing runs while no timer is armed.
+ */
+static pthread_t timer_thread;
+static pthread_mutex_t timer_lock = PTHREAD_MUTEX_INITIALIZER;	//protects the following :
+static pthread_cond_t timer_cond;
+static bool timer_kick;		//deadlines changed since the last diag_timer_run()
+static bool timer_quit;
+
+static void *diag_os_timerthread(UNUSED(void *unused)) {
+	pthread_mutex_lock(&timer_lock);
+	while (!timer_quit) {
+		unsigned long next;
+		bool armed;
+
+		timer_kick = 0;
+		pthread_mutex_unlock(&timer_lock);
+		armed = diag_timer_run(&next);
+		pthread_mutex_lock(&timer_lock);
+
+		if (timer_kick || timer_quit)
+			continue;
+
+		if (!armed) {
+			pthread_cond_wait(&timer_cond, &timer_lock);
+		} else {
+			struct timespec abst;
+			long delta = (long) (next - diag_os_getms());
+
+			if (delta <= 0)
+				continue;
+			//the cond clock isn't necessarily the diag_os_getms() clock : convert.
+			clock_gettime(clkid_pt, &abst);
+			abst.tv_sec += delta / 1000;
+			abst.tv_nsec += (delta % 1000) * 1000*1000;
+			if (abst.tv_nsec >= 1000*1000*1000) {
+				abst.tv_sec++;
+				abst.tv_nsec -= 1000*1000*1000;
+			}
+			(void) pthread_cond_timedwait(&timer_cond, &timer_lock, &abst);
+		}
+	}
+	pthread_mutex_unlock(&timer_lock);
+	diag_msgpool_flush();	//keepalive msgs were freed in this thread
+	return NULL;
+}
+
+void diag_os_timer_wake(void) {
+	pthread_mutex_lock(&timer_lock);
+	timer_kick = 1;
+	pthread_cond_signal(&timer_cond);
+	pthread_mutex_unlock(&timer_lock);
+}
+
 #else
-diag_os_periodic(UNUSED(int unused))
-#endif
-{
-	/* Warning: these indirectly use non-async-signal-safe functions
-	* Their behavior is undefined if they happen
-	* to occur during any other non-async-signal-safe function.
-	* See doc/sourcetree_notes.txt
-	*/
+/* SIGALRM handler : poll the timers every ALARM_TIMEOUT.
+ * Warning: handlers indirectly use non-async-signal-safe functions
+ * Their behavior is undefined if they happen
+ * to occur during any other non-async-signal-safe function.
+ * See doc/sourcetree_notes.txt
+ */
+static pthread_mutex_t periodic_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void diag_os_periodic(UNUSED(int unused)) {
+	unsigned long next;
+
 	if (pthread_mutex_trylock(&periodic_lock)) return;
-	diag_l3_timer();	/* Call L3 Timers */
-	diag_l2_timer();	/* Call L2 timers */
+	(void) diag_timer_run(&next);
 	pthread_mutex_unlock(&periodic_lock);
 }
 
-//diag_os_init sets up a periodic callback (diag_os_periodic())
-//for keepalive messages, and selects + calibrates timer functions.
+void diag_os_timer_wake(void) {
+	//next SIGALRM will see it
+}
+#endif
+
+//diag_os_init starts the timer thread (or periodic callback) that runs
+//diag_timer handlers, for keepalive messages, and selects + calibrates timer functions.
 //return 0 if ok
 int
 diag_os_init(void)
 {
-	const long tmo = ALARM_TIMEOUT;
-
 	if (diag_os_init_done)
 		return 0;
 
 	diag_os_discover();	//auto-select clockids or other capabilities
-	diag_os_calibrate();	//calibrate before starting periodic timer
+	diag_os_calibrate();	//calibrate before starting timers
 
 #if defined(_POSIX_TIMERS) && (SEL_PERIODIC==S_POSIX || SEL_PERIODIC==S_AUTO)
-	struct itimerspec pti;
-	struct sigevent pt_sigev;
-
-	pt_sigev.sigev_notify = SIGEV_THREAD;	//"Upon timer expiration, invoke sigev_notify_function "
-	pt_sigev.sigev_notify_function = diag_os_periodic;
-	pt_sigev.sigev_notify_attributes = NULL;	//not sure what we need here, if anything.
-//	pt_sigev.sigev_value.sival_int = 0;	//not used
-//	pt_sigev.siev_signo = 0;	//not used
-
-	if (timer_create(clkid_pt, &pt_sigev, &ptimer_id) != 0) {
-		fprintf(stderr, FLFMT "Could not create periodic timer... report this\n", FL);
-		diag_os_geterr(0);
+	pthread_condattr_t cattr;
+
+	pthread_condattr_init(&cattr);
+	if (pthread_condattr_setclock(&cattr, clkid_pt) != 0) {
+		//always supported for CLOCK_MONOTONIC... hopefully
+		fprintf(stderr, FLFMT "Could not set timer thread clock... report this\n", FL);
+		pthread_condattr_destroy(&cattr);
 		return diag_iseterr(DIAG_ERR_GENERAL);
 	}
-	//timer was created in disarmed state
-	pti.it_interval.tv_sec = (tmo / 1000);
-	pti.it_interval.tv_nsec = (tmo % 1000) * 1000*1000;
-	pti.it_value.tv_sec = pti.it_interval.tv_sec;
-	pti.it_value.tv_nsec = pti.it_interval.tv_nsec;
-
-	if (timer_settime(ptimer_id, 0, &pti, NULL) != 0) {
-		fprintf(stderr, FLFMT "Could not set periodic timer... report this\n", FL);
-		diag_os_geterr(0);
-		timer_delete(ptimer_id);
+	pthread_cond_init(&timer_cond, &cattr);
+	pthread_condattr_destroy(&cattr);
+
+	timer_quit = 0;
+	timer_kick = 0;
+	if (pthread_create(&timer_thread, NULL, diag_os_timerthread, NULL) != 0) {
+		fprintf(stderr, FLFMT "Could not create timer thread... report this\n", FL);
+		pthread_cond_destroy(&timer_cond);
 		return diag_iseterr(DIAG_ERR_GENERAL);
 	}
 #else	//so, no _POSIX_TIMERS ... sucks
+	const long tmo = ALARM_TIMEOUT;
 	struct sigaction stNew;
 	struct itimerval tv;
 
@@ -229,12 +287,19 @@ diag_os_init(void)
 	return 0;
 }	//diag_os_init
 
-//diag_os_close: delete alarm handlers / periodic timers
+//diag_os_close: stop timer thread, or delete alarm handlers / periodic timers
 //return 0 if ok (in this case, always)
 int diag_os_close() {
+	if (!diag_os_init_done)
+		return 0;
 #if defined(_POSIX_TIMERS) && (SEL_PERIODIC==S_POSIX || SEL_PERIODIC==S_AUTO)
-	//disarm + delete periodic timer
-	timer_delete(ptimer_id);
+	//stop timer thread
+	pthread_mutex_lock(&timer_lock);
+	timer_quit = 1;
+	pthread_cond_signal(&timer_cond);
+	pthread_mutex_unlock(&timer_lock);
+	pthread_join(timer_thread, NULL);
+	pthread_cond_destroy(&timer_cond);
 #else
 	//stop the interval timer:
 	struct itimerval tv={{0,0},{0, 0}};
@@ -247,26 +312,28 @@ int diag_os_close() {
 	sigaction(SIGALRM, &disable_tmr, NULL);
 #endif // _POSIX_TIMERS
 
+	//abort background calibration, if still running
+	if (calib_bg) {
+		pthread_mutex_lock(&calib_lock);
+		calib_quit = 1;
+		pthread_cond_signal(&calib_cond);
+		pthread_mutex_unlock(&calib_lock);
+		pthread_join(calib_thread, NULL);
+		calib_bg = 0;
+	}
+
 	diag_os_init_done = 0;
 	return 0;
 
 } 	//diag_os_close
 
 
-//return after (ms) milliseconds.
-void
-diag_os_millisleep(unsigned int ms)
+//return after (ms) milliseconds, without verification; see diag_os_millisleep()
+static void
+os_sleepms(unsigned int ms)
 {
-	unsigned long long t1,t2;	//for verification
-	long int offsetus;
-
-	t1=diag_os_gethrt();
-
-	if (ms==0 || !discover_done)
-		return;
-
 //3 different compile-time implementations
-//TODO : select implem at runtime if possible? + internal feedback loop
+//TODO : select implem at runtime if possible? (diag_os_hrtwait() has a feedback loop)
 #if defined(_POSIX_TIMERS) && (SEL_SLEEP==S_POSIX || SEL_SLEEP==S_AUTO)
 	struct timespec rqst, resp;
 	int rv;
@@ -372,7 +439,23 @@ diag_os_millisleep(unsigned int ms)
 	}
 #endif // SEL_SLEEP
 
+	return;
+}	//os_sleepms
+
+//return after (ms) milliseconds.
+void
+diag_os_millisleep(unsigned int ms)
+{
+	unsigned long long t1,t2;	//for verification
+	long int offsetus;
+
+	if (ms==0 || !discover_done)
+		return;
+
+	t1=diag_os_gethrt();
+	os_sleepms(ms);
 	t2 = diag_os_gethrt();
+
 	offsetus = ((long int) diag_os_hrtus(t2-t1)) - ms*1000;
 	if ((offsetus > 1500) || (offsetus < -1500))
 		printf("_millisleep off by %ld\n", offsetus);
@@ -381,6 +464,115 @@ diag_os_millisleep(unsigned int ms)
 
 }	//diag_os_millisleep
 
+
+/** diag_os_hrtwait() : sleep + spin **/
+#define HRTWAIT_MARGIN0	1000	//us; initial sleep margin
+#define HRTWAIT_MARGINMIN	50
+#define HRTWAIT_MARGINMAX	5000
+
+static pthread_mutex_t hrtwait_lock = PTHREAD_MUTEX_INITIALIZER;	//protects hrtwait_st
+static struct diag_os_waitstats hrtwait_st = {.margin = HRTWAIT_MARGIN0};
+
+//convert microseconds to a delta of diag_os_gethrt() timestamps; inverse of diag_os_hrtus()
+static unsigned long long hrt_fromus(unsigned long long us) {
+#if defined(_POSIX_TIMERS) && (SEL_HRT==S_POSIX || SEL_HRT==S_AUTO)
+	return us * 1000;
+#else
+	return us;
+#endif
+}
+
+//signed difference (a - b) of hrt timestamps, in us
+static long long hrt_diffus(unsigned long long a, unsigned long long b) {
+	if (a >= b)
+		return (long long) diag_os_hrtus(a - b);
+	return - (long long) diag_os_hrtus(b - a);
+}
+
+void diag_os_hrtwait(unsigned long long t0, unsigned long us) {
+	unsigned long long deadline, tsleep, now;
+	unsigned long margin;
+	long long wakelat = -1;	//us; how late the OS sleep returned, -1 if we didn't sleep
+	long long err;
+
+	if (!discover_done)
+		return;
+
+	deadline = t0 + hrt_fromus(us);
+
+	pthread_mutex_lock(&hrtwait_lock);
+	margin = hrtwait_st.margin;
+	pthread_mutex_unlock(&hrtwait_lock);
+
+	now = diag_os_gethrt();
+	if (hrt_diffus(deadline, now) > (long long) margin) {
+		//sleep until (deadline - margin)
+		tsleep = deadline - hrt_fromus(margin);
+#if defined(_POSIX_TIMERS) && (SEL_SLEEP==S_POSIX || SEL_SLEEP==S_AUTO)
+		struct timespec abst;
+		unsigned long long sleepns = diag_os_hrtus(tsleep - now) * 1000;
+		int rv;
+
+		//clock_nanosleep() can't use every clkid_gt (ex. CLOCK_MONOTONIC_RAW) :
+		//convert to clkid_ns. Both are monotonic, the rate difference is negligible here.
+		clock_gettime(clkid_ns, &abst);
+		abst.tv_sec += sleepns / (1000*1000*1000);
+		abst.tv_nsec += sleepns % (1000*1000*1000);
+		if (abst.tv_nsec >= 1000*1000*1000) {
+			abst.tv_sec++;
+			abst.tv_nsec -= 1000*1000*1000;
+		}
+		//absolute deadline : just retry if interrupted
+		while ((rv = clock_nanosleep(clkid_ns, TIMER_ABSTIME, &abst, NULL)) == EINTR) {}
+		if (rv != 0)
+			fprintf(stderr, "diag_os_hrtwait : error %d\n", rv);
+#else
+		os_sleepms((unsigned int) (diag_os_hrtus(tsleep - now) / 1000));
+#endif
+		wakelat = hrt_diffus(diag_os_gethrt(), tsleep);
+		if (wakelat < 0)
+			wakelat = 0;
+	}
+
+	//spin for the remainder.
+	while ((now = diag_os_gethrt()) < deadline) {}
+
+	err = hrt_diffus(now, deadline);
+
+	pthread_mutex_lock(&hrtwait_lock);
+	if (wakelat >= 0) {
+		//fast attack, slow decay
+		if (wakelat > (long long) hrtwait_st.margin) {
+			hrtwait_st.margin = wakelat + wakelat / 4;
+		} else {
+			hrtwait_st.margin -= (hrtwait_st.margin - wakelat) / 16;
+		}
+		if (hrtwait_st.margin > HRTWAIT_MARGINMAX)
+			hrtwait_st.margin = HRTWAIT_MARGINMAX;
+		if (hrtwait_st.margin < HRTWAIT_MARGINMIN)
+			hrtwait_st.margin = HRTWAIT_MARGINMIN;
+	}
+	hrtwait_st.count++;
+	hrtwait_st.sumerr += err;
+	if (err > hrtwait_st.maxerr)
+		hrtwait_st.maxerr = (long) err;
+	if (err > DIAG_OS_WAITLATE)
+		hrtwait_st.late++;
+	pthread_mutex_unlock(&hrtwait_lock);
+}
+
+void diag_os_getwaitstats(struct diag_os_waitstats *ws, bool reset) {
+	pthread_mutex_lock(&hrtwait_lock);
+	*ws = hrtwait_st;
+	if (reset) {
+		hrtwait_st.count = 0;
+		hrtwait_st.late = 0;
+		hrtwait_st.sumerr = 0;
+		hrtwait_st.maxerr = 0;
+	}
+	pthread_mutex_unlock(&hrtwait_lock);
+}
+
 /*
  * diag_os_ipending: Is input available on stdin. ret 1 if yes.
  *
@@ -424,7 +616,6 @@ diag_os_sched(void)
 		return 0;
 
 #if defined(_POSIX_PRIORITY_SCHEDULING) && (SEL_SCHED==S_POSIX || SEL_SCHED==S_LINUX || SEL_SCHED==S_AUTO)
-#include <sched.h>
 	/*
 	 * Check privileges
 	 */
@@ -480,6 +671,87 @@ diag_os_sched(void)
 }	//of diag_os_sched
 
 
+/** realtime mode **/
+int diag_os_rtprio;
+int diag_os_rtcpu = -1;
+
+#define RT_STACK	(64 * 1024)	//bytes of stack to pre-fault
+
+static struct {
+	int depth;	//diag_os_rt_enter() nesting
+	unsigned int got;	//DIAG_OS_RT_* achieved by the outermost call
+	int policy;	//saved scheduling
+	struct sched_param param;
+#if defined(__linux__)
+	cpu_set_t cpus;	//saved affinity
+#endif
+} rt_st;
+
+//touch RT_STACK bytes of stack, so that page faults happen now instead of
+//during the timing-critical part (with mlockall(MCL_FUTURE), they stay resident).
+static __attribute__((noinline)) void rt_prefault(void) {
+	volatile uint8_t buf[RT_STACK];
+	size_t i;
+
+	for (i = 0; i < sizeof(buf); i += 1024)
+		buf[i] = 0;
+}
+
+unsigned int diag_os_rt_enter(void) {
+	struct sched_param p;
+
+	if (diag_os_rtprio <= 0)
+		return 0;
+	if (rt_st.depth++)
+		return rt_st.got;
+
+	rt_st.got = 0;
+	if (pthread_getschedparam(pthread_self(), &rt_st.policy, &rt_st.param) == 0) {
+		p.sched_priority = diag_os_rtprio;
+		if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &p) == 0)
+			rt_st.got |= DIAG_OS_RT_FIFO;
+	}
+
+#ifdef _POSIX_MEMLOCK
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+		rt_st.got |= DIAG_OS_RT_MLOCK;
+#endif
+
+#if defined(__linux__)
+	if ((diag_os_rtcpu >= 0) && (diag_os_rtcpu < CPU_SETSIZE) &&
+			(sched_getaffinity(0, sizeof(rt_st.cpus), &rt_st.cpus) == 0)) {
+		cpu_set_t cs;
+
+		CPU_ZERO(&cs);
+		CPU_SET(diag_os_rtcpu, &cs);
+		if (sched_setaffinity(0, sizeof(cs), &cs) == 0)
+			rt_st.got |= DIAG_OS_RT_PIN;
+	}
+#endif
+
+	rt_prefault();
+	rt_st.got |= DIAG_OS_RT_STACK;
+	return rt_st.got;
+}
+
+void diag_os_rt_exit(void) {
+	if ((rt_st.depth == 0) || --rt_st.depth)
+		return;
+
+	if (rt_st.got & DIAG_OS_RT_FIFO)
+		(void) pthread_setschedparam(pthread_self(), rt_st.policy, &rt_st.param);
+#ifdef _POSIX_MEMLOCK
+	if (rt_st.got & DIAG_OS_RT_MLOCK)
+		(void) munlockall();
+#endif
+#if defined(__linux__)
+	if (rt_st.got & DIAG_OS_RT_PIN)
+		(void) sched_setaffinity(0, sizeof(rt_st.cpus), &rt_st.cpus);
+#endif
+	rt_st.got = 0;
+}
+
+
 //diag_os_geterr : get OS-specific error string.
 //Either gets the last error if os_errno==0, or print the
 //message associated with the specified os_errno
@@ -575,19 +847,114 @@ static void diag_os_discover(void) {
 }
 
 
-//diag_os_calibrate : run some timing tests to make sure we have
-//adequate performances.
-//call after diag_os_discover !
-void diag_os_calibrate(void) {
+/** diag_os_calibrate() results, cached per host + kernel **/
+#define CALIB_FILE	".freediag_calib"	//in $HOME; ".<nodename>" is appended
+#define CALIB_VERSION	1	//bump if struct os_calib changes
+#define CALIB_KEYLEN	512
+
+struct os_calib {
+	unsigned long hrt_res;	//us; worst measured diag_os_gethrt() resolution
+	unsigned long ms_res;	//ms; worst measured diag_os_getms() resolution
+	long sleep_err;		//us; worst average diag_os_millisleep() error
+	unsigned long sleep_spread;	//%; worst diag_os_millisleep() spread
+	unsigned long margin;	//us; diag_os_hrtwait() sleep margin
+};
+
+static bool calib_stopping(void) {
+	bool rv;
+	pthread_mutex_lock(&calib_lock);
+	rv = calib_quit;
+	pthread_mutex_unlock(&calib_lock);
+	return rv;
+}
+
+//get cache file name (caller must free) + identification string for this host and kernel.
+//ret 0 if ok
+static int calib_id(char **path, char *key) {
+	struct utsname un;
+	const char *home = getenv("HOME");
+
+	if ((home == NULL) || (uname(&un) != 0))
+		return -1;
+	snprintf(key, CALIB_KEYLEN, "%s %s %s %s %s", un.nodename, un.sysname,
+		un.release, un.version, un.machine);
+	if (diag_malloc(path, strlen(home) + strlen(CALIB_FILE) + strlen(un.nodename) + 3))
+		return -1;
+	sprintf(*path, "%s/%s.%s", home, CALIB_FILE, un.nodename);
+	return 0;
+}
+
+//ret 0 if a valid cache was found for this host + kernel
+static int calib_load(struct os_calib *c) {
+	char *path;
+	char key[CALIB_KEYLEN];
+	char line[CALIB_KEYLEN + 8];
+	FILE *fp;
+	int ver, rv = -1;
+
+	if (calib_id(&path, key))
+		return -1;
+	fp = fopen(path, "r");
+	free(path);
+	if (fp == NULL)
+		return -1;
+
+	//line 1 : comment; 2 : version; 3 : key; 4 : results
+	if (!fgets(line, sizeof(line), fp) ||
+		(fscanf(fp, "version %d\n", &ver) != 1) || (ver != CALIB_VERSION) ||
+		!fgets(line, sizeof(line), fp)) {
+		goto done;
+	}
+	line[strcspn(line, "\n")] = 0;
+	if ((strncmp(line, "key ", 4) != 0) || (strcmp(&line[4], key) != 0))
+		goto done;	//other kernel
+	if (fscanf(fp, "%lu %lu %ld %lu %lu", &c->hrt_res, &c->ms_res, &c->sleep_err,
+			&c->sleep_spread, &c->margin) != 5) {
+		goto done;
+	}
+	rv = 0;
+done:
+	fclose(fp);
+	return rv;
+}
+
+//write to a temp file + rename, so that concurrent instances never see half a file.
+static void calib_save(const struct os_calib *c) {
+	char *path, *tmp;
+	char key[CALIB_KEYLEN];
+	FILE *fp;
+
+	if (calib_id(&path, key))
+		return;
+	if (diag_malloc(&tmp, strlen(path) + 16)) {
+		free(path);
+		return;
+	}
+	sprintf(tmp, "%s.%ld", path, (long) getpid());
+
+	fp = fopen(tmp, "w");
+	if (fp) {
+		fprintf(fp, "# freediag timing calibration; delete this file to force a full calibration\n");
+		fprintf(fp, "version %d\n", CALIB_VERSION);
+		fprintf(fp, "key %s\n", key);
+		fprintf(fp, "%lu %lu %ld %lu %lu\n", c->hrt_res, c->ms_res, c->sleep_err,
+			c->sleep_spread, c->margin);
+		if ((fclose(fp) != 0) || (rename(tmp, path) != 0)) {
+			remove(tmp);
+		}
+	}
+	free(tmp);
+	free(path);
+}
+
+//run the timing tests. If !verbose, print nothing but serious warnings.
+//ret 0 if ok, -1 if interrupted by diag_os_close()
+static int calib_measure(struct os_calib *c, bool verbose) {
 	#define RESOL_ITERS	5
-	static int calibrate_done=0;
 	unsigned long t1, t2, t3;
 	unsigned long long tl1, tl2, resol, maxres;	//for _gethrt()
 
-	if (calibrate_done)
-		return;
-	if (!discover_done)
-		diag_os_discover();
+	memset(c, 0, sizeof(*c));
 
 	//test _gethrt(). clock_getres() would tell us the resolution, but measuring
 	//like this gives a better measure of "usable" res.
@@ -601,10 +968,12 @@ void diag_os_calibrate(void) {
 		if (tr > maxres) maxres = tr;
 		resol += tr;
 	}
-	printf("diag_os_gethrt() resolution <= %lluus, avg ~%lluus\n",
+	c->hrt_res = (unsigned long) diag_os_hrtus(maxres);
+	if (verbose)
+		printf("diag_os_gethrt() resolution <= %lluus, avg ~%lluus\n",
 			diag_os_hrtus(maxres), diag_os_hrtus(resol / RESOL_ITERS));
 	if (diag_os_hrtus(maxres) >= 1200)
-		printf("WARNING : your system offers no clock >= 1kHz; this WILL be a problem!\n");
+		fprintf(verbose? stdout:stderr, "WARNING : your system offers no clock >= 1kHz; this WILL be a problem!\n");
 
 	//test _getms()
 	resol=0;
@@ -617,14 +986,18 @@ void diag_os_calibrate(void) {
 		if (tr > maxres) maxres = tr;
 		resol += tr;
 	}
-	printf("diag_os_getms() resolution <= ~%llums, avg ~%llums\n", maxres, resol / RESOL_ITERS);
-	if (t2 > ((unsigned long)(-1) - 1000*30*60)) {
-		//unlikely, since 32-bit milliseconds will wrap in 49.7 days
-		printf("warning : diag_os_getms() will wrap in <30 minutes ! Consider rebooting...\n");
+	c->ms_res = (unsigned long) maxres;
+	if (verbose) {
+		printf("diag_os_getms() resolution <= ~%llums, avg ~%llums\n", maxres, resol / RESOL_ITERS);
+		if (t2 > ((unsigned long)(-1) - 1000*30*60)) {
+			//unlikely, since 32-bit milliseconds will wrap in 49.7 days
+			printf("warning : diag_os_getms() will wrap in <30 minutes ! Consider rebooting...\n");
+		}
 	}
 
 	//test _millisleep() VS _gethrt()
-	printf("testing diag_os_millisleep(), this will take a moment...\n");
+	if (verbose)
+		printf("testing diag_os_millisleep(), this will take a moment...\n");
 	for (int testval=50; testval > 0; testval -= 2) {
 		//Start with the highest timeout
 		int i;
@@ -637,8 +1010,10 @@ void diag_os_calibrate(void) {
 
 		for (i=0; i< iters; i++) {
 			long long timediff;
+			if (calib_stopping())
+				return -1;
 			tl1=diag_os_gethrt();
-			diag_os_millisleep(testval);
+			os_sleepms(testval);
 			tl2=diag_os_gethrt();
 			timediff= (long long) diag_os_hrtus(tl2 - tl1);
 			tsum += timediff;
@@ -649,9 +1024,13 @@ void diag_os_calibrate(void) {
 				max = timediff;
 		}
 		avgerr= (tsum/iters) - (testval*1000);	//average error in us
+		if (avgerr > c->sleep_err)
+			c->sleep_err = (long) avgerr;
+		if (((max-min)*100)/(testval*1000) > (long long) c->sleep_spread)
+			c->sleep_spread = (unsigned long) (((max-min)*100)/(testval*1000));
 		//a high spread (max-min) indicates initbus with dumb interfaces will be
 		//fragile. We just print it out; there's not much we can do to fix this.
-		if ((min < (testval*1000)) || (avgerr > 900)) {
+		if (verbose && ((min < (testval*1000)) || (avgerr > 900))) {
 			printf("diag_os_millisleep(%d) off by %lld%% (+%lldus)"
 			"; spread=%lld%%\n", testval, (avgerr*100/1000)/testval, avgerr, ((max-min)*100)/(testval*1000));
 		}
@@ -661,6 +1040,23 @@ void diag_os_calibrate(void) {
 			testval -= 7;
 	}	//for testvals
 
+	if (!verbose)
+		return 0;
+
+	//test _hrtwait(); this also tunes its margin. Not in the background :
+	//this would skew the stats of real waits.
+	{
+		struct diag_os_waitstats ws;
+		for (int testval=20; testval > 0; testval -= 3) {
+			for (int i=0; i < 3; i++) {
+				diag_os_hrtwait(diag_os_gethrt(), testval * 1000);
+			}
+		}
+		diag_os_getwaitstats(&ws, 1);
+		printf("diag_os_hrtwait() : avg error %lldus, max %ldus, margin %luus\n",
+			ws.sumerr / (long long) ws.count, ws.maxerr, ws.margin);
+	}
+
 	//now test chronoms()
 	t3=diag_os_chronoms(0);	//get current relative time
 	t1=diag_os_chronoms(t3);	//reset stopwatch & get current time (~0)
@@ -669,8 +1065,71 @@ void diag_os_calibrate(void) {
 
 	printf("diag_os_chronoms() : initial time %lums; resolution: ~%lums\n",
 		t3, t2-t1);
+	return 0;
+}
+
+//background re-validation of cached results : update the cache for next time.
+//Starts after CALIB_BGDELAY, unless diag_os_close() is called before.
+static void *calib_bgthread(UNUSED(void *unused)) {
+	struct os_calib c;
+	struct timespec abst;
+	bool quit;
+
+	clock_gettime(CLOCK_REALTIME, &abst);
+	abst.tv_sec += CALIB_BGDELAY;
+	pthread_mutex_lock(&calib_lock);
+	while (!calib_quit) {
+		if (pthread_cond_timedwait(&calib_cond, &calib_lock, &abst) == ETIMEDOUT)
+			break;
+	}
+	quit = calib_quit;
+	pthread_mutex_unlock(&calib_lock);
+	if (quit)
+		return NULL;
+
+	if (calib_measure(&c, 0))
+		return NULL;
+	pthread_mutex_lock(&hrtwait_lock);
+	c.margin = hrtwait_st.margin;
+	pthread_mutex_unlock(&hrtwait_lock);
+	calib_save(&c);
+	return NULL;
+}
+
+//diag_os_calibrate : run some timing tests to make sure we have
+//adequate performances.
+//Results are cached in $HOME (per host + kernel); if the cache is valid, they're
+//only re-checked in a background thread, so that startup isn't delayed.
+//call after diag_os_discover !
+void diag_os_calibrate(void) {
+	static int calibrate_done=0;
+	struct os_calib c;
 
+	if (calibrate_done)
+		return;
+	if (!discover_done)
+		diag_os_discover();
 	calibrate_done=1;
+
+	if (calib_load(&c) == 0) {
+		printf("Using cached timing calibration: gethrt() res %luus, getms() res %lums, "
+			"millisleep() err %+ldus\n", c.hrt_res, c.ms_res, c.sleep_err);
+		pthread_mutex_lock(&hrtwait_lock);
+		hrtwait_st.margin = c.margin;
+		pthread_mutex_unlock(&hrtwait_lock);
+
+		calib_quit = 0;
+		if (pthread_create(&calib_thread, NULL, calib_bgthread, NULL) == 0)
+			calib_bg = 1;
+		return;
+	}
+
+	if (calib_measure(&c, 1))
+		return;
+	pthread_mutex_lock(&hrtwait_lock);
+	c.margin = hrtwait_st.margin;
+	pthread_mutex_unlock(&hrtwait_lock);
+	calib_save(&c);
 	return;
 }	//diag_os_calibrate
 
@@ -36,9 +36,11 @@ extern "C" {
 	### Map of features with more than one implementation related to POSIX ###
 
 	## time-related features ##
-	SEL_PERIODIC: Periodic timer callback (for L2+L3 keepalives)
-		A) needs _POSIX_TIMERS, uses timer_create()
-		B) (available everywhere?) setitimer+sigaction to install a SIGALRM handler
+	SEL_PERIODIC: Timer thread for diag_timer (L2+L3 keepalives etc)
+		A) needs _POSIX_TIMERS, thread sleeping until the next deadline
+			with pthread_cond_timedwait() on CLOCK_MONOTONIC
+		B) (available everywhere?) setitimer+sigaction to install a SIGALRM
+			handler polling the timers every ALARM_TIMEOUT
 	SEL_SLEEP: diag_os_millisleep()
 		A) needs _POSIX_TIMERS, uses clock_nanosleep()
 		B) needs __linux__ && (uid==root), uses /dev/rtc
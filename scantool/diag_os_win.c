@@ -25,8 +25,8 @@
 
 #include "diag_l1.h"
 #include "diag_l2.h"
-#include "diag_l3.h"
 #include "diag_err.h"
+#include "diag_timer.h"
 
 
 #include <process.h>
@@ -51,6 +51,7 @@ int shortsleep_reliable=0;	//TODO : auto-detect this on startup. See diag_os_mil
 HANDLE hDiagTimer = INVALID_HANDLE_VALUE;
 
 CRITICAL_SECTION periodic_lock;
+static CRITICAL_SECTION hrtwait_lock;	//protects hrtwait_st
 
 VOID CALLBACK timercallback(UNUSED(PVOID lpParam), BOOLEAN timedout) {
 
@@ -60,16 +61,21 @@ VOID CALLBACK timercallback(UNUSED(PVOID lpParam), BOOLEAN timedout) {
 		//this should never happen.
 		fprintf(stderr, FLFMT "Problem with OS timer callback! Report this !\n", FL);
 	} else {
-		diag_l3_timer();	/* Call L3 Timer */
-		diag_l2_timer();	/* Call L2 timer */
+		unsigned long next;
+		(void) diag_timer_run(&next);	/* Call expired keepalive timers etc */
 	}
 	LeaveCriticalSection(&periodic_lock);
 
 	return;
 }
 
+//the periodic callback polls the timer heap every ALARM_TIMEOUT; nothing to do.
+void diag_os_timer_wake(void) {
+	return;
+}
+
 //diag_os_init : a bit of a misnomer. This sets up a periodic callback
-//to call diag_l3_timer and diag_l2_timer; that would sound like a job
+//to run expired diag_timer handlers; that would sound like a job
 //for "diag_os_sched". The WIN32 version of diag_os_init also
 //calls diag_os_sched to increase thread priority.
 //return 0 if ok
@@ -87,6 +93,7 @@ diag_os_init(void)
 	//is the timer queue... so that's what we do.
 	//we create the timer in the default timerqueue
 	InitializeCriticalSection(&periodic_lock);
+	InitializeCriticalSection(&hrtwait_lock);
 
 	if (! CreateTimerQueueTimer(&hDiagTimer, NULL,
 			(WAITORTIMERCALLBACK) timercallback, NULL, tmo, tmo,
@@ -160,6 +167,7 @@ int diag_os_close() {
 goodexit:
 	hDiagTimer = INVALID_HANDLE_VALUE;
 	DeleteCriticalSection(&periodic_lock);
+	DeleteCriticalSection(&hrtwait_lock);
 	return 0;
 } 	//diag_os_close
 
@@ -217,6 +225,76 @@ diag_os_millisleep(unsigned int ms)
 }	//diag_os_millisleep
 
 
+/** diag_os_hrtwait() : Sleep() + QPC loop **/
+#define HRTWAIT_MARGIN0	2000	//us; initial sleep margin. Sleep() has ~1ms granularity at best
+#define HRTWAIT_MARGINMIN	1000
+#define HRTWAIT_MARGINMAX	16000
+
+static struct diag_os_waitstats hrtwait_st = {.margin = HRTWAIT_MARGIN0};
+
+void diag_os_hrtwait(unsigned long long t0, unsigned long us) {
+	LONGLONG deadline, tsleep, now;
+	long long wakelat = -1;	//us; how late Sleep() returned, -1 if we didn't sleep
+	long long err;
+	unsigned long margin;
+
+	assert(pfconv_valid);
+
+	deadline = (LONGLONG) t0 + (LONGLONG) ((us * perfo_freq.QuadPart) / 1000000);
+
+	EnterCriticalSection(&hrtwait_lock);
+	margin = hrtwait_st.margin;
+	LeaveCriticalSection(&hrtwait_lock);
+
+	now = (LONGLONG) diag_os_gethrt();
+	if ((long long) ((deadline - now) * pf_conv) > (long long) margin) {
+		tsleep = deadline - (LONGLONG) ((margin * perfo_freq.QuadPart) / 1000000);
+		Sleep((DWORD) ((tsleep - now) * pf_conv / 1000));
+		wakelat = (long long) (((LONGLONG) diag_os_gethrt() - tsleep) * pf_conv);
+		if (wakelat < 0)
+			wakelat = 0;
+	}
+
+	//QPC loop for the remainder
+	while ((now = (LONGLONG) diag_os_gethrt()) < deadline) {}
+
+	err = (long long) ((now - deadline) * pf_conv);
+
+	EnterCriticalSection(&hrtwait_lock);
+	if (wakelat >= 0) {
+		//fast attack, slow decay
+		if (wakelat > (long long) hrtwait_st.margin) {
+			hrtwait_st.margin = wakelat + wakelat / 4;
+		} else {
+			hrtwait_st.margin -= (hrtwait_st.margin - wakelat) / 16;
+		}
+		if (hrtwait_st.margin > HRTWAIT_MARGINMAX)
+			hrtwait_st.margin = HRTWAIT_MARGINMAX;
+		if (hrtwait_st.margin < HRTWAIT_MARGINMIN)
+			hrtwait_st.margin = HRTWAIT_MARGINMIN;
+	}
+	hrtwait_st.count++;
+	hrtwait_st.sumerr += err;
+	if (err > hrtwait_st.maxerr)
+		hrtwait_st.maxerr = (long) err;
+	if (err > DIAG_OS_WAITLATE)
+		hrtwait_st.late++;
+	LeaveCriticalSection(&hrtwait_lock);
+}
+
+void diag_os_getwaitstats(struct diag_os_waitstats *ws, bool reset) {
+	EnterCriticalSection(&hrtwait_lock);
+	*ws = hrtwait_st;
+	if (reset) {
+		hrtwait_st.count = 0;
+		hrtwait_st.late = 0;
+		hrtwait_st.sumerr = 0;
+		hrtwait_st.maxerr = 0;
+	}
+	LeaveCriticalSection(&hrtwait_lock);
+}
+
+
 int
 diag_os_ipending(void) {
 	if (_kbhit()) {
@@ -260,6 +338,67 @@ diag_os_sched(void)
 }	//of diag_os_sched
 
 
+/** realtime mode : TIME_CRITICAL thread priority and CPU affinity.
+ * Memory locking (VirtualLock) is not done. diag_os_rtprio only enables it. */
+int diag_os_rtprio;
+int diag_os_rtcpu = -1;
+
+#define RT_STACK	(64 * 1024)	//bytes of stack to pre-fault
+
+static struct {
+	int depth;	//diag_os_rt_enter() nesting
+	unsigned int got;	//DIAG_OS_RT_* achieved by the outermost call
+	int prio;	//saved thread priority
+	DWORD_PTR affinity;	//saved thread affinity
+} rt_st;
+
+static void rt_prefault(void) {
+	volatile uint8_t buf[RT_STACK];
+	size_t i;
+
+	for (i = 0; i < sizeof(buf); i += 1024)
+		buf[i] = 0;
+}
+
+unsigned int diag_os_rt_enter(void) {
+	HANDLE curthread = GetCurrentThread();
+
+	if (diag_os_rtprio <= 0)
+		return 0;
+	if (rt_st.depth++)
+		return rt_st.got;
+
+	rt_st.got = 0;
+	rt_st.prio = GetThreadPriority(curthread);
+	if ((rt_st.prio != THREAD_PRIORITY_ERROR_RETURN) &&
+			SetThreadPriority(curthread, THREAD_PRIORITY_TIME_CRITICAL))
+		rt_st.got |= DIAG_OS_RT_FIFO;
+
+	if ((diag_os_rtcpu >= 0) && (diag_os_rtcpu < (int) (8 * sizeof(DWORD_PTR)))) {
+		rt_st.affinity = SetThreadAffinityMask(curthread, (DWORD_PTR) 1 << diag_os_rtcpu);
+		if (rt_st.affinity)
+			rt_st.got |= DIAG_OS_RT_PIN;
+	}
+
+	rt_prefault();
+	rt_st.got |= DIAG_OS_RT_STACK;
+	return rt_st.got;
+}
+
+void diag_os_rt_exit(void) {
+	HANDLE curthread = GetCurrentThread();
+
+	if ((rt_st.depth == 0) || --rt_st.depth)
+		return;
+
+	if (rt_st.got & DIAG_OS_RT_FIFO)
+		(void) SetThreadPriority(curthread, rt_st.prio);
+	if (rt_st.got & DIAG_OS_RT_PIN)
+		(void) SetThreadAffinityMask(curthread, rt_st.affinity);
+	rt_st.got = 0;
+}
+
+
 
 //diag_os_geterr : get OS-specific error string.
 //Either gets the last error if os_errno==0, or print the
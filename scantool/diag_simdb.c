@@ -0,0 +1,1239 @@
+/* freediag
+ *
+ * Car simulator (CARSIM) database : parser + request index
+ *
+ * GPLv3
+ *
+ * See diag_simdb.h for an overview. The whole .db file is read in memory,
+ * split in lines, and scanned twice : once to count RQ / RP / ECU / STATE
+ * lines, once to fill the tables. One trie per (ECU, state) is then built
+ * from a sorted copy of the request patterns active in that state, and
+ * every RP line is compiled to a response program.
+ */
+
+#include <assert.h>
+#include <ctype.h>
+#include <math.h> // sin()
+#include <stdlib.h>
+#include <string.h>
+
+#include "diag.h"
+#include "diag_err.h"
+#include "diag_os.h"
+#include "diag_l0.h"
+#include "diag_l1.h"
+#include "diag_simdb.h"
+
+#ifdef HAVE_MMAP
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
+#define TAG_REQUEST "RQ"
+#define TAG_RESPONSE "RP"
+#define TAG_CFG "CFG"
+#define TAG_ECU "ECU"
+#define TAG_STATE "STATE"
+#define TAG_GOTO "GOTO"
+#define STATE_ANY "*"
+#define VALUE_DONTCARE "XXXX"
+
+#define TOKEN_SINE1	 "sin1"
+#define TOKEN_SAWTOOTH1 "swt1"
+#define TOKEN_ISO9141CS "cks1"
+#define TOKEN_REQUESTBYTE "req"
+#define TOKEN_COUNTER1 "cnt1"
+#define RP_SEPS	" \t\r\n"
+
+#define CFG_DATAONLY "DATAONLY"
+#define CFG_NOL2CKSUM "NOL2CKSUM"
+#define CFG_FRAMED "FRAMED"
+#define CFG_FULLINIT "FULLINIT"
+#define CFG_P9141	"P_9141"
+#define CFG_P14230	"P_14230"
+#define CFG_P1850P	"P_J1850P"
+#define CFG_P1850V	"P_J1850V"
+#define CFG_PCAN	"P_CAN"
+#define CFG_PRAW	"P_RAW"
+#define CFG_BAUD	"BAUD"
+#define CFG_P1	"P1"
+#define CFG_P2	"P2"
+
+#define RP_P1	"P1="	//per-response timing overrides
+#define RP_P2	"P2="
+#define SIMDB_TUNSET	UINT16_MAX	//RP line doesn't override P1 / P2
+
+
+//skip the tag of a line (i.e. "RQ "), without running past the end
+static char *skiptag(char *line, const char *tag) {
+	size_t tl = strlen(tag);
+
+	if (line[tl] == '\0')
+		return &line[tl];
+	return &line[tl + 1];
+}
+
+//parse CFG line contents
+static void simdb_parsecfg(struct simdb *db, const char *p) {
+	if (strncmp(p, CFG_DATAONLY, strlen(CFG_DATAONLY)) == 0) {
+		db->dataonly = 1;
+	} else if (strncmp(p, CFG_NOL2CKSUM, strlen(CFG_NOL2CKSUM)) == 0) {
+		db->nocksum = 1;
+	} else if (strncmp(p, CFG_FRAMED, strlen(CFG_FRAMED)) == 0) {
+		db->framed = 1;
+	} else if (strncmp(p, CFG_FULLINIT, strlen(CFG_FULLINIT)) == 0) {
+		db->fullinit = 1;
+	} else if (strncmp(p, CFG_P9141, strlen(CFG_P9141)) == 0) {
+		db->proto_restrict=DIAG_L1_ISO9141;
+	} else if (strncmp(p, CFG_P14230, strlen(CFG_P14230)) == 0) {
+		db->proto_restrict=DIAG_L1_ISO14230;
+	} else if (strncmp(p, CFG_P1850P, strlen(CFG_P1850P)) == 0) {
+		db->proto_restrict=DIAG_L1_J1850_PWM;
+	} else if (strncmp(p, CFG_P1850V, strlen(CFG_P1850V)) == 0) {
+		db->proto_restrict=DIAG_L1_J1850_VPW;
+	} else if (strncmp(p, CFG_PCAN, strlen(CFG_PCAN)) == 0) {
+		db->proto_restrict=DIAG_L1_CAN;
+	} else if (strncmp(p, CFG_PRAW, strlen(CFG_PRAW)) == 0) {
+		db->proto_restrict=DIAG_L1_RAW;
+	} else if (strncmp(p, CFG_BAUD, strlen(CFG_BAUD)) == 0) {
+		unsigned long baud = strtoul(p + strlen(CFG_BAUD), NULL, 0);
+		if ((baud == 0) || (baud > 1000000)) {
+			fprintf(stderr, FLFMT "Invalid CFG line: %s\n", FL, p);
+		} else {
+			db->baud = (unsigned) baud;
+		}
+	} else if (strncmp(p, CFG_P1, strlen(CFG_P1)) == 0) {
+		db->p1 = (unsigned) MIN(strtoul(p + strlen(CFG_P1), NULL, 0), SIMDB_TUNSET - 1);
+	} else if (strncmp(p, CFG_P2, strlen(CFG_P2)) == 0) {
+		db->p2 = (unsigned) MIN(strtoul(p + strlen(CFG_P2), NULL, 0), SIMDB_TUNSET - 1);
+	}
+	return;
+}
+
+// Parse the optional "P1=x" / "P2=x" (ms) prefixes of an RP line,
+// or the ones following an ECU name.
+// @return start of the response bytes
+static const char *simdb_parsetiming(uint16_t *p1, uint16_t *p2, const char *p) {
+	*p1 = SIMDB_TUNSET;
+	*p2 = SIMDB_TUNSET;
+
+	while (1) {
+		uint16_t *tp;
+		char *q;
+		unsigned long ms;
+
+		p += strspn(p, RP_SEPS);
+		if (strncmp(p, RP_P1, strlen(RP_P1)) == 0) {
+			tp = p1;
+		} else if (strncmp(p, RP_P2, strlen(RP_P2)) == 0) {
+			tp = p2;
+		} else {
+			return p;
+		}
+		ms = strtoul(p + strlen(RP_P1), &q, 0);
+		if ((q == p + strlen(RP_P1)) || (ms >= SIMDB_TUNSET)) {
+			fprintf(stderr, FLFMT "Invalid timing in response: %s\n", FL, p);
+		} else {
+			*tp = (uint16_t) ms;
+		}
+		p = q;
+	}
+}
+
+// Parse one RQ element : "XXXX", "0xVV" where each nibble can be "X",
+// or "0xVV/0xMM" (explicit mask). The "0x" prefix is optional.
+// @return 0 if ok
+static int simdb_parserqbyte(const char *tok, uint8_t *val, uint8_t *mask) {
+	const char *slash;
+	unsigned i;
+
+	if (strcmp(tok, VALUE_DONTCARE) == 0) {
+		*val = 0;
+		*mask = 0;
+		return 0;
+	}
+
+	slash = strchr(tok, '/');
+	if (slash) {
+		unsigned long v, m;
+		char *p;
+
+		v = strtoul(tok, &p, 16);
+		if ((p == tok) || (p != slash))
+			return -1;
+		m = strtoul(slash + 1, &p, 16);
+		if ((p == slash + 1) || (*p != '\0') || (v > 0xFF) || (m > 0xFF))
+			return -1;
+		*mask = (uint8_t) m;
+		*val = (uint8_t) v & *mask;
+		return 0;
+	}
+
+	if ((tok[0] == '0') && ((tok[1] == 'x') || (tok[1] == 'X')) && (tok[2] != '\0'))
+		tok += 2;
+	if ((tok[0] == '\0') || (strlen(tok) > 2))
+		return -1;
+
+	*val = 0;
+	*mask = 0;
+	for (i = 0; tok[i] != '\0'; i++) {
+		*val <<= 4;
+		*mask <<= 4;
+		if (tok[i] == 'X') {
+			continue;
+		}
+		if (!isxdigit((unsigned char) tok[i]))
+			return -1;
+		*val |= (uint8_t) (isdigit((unsigned char) tok[i])? tok[i] - '0' : (toupper((unsigned char) tok[i]) - 'A' + 10));
+		*mask |= 0x0F;
+	}
+	if (i == 1)
+		*mask |= 0xF0;	//single digit : high nibble is 0
+	return 0;
+}
+
+// Parse up to SIMDB_REQBYTES elements of an RQ line into val[] and mask[].
+// Parsing stops at the first invalid element (comment, etc.)
+// @return number of pattern bytes
+static unsigned simdb_parserq(const char *p, uint8_t *val, uint8_t *mask) {
+	unsigned i;
+
+	for (i=0; i < SIMDB_REQBYTES; i++) {
+		char tok[32];
+		size_t toklen;
+
+		p += strspn(p, RP_SEPS);
+		if (*p == '\0')
+			break;
+		toklen = strcspn(p, RP_SEPS);
+		if (toklen >= sizeof(tok))
+			break;
+		memcpy(tok, p, toklen);
+		tok[toklen] = '\0';
+		p += toklen;
+		if (simdb_parserqbyte(tok, &val[i], &mask[i]))
+			break;
+	}
+	return i;
+}
+
+
+/** response compiler **/
+
+//parse the "N" or "N+" part of a reqN token.
+//@return 0-based request byte index, or -1 if invalid
+static int simdb_parsereq(const char *s, bool *increment) {
+	unsigned long index;
+	char *p;
+
+	*increment = 0;
+	if (!isdigit((unsigned char) *s))
+		return -1;
+	index = strtoul(s, &p, 10);
+	if (p[0]=='+' && p[1]=='\0') {
+		*increment = 1;
+	} else if (*p != '\0') {
+		return -1;
+	}
+	if ((index < 1) || (index > SIMDB_RPMAX))
+		return -1;
+	return (int) index - 1;
+}
+
+// Compile response text to a program; see SIMDB_OP_* .
+// Needs at most (strlen(text) + 3) bytes in prog[].
+// @return program length; *outlen is set to the number of response bytes.
+static unsigned simdb_compilerp(const char *text, uint8_t *prog, uint16_t *outlen) {
+	unsigned plen = 0;
+	unsigned pos = 0;	//response bytes
+	unsigned lit = 0;	//offset of current SIMDB_OP_LIT in prog[], if any
+	bool inlit = 0;
+	const char *p = text;
+
+	while (1) {
+		char tok[32];
+		size_t toklen;
+		uint8_t op = 0, arg = 0;
+
+		p += strspn(p, RP_SEPS);
+		if (*p == '\0')
+			break;
+		toklen = strcspn(p, RP_SEPS);
+		snprintf(tok, sizeof(tok), "%.*s", (int) toklen, p);
+		p += toklen;
+
+		if (pos == SIMDB_RPMAX) {
+			fprintf(stderr, "Malformed db file, > %d bytes on one line !\n", SIMDB_RPMAX);
+			break;
+		}
+
+		if (strcmp(tok, TOKEN_SINE1) == 0) {
+			op = SIMDB_OP_SIN1;
+		} else if (strcmp(tok, TOKEN_SAWTOOTH1) == 0) {
+			op = SIMDB_OP_SWT1;
+		} else if (strcmp(tok, TOKEN_ISO9141CS) == 0) {
+			op = SIMDB_OP_CKS1;
+		} else if (strcmp(tok, TOKEN_COUNTER1) == 0) {
+			op = SIMDB_OP_CNT1;
+		} else if (strncmp(tok, TOKEN_REQUESTBYTE, strlen(TOKEN_REQUESTBYTE)) == 0) {
+			bool increment;
+			int index = simdb_parsereq(tok + strlen(TOKEN_REQUESTBYTE), &increment);
+			if (index >= 0) {
+				op = increment? SIMDB_OP_REQINC : SIMDB_OP_REQ;
+				arg = (uint8_t) index;
+			} else {
+				//keep the byte, as a 0 value
+				fprintf(stderr, FLFMT "Invalid req* token in response: %s\n", FL, text);
+			}
+		} else {
+			// try scanning element as an Hex byte.
+			unsigned int tempbyte;
+			if (sscanf(tok, "%X", &tempbyte) != 1) {	//can't scan direct to uint8 !
+				fprintf(stderr, FLFMT "Error parsing line: %s at position %d.\n", FL, text, pos*5);
+				break;
+			}
+			arg = (uint8_t) tempbyte;
+		}
+
+		if (op) {
+			prog[plen++] = op;
+			prog[plen++] = arg;
+			inlit = 0;
+		} else {
+			//literal byte : append to current run
+			if (!inlit) {
+				lit = plen;
+				prog[plen++] = SIMDB_OP_LIT;
+				prog[plen++] = 0;
+				inlit = 1;
+			}
+			prog[plen++] = arg;
+			prog[lit + 1]++;
+		}
+		pos++;
+	}
+
+	*outlen = (uint16_t) pos;
+	return plen;
+}
+
+//ret 0 if ok
+static int simdb_compile(struct simdb *db) {
+	unsigned i, total;
+	int rv;
+
+	total = 0;
+	for (i=0; i < db->num_rp; i++) {
+		total += strlen(SIMDB_RPTEXT(db, &db->rp[i])) + 3;
+	}
+
+	if ((rv = diag_malloc(&db->progbuf, total + 1)))
+		return rv;
+
+	db->progbuf_len = 0;
+	for (i=0; i < db->num_rp; i++) {
+		struct simdb_rp *rp = &db->rp[i];
+
+		rp->prog = db->progbuf_len;
+		rp->proglen = (uint16_t) simdb_compilerp(SIMDB_RPTEXT(db, rp), &db->progbuf[rp->prog], &rp->len);
+		db->progbuf_len += rp->proglen;
+	}
+	return 0;
+}
+
+
+/** trie construction **/
+
+//patterns are sorted through these, since qsort() doesn't pass a context to rq_cmp.
+struct simdb_sortent {
+	const uint8_t *val;
+	const uint8_t *mask;
+	uint32_t len;
+	uint32_t idx;		//index in simdb->rq[]
+};
+
+//sort key for pattern byte [pos] : exact values first, then wildcards.
+static unsigned rq_key(const struct simdb_sortent *se, unsigned pos) {
+	if (se->mask[pos] == 0xFF)
+		return se->val[pos];
+	return 0x10000 | (se->mask[pos] << 8) | se->val[pos];
+}
+
+//qsort() comparator for an array of struct simdb_sortent.
+//Shorter patterns sort first; ties are kept in file order.
+static int rq_cmp(const void *a, const void *b) {
+	const struct simdb_sortent *ra = a;
+	const struct simdb_sortent *rb = b;
+	unsigned i;
+
+	for (i=0; (i < ra->len) && (i < rb->len); i++) {
+		unsigned ka = rq_key(ra, i);
+		unsigned kb = rq_key(rb, i);
+		if (ka != kb)
+			return (ka < kb)? -1 : 1;
+	}
+	if (ra->len != rb->len)
+		return (ra->len < rb->len)? -1 : 1;
+	return (ra->idx < rb->idx)? -1 : (ra->idx > rb->idx);
+}
+
+// Build the subtree for sorted[lo..hi-1], which all share the first (depth) pattern bytes.
+// @return new node index
+static uint32_t simdb_buildnode(struct simdb *db, const struct simdb_sortent *sorted,
+		unsigned lo, unsigned hi, unsigned depth) {
+	uint32_t n, term, sub, e;
+	unsigned i, j, k, ngroups, nexact;
+
+	n = db->num_nodes++;
+	term = SIMDB_NONE;
+
+	//patterns ending here sort first
+	for (i = lo; (i < hi) && (sorted[i].len == depth); i++) {
+		if (sorted[i].idx < term)
+			term = sorted[i].idx;
+	}
+
+	//one edge per distinct byte at this depth
+	ngroups = 0;
+	nexact = 0;
+	for (j = i; j < hi; j++) {
+		if ((j == i) || (rq_key(&sorted[j], depth) != rq_key(&sorted[j - 1], depth))) {
+			ngroups++;
+			if (sorted[j].mask[depth] == 0xFF)
+				nexact++;
+		}
+	}
+
+	e = db->num_edges;
+	db->num_edges += ngroups;
+	db->nodes[n].edge0 = e;
+	db->nodes[n].nedges = (uint16_t) ngroups;
+	db->nodes[n].nexact = (uint16_t) nexact;
+	db->nodes[n].term = term;
+
+	sub = term;
+	for (j = i; j < hi; j = k, e++) {
+		uint32_t child;
+		for (k = j + 1; (k < hi) && (rq_key(&sorted[k], depth) == rq_key(&sorted[j], depth)); k++) {}
+
+		db->edges[e].val = sorted[j].val[depth];
+		db->edges[e].mask = sorted[j].mask[depth];
+		child = simdb_buildnode(db, sorted, j, k, depth + 1);
+		db->edges[e].child = child;
+		if (db->nodes[child].sub < sub)
+			sub = db->nodes[child].sub;
+	}
+	db->nodes[n].sub = sub;
+
+	return n;
+}
+
+//build the trie of every (ECU, state). ret 0 if ok
+static int simdb_index(struct simdb *db) {
+	struct simdb_sortent *sorted;
+	unsigned i, st, nsorted;
+	size_t patbytes;
+	int rv;
+
+	//worst case : one node per pattern byte in every trie, plus the roots.
+	//Patterns active in all states appear in all the tries of their ECU.
+	patbytes = 0;
+	for (i=0; i < db->num_rq; i++) {
+		const struct simdb_rq *rq = &db->rq[i];
+		patbytes += (size_t) rq->len *
+			((rq->state == SIMDB_NONE)? db->ecus[rq->ecu].nstates : 1);
+	}
+	if ((rv = diag_calloc(&db->nodes, patbytes + db->num_states)))
+		return rv;
+	if ((rv = diag_calloc(&db->edges, patbytes + 1)))
+		return rv;
+	if ((rv = diag_calloc(&sorted, db->num_rq + 1)))
+		return rv;
+
+	db->num_nodes = 0;
+	db->num_edges = 0;
+	for (st = 0; st < db->num_states; st++) {
+		nsorted = 0;
+		for (i=0; i < db->num_rq; i++) {
+			const struct simdb_rq *rq = &db->rq[i];
+			const struct simdb_ecu *ecu = &db->ecus[rq->ecu];
+
+			if (rq->state != SIMDB_NONE) {
+				if (rq->state != st)
+					continue;
+			} else if ((st < ecu->state0) || (st >= ecu->state0 + ecu->nstates)) {
+				continue;
+			}
+			sorted[nsorted].val = SIMDB_RQVAL(db, rq);
+			sorted[nsorted].mask = SIMDB_RQMASK(db, rq);
+			sorted[nsorted].len = rq->len;
+			sorted[nsorted].idx = i;
+			nsorted++;
+		}
+		qsort(sorted, nsorted, sizeof(*sorted), rq_cmp);
+		db->states[st].root = simdb_buildnode(db, sorted, 0, nsorted, 0);
+	}
+
+	free(sorted);
+	return 0;
+}
+
+
+//read whole file in a new buffer, 0-terminated.
+//@return 0 if ok
+static int simdb_readfile(FILE *fp, const char *fname, char **pbuf, long *plen) {
+	long flen;
+	char *buf;
+	int rv;
+
+	if ((fseek(fp, 0, SEEK_END) != 0) || ((flen = ftell(fp)) < 0)) {
+		fprintf(stderr, FLFMT "Can't get size of \"%s\"\n", FL, fname);
+		return DIAG_ERR_GENERAL;
+	}
+	rewind(fp);
+
+	if ((rv = diag_malloc(&buf, flen + 1)))
+		return rv;
+
+	if (fread(buf, 1, flen, fp) != (size_t) flen) {
+		fprintf(stderr, FLFMT "Error reading \"%s\"\n", FL, fname);
+		free(buf);
+		return DIAG_ERR_GENERAL;
+	}
+
+	buf[flen] = '\0';
+	*pbuf = buf;
+	*plen = flen;
+	return 0;
+}
+
+
+/** text format **/
+
+//terminate the first token of p in-place (names on ECU / STATE / GOTO lines).
+//@return token start; *rest points after it.
+static char *simdb_name(char *p, char **rest) {
+	size_t toklen;
+
+	p += strspn(p, RP_SEPS);
+	toklen = strcspn(p, RP_SEPS);
+	*rest = (p[toklen] == '\0')? &p[toklen] : &p[toklen + 1];
+	p[toklen] = '\0';
+	return p;
+}
+
+//find state (name) of an ECU. @return state index or SIMDB_NONE
+static uint32_t simdb_findstate(const struct simdb *db, const struct simdb_ecu *ecu, const char *name) {
+	uint32_t i;
+
+	for (i = ecu->state0; i < ecu->state0 + ecu->nstates; i++) {
+		if (strcmp(SIMDB_NAME(db, &db->states[i]), name) == 0)
+			return i;
+	}
+	return SIMDB_NONE;
+}
+
+//close the current ECU section : an ECU without STATE lines gets one unnamed state.
+static void simdb_endecu(struct simdb *db, struct simdb_ecu *ecu) {
+	if (ecu->nstates)
+		return;
+	db->states[db->num_states].name = db->textbuf_len - 1;	//""
+	db->num_states++;
+	ecu->nstates = 1;
+}
+
+//ret 0 if ok
+static int simdb_loadtext(struct simdb *db, FILE *fp, const char *fname) {
+	char *line, *eol, *end;
+	long flen;
+	unsigned nrq, nrp, necu, nstate;
+	size_t rqchars;
+	unsigned i, j;
+	struct simdb_rq *currq;
+	struct simdb_ecu *curecu;
+	uint32_t curstate;
+	uint16_t *ecutiming;	//P1, P2 of every ECU line
+	char **gotoname;	//GOTO target of every RQ line
+	int rv;
+
+	db->baud = SIMDB_DEF_BAUD;
+	db->p1 = SIMDB_DEF_P1;
+	db->p2 = SIMDB_DEF_P2;
+
+	if ((rv = simdb_readfile(fp, fname, &db->textbuf, &flen)))
+		return rv;
+	db->textbuf_len = (unsigned) flen + 1;
+	end = db->textbuf + flen;
+
+	//1) split lines, count requests + responses, ECUs and states
+	nrq = 0;
+	nrp = 0;
+	necu = 1;	//lines before the first ECU line go to an unnamed ECU
+	nstate = 1;
+	rqchars = 0;
+	for (line = db->textbuf; line < end; line = eol + 1) {
+		eol = strchr(line, '\n');
+		if (eol == NULL)
+			eol = end;
+		*eol = '\0';
+
+		if (strncmp(line, TAG_REQUEST, strlen(TAG_REQUEST)) == 0) {
+			nrq++;
+			rqchars += (size_t) (eol - line);
+		} else if ((strncmp(line, TAG_RESPONSE, strlen(TAG_RESPONSE)) == 0) && nrq) {
+			//responses before the first request are unreachable
+			nrp++;
+		} else if (strncmp(line, TAG_ECU, strlen(TAG_ECU)) == 0) {
+			necu++;
+			nstate++;	//in case it has no STATE lines
+		} else if (strncmp(line, TAG_STATE, strlen(TAG_STATE)) == 0) {
+			nstate++;
+		}
+	}
+
+	if ((rv = diag_calloc(&db->rq, nrq + 1)) ||
+		(rv = diag_calloc(&db->rp, nrp + 1)) ||
+		(rv = diag_calloc(&db->ecus, necu)) ||
+		(rv = diag_calloc(&db->states, nstate)) ||
+		//every pattern byte takes at least 2 chars (element + separator)
+		(rv = diag_calloc(&db->patbuf, rqchars + 1))) {
+		return rv;
+	}
+	if ((rv = diag_calloc(&ecutiming, 2 * necu))) {
+		return rv;
+	}
+	if ((rv = diag_calloc(&gotoname, nrq + 1))) {
+		free(ecutiming);
+		return rv;
+	}
+
+	//2) parse
+	currq = NULL;
+	db->patbuf_len = 0;
+	db->num_ecus = 1;
+	curecu = &db->ecus[0];
+	curecu->name = db->textbuf_len - 1;	//""
+	ecutiming[0] = ecutiming[1] = SIMDB_TUNSET;
+	curstate = SIMDB_NONE;
+	for (line = db->textbuf; line < end; line += strlen(line) + 1) {
+		if (strncmp(line, TAG_CFG, strlen(TAG_CFG)) == 0) {
+			simdb_parsecfg(db, skiptag(line, TAG_CFG));
+		} else if (strncmp(line, TAG_REQUEST, strlen(TAG_REQUEST)) == 0) {
+			uint8_t val[SIMDB_REQBYTES], mask[SIMDB_REQBYTES];
+
+			currq = &db->rq[db->num_rq];
+			currq->len = simdb_parserq(skiptag(line, TAG_REQUEST), val, mask);
+			currq->pat = db->patbuf_len;
+			memcpy(&db->patbuf[currq->pat], val, currq->len);
+			memcpy(&db->patbuf[currq->pat + currq->len], mask, currq->len);
+			db->patbuf_len += 2 * currq->len;
+			currq->rp_first = db->num_rp;
+			currq->rp_num = 0;
+			currq->ecu = (uint32_t) (curecu - db->ecus);
+			currq->state = curstate;
+			currq->next_state = SIMDB_NONE;
+			db->num_rq++;
+		} else if ((strncmp(line, TAG_RESPONSE, strlen(TAG_RESPONSE)) == 0) && currq) {
+			struct simdb_rp *rp = &db->rp[db->num_rp];
+			rp->text = (uint32_t) (simdb_parsetiming(&rp->p1, &rp->p2, skiptag(line, TAG_RESPONSE)) - db->textbuf);
+			db->num_rp++;
+			currq->rp_num++;
+		} else if (strncmp(line, TAG_ECU, strlen(TAG_ECU)) == 0) {
+			char *rest;
+			char *name = simdb_name(skiptag(line, TAG_ECU), &rest);
+
+			//reuse the unnamed ECU if nothing was defined for it
+			if ((db->num_ecus > 1) || db->num_rq || db->ecus[0].nstates) {
+				simdb_endecu(db, curecu);
+				curecu = &db->ecus[db->num_ecus++];
+			}
+			curecu->name = (uint32_t) (name - db->textbuf);
+			curecu->state0 = db->num_states;
+			curecu->nstates = 0;
+			j = (unsigned) (curecu - db->ecus);
+			(void) simdb_parsetiming(&ecutiming[2 * j], &ecutiming[2 * j + 1], rest);
+			curstate = SIMDB_NONE;
+			currq = NULL;
+		} else if (strncmp(line, TAG_STATE, strlen(TAG_STATE)) == 0) {
+			char *rest;
+			char *name = simdb_name(skiptag(line, TAG_STATE), &rest);
+
+			if ((*name == '\0') || (strcmp(name, STATE_ANY) == 0)) {
+				curstate = SIMDB_NONE;
+			} else {
+				curstate = simdb_findstate(db, curecu, name);
+				if (curstate == SIMDB_NONE) {
+					//new state
+					curstate = db->num_states++;
+					db->states[curstate].name = (uint32_t) (name - db->textbuf);
+					curecu->nstates++;
+				}
+			}
+			currq = NULL;
+		} else if (strncmp(line, TAG_GOTO, strlen(TAG_GOTO)) == 0) {
+			char *rest;
+
+			if (!currq) {
+				fprintf(stderr, FLFMT "GOTO without a RQ line: %s\n", FL, line);
+				continue;
+			}
+			gotoname[currq - db->rq] = simdb_name(skiptag(line, TAG_GOTO), &rest);
+		}
+	}
+	simdb_endecu(db, curecu);
+
+	//3) resolve state transitions; states can be declared after the GOTO line.
+	for (i = 0; i < db->num_rq; i++) {
+		if (!gotoname[i])
+			continue;
+		db->rq[i].next_state = simdb_findstate(db, &db->ecus[db->rq[i].ecu], gotoname[i]);
+		if (db->rq[i].next_state == SIMDB_NONE) {
+			fprintf(stderr, FLFMT "GOTO unknown state \"%s\" in ECU \"%s\"\n", FL,
+				gotoname[i], SIMDB_NAME(db, &db->ecus[db->rq[i].ecu]));
+		}
+	}
+	free(gotoname);
+
+	//4) CFG lines apply to the whole file : resolve timing defaults now.
+	for (i = 0; i < db->num_rq; i++) {
+		const uint16_t *et = &ecutiming[2 * db->rq[i].ecu];
+
+		for (j = db->rq[i].rp_first; j < db->rq[i].rp_first + db->rq[i].rp_num; j++) {
+			struct simdb_rp *rp = &db->rp[j];
+			if (rp->p1 == SIMDB_TUNSET)
+				rp->p1 = (et[0] != SIMDB_TUNSET)? et[0] : (uint16_t) db->p1;
+			if (rp->p2 == SIMDB_TUNSET)
+				rp->p2 = (et[1] != SIMDB_TUNSET)? et[1] : (uint16_t) db->p2;
+		}
+	}
+	free(ecutiming);
+
+	//5) compile responses, build index
+	if ((rv = simdb_compile(db)) ||
+		(rv = simdb_index(db))) {
+		return rv;
+	}
+
+	return 0;
+}
+
+
+/** binary format **/
+
+//check a compiled response program.
+//@return number of response bytes it generates, or -1 if invalid
+static int simdb_checkprog(const uint8_t *prog, unsigned proglen) {
+	unsigned i = 0;
+	int pos = 0;
+
+	while (i < proglen) {
+		if (i + 2 > proglen)
+			return -1;
+		switch (prog[i]) {
+		case SIMDB_OP_LIT:
+			if (i + 2 + prog[i + 1] > proglen)
+				return -1;
+			pos += prog[i + 1];
+			i += prog[i + 1];
+			break;
+		case SIMDB_OP_REQ:
+		case SIMDB_OP_REQINC:
+			if (prog[i + 1] >= SIMDB_RPMAX)
+				return -1;
+			pos++;
+			break;
+		case SIMDB_OP_SIN1:
+		case SIMDB_OP_SWT1:
+		case SIMDB_OP_CKS1:
+		case SIMDB_OP_CNT1:
+			pos++;
+			break;
+		default:
+			return -1;
+		}
+		i += 2;
+	}
+	return (pos > SIMDB_RPMAX)? -1 : pos;
+}
+
+//locate table (id) in the mapped file.
+//@return NULL if invalid.
+static void *simdb_bsec(const struct simdb *db, enum simdb_bsecid id, size_t esize, unsigned *num) {
+	const struct simdb_bhdr *hdr = db->map;
+	const struct simdb_bsec *sec = &hdr->sec[id];
+
+	if ((sec->esize != esize) || (sec->off % 8) ||
+			(sec->off > db->maplen) ||
+			(sec->num > (db->maplen - sec->off) / esize)) {
+		return NULL;
+	}
+	*num = sec->num;
+	return (uint8_t *) db->map + sec->off;
+}
+
+//point tables into the mapped file, and check all offsets / indexes
+//so that a corrupt file can't make lookups run out of bounds.
+//@return 0 if ok
+static int simdb_mapbin(struct simdb *db) {
+	const struct simdb_bhdr *hdr = db->map;
+	unsigned i;
+
+	if ((db->maplen < sizeof(*hdr)) ||
+			(memcmp(hdr->magic, SIMDB_BMAGIC, sizeof(SIMDB_BMAGIC)) != 0) ||
+			(hdr->version != SIMDB_BVERSION) ||
+			(hdr->endian != SIMDB_BENDIAN)) {
+		return DIAG_ERR_GENERAL;
+	}
+
+	db->dataonly = (hdr->flags & SIMDB_BF_DATAONLY) != 0;
+	db->nocksum = (hdr->flags & SIMDB_BF_NOCKSUM) != 0;
+	db->framed = (hdr->flags & SIMDB_BF_FRAMED) != 0;
+	db->fullinit = (hdr->flags & SIMDB_BF_FULLINIT) != 0;
+	db->proto_restrict = hdr->proto_restrict;
+	db->baud = hdr->baud;
+	db->p1 = hdr->p1;
+	db->p2 = hdr->p2;
+
+	if (((db->rq = simdb_bsec(db, SIMDB_SEC_RQ, sizeof(*db->rq), &db->num_rq)) == NULL) ||
+		((db->rp = simdb_bsec(db, SIMDB_SEC_RP, sizeof(*db->rp), &db->num_rp)) == NULL) ||
+		((db->nodes = simdb_bsec(db, SIMDB_SEC_NODES, sizeof(*db->nodes), &db->num_nodes)) == NULL) ||
+		((db->edges = simdb_bsec(db, SIMDB_SEC_EDGES, sizeof(*db->edges), &db->num_edges)) == NULL) ||
+		((db->progbuf = simdb_bsec(db, SIMDB_SEC_PROG, 1, &db->progbuf_len)) == NULL) ||
+		((db->patbuf = simdb_bsec(db, SIMDB_SEC_PAT, 1, &db->patbuf_len)) == NULL) ||
+		((db->textbuf = simdb_bsec(db, SIMDB_SEC_TEXT, 1, &db->textbuf_len)) == NULL) ||
+		((db->ecus = simdb_bsec(db, SIMDB_SEC_ECUS, sizeof(*db->ecus), &db->num_ecus)) == NULL) ||
+		((db->states = simdb_bsec(db, SIMDB_SEC_STATES, sizeof(*db->states), &db->num_states)) == NULL)) {
+		return DIAG_ERR_GENERAL;
+	}
+
+	if ((db->baud == 0) || (db->textbuf_len == 0) ||
+			(db->textbuf[db->textbuf_len - 1] != '\0') ||
+			(db->num_ecus == 0)) {
+		return DIAG_ERR_GENERAL;
+	}
+
+	for (i = 0; i < db->num_ecus; i++) {
+		const struct simdb_ecu *ecu = &db->ecus[i];
+		if ((ecu->name >= db->textbuf_len) || (ecu->nstates == 0) ||
+				((uint64_t) ecu->state0 + ecu->nstates > db->num_states)) {
+			return DIAG_ERR_GENERAL;
+		}
+	}
+	for (i = 0; i < db->num_states; i++) {
+		if ((db->states[i].name >= db->textbuf_len) ||
+				(db->states[i].root >= db->num_nodes)) {
+			return DIAG_ERR_GENERAL;
+		}
+	}
+	for (i = 0; i < db->num_rq; i++) {
+		const struct simdb_rq *rq = &db->rq[i];
+		const struct simdb_ecu *ecu;
+
+		if (((uint64_t) rq->pat + 2ULL * rq->len > db->patbuf_len) ||
+				((uint64_t) rq->rp_first + rq->rp_num > db->num_rp) ||
+				(rq->ecu >= db->num_ecus)) {
+			return DIAG_ERR_GENERAL;
+		}
+		//state transitions must stay within the ECU
+		ecu = &db->ecus[rq->ecu];
+		if ((rq->next_state != SIMDB_NONE) &&
+				((rq->next_state < ecu->state0) || (rq->next_state >= ecu->state0 + ecu->nstates))) {
+			return DIAG_ERR_GENERAL;
+		}
+	}
+	for (i = 0; i < db->num_rp; i++) {
+		const struct simdb_rp *rp = &db->rp[i];
+		if ((rp->text >= db->textbuf_len) ||
+				((uint64_t) rp->prog + rp->proglen > db->progbuf_len) ||
+				(simdb_checkprog(&db->progbuf[rp->prog], rp->proglen) != rp->len)) {
+			return DIAG_ERR_GENERAL;
+		}
+	}
+	for (i = 0; i < db->num_nodes; i++) {
+		const struct simdb_node *np = &db->nodes[i];
+		unsigned j;
+
+		if (((uint64_t) np->edge0 + np->nedges > db->num_edges) ||
+				(np->nexact > np->nedges) ||
+				((np->term != SIMDB_NONE) && (np->term >= db->num_rq)) ||
+				((np->sub != SIMDB_NONE) && (np->sub >= db->num_rq))) {
+			return DIAG_ERR_GENERAL;
+		}
+		//children always come after their parent : no loops
+		for (j = 0; j < np->nedges; j++) {
+			uint32_t child = db->edges[np->edge0 + j].child;
+			if ((child <= i) || (child >= db->num_nodes))
+				return DIAG_ERR_GENERAL;
+		}
+	}
+	return 0;
+}
+
+//ret 0 if ok
+static int simdb_loadbin(struct simdb *db, FILE *fp, const char *fname) {
+	int rv;
+#ifdef HAVE_MMAP
+	struct stat st;
+	void *map;
+
+	if ((fstat(fileno(fp), &st) != 0) || (st.st_size <= 0)) {
+		fprintf(stderr, FLFMT "Can't get size of \"%s\"\n", FL, fname);
+		return DIAG_ERR_GENERAL;
+	}
+	map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, FLFMT "Can't map \"%s\"\n", FL, fname);
+		return DIAG_ERR_GENERAL;
+	}
+	db->map = map;
+	db->maplen = (size_t) st.st_size;
+#else
+	char *buf;
+	long flen;
+
+	if ((rv = simdb_readfile(fp, fname, &buf, &flen)))
+		return rv;
+	db->map = buf;
+	db->maplen = (size_t) flen;
+#endif
+
+	if ((rv = simdb_mapbin(db))) {
+		fprintf(stderr, FLFMT "Invalid compiled carsim file \"%s\"\n", FL, fname);
+		return rv;
+	}
+	return 0;
+}
+
+
+struct simdb *simdb_load(const char *fname) {
+	struct simdb *db;
+	FILE *fp;
+	char magic[sizeof(SIMDB_BMAGIC)];
+	bool compiled;
+	int rv;
+
+	assert(fname != NULL);
+
+	if ((fp = fopen(fname, "rb")) == NULL) {
+		fprintf(stderr, FLFMT "Unable to open file \"%s\"\n", FL, fname);
+		return diag_pseterr(DIAG_ERR_GENERAL);
+	}
+
+	if ((rv = diag_calloc(&db, 1))) {
+		fclose(fp);
+		return diag_pseterr(rv);
+	}
+
+	compiled = (fread(magic, 1, sizeof(magic), fp) == sizeof(magic)) &&
+		(memcmp(magic, SIMDB_BMAGIC, sizeof(magic)) == 0);
+	rewind(fp);
+
+	if (compiled) {
+		rv = simdb_loadbin(db, fp, fname);
+	} else {
+		rv = simdb_loadtext(db, fp, fname);
+	}
+	fclose(fp);
+
+	if (rv) {
+		simdb_free(db);
+		return diag_pseterr(rv);
+	}
+
+	if (diag_l0_debug & DIAG_DEBUG_OPEN) {
+		fprintf(stderr, FLFMT "simdb \"%s\"%s: %u requests, %u responses, %u nodes, %u ECUs, %u states\n",
+			FL, fname, compiled? " (compiled)" : "", db->num_rq, db->num_rp, db->num_nodes,
+			db->num_ecus, db->num_states);
+	}
+
+	return db;
+}
+
+
+//write one table, padded to a multiple of 8 bytes. ret 0 if ok
+static int simdb_writesec(FILE *fp, const void *data, size_t len) {
+	static const uint8_t pad[8];
+
+	if (len && (fwrite(data, 1, len, fp) != len))
+		return DIAG_ERR_GENERAL;
+	len = (8 - (len % 8)) % 8;
+	if (len && (fwrite(pad, 1, len, fp) != len))
+		return DIAG_ERR_GENERAL;
+	return 0;
+}
+
+//append string (t) to text[] at *textlen; ret its offset
+static uint32_t simdb_savetext(char *text, unsigned *textlen, const char *t) {
+	uint32_t off = *textlen;
+
+	strcpy(&text[off], t);
+	*textlen += strlen(t) + 1;
+	return off;
+}
+
+int simdb_save(const struct simdb *db, const char *fname) {
+	struct simdb_bhdr hdr;
+	struct simdb_rp *rp = NULL;
+	struct simdb_ecu *ecus = NULL;
+	struct simdb_state *states = NULL;
+	char *text = NULL;
+	const void *data[SIMDB_NSEC];
+	unsigned textlen, i;
+	uint32_t off;
+	FILE *fp;
+	int rv;
+
+	assert((db != NULL) && (fname != NULL));
+
+	//only keep the response text and names, not the whole source file
+	textlen = 1;
+	for (i = 0; i < db->num_rp; i++) {
+		textlen += strlen(SIMDB_RPTEXT(db, &db->rp[i])) + 1;
+	}
+	for (i = 0; i < db->num_ecus; i++) {
+		textlen += strlen(SIMDB_NAME(db, &db->ecus[i])) + 1;
+	}
+	for (i = 0; i < db->num_states; i++) {
+		textlen += strlen(SIMDB_NAME(db, &db->states[i])) + 1;
+	}
+	if ((rv = diag_calloc(&rp, db->num_rp + 1)) ||
+		(rv = diag_calloc(&ecus, db->num_ecus + 1)) ||
+		(rv = diag_calloc(&states, db->num_states + 1)) ||
+		(rv = diag_malloc(&text, textlen))) {
+		free(states);
+		free(ecus);
+		free(rp);
+		return diag_iseterr(rv);
+	}
+	textlen = 0;
+	text[textlen++] = '\0';
+	for (i = 0; i < db->num_rp; i++) {
+		rp[i] = db->rp[i];
+		rp[i].text = simdb_savetext(text, &textlen, SIMDB_RPTEXT(db, &db->rp[i]));
+	}
+	for (i = 0; i < db->num_ecus; i++) {
+		ecus[i] = db->ecus[i];
+		ecus[i].name = simdb_savetext(text, &textlen, SIMDB_NAME(db, &db->ecus[i]));
+	}
+	for (i = 0; i < db->num_states; i++) {
+		states[i] = db->states[i];
+		states[i].name = simdb_savetext(text, &textlen, SIMDB_NAME(db, &db->states[i]));
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SIMDB_BMAGIC, sizeof(SIMDB_BMAGIC));
+	hdr.version = SIMDB_BVERSION;
+	hdr.endian = SIMDB_BENDIAN;
+	hdr.flags = (db->dataonly? SIMDB_BF_DATAONLY : 0) |
+		(db->nocksum? SIMDB_BF_NOCKSUM : 0) |
+		(db->framed? SIMDB_BF_FRAMED : 0) |
+		(db->fullinit? SIMDB_BF_FULLINIT : 0);
+	hdr.proto_restrict = db->proto_restrict;
+	hdr.baud = db->baud;
+	hdr.p1 = db->p1;
+	hdr.p2 = db->p2;
+
+	hdr.sec[SIMDB_SEC_RQ] = (struct simdb_bsec) {0, db->num_rq, sizeof(*db->rq), 0};
+	hdr.sec[SIMDB_SEC_RP] = (struct simdb_bsec) {0, db->num_rp, sizeof(*db->rp), 0};
+	hdr.sec[SIMDB_SEC_NODES] = (struct simdb_bsec) {0, db->num_nodes, sizeof(*db->nodes), 0};
+	hdr.sec[SIMDB_SEC_EDGES] = (struct simdb_bsec) {0, db->num_edges, sizeof(*db->edges), 0};
+	hdr.sec[SIMDB_SEC_PROG] = (struct simdb_bsec) {0, db->progbuf_len, 1, 0};
+	hdr.sec[SIMDB_SEC_PAT] = (struct simdb_bsec) {0, db->patbuf_len, 1, 0};
+	hdr.sec[SIMDB_SEC_TEXT] = (struct simdb_bsec) {0, textlen, 1, 0};
+	hdr.sec[SIMDB_SEC_ECUS] = (struct simdb_bsec) {0, db->num_ecus, sizeof(*db->ecus), 0};
+	hdr.sec[SIMDB_SEC_STATES] = (struct simdb_bsec) {0, db->num_states, sizeof(*db->states), 0};
+	data[SIMDB_SEC_RQ] = db->rq;
+	data[SIMDB_SEC_RP] = rp;
+	data[SIMDB_SEC_NODES] = db->nodes;
+	data[SIMDB_SEC_EDGES] = db->edges;
+	data[SIMDB_SEC_PROG] = db->progbuf;
+	data[SIMDB_SEC_PAT] = db->patbuf;
+	data[SIMDB_SEC_TEXT] = text;
+	data[SIMDB_SEC_ECUS] = ecus;
+	data[SIMDB_SEC_STATES] = states;
+
+	off = (sizeof(hdr) + 7) & ~7U;
+	for (i = 0; i < SIMDB_NSEC; i++) {
+		hdr.sec[i].off = off;
+		off += (hdr.sec[i].num * hdr.sec[i].esize + 7) & ~7U;
+	}
+
+	if ((fp = fopen(fname, "wb")) == NULL) {
+		fprintf(stderr, FLFMT "Unable to create file \"%s\"\n", FL, fname);
+		free(text);
+		free(states);
+		free(ecus);
+		free(rp);
+		return diag_iseterr(DIAG_ERR_GENERAL);
+	}
+
+	rv = simdb_writesec(fp, &hdr, sizeof(hdr));
+	for (i = 0; (i < SIMDB_NSEC) && !rv; i++) {
+		rv = simdb_writesec(fp, data[i], (size_t) hdr.sec[i].num * hdr.sec[i].esize);
+	}
+	if (fclose(fp) != 0)
+		rv = DIAG_ERR_GENERAL;
+
+	free(text);
+	free(states);
+	free(ecus);
+	free(rp);
+
+	if (rv) {
+		fprintf(stderr, FLFMT "Error writing \"%s\"\n", FL, fname);
+		remove(fname);
+		return diag_iseterr(rv);
+	}
+	return 0;
+}
+
+
+void simdb_free(struct simdb *db) {
+	if (!db)
+		return;
+
+	if (db->map) {
+		//all tables are in the compiled file
+#ifdef HAVE_MMAP
+		munmap(db->map, db->maplen);
+#else
+		free(db->map);
+#endif
+		free(db);
+		return;
+	}
+
+	free(db->nodes);
+	free(db->edges);
+	free(db->rq);
+	free(db->rp);
+	free(db->ecus);
+	free(db->states);
+	free(db->patbuf);
+	free(db->progbuf);
+	free(db->textbuf);
+	free(db);
+	return;
+}
+
+
+/** lookup **/
+
+//recursive trie walk; updates *best with the lowest matching pattern index.
+static void simdb_walk(const struct simdb *db, uint32_t n,
+		const uint8_t *data, unsigned len, unsigned pos, uint32_t *best) {
+	const struct simdb_node *np = &db->nodes[n];
+	const struct simdb_edge *ep;
+	unsigned lo, hi, i;
+
+	if (np->sub >= *best)
+		return;	//nothing better down there
+
+	//pattern fully matched, and not longer than the request
+	if (np->term < *best)
+		*best = np->term;
+
+	if (pos == len) {
+		//request fully matched : any longer pattern in this subtree matches too
+		*best = np->sub;
+		return;
+	}
+
+	ep = &db->edges[np->edge0];
+
+	//binary search among exact edges
+	lo = 0;
+	hi = np->nexact;
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+		if (ep[mid].val < data[pos]) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if ((lo < np->nexact) && (ep[lo].val == data[pos]))
+		simdb_walk(db, ep[lo].child, data, len, pos + 1, best);
+
+	//wildcards
+	for (i = np->nexact; i < np->nedges; i++) {
+		if ((data[pos] & ep[i].mask) == ep[i].val)
+			simdb_walk(db, ep[i].child, data, len, pos + 1, best);
+	}
+	return;
+}
+
+
+const struct simdb_rq *simdb_find(const struct simdb *db, uint32_t state, const uint8_t *data, unsigned len) {
+	uint32_t best = SIMDB_NONE;
+
+	assert((db != NULL) && (data != NULL) && (state < db->num_states));
+
+	simdb_walk(db, db->states[state].root, data, len, 0, &best);
+
+	if (best == SIMDB_NONE)
+		return NULL;
+	return &db->rq[best];
+}
+
+
+/** response programs **/
+
+// Returns a value between 0x00 and 0xFF calculated as the trigonometric
+// sine of the current system time (with a period of one second).
+static uint8_t sine1(void)
+{
+	unsigned long now=diag_os_getms();
+	//sin() returns a float between -1.0 and 1.0
+	return (uint8_t) (0x7F * sin(now * 6.283185 / 1000));
+}
+
+// Returns a value between 0x00 and 0xFF directly proportional
+// to the value of the current system time (with a period of one second).
+static uint8_t sawtooth1(void)
+{
+	unsigned long now=diag_os_getms();
+	return (uint8_t) (0xFF * (now % 1000));
+}
+
+unsigned simdb_run(const struct simdb *db, const struct simdb_rp *rp,
+		const uint8_t req[], uint8_t count, uint8_t *out)
+{
+	const uint8_t *op = &db->progbuf[rp->prog];
+	const uint8_t *end = op + rp->proglen;
+	unsigned pos = 0;
+
+	while (op < end) {
+		switch (op[0]) {
+		case SIMDB_OP_LIT:
+			memcpy(&out[pos], &op[2], op[1]);
+			pos += op[1];
+			op += op[1];
+			break;
+		case SIMDB_OP_SIN1:
+			out[pos++] = sine1();
+			break;
+		case SIMDB_OP_SWT1:
+			out[pos++] = sawtooth1();
+			break;
+		case SIMDB_OP_CKS1:
+			out[pos] = diag_cks1(out, pos);
+			pos++;
+			break;
+		case SIMDB_OP_REQ:
+			out[pos++] = req[op[1]];
+			break;
+		case SIMDB_OP_REQINC:
+			out[pos++] = req[op[1]] + 1;
+			break;
+		case SIMDB_OP_CNT1:
+			out[pos++] = count;
+			break;
+		default:
+			fprintf(stderr, FLFMT "bad response opcode 0x%02X\n", FL, op[0]);
+			return pos;
+		}
+		op += 2;
+	}
+	return pos;
+}
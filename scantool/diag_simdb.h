@@ -0,0 +1,245 @@
+#ifndef _DIAG_SIMDB_H_
+#define _DIAG_SIMDB_H_
+
+/*
+ *	freediag - Vehicle Diagnostic Utility
+ * GPLv3
+ *
+ * Car simulator (CARSIM) database.
+ *
+ * The text .db file (see freediag_carsim_all.db for the syntax) is parsed
+ * once when the L0 is opened. Every RQ line becomes a request pattern;
+ * the patterns are then indexed in a trie so that looking up the responses
+ * for a request costs O(request length) instead of a full file scan.
+ *
+ * Matching rules are the same as the original line-by-line scan :
+ * - only the shortest of either the request or the RQ pattern must match;
+ * - "XXXX" matches any byte;
+ * - if more than one RQ line matches, the first one in the file wins.
+ * Patterns can be as long as a request (SIMDB_REQBYTES), and each pattern
+ * byte has its own mask : besides "XXXX", "0x1X" / "0xX1" match on one
+ * nibble, and "0xVV/0xMM" matches the bits set in 0xMM.
+ *
+ * RP lines are compiled at load time into small response programs
+ * (see SIMDB_OP_*) that the L0 only has to execute on every receive.
+ *
+ * Bus timing parameters (CFG BAUD / P1 / P2, "P1=" / "P2=" overrides
+ * on ECU lines and at the start of RP lines) are resolved at load time so
+ * that every response has its own P1 and P2 values; they are only used by
+ * the L0 when timing emulation is enabled.
+ *
+ * A file can describe several ECUs ("ECU" lines), each with its own state
+ * machine : "STATE" lines restrict the following RQ lines to one state,
+ * and a "GOTO" line after a RQ line makes that request switch the ECU to
+ * another state. Every (ECU, state) pair gets its own trie, containing only
+ * the patterns active in that state, so a lookup still costs one trie walk
+ * per ECU. A file without ECU / STATE lines has one ECU with one state.
+ *
+ * All tables only hold offsets and indexes, never pointers : once built,
+ * they can be saved as-is in a binary "compiled" file (see carsimc.c),
+ * which simdb_load() recognizes and maps back in memory without any parsing.
+ */
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SIMDB_REQBYTES	255	//max number of request bytes analyzed
+#define SIMDB_NONE	UINT32_MAX	//invalid pattern / node index
+#define SIMDB_RPMAX	255	//max bytes per response
+
+/* Default bus timing, used unless the .db file sets CFG BAUD / P1 / P2 */
+#define SIMDB_DEF_BAUD	10400
+#define SIMDB_DEF_P1	0	//ms, ECU inter-byte time
+#define SIMDB_DEF_P2	25	//ms, request -> response latency
+
+/* Response program opcodes. A program is a sequence of (opcode, arg) byte pairs;
+ * only SIMDB_OP_LIT is followed by extra bytes. */
+#define SIMDB_OP_LIT	1	//arg = n; copy the (n) literal bytes that follow
+#define SIMDB_OP_SIN1	2	//"sin1" : sine of current time, period = 1s
+#define SIMDB_OP_SWT1	3	//"swt1" : sawtooth of current time, period = 1s
+#define SIMDB_OP_CKS1	4	//"cks1" : 8-bit sum of all previous response bytes
+#define SIMDB_OP_REQ	5	//"reqN" : arg = request byte index (0-based)
+#define SIMDB_OP_REQINC	6	//"reqN+" : request byte + 1
+#define SIMDB_OP_CNT1	7	//"cnt1" : number of times this response was sent, mod 256
+
+/** Request pattern (one per RQ line) */
+struct simdb_rq {
+	uint32_t pat;		//offset in simdb->patbuf[] : (len) values, followed by (len) masks
+	uint32_t len;		//number of pattern bytes
+	uint32_t rp_first;	//index of first response in simdb->rp[]
+	uint32_t rp_num;	//number of responses (RP lines following the RQ line)
+	uint32_t ecu;		//index in simdb->ecus[]
+	uint32_t state;		//index in simdb->states[] where this pattern is active; SIMDB_NONE = all states of the ECU
+	uint32_t next_state;	//state to switch to when this pattern matches, or SIMDB_NONE
+	uint32_t reserved;
+};
+
+/** Response (one per RP line) */
+struct simdb_rp {
+	uint32_t text;		//offset in simdb->textbuf[] of the unparsed response, without the "RP " tag
+	uint32_t prog;		//offset of the compiled program in simdb->progbuf[]
+	uint16_t proglen;	//program length
+	uint16_t len;		//number of response bytes the program generates
+	uint16_t p1;		//ECU inter-byte time, ms
+	uint16_t p2;		//latency from end of request (or previous response), ms
+};
+
+/* Index trie. Edges of a node are contiguous in simdb->edges[],
+ * exact bytes (mask == 0xFF) first sorted by value, then the wildcards.
+ */
+struct simdb_node {
+	uint32_t edge0;		//index of first edge
+	uint16_t nedges;	//total number of edges
+	uint16_t nexact;	//number of exact-byte edges
+	uint32_t term;		//lowest pattern index ending at this node, or SIMDB_NONE
+	uint32_t sub;		//lowest pattern index in the whole subtree (including term)
+};
+
+struct simdb_edge {
+	uint8_t val;
+	uint8_t mask;
+	uint32_t child;		//node index
+};
+
+/** ECU. Its states are simdb->states[state0 ... state0 + nstates - 1];
+ * the first one is the initial state. */
+struct simdb_ecu {
+	uint32_t name;		//offset in simdb->textbuf[]
+	uint32_t state0;
+	uint32_t nstates;
+	uint32_t reserved;
+};
+
+struct simdb_state {
+	uint32_t name;		//offset in simdb->textbuf[]
+	uint32_t root;		//trie root node : patterns active in this state
+};
+
+struct simdb {
+	/* CFG lines */
+	bool	dataonly;	/* messages are sent/received without headers or checksums; required for J1850 */
+	bool	nocksum;	/* messages are sent/received without checksums */
+	bool	framed;		/* responses must be considered as complete frames; dataonly and nocksum imply this */
+	bool	fullinit;	/* indicate that l0 does full init */
+	int	proto_restrict;	/* (optional) only accept connections matching this proto */
+	unsigned	baud;	/* bus speed for timing emulation */
+	unsigned	p1, p2;	/* default P1 and P2 (ms) for RP lines that don't override them */
+
+	struct simdb_rq *rq;	//patterns, in file order
+	unsigned num_rq;
+	struct simdb_rp *rp;	//responses, in file order
+	unsigned num_rp;
+
+	struct simdb_node *nodes;	//nodes[0] is the root
+	unsigned num_nodes;
+	struct simdb_edge *edges;
+	unsigned num_edges;
+
+	struct simdb_ecu *ecus;		//at least one
+	unsigned num_ecus;
+	struct simdb_state *states;
+	unsigned num_states;
+
+	uint8_t *progbuf;	//compiled response programs
+	unsigned progbuf_len;
+	uint8_t *patbuf;	//request patterns
+	unsigned patbuf_len;
+	char *textbuf;		//response text, 0-terminated strings
+	unsigned textbuf_len;
+
+	/* private */
+	void *map;		//compiled file contents, if loaded from one. Tables point in here.
+	size_t maplen;
+};
+
+/* Binary (compiled) file format, in host byte order :
+ * a struct simdb_bhdr, followed by the tables listed in bhdr.sec[] .
+ * Each table starts on an 8-byte boundary.
+ */
+#define SIMDB_BMAGIC	"FDSIMDB"	//includes the terminating 0
+#define SIMDB_BVERSION	2
+#define SIMDB_BENDIAN	0x01020304	//stored in host order, detects foreign files
+
+#define SIMDB_BF_DATAONLY	0x01
+#define SIMDB_BF_NOCKSUM	0x02
+#define SIMDB_BF_FRAMED		0x04
+#define SIMDB_BF_FULLINIT	0x08
+
+enum simdb_bsecid {
+	SIMDB_SEC_RQ,
+	SIMDB_SEC_RP,
+	SIMDB_SEC_NODES,
+	SIMDB_SEC_EDGES,
+	SIMDB_SEC_PROG,
+	SIMDB_SEC_PAT,
+	SIMDB_SEC_TEXT,
+	SIMDB_SEC_ECUS,
+	SIMDB_SEC_STATES,
+	SIMDB_NSEC
+};
+
+struct simdb_bsec {
+	uint32_t off;		//from start of file
+	uint32_t num;		//number of elements
+	uint32_t esize;		//element size
+	uint32_t reserved;
+};
+
+struct simdb_bhdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t endian;
+	uint32_t flags;		//SIMDB_BF_*
+	int32_t proto_restrict;
+	uint32_t baud, p1, p2;
+	uint32_t reserved;
+	struct simdb_bsec sec[SIMDB_NSEC];
+};
+
+/* table accessors */
+#define SIMDB_RQVAL(db, rq)	(&(db)->patbuf[(rq)->pat])
+#define SIMDB_RQMASK(db, rq)	(&(db)->patbuf[(rq)->pat + (rq)->len])
+#define SIMDB_RPTEXT(db, rp)	(&(db)->textbuf[(rp)->text])
+#define SIMDB_NAME(db, x)	(&(db)->textbuf[(x)->name])	//ECU or state name
+
+/** Load and index a carsim .db file, or map a compiled one
+ *
+ * The file format (text or binary) is auto-detected.
+ * @return new simdb, to be freed with simdb_free(); NULL if failed.
+ */
+struct simdb *simdb_load(const char *fname);
+
+/** Save a simdb in the binary format
+ *
+ * @return 0 if ok
+ */
+int simdb_save(const struct simdb *db, const char *fname);
+
+/** Free a simdb returned by simdb_load(). Safe to call with NULL. */
+void simdb_free(struct simdb *db);
+
+/** Find the pattern matching a request, for one ECU in one state
+ *
+ * @param state : index in db->states[]
+ * @return matching pattern (first one in file order), NULL if none
+ */
+const struct simdb_rq *simdb_find(const struct simdb *db, uint32_t state, const uint8_t *data, unsigned len);
+
+/** Run a compiled response program
+ *
+ * @param req : request that matched, for "reqN"
+ * @param count : value for "cnt1"
+ * @param out : must hold rp->len bytes
+ * @return number of bytes generated
+ */
+unsigned simdb_run(const struct simdb *db, const struct simdb_rp *rp,
+		const uint8_t req[], uint8_t count, uint8_t *out);
+
+#if defined(__cplusplus)
+}
+#endif
+#endif // _DIAG_SIMDB_H_
@@ -0,0 +1,231 @@
+/* freediag
+ *
+ * Deadline timers : see diag_timer.h
+ *
+ * GPLv3
+ *
+ * heap[] is a binary min-heap of armed timers, ordered by deadline.
+ * timer_mtx protects the heap and every struct diag_timer; run_mtx is held
+ * by diag_timer_run() while it calls handlers, so that diag_timer_del() can
+ * wait for a running handler without holding timer_mtx.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diag.h"
+#include "diag_err.h"
+#include "diag_os.h"
+#include "diag_timer.h"
+
+#define TIMER_HEAPINIT	16	//initial heap size; grows as needed
+
+static diag_mtx *timer_mtx;
+static diag_mtx *run_mtx;
+static struct diag_timer **heap;
+static unsigned heap_num, heap_size;
+static struct diag_timer *running;	//handler being called, if any
+static bool running_del;		//... and diag_timer_del() was called for it
+
+//ms timestamps wrap around : compare their difference
+#define TIMER_BEFORE(a, b)	((long) ((a) - (b)) < 0)
+
+
+/** heap helpers; timer_mtx must be held **/
+
+static void heap_set(unsigned i, struct diag_timer *dt) {
+	heap[i] = dt;
+	dt->idx = i + 1;
+}
+
+static void heap_up(unsigned i) {
+	struct diag_timer *dt = heap[i];
+
+	while (i > 0) {
+		unsigned parent = (i - 1) / 2;
+		if (!TIMER_BEFORE(dt->deadline, heap[parent]->deadline))
+			break;
+		heap_set(i, heap[parent]);
+		i = parent;
+	}
+	heap_set(i, dt);
+}
+
+static void heap_down(unsigned i) {
+	struct diag_timer *dt = heap[i];
+
+	while (1) {
+		unsigned c = 2 * i + 1;
+		if (c >= heap_num)
+			break;
+		if ((c + 1 < heap_num) && TIMER_BEFORE(heap[c + 1]->deadline, heap[c]->deadline))
+			c++;
+		if (!TIMER_BEFORE(heap[c]->deadline, dt->deadline))
+			break;
+		heap_set(i, heap[c]);
+		i = c;
+	}
+	heap_set(i, dt);
+}
+
+//ret 0 if ok, diag_iseterr'd error otherwise
+static int heap_insert(struct diag_timer *dt) {
+	if (heap_num == heap_size) {
+		unsigned newsize = heap_size? 2 * heap_size : TIMER_HEAPINIT;
+		int rv = diag_realloc(&heap, newsize);
+		if (rv)
+			return rv;
+		heap_size = newsize;
+	}
+	heap_set(heap_num, dt);
+	heap_num++;
+	heap_up(heap_num - 1);
+	return 0;
+}
+
+static void heap_remove(struct diag_timer *dt) {
+	unsigned i = dt->idx - 1;
+
+	assert((dt->idx != 0) && (heap[i] == dt));
+	dt->idx = 0;
+	heap_num--;
+	if (i == heap_num)
+		return;
+	heap_set(i, heap[heap_num]);
+	heap_up(i);
+	heap_down(heap[i]->idx - 1);
+}
+
+
+/** public funcs **/
+
+int diag_timer_add(struct diag_timer *dt, unsigned long deadline) {
+	bool wake;
+	int rv = 0;
+
+	assert((dt != NULL) && (dt->fn != NULL) && (timer_mtx != NULL));
+
+	diag_os_lock(timer_mtx);
+	dt->deadline = deadline;
+	if (dt == running) {
+		//re-armed when the handler returns
+		dt->rearm = 1;
+		running_del = 0;
+		diag_os_unlock(timer_mtx);
+		return 0;
+	}
+	if (dt->idx) {
+		heap_up(dt->idx - 1);
+		heap_down(dt->idx - 1);
+	} else {
+		rv = heap_insert(dt);
+	}
+	//the timer thread only needs to know about a new earliest deadline
+	wake = (rv == 0) && (heap[0] == dt);
+	diag_os_unlock(timer_mtx);
+
+	if (rv)
+		return rv;	//already diag_iseterr'd by diag_realloc
+	if (wake)
+		diag_os_timer_wake();
+	return 0;
+}
+
+void diag_timer_del(struct diag_timer *dt) {
+	bool wait = 0;
+
+	assert((dt != NULL) && (timer_mtx != NULL));
+
+	diag_os_lock(timer_mtx);
+	if (dt->idx)
+		heap_remove(dt);
+	if (dt == running) {
+		running_del = 1;
+		dt->rearm = 0;
+		wait = 1;
+	}
+	diag_os_unlock(timer_mtx);
+
+	if (wait) {
+		//diag_timer_run() holds run_mtx until the handler returns
+		diag_os_lock(run_mtx);
+		diag_os_unlock(run_mtx);
+	}
+}
+
+bool diag_timer_run(unsigned long *next) {
+	bool armed;
+
+	if (!timer_mtx)
+		return 0;
+
+	diag_os_lock(run_mtx);
+	diag_os_lock(timer_mtx);
+	while (heap_num) {
+		struct diag_timer *dt = heap[0];
+		unsigned long now = diag_os_getms();
+		unsigned long nd;
+
+		if (TIMER_BEFORE(now, dt->deadline))
+			break;
+
+		heap_remove(dt);
+		running = dt;
+		running_del = 0;
+		dt->rearm = 0;
+		diag_os_unlock(timer_mtx);
+
+		nd = dt->fn(dt->arg, now);
+
+		diag_os_lock(timer_mtx);
+		running = NULL;
+		if (running_del)
+			continue;
+		if (dt->rearm && ((nd == DIAG_TIMER_NONE) || TIMER_BEFORE(dt->deadline, nd)))
+			nd = dt->deadline;
+		if (nd != DIAG_TIMER_NONE) {
+			dt->deadline = nd;
+			if (heap_insert(dt))
+				fprintf(stderr, FLFMT "Could not re-arm timer !\n", FL);
+		}
+	}
+	armed = (heap_num != 0);
+	if (armed)
+		*next = heap[0]->deadline;
+	diag_os_unlock(timer_mtx);
+	diag_os_unlock(run_mtx);
+
+	return armed;
+}
+
+int diag_timer_init(void) {
+	if (timer_mtx)
+		return 0;
+
+	timer_mtx = diag_os_newmtx();
+	run_mtx = diag_os_newmtx();
+	if (!timer_mtx || !run_mtx) {
+		if (timer_mtx)
+			diag_os_delmtx(timer_mtx);
+		if (run_mtx)
+			diag_os_delmtx(run_mtx);
+		timer_mtx = run_mtx = NULL;
+		return diag_iseterr(DIAG_ERR_GENERAL);
+	}
+	return 0;
+}
+
+void diag_timer_end(void) {
+	if (!timer_mtx)
+		return;
+
+	if (heap_num)
+		fprintf(stderr, FLFMT "%u timers still armed !\n", FL, heap_num);
+	free(heap);
+	heap = NULL;
+	heap_num = heap_size = 0;
+	diag_os_delmtx(run_mtx);
+	diag_os_delmtx(timer_mtx);
+	run_mtx = timer_mtx = NULL;
+}
@@ -0,0 +1,73 @@
+#ifndef _DIAG_TIMER_H_
+#define _DIAG_TIMER_H_
+
+/* freediag
+ * GPLv3
+ *
+ * Deadline timers, for keepalive messages and other background work.
+ *
+ * Every user (L2 / L3 connection, L0 recorder, ...) embeds a
+ * struct diag_timer, armed with an absolute deadline in diag_os_getms() time.
+ * Armed timers are kept in a min-heap; the OS layer sleeps until the
+ * earliest deadline (see diag_os_timer_wake()) and calls diag_timer_run(),
+ * so there are no wakeups while nothing is due, and inserting / removing
+ * a timer costs O(log n).
+ *
+ * Handlers run in the timer thread, one at a time. They return the next
+ * deadline : a handler that finds its connection was used in the meantime
+ * simply reschedules itself, so the hot paths (send / recv) only have to
+ * update a timestamp, never the heap.
+ */
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdbool.h>
+
+#define DIAG_TIMER_NONE	((unsigned long) -1)	//handler return value : don't re-arm
+
+struct diag_timer {
+	/** Timer handler.
+	 * @param now : current time, diag_os_getms()
+	 * @return next deadline, or DIAG_TIMER_NONE
+	 */
+	unsigned long (*fn)(void *arg, unsigned long now);
+	void *arg;
+
+	/* private */
+	unsigned long deadline;
+	unsigned idx;		//position in heap + 1; 0 if not armed
+	bool rearm;		//diag_timer_add() was called while the handler was running
+};
+
+/** Arm (or re-arm) a timer.
+ *
+ * Can be called from any thread, including from handlers.
+ * @param deadline : absolute time, diag_os_getms()
+ * @return 0 if ok
+ */
+int diag_timer_add(struct diag_timer *dt, unsigned long deadline);
+
+/** Disarm a timer.
+ *
+ * If its handler is running, waits until it returns; the handler is never
+ * called after this. Must not be called from a timer handler.
+ */
+void diag_timer_del(struct diag_timer *dt);
+
+/** Run expired handlers; called by the OS layer.
+ *
+ * @param next : set to the next deadline, if any
+ * @return 1 if a timer is still armed.
+ */
+bool diag_timer_run(unsigned long *next);
+
+/** set up / tear down; called from diag_init() and diag_end(). */
+int diag_timer_init(void);
+void diag_timer_end(void);
+
+#if defined(__cplusplus)
+}
+#endif
+#endif // _DIAG_TIMER_H_
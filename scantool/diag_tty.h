@@ -43,6 +43,13 @@ struct diag_serial_settings {
 	enum diag_parity parflag;
 };
 
+/** Time to send one byte with settings (pss), in us; 0 if the speed is unknown.
+ * A byte is 1 start bit + data bits + stop bits + parity bit, if set.
+ */
+#define DIAG_SS_BYTE_US(pss) ((pss)->speed? \
+	((1UL + (pss)->databits + (pss)->stopbits + (((pss)->parflag == diag_par_n)? 0 : 1)) * \
+		1000000UL / (pss)->speed) : 0)
+
 
 /*** Public functions ***/
 typedef void ttyp;	//used as "(tty_internal_struct *) ttyp" in tty code
@@ -56,6 +63,56 @@ typedef void ttyp;	//used as "(tty_internal_struct *) ttyp" in tty code
  */
 char ** diag_tty_getportlist(int *numports);
 
+/** Serial port details, see diag_tty_getportinfo() */
+struct diag_tty_portinfo {
+	char *name;		/** full port name, as for diag_tty_open() */
+	char *driver;		/** OS driver name ("ftdi_sio", "cdc_acm"...), NULL if unknown */
+	char *product;		/** USB product string, NULL if unknown */
+	uint16_t vid;		/** USB vendor ID, 0 if not a USB device */
+	uint16_t pid;		/** USB product ID */
+	const char *adapter;	/** known USB-serial chip matched from vid:pid, NULL if unknown */
+};
+
+/** Get available serial ports, with details
+ *
+ * Unlike diag_tty_getportlist() on some OSes, this never opens the ports
+ * (details come from /sys/class/tty on linux).
+ * @param[out] pinfo : will hold an array of port descriptions, to be
+ * free'd with diag_tty_freeportinfo()
+ * @return # of ports found, <0 if error
+ */
+int diag_tty_getportinfo(struct diag_tty_portinfo **pinfo);
+
+void diag_tty_freeportinfo(struct diag_tty_portinfo *pinfo, int numports);
+
+/** Hotplug events, see diag_tty_watch_new() */
+enum diag_tty_event {
+	DIAG_TTY_ADDED,
+	DIAG_TTY_REMOVED,
+};
+
+struct diag_tty_watch;
+
+/** Start watching for serial ports appearing / disappearing.
+ *
+ * Nothing runs in the background : events are queued by the OS until
+ * diag_tty_watch_poll() reports them.
+ * @param cb : called with the port name (as returned by diag_tty_getportlist())
+ * for every event
+ * @return new watcher, NULL if not supported on this OS
+ */
+struct diag_tty_watch *diag_tty_watch_new(void (*cb)(void *cbdata, enum diag_tty_event ev,
+					const char *portname), void *cbdata);
+
+/** Report pending hotplug events through the callback.
+ *
+ * @param timeout : max time to wait for the first event (ms), 0 to return immediately
+ * @return # of events reported, <0 if error
+ */
+int diag_tty_watch_poll(struct diag_tty_watch *tw, unsigned int timeout);
+
+void diag_tty_watch_del(struct diag_tty_watch *tw);
+
 /** Open serial port
  * @param portname: serial port device / file / tty name
  * @return new ttyp handle if ok, NULL if failed
@@ -113,6 +170,46 @@ ssize_t diag_tty_read(ttyp *tty_int,
 ssize_t diag_tty_write(ttyp *tty_int,
 	const void *buf, const size_t count);
 
+/** Write bytes to tty (non-blocking).
+ *
+ * Like diag_tty_write(), but returns as soon as the data is queued in the
+ * OS / driver, without waiting for it to be transmitted. Useful when the
+ * caller will read an echo or a response right after : the read can start
+ * while the last bytes are still going out.
+ * @return # of bytes queued; \<0 if error.
+ * @see diag_tty_txpending, diag_tty_drain
+ */
+ssize_t diag_tty_write_nb(ttyp *tty_int,
+	const void *buf, const size_t count);
+
+/** Write bytes gathered from (iovcnt) segments (blocking).
+ *
+ * Same as diag_tty_write() with the concatenation of the segments, in one
+ * system call where possible.
+ * @return # of bytes written; \<0 if error.
+ */
+ssize_t diag_tty_writev(ttyp *tty_int,
+	const struct diag_iov *iov, unsigned int iovcnt);
+
+/** Scatter-gather version of diag_tty_write_nb(). */
+ssize_t diag_tty_writev_nb(ttyp *tty_int,
+	const struct diag_iov *iov, unsigned int iovcnt);
+
+/** Estimate the remaining transmit time.
+ *
+ * Computed from the bytes queued with diag_tty_write_nb() and the current
+ * speed; refined with the OS output queue count when available.
+ * @return time (us) until the last queued byte is on the wire; 0 if done.
+ */
+unsigned long diag_tty_txpending(ttyp *tty_int);
+
+/** Wait until every queued byte is transmitted.
+ *
+ * Same caveats as diag_tty_write().
+ * @return 0 if ok
+ */
+int diag_tty_drain(ttyp *tty_int);
+
 
 /** Send a break on TXD.
  * @param ms: duration (milliseconds)
@@ -129,5 +226,17 @@ int diag_tty_break(ttyp *tty_int, const unsigned int ms);
  */
 int diag_tty_fastbreak(ttyp *tty_int, const unsigned int ms);
 
+/** diag_tty_fastbreak() implementations */
+enum diag_tty_brkmode {
+	DIAG_BRK_BYTE,	/** send 0x00 @ 360bps, wait for the echo. Default */
+	DIAG_BRK_SET,	/** set / clear break, like diag_tty_break(); sleep + spin timing */
+};
+
+/** Select the diag_tty_fastbreak() implementation for this port.
+ * dumbtest ("debug l0test 15") compares them on a given interface.
+ * @return 0 if ok, DIAG_ERR_PROTO_NOTSUPP if not available on this OS
+ */
+int diag_tty_setbrkmode(ttyp *tty_int, enum diag_tty_brkmode mode);
+
 
 #endif /* _DIAG_TTY_H_ */
@@ -0,0 +1,868 @@
+/* freediag
+ *
+ * pty loopback fixture : see diag_tty_pty.h
+ *
+ * GPLv3
+ *
+ * The responder thread owns the master side and all the "responder state"
+ * in struct diag_pty; the tty code only talks to it through the event pipe
+ * (breaks, and the exit request). Times are in us since the pty was opened.
+ *
+ * K-line responses (dumb and br ISO modes) are timed : the first one is sent
+ * P2 after the end of the request, the next ones P2 after the previous one.
+ * The ECUs of a .db file answer one after the other, in file order.
+ * elm and br J1850 modes answer immediately, like the real interfaces do
+ * once they have collected the responses.
+ */
+
+#define _GNU_SOURCE	//for posix_openpt() etc
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "diag.h"
+#include "diag_err.h"
+#include "diag_l0.h"
+#include "diag_os.h"
+#include "diag_simdb.h"
+#include "diag_tty_pty.h"
+
+#define PTY_GAP		15	//ms without a byte that ends a K-line request; must be > P4
+#define PTY_5BAUD_MIN	150	//ms; a longer break starts a 5 baud init
+#define PTY_5BAUD_BIT	200	//ms, 5 baud bit
+#define PTY_5BAUD_NBRK	10	//max # of low periods in a 5 baud byte
+#define PTY_W1		80	//ms, 5 baud address -> sync byte
+#define PTY_LINE	128	//elm command line
+#define PTY_NEVER	((unsigned long long) -1)
+
+#define PTY_ELMVERSION	"ELM327 v1.3a"
+
+enum pty_mode {PTY_DUMB, PTY_ELM, PTY_BR};
+
+static const struct {
+	const char *name;
+	enum pty_mode mode;
+} pty_modes[] = {
+	{"dumb", PTY_DUMB},
+	{"elm", PTY_ELM},
+	{"br", PTY_BR},
+	{NULL, PTY_DUMB}
+};
+
+/** event pipe message */
+struct pty_event {
+	unsigned long long t0;	//diag_os_gethrt()
+	unsigned int ms;	//break length; 0 = exit
+};
+
+struct pty_ecu {
+	uint32_t state;		//current state, index in db->states[]
+	// queued responses : db->rp[rp_next ... rp_next + rp_left - 1]
+	unsigned rp_next;
+	unsigned rp_left;
+};
+
+struct diag_pty {
+	enum pty_mode mode;
+	int mfd;		//master
+	int sfd;		//slave, kept open so the master never sees a hangup
+	int evp[2];		//event pipe
+	char *sname;		//slave name
+	bool running;		//thread was started
+	pthread_t thread;
+	struct simdb *db;
+	unsigned long long t_base;	//diag_os_gethrt() at open
+
+	/* responder state */
+	struct pty_ecu *ecus;	//one per db->ecus[]
+	uint8_t *rpcount;	//"cnt1" counters, one per db->rp[]
+	unsigned ecu_cur;	//ECU whose responses are sent next
+	uint8_t req[SIMDB_REQBYTES];	//current request
+	unsigned reqlen;
+	bool addcks;		//append a checksum to the responses (NOL2CKSUM .db file)
+	unsigned long long t_rx;	//last request byte
+	unsigned long long t_due;	//next timed response, or PTY_NEVER
+
+	/* dumb : 5 baud init decoder */
+	bool slow;		//decoding
+	unsigned long long t_slow;	//start bit
+	unsigned nbrk;
+	unsigned long brk_start[PTY_5BAUD_NBRK];	//ms since start bit
+	unsigned long brk_len[PTY_5BAUD_NBRK];
+
+	/* elm */
+	char line[PTY_LINE];
+	unsigned linelen;
+	bool echo;
+	uint8_t atsh[3];	//header
+	uint8_t iia;		//5 baud init address
+	uint8_t elmkb[2];	//keybytes of the last 5 baud init
+
+	/* br */
+	bool j1850;
+	uint8_t msg[16];	//control byte + up to 15 bytes
+	unsigned msglen;
+};
+
+
+static unsigned long long pty_now(const struct diag_pty *pty) {
+	return diag_os_hrtus(diag_os_gethrt() - pty->t_base);
+}
+
+static void pty_write(struct diag_pty *pty, const void *buf, size_t len) {
+	const uint8_t *p = buf;
+
+	while (len) {
+		ssize_t rv = write(pty->mfd, p, len);
+		if (rv < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, FLFMT "pty write failed: %s\n", FL, strerror(errno));
+			return;
+		}
+		p += rv;
+		len -= (size_t) rv;
+	}
+}
+
+static void pty_puts(struct diag_pty *pty, const char *s) {
+	pty_write(pty, s, strlen(s));
+}
+
+
+/** ECU emulation, common to all modes **/
+
+// Drop queued responses.
+static void pty_flush(struct diag_pty *pty) {
+	unsigned e;
+
+	for (e = 0; e < pty->db->num_ecus; e++)
+		pty->ecus[e].rp_left = 0;
+	pty->t_due = PTY_NEVER;
+}
+
+// Bus init : ECUs go back to their initial state.
+static void pty_reset(struct diag_pty *pty) {
+	unsigned e;
+
+	pty_flush(pty);
+	for (e = 0; e < pty->db->num_ecus; e++)
+		pty->ecus[e].state = pty->db->ecus[e].state0;
+	pty->reqlen = 0;
+}
+
+// Queue the responses of every ECU to req[], and apply state transitions.
+static void pty_lookup(struct diag_pty *pty, bool addcks) {
+	const struct simdb *db = pty->db;
+	unsigned e;
+
+	//"reqN" may look past the end of the request
+	memset(&pty->req[pty->reqlen], 0, sizeof(pty->req) - pty->reqlen);
+	pty->addcks = addcks && db->nocksum && (pty->reqlen > 1);
+	pty->ecu_cur = 0;
+	pty->t_due = PTY_NEVER;
+
+	if (diag_l0_debug & DIAG_DEBUG_DATA) {
+		fprintf(stderr, FLFMT "pty request: ", FL);
+		diag_data_dump(stderr, pty->req, pty->reqlen);
+		fprintf(stderr, "\n");
+	}
+
+	for (e = 0; e < db->num_ecus; e++) {
+		struct pty_ecu *q = &pty->ecus[e];
+		const struct simdb_rq *rq;
+
+		rq = simdb_find(db, q->state, pty->req, pty->reqlen);
+		if (rq == NULL) {
+			q->rp_left = 0;
+			continue;
+		}
+		q->rp_next = rq->rp_first;
+		q->rp_left = rq->rp_num;
+		if (rq->next_state != SIMDB_NONE)
+			q->state = rq->next_state;
+	}
+}
+
+// @return next queued response, NULL if none
+static const struct simdb_rp *pty_peekrp(struct diag_pty *pty) {
+	for (; pty->ecu_cur < pty->db->num_ecus; pty->ecu_cur++) {
+		const struct pty_ecu *q = &pty->ecus[pty->ecu_cur];
+		if (q->rp_left)
+			return &pty->db->rp[q->rp_next];
+	}
+	return NULL;
+}
+
+// Generate the next queued response; out[] must hold SIMDB_RPMAX + 1 bytes.
+// @return length, 0 if none
+static unsigned pty_nextrp(struct diag_pty *pty, uint8_t *out) {
+	const struct simdb_rp *rp = pty_peekrp(pty);
+	struct pty_ecu *q;
+	unsigned len;
+
+	if (rp == NULL)
+		return 0;
+	q = &pty->ecus[pty->ecu_cur];
+	len = simdb_run(pty->db, rp, pty->req, pty->rpcount[q->rp_next]++, out);
+	q->rp_next++;
+	q->rp_left--;
+	if (pty->addcks) {
+		out[len] = diag_cks1(out, len);
+		len++;
+	}
+	return len;
+}
+
+// Concatenate all queued responses (init exchanges); ret length
+static unsigned pty_allrp(struct diag_pty *pty, uint8_t *out, unsigned size) {
+	uint8_t rp[SIMDB_RPMAX + 1];
+	unsigned len, pos = 0;
+
+	while ((len = pty_nextrp(pty, rp)) != 0) {
+		if (pos + len > size)
+			len = size - pos;
+		memcpy(&out[pos], rp, len);
+		pos += len;
+	}
+	return pos;
+}
+
+// Timed responses : schedule the next one, at least (dmin) ms after (tref).
+static void pty_schedule(struct diag_pty *pty, unsigned long long tref, unsigned dmin) {
+	const struct simdb_rp *rp = pty_peekrp(pty);
+	unsigned d;
+
+	if (rp == NULL) {
+		pty->t_due = PTY_NEVER;
+		return;
+	}
+	d = (rp->p2 > dmin)? rp->p2 : dmin;
+	pty->t_due = tref + d * 1000ULL;
+}
+
+// Send the next timed response, with P1 between bytes.
+static void pty_sendtimed(struct diag_pty *pty) {
+	uint8_t out[SIMDB_RPMAX + 1];
+	const struct simdb_rp *rp = pty_peekrp(pty);
+	unsigned i, len;
+
+	len = pty_nextrp(pty, out);
+	if (len == 0) {
+		pty->t_due = PTY_NEVER;
+		return;
+	}
+	if (rp->p1 == 0) {
+		pty_write(pty, out, len);
+	} else {
+		for (i = 0; i < len; i++) {
+			if (i)
+				diag_os_millisleep(rp->p1);
+			pty_write(pty, &out[i], 1);
+		}
+	}
+	pty_schedule(pty, pty_now(pty), 0);
+}
+
+// Store request bytes (K-line); drops pending responses like a real bus would.
+static void pty_rxreq(struct diag_pty *pty, const uint8_t *buf, unsigned n, unsigned long long now) {
+	if (pty->reqlen == 0)
+		pty_flush(pty);
+	if (n > sizeof(pty->req) - pty->reqlen)
+		n = sizeof(pty->req) - pty->reqlen;
+	memcpy(&pty->req[pty->reqlen], buf, n);
+	pty->reqlen += n;
+	pty->t_rx = now;
+}
+
+
+/** dumb : K-line with echo **/
+
+static uint8_t dumb_5baud_decode(const struct diag_pty *pty) {
+	uint8_t addr = 0;
+	unsigned bit, i;
+
+	for (bit = 0; bit < 8; bit++) {
+		//middle of the bit, after the start bit
+		unsigned long mid = (2 * bit + 3) * PTY_5BAUD_BIT / 2;
+		bool low = 0;
+
+		for (i = 0; i < pty->nbrk; i++) {
+			if ((mid >= pty->brk_start[i]) && (mid < pty->brk_start[i] + pty->brk_len[i]))
+				low = 1;
+		}
+		if (!low)
+			addr |= 1 << bit;
+	}
+	return addr;
+}
+
+static void dumb_break(struct diag_pty *pty, unsigned long long t0, unsigned int ms) {
+	if (pty->slow) {
+		if (pty->nbrk < PTY_5BAUD_NBRK) {
+			pty->brk_start[pty->nbrk] = (unsigned long) ((t0 - pty->t_slow) / 1000);
+			pty->brk_len[pty->nbrk] = ms;
+			pty->nbrk++;
+		}
+		return;
+	}
+
+	pty_reset(pty);
+	if (ms >= PTY_5BAUD_MIN) {
+		pty->slow = 1;
+		pty->t_slow = t0;
+		pty->brk_start[0] = 0;
+		pty->brk_len[0] = ms;
+		pty->nbrk = 1;
+		return;
+	}
+
+	//fast init : like the carsim L0, the wake-up pattern is a 0x00 request.
+	pty->req[0] = 0;
+	pty->reqlen = 1;
+	pty_lookup(pty, 0);
+	pty->reqlen = 0;
+	pty_schedule(pty, t0 + ms * 1000ULL, PTY_GAP);
+}
+
+static void dumb_rx(struct diag_pty *pty, const uint8_t *buf, unsigned n, unsigned long long now) {
+	pty_write(pty, buf, n);	//echo
+	if (!pty->slow)
+		pty_rxreq(pty, buf, n, now);
+}
+
+static void dumb_tick(struct diag_pty *pty, unsigned long long now) {
+	unsigned long long t_stop = pty->t_slow + 10 * PTY_5BAUD_BIT * 1000ULL;
+
+	if (pty->slow && (now >= t_stop)) {
+		pty->slow = 0;
+		pty->req[0] = dumb_5baud_decode(pty);
+		pty->reqlen = 1;
+		pty_lookup(pty, 0);
+		pty->reqlen = 0;
+		pty_schedule(pty, t_stop, PTY_W1);
+	}
+	if (pty->reqlen && (now >= pty->t_rx + PTY_GAP * 1000ULL)) {
+		pty_lookup(pty, 1);
+		pty->reqlen = 0;
+		pty_schedule(pty, pty->t_rx, PTY_GAP);
+	}
+	if (now >= pty->t_due)
+		pty_sendtimed(pty);
+}
+
+
+/** elm : ELM327 command interpreter **/
+
+static void elm_reply(struct diag_pty *pty, const char *s) {
+	pty_puts(pty, s);
+	pty_puts(pty, "\r\r>");
+}
+
+// parse (max) hex bytes, ignoring spaces; ret # of bytes, -1 if bad
+static int elm_parsehex(const char *s, uint8_t *out, int max) {
+	int n = 0;
+
+	while (*s) {
+		unsigned int v;
+		if (*s == ' ') {
+			s++;
+			continue;
+		}
+		if ((n == max) || !isxdigit((unsigned char) s[0]) || !isxdigit((unsigned char) s[1]))
+			return -1;
+		if (sscanf(s, "%2x", &v) != 1)
+			return -1;
+		out[n++] = (uint8_t) v;
+		s += 2;
+	}
+	return n;
+}
+
+// Header for (n) data bytes : like the ELM, put the length in KWP format bytes.
+static void elm_header(const struct diag_pty *pty, uint8_t *hdr, unsigned n) {
+	hdr[0] = pty->atsh[0];
+	if ((hdr[0] & 0x80) && (n < 0x40))
+		hdr[0] = (uint8_t) ((hdr[0] & 0xC0) | n);
+	hdr[1] = pty->atsh[1];
+	hdr[2] = pty->atsh[2];
+}
+
+static void elm_fastinit(struct diag_pty *pty) {
+	uint8_t rp[SIMDB_RPMAX + 1];
+
+	pty_reset(pty);
+	pty->req[0] = 0;
+	pty->reqlen = 1;
+	pty_lookup(pty, 0);
+
+	//StartCommunication request
+	elm_header(pty, pty->req, 1);
+	pty->req[3] = 0x81;
+	pty->req[4] = diag_cks1(pty->req, 4);
+	pty->reqlen = 5;
+	pty_lookup(pty, 0);
+	if (pty_allrp(pty, rp, sizeof(rp)) == 0) {
+		elm_reply(pty, "BUS INIT: ...ERROR");
+		return;
+	}
+	elm_reply(pty, "BUS INIT: ...OK");
+}
+
+static void elm_slowinit(struct diag_pty *pty) {
+	uint8_t rp[SIMDB_RPMAX + 1];
+
+	pty_reset(pty);
+	pty->req[0] = pty->iia;
+	pty->reqlen = 1;
+	pty_lookup(pty, 0);
+	//sync byte + keybytes
+	if ((pty_allrp(pty, rp, sizeof(rp)) < 3) || (rp[0] != 0x55)) {
+		elm_reply(pty, "BUS INIT: ...ERROR");
+		return;
+	}
+	pty->elmkb[0] = rp[1];
+	pty->elmkb[1] = rp[2];
+	//inverted keybyte 2 -> inverted address
+	pty->req[0] = (uint8_t) ~rp[2];
+	pty_lookup(pty, 0);
+	pty_flush(pty);
+	elm_reply(pty, "BUS INIT: ...OK");
+}
+
+static void elm_at(struct diag_pty *pty, const char *cmd) {
+	char buf[32];
+	uint8_t v[3];
+
+	if ((strcmp(cmd, "Z") == 0) || (strcmp(cmd, "I") == 0)) {
+		if (cmd[0] == 'Z') {
+			pty->echo = 1;
+			pty->atsh[0] = 0xC1;
+			pty->atsh[1] = 0x33;
+			pty->atsh[2] = 0xF1;
+			pty->iia = 0x33;
+			pty_reset(pty);
+		}
+		elm_reply(pty, PTY_ELMVERSION);
+	} else if ((strcmp(cmd, "E0") == 0) || (strcmp(cmd, "E1") == 0)) {
+		pty->echo = (cmd[1] == '1');
+		elm_reply(pty, "OK");
+	} else if (strncmp(cmd, "SH", 2) == 0) {
+		if (elm_parsehex(&cmd[2], v, 3) != 3) {
+			elm_reply(pty, "?");
+			return;
+		}
+		memcpy(pty->atsh, v, 3);
+		elm_reply(pty, "OK");
+	} else if (strncmp(cmd, "IIA", 3) == 0) {
+		if (elm_parsehex(&cmd[3], v, 1) != 1) {
+			elm_reply(pty, "?");
+			return;
+		}
+		pty->iia = v[0];
+		elm_reply(pty, "OK");
+	} else if (strcmp(cmd, "FI") == 0) {
+		elm_fastinit(pty);
+	} else if (strcmp(cmd, "SI") == 0) {
+		elm_slowinit(pty);
+	} else if (strcmp(cmd, "KW") == 0) {
+		sprintf(buf, "1:%02X 2:%02X", pty->elmkb[0], pty->elmkb[1]);
+		elm_reply(pty, buf);
+	} else {
+		//settings we don't care about : ATL0, ATH1, ATTPx, ATSR, ATAL, ...
+		elm_reply(pty, "OK");
+	}
+}
+
+static void elm_request(struct diag_pty *pty, const uint8_t *data, unsigned n) {
+	uint8_t rp[SIMDB_RPMAX + 1];
+	unsigned i, len;
+	bool found = 0;
+
+	if (n + 4 > sizeof(pty->req)) {
+		elm_reply(pty, "?");
+		return;
+	}
+	elm_header(pty, pty->req, n);
+	memcpy(&pty->req[3], data, n);
+	pty->req[n + 3] = diag_cks1(pty->req, n + 3);
+	pty->reqlen = n + 4;
+	pty_lookup(pty, 1);
+
+	while ((len = pty_nextrp(pty, rp)) != 0) {
+		char hex[4];
+		for (i = 0; i < len; i++) {
+			sprintf(hex, "%02X ", rp[i]);
+			pty_puts(pty, hex);
+		}
+		pty_puts(pty, "\r");
+		found = 1;
+	}
+	if (found)
+		pty_puts(pty, "\r>");
+	else
+		elm_reply(pty, "NO DATA");
+}
+
+static void elm_rx(struct diag_pty *pty, const uint8_t *buf, unsigned n) {
+	unsigned i;
+
+	if (pty->echo)
+		pty_write(pty, buf, n);
+
+	for (i = 0; i < n; i++) {
+		uint8_t data[PTY_LINE / 2];
+		int len;
+		char c = (char) buf[i];
+
+		if ((c == '\n') || (c == ' '))
+			continue;
+		if (c != '\r') {
+			if (pty->linelen < PTY_LINE - 1)
+				pty->line[pty->linelen++] = (char) toupper((unsigned char) c);
+			continue;
+		}
+		pty->line[pty->linelen] = 0;
+		pty->linelen = 0;
+
+		if (strncmp(pty->line, "AT", 2) == 0) {
+			elm_at(pty, &pty->line[2]);
+			continue;
+		}
+		len = elm_parsehex(pty->line, data, sizeof(data));
+		if (len <= 0) {
+			elm_reply(pty, "?");
+			continue;
+		}
+		elm_request(pty, data, (unsigned) len);
+	}
+}
+
+
+/** br : BR-1 interface **/
+
+#define BR_ERR	0x80	//control byte : error / no more data
+
+static void br_reply(struct diag_pty *pty, const uint8_t *data, unsigned n) {
+	uint8_t ctl = (uint8_t) n;
+
+	if ((n == 0) || (n > 15)) {
+		ctl = BR_ERR;
+		n = 0;
+	}
+	pty_write(pty, &ctl, 1);
+	pty_write(pty, data, n);
+}
+
+static void br_init(struct diag_pty *pty, const uint8_t *data, unsigned n) {
+	uint8_t rp[SIMDB_RPMAX + 1];
+	unsigned len;
+
+	pty_reset(pty);
+	switch (data[0]) {
+	case 0:	//J1850 VPW
+	case 1:	//J1850 PWM
+		pty->j1850 = 1;
+		rp[0] = rp[1] = 0;
+		br_reply(pty, rp, 2);	//2 byte response : new-style interface
+		break;
+	case 2:	//5 baud init : report keybytes
+		pty->j1850 = 0;
+		pty->req[0] = (n > 1)? data[1] : 0x33;
+		pty->reqlen = 1;
+		pty_lookup(pty, 0);
+		len = pty_allrp(pty, rp, sizeof(rp));
+		if ((len < 3) || (rp[0] != 0x55)) {
+			br_reply(pty, NULL, 0);
+			break;
+		}
+		br_reply(pty, &rp[1], 2);
+		break;
+	case 3:	//fast init : StartCommunication request follows, response is raw
+		pty->j1850 = 0;
+		pty->req[0] = 0;
+		pty->reqlen = 1;
+		pty_lookup(pty, 0);
+		pty->reqlen = 0;
+		pty_rxreq(pty, &data[1], n - 1, pty_now(pty));
+		pty_lookup(pty, 1);
+		pty->reqlen = 0;
+		pty_schedule(pty, pty->t_rx, 0);
+		break;
+	default:
+		br_reply(pty, NULL, 0);
+		break;
+	}
+}
+
+static void br_msg(struct diag_pty *pty) {
+	uint8_t ctl = pty->msg[0];
+	const uint8_t *data = &pty->msg[1];
+	unsigned n = ctl & 0x0F;
+	uint8_t rp[SIMDB_RPMAX + 1];
+
+	if (ctl & 0x40) {
+		if (n)
+			br_init(pty, data, n);
+		else
+			br_reply(pty, NULL, 0);
+		return;
+	}
+
+	if (!pty->j1850) {
+		//ISO : raw responses
+		pty->reqlen = 0;
+		pty_rxreq(pty, data, n, pty_now(pty));
+		pty_lookup(pty, 1);
+		pty->reqlen = 0;
+		pty_schedule(pty, pty->t_rx, 0);
+		return;
+	}
+
+	//J1850 : last byte is the frame #. Frame 1 is a new request, the next ones
+	//ask for the following responses.
+	if (n < 2) {
+		br_reply(pty, NULL, 0);
+		return;
+	}
+	if (data[n - 1] <= 1) {
+		memcpy(pty->req, data, n - 1);
+		pty->reqlen = n - 1;
+		pty_lookup(pty, 0);
+		pty->reqlen = 0;
+	}
+	br_reply(pty, rp, pty_nextrp(pty, rp));
+}
+
+static void br_rx(struct diag_pty *pty, const uint8_t *buf, unsigned n) {
+	unsigned i;
+
+	for (i = 0; i < n; i++) {
+		if ((pty->msglen == 0) && (buf[i] == 0x20)) {
+			//CHIP CONNECT
+			uint8_t ff = 0xFF;
+			pty_write(pty, &ff, 1);
+			continue;
+		}
+		pty->msg[pty->msglen++] = buf[i];
+		if (pty->msglen > (unsigned) (pty->msg[0] & 0x0F)) {
+			br_msg(pty);
+			pty->msglen = 0;
+		}
+	}
+}
+
+
+/** responder thread **/
+
+static unsigned long long pty_next(const struct diag_pty *pty) {
+	unsigned long long next = pty->t_due;
+
+	if (pty->slow) {
+		unsigned long long t = pty->t_slow + 10 * PTY_5BAUD_BIT * 1000ULL;
+		if (t < next)
+			next = t;
+	}
+	if ((pty->mode == PTY_DUMB) && pty->reqlen) {
+		unsigned long long t = pty->t_rx + PTY_GAP * 1000ULL;
+		if (t < next)
+			next = t;
+	}
+	return next;
+}
+
+static void *pty_thread(void *arg) {
+	struct diag_pty *pty = arg;
+
+	while (1) {
+		struct pollfd pfd[2];
+		unsigned long long now = pty_now(pty);
+		unsigned long long next = pty_next(pty);
+		int timeout = -1;
+		int rv;
+
+		if (next != PTY_NEVER)
+			timeout = (next > now)? (int) ((next - now + 999) / 1000) : 0;
+
+		pfd[0].fd = pty->evp[0];
+		pfd[0].events = POLLIN;
+		pfd[1].fd = pty->mfd;
+		pfd[1].events = POLLIN;
+		rv = poll(pfd, 2, timeout);
+		if (rv < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, FLFMT "pty poll failed: %s\n", FL, strerror(errno));
+			break;
+		}
+
+		if (pfd[0].revents & POLLIN) {
+			struct pty_event ev;
+			if (read(pty->evp[0], &ev, sizeof(ev)) != (ssize_t) sizeof(ev))
+				break;
+			if (ev.ms == 0)
+				break;
+			if (pty->mode == PTY_DUMB)
+				dumb_break(pty, diag_os_hrtus(ev.t0 - pty->t_base), ev.ms);
+		}
+
+		if (pfd[1].revents & POLLIN) {
+			uint8_t buf[256];
+			ssize_t n = read(pty->mfd, buf, sizeof(buf));
+
+			if (n > 0) {
+				switch (pty->mode) {
+				case PTY_DUMB:
+					dumb_rx(pty, buf, (unsigned) n, pty_now(pty));
+					break;
+				case PTY_ELM:
+					elm_rx(pty, buf, (unsigned) n);
+					break;
+				case PTY_BR:
+					br_rx(pty, buf, (unsigned) n);
+					break;
+				}
+			}
+		}
+
+		now = pty_now(pty);
+		if (pty->mode == PTY_DUMB)
+			dumb_tick(pty, now);
+		else if (now >= pty->t_due)
+			pty_sendtimed(pty);
+	}
+	return NULL;
+}
+
+
+/** public funcs **/
+
+static void pty_free(struct diag_pty *pty) {
+	if (pty->sfd >= 0)
+		close(pty->sfd);
+	if (pty->mfd >= 0)
+		close(pty->mfd);
+	if (pty->evp[0] >= 0) {
+		close(pty->evp[0]);
+		close(pty->evp[1]);
+	}
+	free(pty->sname);
+	free(pty->ecus);
+	free(pty->rpcount);
+	simdb_free(pty->db);
+	free(pty);
+}
+
+struct diag_pty *diag_pty_open(const char *spec) {
+	struct diag_pty *pty;
+	const char *dbfile = strchr(spec, ':');
+	const char *sname;
+	sigset_t all, old;
+	int i;
+
+	for (i = 0; dbfile && pty_modes[i].name; i++) {
+		if ((strlen(pty_modes[i].name) == (size_t) (dbfile - spec)) &&
+				(strncmp(spec, pty_modes[i].name, dbfile - spec) == 0))
+			break;
+	}
+	if ((dbfile == NULL) || (pty_modes[i].name == NULL)) {
+		fprintf(stderr, FLFMT "Bad pty port \"%s\" : use \"" DIAG_PTY_PREFIX
+			"<dumb|elm|br>:<file.db>\"\n", FL, spec);
+		return diag_pseterr(DIAG_ERR_BADCFG);
+	}
+	dbfile++;
+
+	if (diag_calloc(&pty, 1))
+		return diag_pseterr(DIAG_ERR_NOMEM);
+	pty->mode = pty_modes[i].mode;
+	pty->mfd = pty->sfd = -1;
+	pty->evp[0] = pty->evp[1] = -1;
+
+	if ((pty->db = simdb_load(dbfile)) == NULL) {
+		fprintf(stderr, FLFMT "Unable to load file \"%s\"\n", FL, dbfile);
+		pty_free(pty);
+		return diag_pseterr(DIAG_ERR_GENERAL);
+	}
+	if (diag_calloc(&pty->ecus, pty->db->num_ecus) ||
+			diag_calloc(&pty->rpcount, pty->db->num_rp + 1)) {
+		pty_free(pty);
+		return diag_pseterr(DIAG_ERR_NOMEM);
+	}
+	pty_reset(pty);
+
+	pty->mfd = posix_openpt(O_RDWR | O_NOCTTY);
+	if ((pty->mfd < 0) || grantpt(pty->mfd) || unlockpt(pty->mfd) ||
+			((sname = ptsname(pty->mfd)) == NULL)) {
+		fprintf(stderr, FLFMT "Can't create pty: %s\n", FL, strerror(errno));
+		pty_free(pty);
+		return diag_pseterr(DIAG_ERR_GENERAL);
+	}
+	if (diag_malloc(&pty->sname, strlen(sname) + 1)) {
+		pty_free(pty);
+		return diag_pseterr(DIAG_ERR_NOMEM);
+	}
+	strcpy(pty->sname, sname);
+
+	pty->sfd = open(pty->sname, O_RDWR | O_NOCTTY);
+	if ((pty->sfd < 0) || pipe(pty->evp)) {
+		fprintf(stderr, FLFMT "Can't open pty: %s\n", FL, strerror(errno));
+		pty_free(pty);
+		return diag_pseterr(DIAG_ERR_GENERAL);
+	}
+
+	pty->t_base = diag_os_gethrt();
+	pty->echo = 1;
+	pty->atsh[0] = 0xC1;
+	pty->atsh[1] = 0x33;
+	pty->atsh[2] = 0xF1;
+	pty->iia = 0x33;
+
+	//the responder must not catch the tty timeout signals : start it with all signals blocked
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	pty->running = (pthread_create(&pty->thread, NULL, pty_thread, pty) == 0);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (!pty->running) {
+		fprintf(stderr, FLFMT "Can't start pty responder\n", FL);
+		pty_free(pty);
+		return diag_pseterr(DIAG_ERR_GENERAL);
+	}
+
+	if (diag_l0_debug & DIAG_DEBUG_OPEN)
+		fprintf(stderr, FLFMT "pty %s : %s responder, %s\n", FL, pty->sname,
+			pty_modes[i].name, dbfile);
+	return pty;
+}
+
+const char *diag_pty_name(const struct diag_pty *pty) {
+	return pty->sname;
+}
+
+void diag_pty_break(struct diag_pty *pty, unsigned long long t0, unsigned int ms) {
+	struct pty_event ev;
+
+	if (ms == 0)
+		return;
+	ev.t0 = t0;
+	ev.ms = ms;
+	if (write(pty->evp[1], &ev, sizeof(ev)) != (ssize_t) sizeof(ev))
+		fprintf(stderr, FLFMT "pty break event lost\n", FL);
+}
+
+void diag_pty_close(struct diag_pty *pty) {
+	struct pty_event ev = {0, 0};
+
+	if (!pty)
+		return;
+	if (write(pty->evp[1], &ev, sizeof(ev)) == (ssize_t) sizeof(ev))
+		pthread_join(pty->thread, NULL);
+	pty_free(pty);
+}
@@ -0,0 +1,59 @@
+#ifndef _DIAG_TTY_PTY_H_
+#define _DIAG_TTY_PTY_H_
+
+/* freediag
+ * GPLv3
+ *
+ * pty loopback fixture : a simulated interface + ECU behind a pseudo-terminal,
+ * so that real L0 drivers (dumb, elm, br) run over the real diag_tty_unix.c
+ * code without any hardware.
+ *
+ * It is selected with a port name like "pty:<mode>:<file.db>", for example
+ *	set port pty:dumb:l3_j1979_9141_1.db
+ * diag_tty_open() then creates a pty, starts a responder thread on the
+ * master side, and opens the slave side as usual. The responder emulates
+ * the interface given by <mode>, and the ECU(s) described by the carsim
+ * .db file (see diag_simdb.h) :
+ *	dumb : K-line with echo. Breaks (diag_tty_break / fastbreak) are
+ *		reported by the tty code; a short one is a fast init, a long one
+ *		starts a 5 baud init, decoded from the following breaks (the
+ *		dumb driver's MAN_BREAK method). A request ends after a gap on
+ *		the bus; responses are sent P2 after it, with P1 between bytes.
+ *	elm : ELM327 command interpreter (AT commands, hex requests).
+ *	br : B. Roadman BR-1 protocol, J1850 or ISO9141 / 14230.
+ * If the .db file has NOL2CKSUM, the responder appends the checksum that the
+ * real ECU would send.
+ */
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define DIAG_PTY_PREFIX	"pty:"
+
+struct diag_pty;
+
+/** Create a pty and start the responder.
+ *
+ * @param spec : "<mode>:<file.db>", i.e. the port name without DIAG_PTY_PREFIX
+ * @return new fixture, NULL if failed
+ */
+struct diag_pty *diag_pty_open(const char *spec);
+
+/** @return name of the slave device, to be opened by the caller */
+const char *diag_pty_name(const struct diag_pty *pty);
+
+/** Tell the responder a break started at (t0), lasting (ms).
+ *
+ * @param t0 : diag_os_gethrt() timestamp
+ * The caller still has to wait for the break to finish.
+ */
+void diag_pty_break(struct diag_pty *pty, unsigned long long t0, unsigned int ms);
+
+/** Stop the responder and delete the pty. */
+void diag_pty_close(struct diag_pty *pty);
+
+#if defined(__cplusplus)
+}
+#endif
+#endif // _DIAG_TTY_PTY_H_
@@ -25,11 +25,14 @@
  *
  */
 
+#define _GNU_SOURCE	//for ppoll()
 #include <assert.h>
 #include <sys/types.h>
+#include <sys/uio.h>	//writev
 #include <errno.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <limits.h>	//PATH_MAX
 #include <unistd.h>
 
 #include <stdbool.h>
@@ -58,6 +61,7 @@ ttyp * diag_tty_open(const char *portname)
 {
 	int rv;
 	struct unix_tty_int *uti;
+	const char *devname;	//device to open
 #if defined(_POSIX_TIMERS) && (SEL_TIMEOUT==S_POSIX || SEL_TIMEOUT==S_AUTO)
 	struct sigevent to_sigev;
 	struct sigaction sa;
@@ -108,6 +112,18 @@ ttyp * diag_tty_open(const char *portname)
 
 	//past this point, we can call diag_tty_close(uti) to abort in case of errors
 
+	devname = uti->name;
+#ifdef USE_TTYPTY
+	if (strncmp(portname, DIAG_PTY_PREFIX, strlen(DIAG_PTY_PREFIX)) == 0) {
+		uti->pty = diag_pty_open(portname + strlen(DIAG_PTY_PREFIX));
+		if (uti->pty == NULL) {
+			diag_tty_close(uti);
+			return diag_pseterr(DIAG_ERR_GENERAL);
+		}
+		devname = diag_pty_name(uti->pty);
+	}
+#endif
+
 	errno = 0;
 
 #if defined(O_NONBLOCK) && (SEL_TTYOPEN==S_ALT1 || SEL_TTYOPEN==S_AUTO)
@@ -117,7 +133,7 @@ ttyp * diag_tty_open(const char *portname)
 	 */
 	{
 		int fl;
-		uti->fd = open(uti->name, O_RDWR | O_NONBLOCK);
+		uti->fd = open(devname, O_RDWR | O_NONBLOCK);
 
 		if (uti->fd > 0) {
 			errno = 0;
@@ -143,7 +159,7 @@ ttyp * diag_tty_open(const char *portname)
 	#ifndef O_NONBLOCK
 	#warning No O_NONBLOCK on your system ?! Please report this
 	#endif
-	uti->fd = open(uti->name, O_RDWR);
+	uti->fd = open(devname, O_RDWR);
 
 #endif // O_NONBLOCK
 
@@ -168,7 +184,9 @@ ttyp * diag_tty_open(const char *portname)
 	 */
 
 #if defined(__linux__)
-	if (ioctl(uti->fd, TIOCGSERIAL, &uti->ss_orig) < 0) {
+	if (TTY_ISPTY(uti)) {
+		uti->tioc_works = 0;
+	} else if (ioctl(uti->fd, TIOCGSERIAL, &uti->ss_orig) < 0) {
 		fprintf(stderr,
 			FLFMT "open: TIOCGSERIAL failed: %s\n", FL, strerror(errno));
 		uti->tioc_works = 0;
@@ -178,11 +196,11 @@ ttyp * diag_tty_open(const char *portname)
 	}
 #endif
 
-	if (ioctl(uti->fd, TIOCMGET, &uti->modemflags) < 0) {
+	if (!TTY_ISPTY(uti) && (ioctl(uti->fd, TIOCMGET, &uti->modemflags) < 0)) {
+		//ptys (bench_tty, tests) have no modem lines : diag_tty_control() will fail, but reads / writes work.
 		fprintf(stderr,
 			FLFMT "open: TIOCMGET failed: %s\n", FL, strerror(errno));
-		diag_tty_close(uti);
-		return diag_pseterr(DIAG_ERR_GENERAL);
+		uti->modemflags = 0;
 	}
 
 #ifdef 	USE_TERMIOS2
@@ -242,6 +260,17 @@ ttyp * diag_tty_open(const char *portname)
 	//arbitrarily set the single byte write timeout to 1ms
 	uti->byte_write_timeout_us = 1000ul;
 
+#ifdef USE_TTYPOLL
+	//some systems (older OSX) don't support poll() on ttys : check now.
+	{
+		struct pollfd pfd;
+		pfd.fd = uti->fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		uti->use_poll = (poll(&pfd, 1, 0) >= 0) && !(pfd.revents & POLLNVAL);
+	}
+#endif
+
 	return uti;
 }
 
@@ -270,6 +299,9 @@ void diag_tty_close(ttyp *tty_int)
 		(void)ioctl(uti->fd, TIOCMSET, &uti->modemflags);
 		(void)close(uti->fd);
 	}
+#ifdef USE_TTYPTY
+	diag_pty_close(uti->pty);
+#endif
 
 	free(uti);
 
@@ -596,10 +628,7 @@ diag_tty_setup(ttyp *tty_int, const struct diag_serial_settings *pset)
 
 #if defined(_POSIX_TIMERS) || defined(__linux__)
 	//calculate write timeout for a single byte
-	//gross bits per byte: 1 start bit + count of data bits + count of stop bits + parity bit, if set
-	int gross_bits_per_byte = 1 + pset->databits + pset->stopbits + (pset->parflag == diag_par_n ? 0 : 1);
-	//single byte timeout to: (gross_bits_per_byte / (baudrate[1/s]/1000000[us/s]))[us];
-	uti->byte_write_timeout_us = (gross_bits_per_byte * 1000000ul / pset->speed);
+	uti->byte_write_timeout_us = DIAG_SS_BYTE_US(pset);
 #endif
 
 	spd_real = _tty_setspeed(uti, pset->speed);
@@ -641,6 +670,9 @@ diag_tty_control(ttyp *tty_int,  unsigned int dtr, unsigned int rts)
 	else
 		clearflags = TIOCM_RTS;
 
+	if (TTY_ISPTY(uti))
+		return 0;	//no modem lines on the loopback fixture
+
 	errno = 0;
 	if (ioctl(uti->fd, TIOCMGET, &flags) < 0) {
 		fprintf(stderr,
@@ -664,24 +696,61 @@ diag_tty_control(ttyp *tty_int,  unsigned int dtr, unsigned int rts)
 	return 0;
 }
 
-// diag_tty_write: return # of bytes written; <0 if error.
+//copy (iov) to (vec), which must hold TTY_IOVMAX entries.
+//ret total # of bytes, 0 if there are too many segments.
+static size_t tty_iovec(struct iovec *vec, const struct diag_iov *iov, unsigned int iovcnt) {
+	size_t count = 0;
+	unsigned int i;
+
+	if (iovcnt > TTY_IOVMAX)
+		return 0;
+	for (i = 0; i < iovcnt; i++) {
+		vec[i].iov_base = (void *) iov[i].data;
+		vec[i].iov_len = iov[i].len;
+		count += iov[i].len;
+	}
+	return count;
+}
+
+//writev() vec[*first .. cnt-1]; then drop the written bytes from the
+//front of vec, updating *first. Same return value as writev().
+static ssize_t tty_writev_some(int fd, struct iovec *vec, int *first, int cnt) {
+	ssize_t rv = writev(fd, &vec[*first], cnt - *first);
+	size_t done = (rv > 0)? (size_t) rv : 0;
+
+	while (done && (*first < cnt)) {
+		if (done < vec[*first].iov_len) {
+			vec[*first].iov_base = (uint8_t *) vec[*first].iov_base + done;
+			vec[*first].iov_len -= done;
+			done = 0;
+		} else {
+			done -= vec[*first].iov_len;
+			(*first)++;
+		}
+	}
+	return rv;
+}
+
+// tty_queue: write bytes to the kernel, without waiting for them to be transmitted.
+// return # of bytes written; <0 if error.
 // In addition, this calculates + enforces a write timeout based on the number of bytes.
 // But write timeouts should be very rare, and are considered an error
-ssize_t
-diag_tty_write(ttyp *tty_int, const void *buf, const size_t count)
+static ssize_t
+tty_queue(struct unix_tty_int *uti, const struct diag_iov *iov, unsigned int iovcnt)
 #if defined(_POSIX_TIMERS) && (SEL_TIMEOUT==S_POSIX || SEL_TIMEOUT==S_AUTO)
 {
 	ssize_t rv;
-	struct unix_tty_int *uti = tty_int;
-	size_t n;
-	const uint8_t *p;
+	size_t n, count;
+	struct iovec vec[TTY_IOVMAX];
+	int first = 0;
 	struct itimerspec it;
 
 	errno = 0;
-	p = (const uint8_t *)buf;
 	rv = 0;
 
-	assert(count > 0);
+	count = tty_iovec(vec, iov, iovcnt);
+	if (count == 0)
+		return diag_iseterr(DIAG_ERR_BADLEN);
 
 	//the timeout (the port is opened in blocking mode, and we don't want it to block indefinitely);
 	//the single byte timeout * count of bytes + 10ms (10 thousand microseconds; an arbitrary value)
@@ -702,7 +771,7 @@ diag_tty_write(ttyp *tty_int, const void *buf, const size_t count)
 		if (uti->pt_expired)
 			break;
 
-		rv = write(uti->fd, &p[n], count-n);
+		rv = tty_writev_some(uti->fd, vec, &first, (int) iovcnt);
 		if (rv < 0) {
 			if (errno == EINTR) {
 				//not an error, just interrupted (probably a signal handler)
@@ -727,22 +796,8 @@ diag_tty_write(ttyp *tty_int, const void *buf, const size_t count)
 		return diag_iseterr(DIAG_ERR_GENERAL);
 	}
 
-	//wait until the data is transmitted
-#ifdef USE_TERMIOS2
-	/* no exact equivalent ioctl for tcdrain,
-	  but TCSBRK with arg !=0 is "treated like tcdrain(fd)" according
-	  to info tty_ioctl */
-	if (ioctl(uti->fd, TCSBRK, 1) != 0) {
-		static int tcsb_warned=0;
-		if (!tcsb_warned) fprintf(stderr, "TCSBRK doesn't work!\n");
-		tcsb_warned=1;
-	}
-#else
-	tcdrain(uti->fd);
-#endif
-
-	return rv;
-}	//_POSIX_TIMERS tty_write()
+	return (ssize_t) n;
+}	//_POSIX_TIMERS tty_queue()
 
 #elif (SEL_TIMEOUT==S_LINUX || SEL_TIMEOUT==S_OTHER || SEL_TIMEOUT==S_AUTO)
 	/* No POSIX timers, this should be OK for everything else
@@ -751,15 +806,20 @@ diag_tty_write(ttyp *tty_int, const void *buf, const size_t count)
 {
 	ssize_t rv;
 	ssize_t n;
-	size_t c = count;
-	struct unix_tty_int *uti = tty_int;
-	const uint8_t *p;
+	size_t c, count;
+	struct iovec vec[TTY_IOVMAX];
+	int first = 0;
 	unsigned long long t1, t2;
 	int expired;
-	long unsigned int timeout = uti->byte_write_timeout_us * count + 10000ul;
+	long unsigned int timeout;
+
+	count = tty_iovec(vec, iov, iovcnt);
+	if (count == 0)
+		return diag_iseterr(DIAG_ERR_BADLEN);
+	c = count;
+	timeout = uti->byte_write_timeout_us * count + 10000ul;
 
 	t1 = diag_os_gethrt();
-	p = (const uint8_t *)buf;	/* For easy pointer I/O */
 	n = 0;
 	expired = 0;
 	errno = 0;
@@ -771,7 +831,7 @@ diag_tty_write(ttyp *tty_int, const void *buf, const size_t count)
 			break;
 		}
 
-		rv = write(uti->fd,  &p[n], c);
+		rv = tty_writev_some(uti->fd, vec, &first, (int) iovcnt);
 		if (rv == -1 && errno == EINTR) {
 			rv = 0;
 			errno = 0;
@@ -786,15 +846,6 @@ diag_tty_write(ttyp *tty_int, const void *buf, const size_t count)
 	}
 
 	if (n > 0 || rv >= 0) {
-		//wait until the data is transmitted
-#ifdef USE_TERMIOS2
-		/* no exact equivalent ioctl for tcdrain, but
-		 "TCSBRK : [...] treat tcsendbreak(fd,arg) with nonzero arg like tcdrain(fd)."
-		 */
-		ioctl(uti->fd, TCSBRK, 1);
-#else
-		tcdrain(uti->fd);
-#endif
 		return n;
 	}
 
@@ -806,11 +857,234 @@ diag_tty_write(ttyp *tty_int, const void *buf, const size_t count)
 }	//S_OTHER || S_LINUX write implem
 #else
 	#error Fell in the cracks of implementation selectors !
-#endif	//tty_write() implementations
+#endif	//tty_queue() implementations
 
 
 ssize_t
-diag_tty_read(ttyp *tty_int, void *buf, size_t count, unsigned int timeout)
+diag_tty_writev_nb(ttyp *tty_int, const struct diag_iov *iov, unsigned int iovcnt)
+{
+	struct unix_tty_int *uti = tty_int;
+	unsigned long pending;
+	unsigned long long t0;
+	ssize_t rv;
+
+	pending = diag_tty_txpending(uti);
+	t0 = diag_os_gethrt();
+
+	rv = tty_queue(uti, iov, iovcnt);
+	if (rv <= 0)
+		return rv;
+
+	//new bytes go out after whatever was still queued
+	uti->tx_t0 = t0;
+	uti->tx_us = pending + (unsigned long) rv * uti->byte_write_timeout_us;
+	return rv;
+}
+
+ssize_t
+diag_tty_writev(ttyp *tty_int, const struct diag_iov *iov, unsigned int iovcnt)
+{
+	ssize_t rv;
+
+	rv = diag_tty_writev_nb(tty_int, iov, iovcnt);
+	if (rv < 0)
+		return rv;
+
+	diag_tty_drain(tty_int);
+	return rv;
+}
+
+ssize_t
+diag_tty_write_nb(ttyp *tty_int, const void *buf, const size_t count)
+{
+	struct diag_iov iov;
+
+	iov.data = buf;
+	iov.len = count;
+	return diag_tty_writev_nb(tty_int, &iov, 1);
+}
+
+ssize_t
+diag_tty_write(ttyp *tty_int, const void *buf, const size_t count)
+{
+	struct diag_iov iov;
+
+	iov.data = buf;
+	iov.len = count;
+	return diag_tty_writev(tty_int, &iov, 1);
+}
+
+int diag_tty_drain(ttyp *tty_int) {
+	struct unix_tty_int *uti = tty_int;
+	int rv;
+
+	//wait until the data is transmitted
+#ifdef USE_TERMIOS2
+	/* no exact equivalent ioctl for tcdrain,
+	  but TCSBRK with arg !=0 is "treated like tcdrain(fd)" according
+	  to info tty_ioctl */
+	rv = ioctl(uti->fd, TCSBRK, 1);
+	if (rv != 0) {
+		static int tcsb_warned=0;
+		if (!tcsb_warned) fprintf(stderr, "TCSBRK doesn't work!\n");
+		tcsb_warned=1;
+	}
+#else
+	rv = tcdrain(uti->fd);
+#endif
+	uti->tx_us = 0;
+
+	return rv? diag_iseterr(DIAG_ERR_GENERAL) : 0;
+}
+
+unsigned long diag_tty_txpending(ttyp *tty_int) {
+	struct unix_tty_int *uti = tty_int;
+	unsigned long pending = 0;
+	int outq;
+
+	if (uti->tx_us) {
+		unsigned long long elapsed = diag_os_hrtus(diag_os_gethrt() - uti->tx_t0);
+		if (elapsed < uti->tx_us)
+			pending = uti->tx_us - (unsigned long) elapsed;
+		else
+			uti->tx_us = 0;
+	}
+
+#ifdef TIOCOUTQ
+	//bytes still in the kernel buffer. The UART FIFO or USB adapter isn't
+	//counted, so the estimate above wins if it's longer.
+	if ((ioctl(uti->fd, TIOCOUTQ, &outq) == 0) && (outq > 0)) {
+		unsigned long q = (unsigned long) outq * uti->byte_write_timeout_us;
+		if (q > pending)
+			pending = q;
+	}
+#else
+	(void) outq;
+#endif
+
+	return pending;
+}
+
+
+/** read-ahead buffer helpers **/
+
+//copy up to (count) buffered bytes to buf; ret # of bytes copied
+static size_t rx_get(struct unix_tty_int *uti, uint8_t *buf, size_t count) {
+	size_t n = uti->rx_len;
+
+	if (n > count)
+		n = count;
+	if (n) {
+		memcpy(buf, &uti->rxbuf[uti->rx_pos], n);
+		uti->rx_pos += n;
+		uti->rx_len -= n;
+	}
+	if (uti->rx_len == 0)
+		uti->rx_pos = 0;
+	return n;
+}
+
+//refill the (empty) buffer with a single read() : gets everything the kernel has,
+//up to TTY_RXBUF bytes. Ret like read()
+static ssize_t rx_fill(struct unix_tty_int *uti) {
+	ssize_t rv;
+
+	assert(uti->rx_len == 0);
+	rv = read(uti->fd, uti->rxbuf, sizeof(uti->rxbuf));
+	uti->rd_syscalls++;
+	if (rv > 0) {
+		uti->rx_pos = 0;
+		uti->rx_len = (unsigned) rv;
+	}
+	return rv;
+}
+
+
+#ifdef USE_TTYPOLL
+/* poll() implementation : wait for data with poll() (or ppoll()) until
+ * (start + timeout). No timers or signals; typically 2 syscalls per read.
+ */
+static ssize_t
+tty_read_poll(struct unix_tty_int *uti, void *buf, size_t count, unsigned int timeout)
+{
+	unsigned long long t0, tmo_us;
+	uint8_t *p = (uint8_t *)buf;
+	size_t n = 0;
+
+	assert((count > 0) && ( timeout > 0) && (timeout < MAXTIMEOUT));
+
+	t0 = diag_os_gethrt();
+	tmo_us = timeout * 1000ULL;
+	errno = 0;
+
+	while (n < count) {
+		struct pollfd pfd;
+		unsigned long long elapsed, rmn;
+		ssize_t rv;
+		int prv;
+
+		elapsed = diag_os_hrtus(diag_os_gethrt() - t0);
+		if (elapsed >= tmo_us)
+			break;
+		rmn = tmo_us - elapsed;	//remaining before deadline
+
+		pfd.fd = uti->fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+#ifdef HAVE_PPOLL
+		{
+			struct timespec ts;
+			ts.tv_sec = rmn / (1000*1000);
+			ts.tv_nsec = (rmn % (1000*1000)) * 1000;
+			prv = ppoll(&pfd, 1, &ts, NULL);
+		}
+#else
+		prv = poll(&pfd, 1, (int) ((rmn + 999) / 1000));	//round up : never return early
+#endif
+		uti->rd_syscalls++;
+		if (prv < 0) {
+			if (errno == EINTR) {
+				errno = 0;
+				continue;
+			}
+			fprintf(stderr, FLFMT "poll() error: %s.\n", FL, strerror(errno));
+			return diag_iseterr(DIAG_ERR_GENERAL);
+		}
+		if (prv == 0) {
+			continue;	//deadline check above will catch it
+		}
+		if (!(pfd.revents & POLLIN)) {
+			//POLLERR, POLLHUP, POLLNVAL without data
+			fprintf(stderr, FLFMT "poll() on fd %d : revents=0x%X.\n", FL, uti->fd, (unsigned) pfd.revents);
+			return diag_iseterr(DIAG_ERR_GENERAL);
+		}
+
+		rv = rx_fill(uti);
+		if (rv < 0) {
+			if ((errno == EINTR) || (errno == EAGAIN)) {
+				errno = 0;
+				continue;
+			}
+			fprintf(stderr, FLFMT "read on fd %d returned %s.\n", FL, uti->fd, strerror(errno));
+			return diag_iseterr(DIAG_ERR_GENERAL);
+		}
+		if (rv == 0) {
+			//POLLIN with nothing to read : hangup
+			fprintf(stderr, FLFMT "read on fd %d : end of file.\n", FL, uti->fd);
+			return diag_iseterr(DIAG_ERR_GENERAL);
+		}
+		n += rx_get(uti, &p[n], count - n);
+	}
+
+	if (n > 0)
+		return n;
+	return DIAG_ERR_TIMEOUT;	//without diag_iseterr() !
+}
+#endif // USE_TTYPOLL
+
+//SEL_TIMEOUT implementations; see diag_tty_unix.h
+static ssize_t
+tty_read_timeout(ttyp *tty_int, void *buf, size_t count, unsigned int timeout)
 #if defined(_POSIX_TIMERS) && (SEL_TIMEOUT==S_POSIX || SEL_TIMEOUT==S_AUTO)
 {
 	ssize_t rv;
@@ -834,6 +1108,7 @@ diag_tty_read(ttyp *tty_int, void *buf, size_t count, unsigned int timeout)
 
 	//arm the timer
 	timer_settime(uti->timerid, 0, &it, NULL);
+	uti->rd_syscalls++;
 
 	n = 0;
 	p = (uint8_t *)buf;
@@ -845,7 +1120,7 @@ diag_tty_read(ttyp *tty_int, void *buf, size_t count, unsigned int timeout)
 			break;
 		}
 
-		rv = read(uti->fd, &p[n], count-n);
+		rv = rx_fill(uti);
 		if (rv < 0) {
 			if (errno == EINTR) {
 				//not an error, just an interrupted syscall
@@ -856,13 +1131,14 @@ diag_tty_read(ttyp *tty_int, void *buf, size_t count, unsigned int timeout)
 				break;
 			}
 		} else {
-			n += rv;
+			n += rx_get(uti, &p[n], count - n);
 		}
 	}
 
 	//always disarm the timer
 	it.it_value.tv_sec = it.it_value.tv_nsec = 0;
 	timer_settime(uti->timerid, 0, &it, NULL);
+	uti->rd_syscalls++;
 
 	//if anything has been read, then return the number of read bytes; return timeout error otherwise
 	if(rv >= 0) {
@@ -927,6 +1203,7 @@ diag_tty_read(ttyp *tty_int, void *buf, size_t count, unsigned int timeout)
 			tv.tv_usec = rmn % (1000*1000);
 
 			rv = select( uti->fd + 1,  &set, NULL, NULL, &tv );
+			uti->rd_syscalls++;
 			// 4 possibilities here:
 			//	EINTR => retry
 			//	FD ready => break
@@ -947,7 +1224,7 @@ diag_tty_read(ttyp *tty_int, void *buf, size_t count, unsigned int timeout)
 			}
 		}	//select loop
 
-		rv = read(uti->fd,  &p[n], count);
+		rv = rx_fill(uti);
 
 		if ((rv < 0) && (rv == EINTR)) {
 			rv=0;
@@ -960,6 +1237,7 @@ diag_tty_read(ttyp *tty_int, void *buf, size_t count, unsigned int timeout)
 			break;
 		}
 
+		rv = rx_get(uti, &p[n], count);
 		count -= rv;
 		n += rv;
 	}	//total read loop
@@ -1092,6 +1370,33 @@ finished:
 	#error Fell in the cracks of implementation selectors !
 #endif //_tty_read() implementations
 
+ssize_t
+diag_tty_read(ttyp *tty_int, void *buf, size_t count, unsigned int timeout)
+{
+	struct unix_tty_int *uti = tty_int;
+	uint8_t *p = (uint8_t *)buf;
+	size_t n;
+	ssize_t rv;
+
+	//serve from the read-ahead buffer first
+	n = rx_get(uti, p, count);
+	if (n == count)
+		return n;
+
+#ifdef USE_TTYPOLL
+	if (uti->use_poll)
+		rv = tty_read_poll(uti, &p[n], count - n, timeout);
+	else
+#endif
+	rv = tty_read_timeout(uti, &p[n], count - n, timeout);
+
+	if (rv > 0)
+		return n + rv;
+	if ((rv == DIAG_ERR_TIMEOUT) && (n > 0))
+		return n;
+	return rv;
+}
+
 
 /*
  * POSIX serial I/O input flush +
@@ -1105,6 +1410,9 @@ int diag_tty_iflush(ttyp *tty_int) {
 
 	errno = 0;
 
+	//drop read-ahead data too
+	uti->rx_pos = uti->rx_len = 0;
+
 #ifdef USE_TERMIOS2
 	rv=ioctl(uti->fd, TCFLSH, TCIFLUSH);
 #else
@@ -1128,16 +1436,14 @@ int diag_tty_iflush(ttyp *tty_int) {
 
 
 
-// ideally use TIOCSBRK, if defined (probably in sys/ioctl.h)
-int diag_tty_break(ttyp *tty_int, const unsigned int ms)
-{
 #ifdef TIOCSBRK
 // TIOCSBRK: set TX break until TIOCCBRK. Ideal for our use but not in POSIX.
 /*
- * This one returns right after clearing the break. This is more generic and
- * can be used to bit-bang a 5bps byte.
+ * tty_brkpulse : drain TX, then set break for (us). (*t0) is the diag_os_gethrt()
+ * timestamp right after setting break; the pulse is timed with diag_os_hrtwait()
+ * (sleep, then spin) from there. Returns right after clearing the break.
  */
-	struct unix_tty_int *uti = tty_int;
+static int tty_brkpulse(struct unix_tty_int *uti, unsigned long us, unsigned long long *t0) {
 #ifdef USE_TERMIOS2
 	/* no exact equivalent ioctl for tcdrain, but
 	 "TCSBRK : [...] treat tcsendbreak(fd,arg) with nonzero arg like tcdrain(fd)."
@@ -1156,8 +1462,9 @@ int diag_tty_break(ttyp *tty_int, const unsigned int ms)
 			FLFMT "open: Ioctl TIOCSBRK failed %s\n", FL, strerror(errno));
 		return diag_iseterr(DIAG_ERR_GENERAL);
 	}
+	*t0 = diag_os_gethrt();
 
-	diag_os_millisleep(ms);
+	diag_os_hrtwait(*t0, us);
 
 	if (ioctl(uti->fd, TIOCCBRK, 0) < 0) {
 		fprintf(stderr,
@@ -1166,6 +1473,30 @@ int diag_tty_break(ttyp *tty_int, const unsigned int ms)
 	}
 
 	return 0;
+}
+#endif // TIOCSBRK
+
+// ideally use TIOCSBRK, if defined (probably in sys/ioctl.h)
+int diag_tty_break(ttyp *tty_int, const unsigned int ms)
+{
+	struct unix_tty_int *uti = tty_int;
+
+#ifdef USE_TTYPTY
+	if (uti->pty) {
+		diag_pty_break(uti->pty, diag_os_gethrt(), ms);
+		diag_os_millisleep(ms);
+		return 0;
+	}
+#endif
+
+#ifdef TIOCSBRK
+	/*
+	 * This one returns right after clearing the break. This is more generic and
+	 * can be used to bit-bang a 5bps byte.
+	 */
+	unsigned long long t0;
+
+	return tty_brkpulse(uti, ms * 1000UL, &t0);
 
 #else
 #warning ******* Dont know how to implement diag_tty_break() on your OS !
@@ -1179,6 +1510,18 @@ int diag_tty_break(ttyp *tty_int, const unsigned int ms)
 }	//diag_tty_break
 
 
+int diag_tty_setbrkmode(ttyp *tty_int, enum diag_tty_brkmode mode) {
+	struct unix_tty_int *uti = tty_int;
+
+#ifndef TIOCSBRK
+	if (mode == DIAG_BRK_SET)
+		return diag_iseterr(DIAG_ERR_PROTO_NOTSUPP);
+#endif
+	uti->brkmode = mode;
+	return 0;
+}
+
+
 
 /*
  * diag_tty_fastbreak
@@ -1198,6 +1541,28 @@ int diag_tty_fastbreak(ttyp *tty_int, const unsigned int ms) {
 	if (ms<25)
 		return diag_iseterr(DIAG_ERR_TIMEOUT);
 
+#ifdef USE_TTYPTY
+	if (uti->pty) {
+		diag_pty_break(uti->pty, diag_os_gethrt(), 25);
+		diag_os_millisleep(ms);
+		return 0;
+	}
+#endif
+
+#ifdef TIOCSBRK
+	if (uti->brkmode == DIAG_BRK_SET) {
+		int rv = tty_brkpulse(uti, 25000, &tv1);
+		if (rv)
+			return rv;
+		diag_os_hrtwait(tv1, ms * 1000UL);
+		if (diag_l0_debug & DIAG_DEBUG_TIMER) {
+			fprintf(stderr, FLFMT "Fast break finished : tWUP=%llu\n", FL,
+				diag_os_hrtus(diag_os_gethrt() - tv1));
+		}
+		return 0;
+	}
+#endif
+
 	/* Set baud rate etc to 360 baud, 8, N, 1 */
 	set.speed = 360;
 	set.databits = diag_databits_8;
@@ -1266,15 +1631,22 @@ static bool test_ttyness(const char *pname) {
 	return yes;
 }
 
-/* To find available ports, iterate in /dev/ and /dev/usb/
- * to find & test possible port names.
+//port names worth listing
+static bool tty_namematch(const char *name) {
+	return (!strncmp(name,"ttyS",4)) ||
+		(!strncmp(name,"ttyUSB",6)) ||
+		(!strncmp(name,"ttyACM",6));
+}
+
+/* tty_probeports : iterate in /dev/ and /dev/usb/
+ * to find & test possible port names. Opens every candidate !
  * Adapted from FreeSSM :
  * https://github.com/Comer352L/FreeSSM
  */
-char ** diag_tty_getportlist(int *numports) {
+static char ** tty_probeports(int *numports) {
 	char ffn[256] = "";				// full filename incl. path
 	const char *devroot="/dev/";
-	const char *devusbroot="/dev/usb";
+	const char *devusbroot="/dev/usb/";
 	DIR *dp = NULL;
 	struct dirent *fp = NULL;
 	char **portlist = NULL;
@@ -1290,9 +1662,7 @@ char ** diag_tty_getportlist(int *numports) {
 		while (1) {
 			fp = readdir (dp);	// get next file in directory
 			if (fp == NULL) break;
-			if ((!strncmp(fp->d_name,"ttyS",4)) ||
-					(!strncmp(fp->d_name,"ttyUSB",6)) ||
-					(!strncmp(fp->d_name,"ttyACM",6))) {
+			if (tty_namematch(fp->d_name)) {
 				// CONSTRUCT FULL FILENAME:
 				strcpy(ffn, devroot);
 				strncat(ffn, fp->d_name, ARRAY_SIZE(ffn) - strlen(devroot) - 1);
@@ -1340,3 +1710,331 @@ char ** diag_tty_getportlist(int *numports) {
 	return portlist;
 }
 
+//malloc'd copy of (src) into (*dst). ret 0 if ok
+static int tty_strcpy(char **dst, const char *src) {
+	if (diag_malloc(dst, strlen(src) + 1))
+		return diag_iseterr(DIAG_ERR_NOMEM);
+	strcpy(*dst, src);
+	return 0;
+}
+
+//known USB-serial chips, for diag_tty_portinfo.adapter
+static const struct {
+	uint16_t vid;
+	uint16_t pid;
+	const char *name;
+} tty_adapters[] = {
+	{0x0403, 0x6001, "FTDI FT232R/FT232BM"},
+	{0x0403, 0x6010, "FTDI FT2232"},
+	{0x0403, 0x6011, "FTDI FT4232"},
+	{0x0403, 0x6014, "FTDI FT232H"},
+	{0x0403, 0x6015, "FTDI FT-X"},
+	{0x067b, 0x2303, "Prolific PL2303"},
+	{0x10c4, 0xea60, "Silabs CP210x"},
+	{0x1a86, 0x5523, "WCH CH341"},
+	{0x1a86, 0x7523, "WCH CH340"},
+};
+
+#ifdef USE_TTYSYSFS
+#define SYSFS_TTY	"/sys/class/tty"
+
+//read the first line of (dir)/(file) into (buf). ret 0 if ok
+static int sysfs_read(const char *dir, const char *file, char *buf, size_t len) {
+	char path[PATH_MAX];
+	FILE *fp;
+	char *nl;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return DIAG_ERR_GENERAL;
+	if (fgets(buf, (int) len, fp) == NULL) {
+		fclose(fp);
+		return DIAG_ERR_GENERAL;
+	}
+	fclose(fp);
+	nl = strchr(buf, '\n');
+	if (nl)
+		*nl = 0;
+	return 0;
+}
+
+//fill (pi) for /sys/class/tty/(name). ret 0 if ok, >0 if (name) is not a serial port.
+static int sysfs_portinfo(const char *name, struct diag_tty_portinfo *pi) {
+	char dir[PATH_MAX], path[PATH_MAX], real[PATH_MAX];
+	char buf[128];	//sysfs_read() / readlink() only
+	char *p;
+	ssize_t rv;
+
+	memset(pi, 0, sizeof(*pi));
+	snprintf(dir, sizeof(dir), SYSFS_TTY "/%s", name);
+
+	//virtual ttys (console, ptys...) have no "device"
+	snprintf(path, sizeof(path), SYSFS_TTY "/%s/device", name);
+	if (realpath(path, real) == NULL)
+		return 1;
+	//legacy 8250 ports are always registered; "type" is 0 (PORT_UNKNOWN) without a UART
+	if ((sysfs_read(dir, "type", buf, sizeof(buf)) == 0) && (atoi(buf) == 0))
+		return 1;
+
+	snprintf(path, sizeof(path), "/dev/%s", name);
+	if (tty_strcpy(&pi->name, path))
+		return DIAG_ERR_NOMEM;
+
+	snprintf(path, sizeof(path), SYSFS_TTY "/%s/device/driver", name);
+	rv = readlink(path, buf, sizeof(buf) - 1);
+	if (rv > 0) {
+		buf[rv] = 0;
+		p = strrchr(buf, '/');
+		if (tty_strcpy(&pi->driver, p? p + 1 : buf))
+			return DIAG_ERR_NOMEM;
+	}
+
+	//USB : walk up from the interface to the device, which has idVendor
+	snprintf(path, sizeof(path), SYSFS_TTY "/%s/device", name);
+	if (realpath(path, dir) == NULL)
+		return 0;
+	while (((p = strrchr(dir, '/')) != NULL) && (p != dir)) {
+		*p = 0;
+		if (sysfs_read(dir, "idVendor", buf, sizeof(buf)) == 0) {
+			unsigned int i;
+
+			pi->vid = (uint16_t) strtoul(buf, NULL, 16);
+			if (sysfs_read(dir, "idProduct", buf, sizeof(buf)) == 0)
+				pi->pid = (uint16_t) strtoul(buf, NULL, 16);
+			if ((sysfs_read(dir, "product", buf, sizeof(buf)) == 0) &&
+					tty_strcpy(&pi->product, buf))
+				return DIAG_ERR_NOMEM;
+			for (i = 0; i < ARRAY_SIZE(tty_adapters); i++) {
+				if ((tty_adapters[i].vid == pi->vid) && (tty_adapters[i].pid == pi->pid))
+					pi->adapter = tty_adapters[i].name;
+			}
+			break;
+		}
+	}
+	return 0;
+}
+
+//USB ports first (the default port is the first one), then by name
+static int portinfo_cmp(const void *a, const void *b) {
+	const struct diag_tty_portinfo *pa = a, *pb = b;
+
+	if ((pa->vid != 0) != (pb->vid != 0))
+		return (pa->vid != 0)? -1 : 1;
+	return strcmp(pa->name, pb->name);
+}
+
+//ret # of ports, <0 if error (including : no sysfs)
+static int sysfs_getportinfo(struct diag_tty_portinfo **pinfo) {
+	DIR *dp;
+	struct dirent *fp;
+	struct diag_tty_portinfo *pi = NULL;
+	int elems = 0;
+
+	*pinfo = NULL;
+	dp = opendir(SYSFS_TTY);
+	if (dp == NULL)
+		return DIAG_ERR_GENERAL;
+
+	while ((fp = readdir(dp)) != NULL) {
+		int rv;
+
+		if (!tty_namematch(fp->d_name))
+			continue;
+		if (diag_realloc(&pi, (size_t) elems + 1)) {
+			diag_tty_freeportinfo(pi, elems);
+			closedir(dp);
+			return DIAG_ERR_NOMEM;	//already diag_iseterr'd
+		}
+		rv = sysfs_portinfo(fp->d_name, &pi[elems]);
+		if (rv < 0) {
+			diag_tty_freeportinfo(pi, elems + 1);
+			closedir(dp);
+			return diag_iseterr(rv);
+		}
+		if (rv == 0)
+			elems++;
+	}
+	closedir(dp);
+
+	if (elems)
+		qsort(pi, (size_t) elems, sizeof(*pi), portinfo_cmp);
+	*pinfo = pi;
+	return elems;
+}
+#endif // USE_TTYSYSFS
+
+char ** diag_tty_getportlist(int *numports) {
+#ifdef USE_TTYSYSFS
+	struct diag_tty_portinfo *pi;
+	char **portlist = NULL;
+	int elems, i;
+
+	assert(numports != NULL);
+	*numports = 0;
+
+	elems = sysfs_getportinfo(&pi);
+	if (elems < 0)
+		return tty_probeports(numports);	//no sysfs
+
+	for (i = 0; i < elems; i++) {
+		char **templist = strlist_add(portlist, pi[i].name, i);
+		if (!templist) {
+			strlist_free(portlist, i);
+			diag_tty_freeportinfo(pi, elems);
+			return diag_pseterr(DIAG_ERR_NOMEM);
+		}
+		portlist = templist;
+	}
+	diag_tty_freeportinfo(pi, elems);
+	*numports = elems;
+	return portlist;
+#else
+	return tty_probeports(numports);
+#endif
+}
+
+int diag_tty_getportinfo(struct diag_tty_portinfo **pinfo) {
+	struct diag_tty_portinfo *pi;
+	char **portlist;
+	int elems, i;
+
+	assert(pinfo != NULL);
+	*pinfo = NULL;
+
+#ifdef USE_TTYSYSFS
+	elems = sysfs_getportinfo(pinfo);
+	if (elems >= 0)
+		return elems;
+#endif
+	//no details : just the names
+	portlist = tty_probeports(&elems);
+	if (elems == 0)
+		return 0;
+	if (diag_calloc(&pi, (size_t) elems)) {
+		strlist_free(portlist, elems);
+		return diag_iseterr(DIAG_ERR_NOMEM);
+	}
+	for (i = 0; i < elems; i++) {
+		pi[i].name = portlist[i];	//steal the strings
+	}
+	free(portlist);
+	*pinfo = pi;
+	return elems;
+}
+
+void diag_tty_freeportinfo(struct diag_tty_portinfo *pinfo, int numports) {
+	int i;
+
+	if (!pinfo)
+		return;
+	for (i = 0; i < numports; i++) {
+		free(pinfo[i].name);
+		free(pinfo[i].driver);
+		free(pinfo[i].product);
+	}
+	free(pinfo);
+}
+
+
+/** hotplug watcher **/
+#ifdef USE_TTYWATCH
+struct diag_tty_watch {
+	int fd;		//inotify instance, watching /dev
+	void (*cb)(void *cbdata, enum diag_tty_event ev, const char *portname);
+	void *cbdata;
+};
+
+struct diag_tty_watch *diag_tty_watch_new(void (*cb)(void *cbdata, enum diag_tty_event ev,
+					const char *portname), void *cbdata) {
+	struct diag_tty_watch *tw;
+
+	assert(cb != NULL);
+	if (diag_calloc(&tw, 1))
+		return diag_pseterr(DIAG_ERR_NOMEM);
+
+	tw->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (tw->fd < 0) {
+		fprintf(stderr, FLFMT "inotify_init1 failed: %s\n", FL, strerror(errno));
+		free(tw);
+		return diag_pseterr(DIAG_ERR_GENERAL);
+	}
+	//udev creates and deletes the nodes after the kernel has (un)registered the port
+	if (inotify_add_watch(tw->fd, "/dev", IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM) < 0) {
+		fprintf(stderr, FLFMT "inotify_add_watch failed: %s\n", FL, strerror(errno));
+		close(tw->fd);
+		free(tw);
+		return diag_pseterr(DIAG_ERR_GENERAL);
+	}
+	tw->cb = cb;
+	tw->cbdata = cbdata;
+	return tw;
+}
+
+int diag_tty_watch_poll(struct diag_tty_watch *tw, unsigned int timeout) {
+	union {
+		struct inotify_event ev;	//for alignment
+		char buf[4096];
+	} ib;
+	struct pollfd pfd;
+	int events = 0;
+
+	assert(tw != NULL);
+	pfd.fd = tw->fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, (int) timeout) < 0) {
+		if (errno == EINTR)
+			return 0;
+		fprintf(stderr, FLFMT "poll failed: %s\n", FL, strerror(errno));
+		return diag_iseterr(DIAG_ERR_GENERAL);
+	}
+
+	while (1) {
+		ssize_t len = read(tw->fd, ib.buf, sizeof(ib.buf));
+		char *p;
+
+		if (len <= 0) {
+			if ((len < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+				fprintf(stderr, FLFMT "inotify read failed: %s\n", FL, strerror(errno));
+				return diag_iseterr(DIAG_ERR_GENERAL);
+			}
+			break;
+		}
+		for (p = ib.buf; p < ib.buf + len; ) {
+			const struct inotify_event *ev = (const struct inotify_event *) p;
+			char name[PATH_MAX];
+
+			p += sizeof(struct inotify_event) + ev->len;
+			if ((ev->len == 0) || (ev->mask & IN_ISDIR) || !tty_namematch(ev->name))
+				continue;
+			snprintf(name, sizeof(name), "/dev/%s", ev->name);
+			tw->cb(tw->cbdata, (ev->mask & (IN_CREATE | IN_MOVED_TO))?
+				DIAG_TTY_ADDED : DIAG_TTY_REMOVED, name);
+			events++;
+		}
+	}
+	return events;
+}
+
+void diag_tty_watch_del(struct diag_tty_watch *tw) {
+	if (!tw)
+		return;
+	close(tw->fd);
+	free(tw);
+}
+
+#else
+struct diag_tty_watch *diag_tty_watch_new(UNUSED(void (*cb)(void *cbdata, enum diag_tty_event ev,
+					const char *portname)), UNUSED(void *cbdata)) {
+	return diag_pseterr(DIAG_ERR_PROTO_NOTSUPP);
+}
+
+int diag_tty_watch_poll(UNUSED(struct diag_tty_watch *tw), UNUSED(unsigned int timeout)) {
+	return diag_iseterr(DIAG_ERR_PROTO_NOTSUPP);
+}
+
+void diag_tty_watch_del(UNUSED(struct diag_tty_watch *tw)) {
+	return;
+}
+#endif // USE_TTYWATCH
+
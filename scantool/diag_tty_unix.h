@@ -1,7 +1,8 @@
 /*
  * diag_tty_unix.h
  *
- * This is totally unix-exclusive and should only be included by diag_tty_unix.c !
+ * This is totally unix-exclusive and should only be included by diag_tty_unix.c
+ * (and bench_tty.c) !
  * Public functions are in diag_tty.h
  *
  * This file is part of freediag - Vehicle Diagnostic Utility
@@ -36,7 +37,9 @@ extern "C" {
 #endif
 
 
+#include <stdbool.h>
 #include <unistd.h>
+#include <signal.h>	//sig_atomic_t
 
 /****** OS-specific implementation selectors ******/
 /*	These are for testing/debugging only, to force compilation of certain implementations
@@ -50,9 +53,18 @@ extern "C" {
 		S_OTHER) use select(timeout) + read + manual timeout check loop
 		S_LINUX) needs __linux__ && /dev/rtc
 		X) (ugly, not implemented) : increase OS periodic callback frequency, control timeout manually
+	SEL_TTYREAD: diag_tty_read() implementation
+		ALT1) needs HAVE_POLL : poll() (or ppoll() if HAVE_PPOLL) against a deadline, no signals.
+			Selected at runtime, by diag_tty_open(), if the fd supports poll(); SEL_TIMEOUT otherwise.
+		ALT2) always use the SEL_TIMEOUT implementation
 	SEL_TTYOPEN: diag_tty_open() : open() flags:
 		ALT1) needs O_NONBLOCK; open non-blocking then clear flag
 		ALT2) don't set O_NONBLOCK.
+	SEL_TTYENUM: diag_tty_getportlist() / diag_tty_getportinfo()
+		ALT1) needs __linux__ : list /sys/class/tty, with USB details; never opens ports.
+			Falls back to ALT2 at runtime if /sys/class/tty can't be read.
+		ALT2) probe ttyS*, ttyUSB*, ttyACM* in /dev and /dev/usb by opening them
+	diag_tty_watch_*() (hotplug) needs HAVE_INOTIFY and HAVE_POLL : inotify on /dev.
 	SEL_TTYBAUD: diag_tty_setup() : tty settings (bps, parity etc)
 		ALT1) needs __linux__ : termios2 + BOTHER
 		ALT2) needs __linux__ : uses TIOCSSERIAL, ASYNC_SPD_CUST, CBAUD.
@@ -89,6 +101,24 @@ extern "C" {
 #ifndef SEL_TTYBAUD
 #define SEL_TTYBAUD	S_AUTO
 #endif
+#ifndef SEL_TTYREAD
+#define SEL_TTYREAD	S_AUTO
+#endif
+#ifndef SEL_TTYENUM
+#define SEL_TTYENUM	S_AUTO
+#endif
+
+#if defined(HAVE_POLL) && (SEL_TTYREAD==S_ALT1 || SEL_TTYREAD==S_AUTO)
+	#define USE_TTYPOLL
+#endif
+
+#if defined(__linux__) && (SEL_TTYENUM==S_ALT1 || SEL_TTYENUM==S_AUTO)
+	#define USE_TTYSYSFS
+#endif
+
+#if defined(HAVE_INOTIFY) && defined(HAVE_POLL)
+	#define USE_TTYWATCH
+#endif
 /****** ******/
 
 
@@ -128,6 +158,14 @@ extern "C" {
 	#include <time.h>
 #endif
 
+#if defined(USE_TTYPOLL) || defined(USE_TTYWATCH)
+	#include <poll.h>
+#endif
+
+#ifdef USE_TTYWATCH
+	#include <sys/inotify.h>
+#endif
+
 #if defined(__linux__)
 	#include <linux/rtc.h>
 	#include <linux/serial.h>	/* For Linux-specific struct serial_struct */
@@ -135,8 +173,18 @@ extern "C" {
 
 #include "diag_tty.h"
 
+#ifdef USE_TTYPTY
+	#include "diag_tty_pty.h"
+	#define TTY_ISPTY(uti)	((uti)->pty != NULL)
+#else
+	#define TTY_ISPTY(uti)	0
+#endif
+
 #define DL0D_INVALIDHANDLE -1
 
+#define TTY_RXBUF	256	//read-ahead buffer size
+#define TTY_IOVMAX	8	//max segments for diag_tty_writev()
+
 
 //struct tty_int : internal data, one per L0 struct
 struct unix_tty_int {
@@ -172,6 +220,27 @@ struct unix_tty_int {
 #endif
 
 	unsigned long int byte_write_timeout_us; //single byte write timeout in microseconds
+
+	//transmit tracking : bytes queued by diag_tty_write_nb() should be on the wire
+	//tx_us after tx_t0 (diag_os_gethrt() timestamp). 0 when drained.
+	unsigned long long tx_t0;
+	unsigned long tx_us;
+
+	enum diag_tty_brkmode brkmode;	//diag_tty_fastbreak() implementation
+
+	bool use_poll;		//diag_tty_read() uses poll(); see SEL_TTYREAD
+	unsigned long rd_syscalls;	//syscalls made by diag_tty_read(), for bench_tty
+
+	/* read-ahead buffer : diag_tty_read() drains everything the kernel has
+	 * with one read(), and serves the next calls from here. Only refilled
+	 * when empty, so it never wraps. */
+	uint8_t rxbuf[TTY_RXBUF];
+	unsigned rx_pos;	//first unread byte
+	unsigned rx_len;	//# of unread bytes
+
+#ifdef USE_TTYPTY
+	struct diag_pty *pty;	//loopback fixture, if opened as DIAG_PTY_PREFIX...
+#endif
 };
 
 #if defined(__cplusplus)
@@ -24,6 +24,7 @@ struct tty_int {
 	char *name;	//port name, alloc'd
 	HANDLE fd;
 	DCB dcb;
+	enum diag_tty_brkmode brkmode;	//diag_tty_fastbreak() implementation
 };
 
 //diag_tty_open : open specified port for L0
@@ -321,6 +322,60 @@ ssize_t diag_tty_write(ttyp *ttyh, const void *buf, const size_t count) {
 	return byteswritten;
 } //diag_tty_write
 
+//WriteFile is not overlapped, so this still blocks; nothing to track.
+ssize_t diag_tty_write_nb(ttyp *ttyh, const void *buf, const size_t count) {
+	return diag_tty_write(ttyh, buf, count);
+}
+
+//no WriteFileGather for serial ports : one WriteFile per segment, one flush.
+ssize_t diag_tty_writev_nb(ttyp *ttyh, const struct diag_iov *iov, unsigned int iovcnt) {
+	struct tty_int *wti = ttyh;
+	DWORD byteswritten;
+	ssize_t total = 0;
+	unsigned int i;
+
+	if (wti->fd == INVALID_HANDLE_VALUE) {
+		fprintf(stderr, FLFMT "Error. Is the port open ?\n", FL);
+		return diag_iseterr(DIAG_ERR_GENERAL);
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		if (iov[i].len == 0)
+			continue;
+		if (! WriteFile(wti->fd, iov[i].data, iov[i].len, &byteswritten, NULL)) {
+			fprintf(stderr, FLFMT "WriteFile error:%s. %u bytes written, %u requested\n", FL, diag_os_geterr(0), (unsigned int) byteswritten, (unsigned) iov[i].len);
+			return diag_iseterr(DIAG_ERR_GENERAL);
+		}
+		total += byteswritten;
+	}
+	return total;
+}
+
+ssize_t diag_tty_writev(ttyp *ttyh, const struct diag_iov *iov, unsigned int iovcnt) {
+	ssize_t rv;
+
+	rv = diag_tty_writev_nb(ttyh, iov, iovcnt);
+	if (rv < 0)
+		return rv;
+	if (diag_tty_drain(ttyh))
+		return diag_iseterr(DIAG_ERR_GENERAL);
+	return rv;
+}
+
+unsigned long diag_tty_txpending(UNUSED(ttyp *ttyh)) {
+	return 0;
+}
+
+int diag_tty_drain(ttyp *ttyh) {
+	struct tty_int *wti = ttyh;
+
+	if (!FlushFileBuffers(wti->fd)) {
+		fprintf(stderr, FLFMT "tty_drain : could not flush buffers, %s\n", FL, diag_os_geterr(0));
+		return diag_iseterr(DIAG_ERR_GENERAL);
+	}
+	return 0;
+}
+
 
 // diag_tty_read
 //attempt to read (count) bytes until (timeout) passes.
@@ -402,13 +457,10 @@ int diag_tty_iflush(ttyp *ttyh)
 
 
 
-// diag_tty_break #1 : use Set / ClearCommBreak
-// and return as soon as break is cleared.
+// tty_brkpulse : Set / ClearCommBreak, with (us) between the two timed with
+// diag_os_hrtwait() from (*t0), the diag_os_gethrt() timestamp after SetCommBreak.
 // ret 0 if ok
-int diag_tty_break(ttyp *ttyh, const unsigned int ms) {
-	LARGE_INTEGER qpc1, qpc2;	//for timing verification
-	long real_t;	//"real" duration
-	struct tty_int *wti = ttyh;
+static int tty_brkpulse(struct tty_int *wti, unsigned long us, unsigned long long *t0) {
 	int errval=0;
 
 	if (wti->fd == INVALID_HANDLE_VALUE) {
@@ -416,18 +468,11 @@ int diag_tty_break(ttyp *ttyh, const unsigned int ms) {
 		return diag_iseterr(DIAG_ERR_GENERAL);
 	}
 
-	if (ms <= 1)
-		return diag_iseterr(DIAG_ERR_GENERAL);
-
-	QueryPerformanceCounter(&qpc1);
 	errval = !SetCommBreak(wti->fd);
-	QueryPerformanceCounter(&qpc2);
 	//that call can take quite a while (6ms !!) on some setups (win7 + CH340 USB-Serial).
 	//It's still impossible to know (from here) when exactly TXD goes low (beginning or end of the call)
-	real_t=(long) (pf_conv * (qpc2.QuadPart-qpc1.QuadPart)) / 1000L;
-	real_t = (long) ms - real_t;	//time remaining
-	if (real_t <= 0) real_t = 0;
-	diag_os_millisleep((unsigned int ) real_t);
+	*t0 = diag_os_gethrt();
+	diag_os_hrtwait(*t0, us);
 
 	errval |= !ClearCommBreak(wti->fd);
 
@@ -440,6 +485,25 @@ int diag_tty_break(ttyp *ttyh, const unsigned int ms) {
 	return 0;
 }
 
+// diag_tty_break #1 : use Set / ClearCommBreak
+// and return as soon as break is cleared.
+// ret 0 if ok
+int diag_tty_break(ttyp *ttyh, const unsigned int ms) {
+	unsigned long long t0;
+
+	if (ms <= 1)
+		return diag_iseterr(DIAG_ERR_GENERAL);
+
+	return tty_brkpulse(ttyh, ms * 1000UL, &t0);
+}
+
+int diag_tty_setbrkmode(ttyp *ttyh, enum diag_tty_brkmode mode) {
+	struct tty_int *wti = ttyh;
+
+	wti->brkmode = mode;
+	return 0;
+}
+
 
 /*
  * diag_tty_fastbreak: send 0x00 at 360bps => fixed 25ms break; return [ms] after starting break.
@@ -464,6 +528,15 @@ int diag_tty_fastbreak(ttyp *ttyh, const unsigned int ms) {
 	if (ms<25)		//very funny
 		return diag_iseterr(DIAG_ERR_TIMEOUT);
 
+	if (wti->brkmode == DIAG_BRK_SET) {
+		unsigned long long t0;
+		int rv = tty_brkpulse(wti, 25000, &t0);
+		if (rv)
+			return rv;
+		diag_os_hrtwait(t0, ms * 1000UL);
+		return 0;
+	}
+
 	if (dh == INVALID_HANDLE_VALUE) {
 		fprintf(stderr, FLFMT "Error. Is the port open ?\n", FL);
 		return diag_iseterr(DIAG_ERR_GENERAL);
@@ -610,3 +683,54 @@ char ** diag_tty_getportlist(int *numports) {
 	*numports = elems;
 	return portlist;
 }
+
+//no details available here : just the names
+int diag_tty_getportinfo(struct diag_tty_portinfo **pinfo) {
+	struct diag_tty_portinfo *pi;
+	char **portlist;
+	int elems, i;
+
+	assert(pinfo != NULL);
+	*pinfo = NULL;
+
+	portlist = diag_tty_getportlist(&elems);
+	if (elems == 0)
+		return 0;
+	if (diag_calloc(&pi, (size_t) elems)) {
+		strlist_free(portlist, elems);
+		return diag_iseterr(DIAG_ERR_NOMEM);
+	}
+	for (i = 0; i < elems; i++) {
+		pi[i].name = portlist[i];	//steal the strings
+	}
+	free(portlist);
+	*pinfo = pi;
+	return elems;
+}
+
+void diag_tty_freeportinfo(struct diag_tty_portinfo *pinfo, int numports) {
+	int i;
+
+	if (!pinfo)
+		return;
+	for (i = 0; i < numports; i++) {
+		free(pinfo[i].name);
+		free(pinfo[i].driver);
+		free(pinfo[i].product);
+	}
+	free(pinfo);
+}
+
+//TODO : RegisterDeviceNotification() needs a window; not implemented.
+struct diag_tty_watch *diag_tty_watch_new(UNUSED(void (*cb)(void *cbdata, enum diag_tty_event ev,
+					const char *portname)), UNUSED(void *cbdata)) {
+	return diag_pseterr(DIAG_ERR_PROTO_NOTSUPP);
+}
+
+int diag_tty_watch_poll(UNUSED(struct diag_tty_watch *tw), UNUSED(unsigned int timeout)) {
+	return diag_iseterr(DIAG_ERR_PROTO_NOTSUPP);
+}
+
+void diag_tty_watch_del(UNUSED(struct diag_tty_watch *tw)) {
+	return;
+}
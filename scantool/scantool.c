@@ -254,7 +254,7 @@ j1979_data_rcv(void *handle, struct diag_msg *msg)
 		/* Ok, we now have the ecu_info for this message fragment */
 
 		/* Attach the fragment to the ecu_info */
-		rmsg = diag_dupsinglemsg(tmsg);
+		rmsg = diag_sharesinglemsg(tmsg);
 		if (rmsg == NULL)
 			return;
 		LL_CONCAT(ep->rxmsg, rmsg);
@@ -782,6 +782,9 @@ do_l2_14230_start(int init_type)
 
 	flags |= DIAG_L2_IDLE_J1978;	/* Use J1978 idle msgs */
 
+	if (global_cfg.fasttiming)
+		flags |= DIAG_L2_TYPE_ATP;
+
 	flags |= (init_type & DIAG_L2_TYPE_INITMASK) ;
 
 	d_conn = do_l2_common_start(DIAG_L1_ISO14230, DIAG_L2_PROT_ISO14230,
@@ -485,7 +485,7 @@ static void
 ecu_id_callback(void *handle, struct diag_msg *in)
 {
 	struct diag_msg **out = (struct diag_msg **)handle;
-	*out = diag_dupmsg(in);
+	*out = diag_retainmsg(in);
 }
 
 /*
@@ -41,6 +41,8 @@
 #include "diag.h"
 #include "diag_os.h"
 #include "diag_err.h"
+#include "diag_l0.h"
+#include "diag_l0_rec.h"
 
 #include "scantool_cli.h"
 
@@ -75,6 +77,8 @@ static int cmd_help(int argc, char **argv);
 
 static int cmd_log(int argc, char **argv);
 static int cmd_stoplog(int argc, char **argv);
+static int cmd_record(int argc, char **argv);
+static int cmd_stoprecord(int argc, char **argv);
 
 UNUSED(static int cmd_play(int argc, char **argv));
 
@@ -90,6 +94,10 @@ static const struct cmd_tbl_entry basic_cmd_table[]=
 	{ "log", "log <filename>", "Log monitor data to <filename>",
 		cmd_log, FLAG_FILE_ARG, NULL},
 	{ "stoplog", "stoplog", "Stop logging", cmd_stoplog, 0, NULL},
+	{ "record", "record <filename> [timing]",
+		"Record interface traffic as a CARSIM db file; \"timing\" adds measured P2 times",
+		cmd_record, FLAG_FILE_ARG, NULL},
+	{ "stoprecord", "stoprecord", "Stop recording", cmd_stoprecord, 0, NULL},
 
 	{ "play", "play filename", "Play back data from <filename>",
 		cmd_play, FLAG_HIDDEN | FLAG_FILE_ARG, NULL},
@@ -505,6 +513,63 @@ cmd_stoplog(UNUSED(int argc), UNUSED(char **argv))
 	return CMD_OK;
 }
 
+
+static int
+cmd_record(int argc, char **argv)
+{
+	bool timing = 0;
+
+	if ((argc < 2) || (argc > 3)) {
+		return CMD_USAGE;
+	}
+	if (argc == 3) {
+		if (strcmp(argv[2], "timing") != 0)
+			return CMD_USAGE;
+		timing = 1;
+	}
+
+	if (!global_dl0d) {
+		printf("No global L0. Please select + configure L0 first\n");
+		return CMD_FAILED;
+	}
+	if (global_dl0d->rec) {
+		printf("Already recording\n");
+		return CMD_FAILED;
+	}
+	if (diag_init()) {
+		printf("diag_init failed\n");
+		return CMD_FAILED;
+	}
+
+	if (diag_l0_rec_start(global_dl0d, argv[1], timing)) {
+		printf("Failed to start recording to %s\n", argv[1]);
+		return CMD_FAILED;
+	}
+
+	printf("Recording to file %s\n", argv[1]);
+	return CMD_OK;
+}
+
+
+static int
+cmd_stoprecord(UNUSED(int argc), UNUSED(char **argv))
+{
+	unsigned nexch, ndup;
+
+	if (!global_dl0d || !global_dl0d->rec) {
+		printf("Recording was not on\n");
+		return CMD_FAILED;
+	}
+
+	if (diag_l0_rec_stop(global_dl0d, &nexch, &ndup)) {
+		printf("Error while writing recorded file !\n");
+		return CMD_FAILED;
+	}
+
+	printf("Recorded %u exchanges (%u duplicates skipped)\n", nexch, ndup);
+	return CMD_OK;
+}
+
 static int
 cmd_play(int argc, char **argv)
 {
@@ -716,6 +781,9 @@ do_cli(const struct cmd_tbl_entry *cmd_tbl, const char *prompt, FILE *instream,
 		if (global_logfp != NULL) {
 			cmd_stoplog(0, NULL);
 		}
+		if (global_dl0d && global_dl0d->rec) {
+			cmd_stoprecord(0, NULL);
+		}
 
 		do_cli(diag_cmd_table, "", instream, 1, &disco);	//XXX should be called recursively in case there are >1 active L3 conns...
 
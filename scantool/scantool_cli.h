@@ -111,6 +111,7 @@ extern struct globcfg {
 	uint8_t	src;	/* u8: source addr / tester ID */
 	bool	addrtype;	/* Address type, 1 = functional */
 	unsigned int speed;	/* ECU comms speed */
+	bool	fasttiming;	/* ISO14230 : negotiate faster timings (DIAG_L2_TYPE_ATP) */
 
 	int	initmode;	/* Type of bus init (ISO9141/14230 only) */
 	int	L1proto;	/* L1 (H/W) Protocol type */
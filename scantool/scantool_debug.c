@@ -27,7 +27,9 @@
  */
 
 #include "diag.h"
+#include "diag_os.h"
 #include "diag_tty.h"
+#include "diag_l0.h"
 #include "diag_l1.h"
 #include "diag_l2.h"
 #include "diag_l3.h"
@@ -61,6 +63,8 @@ static int cmd_debug_l2(int argc, char **argv);
 static int cmd_debug_l3(int argc, char **argv);
 static int cmd_debug_all(int argc, char **argv);
 static int cmd_debug_l0test(int argc, char **argv);
+static int cmd_debug_stats(int argc, char **argv);
+static int cmd_debug_ports(int argc, char **argv);
 
 const struct cmd_tbl_entry debug_cmd_table[] =
 {
@@ -86,6 +90,10 @@ const struct cmd_tbl_entry debug_cmd_table[] =
 		cmd_debug_all, 0, NULL},
 	{ "l0test", "l0test [testnum]", "Dumb interface tests. Disconnect from vehicle first !",
 		cmd_debug_l0test, 0, NULL},
+	{ "stats", "stats [on|off|reset]", "Show/enable/clear L0 I/O statistics and timing histograms",
+		cmd_debug_stats, 0, NULL},
+	{ "ports", "ports [watch [seconds]]", "List serial ports with details; optionally report hotplug events",
+		cmd_debug_ports, 0, NULL},
 	{ "up", "up", "Return to previous menu level",
 		cmd_up, 0, NULL},
 	{ "quit","quit", "Exit program",
@@ -200,7 +208,7 @@ cmd_debug_show(UNUSED(int argc), UNUSED(char **argv))
 //could interfere with ECUs, although very unlikely.
 
 static int cmd_debug_l0test(int argc, char **argv) {
-#define MAX_L0TEST 14
+#define MAX_L0TEST 15
 	struct diag_l0_device *dl0d = global_dl0d;
 	unsigned int testnum=0;
 
@@ -222,7 +230,8 @@ static int cmd_debug_l0test(int argc, char **argv) {
 				"\t8 : block half duplex removal speed test.\n"
 				"\t9 : read timeout accuracy check\n"
 				"\t11: half duplex incomplete read timeout test.\n"
-				"\t12: diag_tty_write() duration.\n");
+				"\t12: diag_tty_write() duration.\n"
+				"\t15: compare fast break methods (pulse, tWUP, first byte timing).\n");
 		return CMD_OK;
 	}
 	if ((testnum < 1) || (testnum > MAX_L0TEST)) {
@@ -257,3 +266,122 @@ static int cmd_debug_l0test(int argc, char **argv) {
 
 }
 
+
+//cmd_debug_stats : I/O counters of the global L0, see struct diag_l0_stats;
+//and diag_os_hrtwait() accuracy.
+static int cmd_debug_stats(int argc, char **argv) {
+	struct diag_l0_device *dl0d = global_dl0d;
+	struct diag_l0_stats *st;
+	struct diag_os_waitstats ws;
+	unsigned int i;
+
+	if (argc > 1) {
+		if (strcmp(argv[1], "on") == 0) {
+			diag_l0_stats_on = 1;
+		} else if (strcmp(argv[1], "off") == 0) {
+			diag_l0_stats_on = 0;
+		} else if (strcmp(argv[1], "reset") == 0) {
+			if (dl0d)
+				diag_l0_stats_reset(dl0d);
+			diag_os_getwaitstats(&ws, 1);
+			printf("Statistics cleared.\n");
+			return CMD_OK;
+		} else {
+			return CMD_USAGE;
+		}
+	}
+
+	printf("Statistics are %s.\n", diag_l0_stats_on? "on" : "off");
+	if (!dl0d) {
+		printf("No global L0. Please select + conf L0 first\n");
+		return CMD_OK;
+	}
+	st = &dl0d->stats;
+
+	printf("%s: tx %lu calls, %lu bytes, %lu frames; %lu echo errors\n",
+		dl0d->dl0->shortname, st->tx_calls, st->tx_bytes, st->tx_frames, st->echo_errors);
+	printf("\trx %lu calls, %lu bytes, %lu frames; %lu timeouts, %lu errors\n",
+		st->rx_calls, st->rx_bytes, st->rx_frames, st->rx_timeouts, st->rx_errors);
+
+	printf("\t%10s %10s %10s\n", ">= us", "recv", "response");
+	for (i = 0; i < DIAG_L0_STATBINS; i++) {
+		if (!st->rx_lat[i] && !st->rsp_lat[i])
+			continue;
+		printf("\t%10lu %10lu %10lu\n", i? (1UL << i) : 0UL,
+			st->rx_lat[i], st->rsp_lat[i]);
+	}
+
+	diag_os_getwaitstats(&ws, 0);
+	printf("hrtwait: %lu waits, %lu late, avg err %lld us, max err %ld us, margin %lu us\n",
+		ws.count, ws.late, ws.count? (ws.sumerr / (long long) ws.count) : 0,
+		ws.maxerr, ws.margin);
+	return CMD_OK;
+}
+
+
+static void ports_event(UNUSED(void *cbdata), enum diag_tty_event ev, const char *portname) {
+	printf("%s %s\n", (ev == DIAG_TTY_ADDED)? "+" : "-", portname);
+}
+
+//cmd_debug_ports : diag_tty_getportinfo(), and diag_tty_watch_*
+static int cmd_debug_ports(int argc, char **argv) {
+	struct diag_tty_portinfo *pi;
+	struct diag_tty_watch *tw;
+	unsigned long t0;
+	unsigned int secs = 0;
+	int i, n;
+
+	if ((argc > 1) && (strcmp(argv[1], "watch") != 0))
+		return CMD_USAGE;
+	if ((argc > 2) && (sscanf(argv[2], "%u", &secs) != 1))
+		return CMD_USAGE;
+	if (diag_init())
+		return CMD_FAILED;
+
+	n = diag_tty_getportinfo(&pi);
+	if (n < 0) {
+		printf("Could not list ports.\n");
+		return CMD_FAILED;
+	}
+	printf("%d port(s) found.\n", n);
+	for (i = 0; i < n; i++) {
+		printf("%s", pi[i].name);
+		if (pi[i].driver)
+			printf("\t%s", pi[i].driver);
+		if (pi[i].vid)
+			printf("\t%04X:%04X", pi[i].vid, pi[i].pid);
+		if (pi[i].adapter)
+			printf(" (%s)", pi[i].adapter);
+		if (pi[i].product)
+			printf(" \"%s\"", pi[i].product);
+		printf("\n");
+	}
+	diag_tty_freeportinfo(pi, n);
+
+	if (argc <= 1)
+		return CMD_OK;
+
+	tw = diag_tty_watch_new(ports_event, NULL);
+	if (tw == NULL) {
+		printf("Hotplug events not supported.\n");
+		return CMD_FAILED;
+	}
+	if (secs)
+		printf("Watching for %u s...\n", secs);
+	else
+		printf("Watching, press Enter to stop...\n");
+	(void) diag_os_ipending();	//purge
+	t0 = diag_os_getms();
+	while (1) {
+		if (diag_tty_watch_poll(tw, 200) < 0)
+			break;
+		if (secs) {
+			if ((diag_os_getms() - t0) >= secs * 1000UL)
+				break;
+		} else if (diag_os_ipending()) {
+			break;
+		}
+	}
+	diag_tty_watch_del(tw);
+	return CMD_OK;
+}
@@ -366,6 +366,9 @@ do_l2_generic_start(void)
 
 	flags |= (global_cfg.initmode & DIAG_L2_TYPE_INITMASK) ;
 
+	if (global_cfg.fasttiming)
+		flags |= DIAG_L2_TYPE_ATP;
+
 	d_conn = diag_l2_StartCommunications(dl0d, global_cfg.L2proto,
 		flags, global_cfg.speed, global_cfg.tgt, global_cfg.src);
 
@@ -34,6 +34,7 @@
 #include "diag_l0.h"
 #include "diag_l1.h"
 #include "diag_l2.h"
+#include "diag_os.h"
 
 #include "scantool.h"
 #include "scantool_cli.h"
@@ -43,8 +44,6 @@
 /* struct global_cfg contains all global parameters */
 struct globcfg global_cfg;
 
-struct diag_l0_device *global_dl0d;
-
 
 /*
  * XXX All commands should probably have optional "init" hooks.
@@ -65,6 +64,7 @@ int set_init(void)
 	global_cfg.L2proto = l2proto_list[0]->diag_l2_protocol; /* cannot guarantee 9141 was compiled... DIAG_L2_PROT_ISO9141; */
 
 	global_cfg.initmode = DIAG_L2_TYPE_FASTINIT ;
+	global_cfg.fasttiming = 0;
 
 	global_cfg.units = 0;		/* English (1), or Metric (0) */
 
@@ -95,8 +95,10 @@ static int cmd_set_addrtype(int argc, char **argv);
 static int cmd_set_l1protocol(int argc, char **argv);
 static int cmd_set_l2protocol(int argc, char **argv);
 static int cmd_set_initmode(int argc, char **argv);
+static int cmd_set_fasttiming(int argc, char **argv);
 static int cmd_set_display(int argc, char **argv);
 static int cmd_set_interface(int argc, char **argv);
+static int cmd_set_realtime(int argc, char **argv);
 
 const struct cmd_tbl_entry set_cmd_table[] =
 {
@@ -130,6 +132,12 @@ const struct cmd_tbl_entry set_cmd_table[] =
 	{ "initmode", "initmode [modename]", "Bus initialisation mode to use. Use 'set initmode ?' to show valid choices.",
 		cmd_set_initmode, 0, NULL},
 
+	{ "fasttiming", "fasttiming [on/off]", "ISO14230 : negotiate faster timings with the ECU (AccessTimingParameters) when connecting. Physical addressing only.",
+		cmd_set_fasttiming, 0, NULL},
+
+	{ "realtime", "realtime [off | prio [cpu]]", "Realtime mode (SCHED_FIFO priority 1-99, memory locking, pinning to cpu) during dumb interface inits",
+		cmd_set_realtime, 0, NULL},
+
 	{ "show", "show", "Shows all settable values, including L0-specific items",
 		cmd_set_show, 0, NULL},
 
@@ -261,6 +269,8 @@ cmd_set_show(UNUSED(int argc), UNUSED(char **argv))
 	cmd_set_l1protocol(0,NULL);
 	cmd_set_l2protocol(0,NULL);
 	cmd_set_initmode(0,NULL);
+	cmd_set_fasttiming(0,NULL);
+	cmd_set_realtime(0,NULL);
 
 	/* Parse L0-specific config items */
 	if (global_dl0d) {
@@ -417,6 +427,23 @@ cmd_set_destaddr(int argc, char **argv)
 	return CMD_OK;
 }
 
+static int
+cmd_set_fasttiming(int argc, char **argv)
+{
+	if (argc > 1) {
+		if (strcmp(argv[1], "on") == 0)
+			global_cfg.fasttiming = 1;
+		else if (strcmp(argv[1], "off") == 0)
+			global_cfg.fasttiming = 0;
+		else
+			return CMD_USAGE;
+	} else {
+		printf("fasttiming: %s\n", global_cfg.fasttiming ? "on" : "off");
+	}
+
+	return CMD_OK;
+}
+
 static int
 cmd_set_addrtype(int argc, char **argv)
 {
@@ -552,3 +579,74 @@ cmd_set_help(int argc, char **argv)
 {
 	return help_common(argc, argv, set_cmd_table);
 }
+
+
+#define RT_TESTWAITS	50	//1ms each
+
+//measure diag_os_hrtwait() errors (us) over RT_TESTWAITS waits
+static void rt_jitter(long *avg, long *max) {
+	unsigned long long t0;
+	long sum = 0;
+	int i;
+
+	*max = 0;
+	t0 = diag_os_gethrt();
+	for (i = 1; i <= RT_TESTWAITS; i++) {
+		long err;
+
+		diag_os_hrtwait(t0, i * 1000UL);
+		err = (long) diag_os_hrtus(diag_os_gethrt() - t0) - i * 1000L;
+		sum += err;
+		if (err > *max)
+			*max = err;
+	}
+	*avg = sum / RT_TESTWAITS;
+}
+
+static int cmd_set_realtime(int argc, char **argv) {
+	long avg0, max0, avg1, max1;
+	unsigned int rt;
+	int prio, cpu = -1;
+
+	if (argc <= 1) {
+		if (diag_os_rtprio == 0)
+			printf("realtime: off\n");
+		else if (diag_os_rtcpu < 0)
+			printf("realtime: priority %d\n", diag_os_rtprio);
+		else
+			printf("realtime: priority %d, cpu %d\n", diag_os_rtprio, diag_os_rtcpu);
+		return CMD_OK;
+	}
+	if (strcasecmp(argv[1], "off") == 0) {
+		diag_os_rtprio = 0;
+		return CMD_OK;
+	}
+	prio = htoi(argv[1]);
+	if (argc > 2)
+		cpu = htoi(argv[2]);
+	if ((prio < 1) || (prio > 99) || (argc > 3) || ((argc > 2) && (cpu < 0))) {
+		return CMD_USAGE;
+	}
+	if (diag_init())
+		return CMD_FAILED;
+
+	//try it, and report what was achieved
+	rt_jitter(&avg0, &max0);
+	diag_os_rtprio = prio;
+	diag_os_rtcpu = cpu;
+	rt = diag_os_rt_enter();
+	rt_jitter(&avg1, &max1);
+	diag_os_rt_exit();
+
+	printf("realtime: priority %d %s; memory lock %s", prio,
+		(rt & DIAG_OS_RT_FIFO)? "ok" : "FAILED", (rt & DIAG_OS_RT_MLOCK)? "ok" : "FAILED");
+	if (cpu >= 0)
+		printf("; cpu %d %s", cpu, (rt & DIAG_OS_RT_PIN)? "ok" : "FAILED");
+	printf("\n");
+	if (!(rt & (DIAG_OS_RT_FIFO | DIAG_OS_RT_MLOCK | DIAG_OS_RT_PIN)))
+		printf("No realtime features available (missing privileges ?); "
+			"only the stack will be pre-faulted.\n");
+	printf("1ms wait error : avg %ldus, max %ldus (normal : avg %ldus, max %ldus)\n",
+		avg1, max1, avg0, max0);
+	return CMD_OK;
+}
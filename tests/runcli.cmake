@@ -3,12 +3,25 @@
 # TEST_PROG (scantool binary)
 # TESTFDIR (directory for .ini, .stdout, .stderr files)
 # TESTF (root of files)
+# and optionally
+# CARSIMC (carsimc binary) and CARSIMC_SRC (.db file in TESTFDIR) : compile
+#	CARSIMC_SRC to {TESTF}.dbc in the current directory before running the test
 
 #This runs "{TEST_PROG} -f {TESTF}.ini" and compares stdout/err output to
 # TESTFDIR/{TESTF}.stdout and TESTFDIR{TESTF}.stderr respectively
 
-#execute_process(COMMAND ${TEST_PROG} -f ${TESTFDIR}/${TESTF}.ini
-execute_process(COMMAND ${TEST_PROG} -f "${TESTF}.ini"
+if(DEFINED CARSIMC)
+	execute_process(COMMAND ${CARSIMC} "${TESTFDIR}/${CARSIMC_SRC}" "${TESTF}.dbc"
+		RESULT_VARIABLE HAD_ERROR
+		OUTPUT_VARIABLE OUTV
+		ERROR_VARIABLE ERRV
+		)
+	if(HAD_ERROR)
+		message(FATAL_ERROR "carsimc failed:\n${OUTV}${ERRV}")
+	endif()
+endif()
+
+execute_process(COMMAND ${TEST_PROG} -f "${TESTFDIR}/${TESTF}.ini"
 	TIMEOUT 25
 	RESULT_VARIABLE HAD_ERROR
 	OUTPUT_VARIABLE OUTV